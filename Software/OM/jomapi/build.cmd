@@ -36,7 +36,7 @@ ECHO Setting environment variables for C compiler (%PLATFORM%)...
 call "%COMNTOOLS%\..\..\VC\vcvarsall.bat" %PLATFORM%
 
 ECHO Compiling JNI file...
-cl -c /D WIN32 /EHsc /I "%JAVA_HOME%\include" /I "%JAVA_HOME%\include\win32" /I "..\omapi\include" /Tc"c\JOMAPI.c" /Tp"..\omapi\src\DeviceFinder.cpp" /Tp"..\omapi\src\omapi-devicefinder.cpp" /Tc"..\omapi\src\omapi-download.c" /Tc"..\omapi\src\omapi-internal.c" /Tc"..\omapi\src\omapi-main.c" /Tc"..\omapi\src\omapi-reader.c" /Tc"..\omapi\src\omapi-settings.c" /Tc"..\omapi\src\omapi-status.c"
+cl -c /D WIN32 /EHsc /I "%JAVA_HOME%\include" /I "%JAVA_HOME%\include\win32" /I "..\omapi\include" /Tc"c\JOMAPI.c" /Tp"..\omapi\src\DeviceFinder.cpp" /Tp"..\omapi\src\omapi-devicefinder.cpp" /Tc"..\omapi\src\omapi-download.c" /Tc"..\omapi\src\omapi-internal.c" /Tc"..\omapi\src\omapi-main.c" /Tc"..\omapi\src\omapi-reader.c" /Tc"..\omapi\src\omapi-settings.c" /Tc"..\omapi\src\omapi-status.c" /Tc"..\omapi\src\omapi-verify.c" /Tc"..\omapi\src\omapi-simulator.c"
 IF ERRORLEVEL 1 GOTO ERROR
 
 ECHO Linking JNI files... %PLATFORM%
@@ -44,7 +44,7 @@ SET POSTFIX=
 IF /I %PLATFORM%!==x86! SET POSTFIX=32
 IF /I %PLATFORM%!==x64! SET POSTFIX=64
 rem  "%JAVA_HOME%\lib\jvm.lib" 
-link /dll /defaultlib:user32.lib JOMAPI DeviceFinder omapi-devicefinder omapi-download omapi-internal omapi-main omapi-reader omapi-settings omapi-status /out:bin\JOMAPI%POSTFIX%.dll
+link /dll /defaultlib:user32.lib JOMAPI DeviceFinder omapi-devicefinder omapi-download omapi-internal omapi-main omapi-reader omapi-settings omapi-status omapi-verify omapi-simulator /out:bin\JOMAPI%POSTFIX%.dll
 IF ERRORLEVEL 1 GOTO ERROR
 
 rem ECHO Copying DLL file...
@@ -152,7 +152,9 @@ static void download_DownloadCallback(void *reference, int deviceId, OM_DOWNLOAD
     }
     else if (status == OM_DOWNLOAD_COMPLETE)
     { 
-        printf("DOWNLOAD #%d: Complete.\n", deviceId);
+        int bytesPerSecond = 0;
+        OmQueryDownloadThroughput(deviceId, &bytesPerSecond, NULL);
+        printf("DOWNLOAD #%d: Complete (%d kB/s).\n", deviceId, bytesPerSecond / 1024);
     }
     else if (status == OM_DOWNLOAD_CANCELLED)
     { 
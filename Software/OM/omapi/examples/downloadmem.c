@@ -35,8 +35,9 @@
  *  This example uses the OmDeviceCallback to monitor for any connected devices and
  *    begins downloading in the background.
  *  This example uses the OmDownloadCallback and OmDownloadChunkCallback to monitor download progress.
+ *  This example uses OmReaderOpenBuffer to read the downloaded data directly from RAM.
  *
- *  @remarks Makes use of \ref api_init, \ref download, \ref return_codes
+ *  @remarks Makes use of \ref api_init, \ref download, \ref reader, \ref return_codes
  */
 
 
@@ -158,8 +159,29 @@ static void downloadmem_DownloadCallback(void *reference, int deviceId, OM_DOWNL
         }
         else
         {
+            OmReaderHandle reader;
+
             printf("SUCCESS: Download buffer filled in RAM: %d bytes at 0x%p\n", downloadStatus->length, downloadStatus->buffer);
-            /* TODO: Do something with data at downloadStatus->buffer (downloadStatus->length bytes) */
+
+            /* Parse the data directly from RAM (the buffer must remain allocated until the reader is closed) */
+            reader = OmReaderOpenBuffer(downloadStatus->buffer, downloadStatus->length);
+            if (reader == NULL)
+            {
+                printf("ERROR: Problem reading the downloaded data.\n");
+            }
+            else
+            {
+                int blocks = 0, samples = 0;
+                for (;;)
+                {
+                    int numSamples = OmReaderNextBlock(reader);
+                    if (numSamples < 0) { break; }
+                    blocks++;
+                    samples += numSamples;
+                }
+                OmReaderClose(reader);
+                printf("DOWNLOADMEM #%d: Read %d samples from %d data blocks.\n", deviceId, samples, blocks);
+            }
         }
     }
     else if (status == OM_DOWNLOAD_CANCELLED)
@@ -33,6 +33,9 @@
  *
  *  A command-line tool to verify a specified binary data file contains sensible data.
  *
+ *  @note Builds for 64-bit Linux and macOS before the packed timestamp fields were fixed read data blocks with the
+ *        wrong layout, and reported spurious EVENT errors on valid files; results for such files now differ from those builds.
+ *
  *  @remarks Makes use of \ref reader
  */
 
@@ -49,13 +52,43 @@
 #include <math.h>
 #include <time.h>
 #include <sys/timeb.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #ifdef _WIN32
 #define gmtime_r(timer, result) gmtime_s(result, timer)
+#define localtime_r(timer, result) localtime_s(result, timer)
 #define timegm _mkgmtime
 #define tzset _tzset
 #endif
 
+/* Worker threads (as the API's internal thread/mutex wrappers) */
+#ifdef _WIN32
+#define thread_t HANDLE
+#define thread_create(thread, attr_ignored, start_routine, arg) ((*(thread) = CreateThread(attr_ignored, 0, start_routine, arg, 0, NULL)) == NULL)
+#define thread_join(thread, value_ptr_ignored) ((value_ptr_ignored), WaitForSingleObject((*thread), INFINITE) != WAIT_OBJECT_0)
+#define thread_return_t DWORD WINAPI
+#define thread_return_value(value) ((unsigned int)(value))
+#define mutex_t HANDLE
+#define mutex_init(mutex, attr_ignored) ((*(mutex) = CreateMutex(attr_ignored, FALSE, NULL)) == NULL)
+#define mutex_lock(mutex) (WaitForSingleObject(*(mutex), INFINITE) != WAIT_OBJECT_0)
+#define mutex_unlock(mutex) (ReleaseMutex(*(mutex)) == 0)
+#define mutex_destroy(mutex) (CloseHandle(*(mutex)) == 0)
+#else
+#define thread_t      pthread_t
+#define thread_create pthread_create
+#define thread_join(thread, value_ptr) pthread_join(*(thread), value_ptr)
+typedef void *        thread_return_t;
+#define thread_return_value(value_ignored) ((value_ignored), NULL)
+#define mutex_t       pthread_mutex_t
+#define mutex_init    pthread_mutex_init
+#define mutex_lock    pthread_mutex_lock
+#define mutex_unlock  pthread_mutex_unlock
+#define mutex_destroy pthread_mutex_destroy
+#endif
+
 
 
 /* API header */
@@ -74,14 +107,8 @@
 #define VERIFY_OPTION_NO_CHECK_STOP     0x02
 #define VERIFY_OPTION_OUTPUT_NEW        0x04
 
-/* Error measures */
-#define STUCK_COUNT (12 * 120)
-#define AVERAGE_FACTOR 0.00001
-#define AVERAGE_RANGE_MAX 0.400
-#define AVERAGE_RANGE_OFF 0.300
-
-#define IGNORE_RECENT_RESTARTS (6*60*60)        // Enable this if the devices have been connected/disconnected recently (causing a break in the data)
-
+/* Read-ahead depth (64 kB buffers) for each file */
+#define VERIFY_READ_AHEAD 16
 
 
 #define ID_NAND
@@ -97,8 +124,28 @@ typedef struct
     // ???!!!
 } download_t;
 
+/* Verification results for a single file */
+typedef struct
+{
+    char label[256];
+    int retval;
+    unsigned int errorFile, errorEvent, errorStuck, errorRange, errorRate, errorBreaks;
+    int restarts;
+    float breakTime;
+    double maxAv;
+    float minInterval, maxInterval;
+    float duration;
+    unsigned int minLight;
+    int batteryMaxPercent, batteryMinPercent;
+    int startStopFail;
+    float percentPerHour;
+    char description[1024];
+    char line[768];
+} verify_result_t;
+
 static int globalOptions = 0;
 static int globalAllowedRestarts = 0;
+static int globalReadAhead = VERIFY_READ_AHEAD;
 
 #ifdef ID_NAND
 // "NANDID=%02x:%02x:%02x:%02x:%02x:%02x,%d\r\n", id[0], id[1], id[2], id[3], id[4], id[5], nandPresent
@@ -147,29 +194,6 @@ static int OmGetNandId(int deviceId, unsigned char *id, int *present, int *ident
 
 FILE *outfile;
 
-// Calculate epoch the time in seconds from a packed time
-time_t TimeSerial(OM_DATETIME timestamp)
-{
-    time_t tSec;                            // Seconds since epoch
-    struct tm tParts = {0};                 // Time elements (YMDHMS)
-    tParts.tm_year = OM_DATETIME_YEAR(timestamp) - 1900;
-    tParts.tm_mon = OM_DATETIME_MONTH(timestamp) - 1;
-    tParts.tm_mday = OM_DATETIME_DAY(timestamp);
-    tParts.tm_hour = OM_DATETIME_HOURS(timestamp);
-    tParts.tm_min = OM_DATETIME_MINUTES(timestamp);
-    tParts.tm_sec = OM_DATETIME_SECONDS(timestamp);
-    tSec = timegm(&tParts);                 // Pack from YMDHMS
-    return tSec;
-}
-
-
-// Calculate the time in 1/65536th seconds from a packed time
-unsigned long long Ticks(OM_DATETIME timestamp, unsigned short fractional)
-{
-    time_t tSec = TimeSerial(timestamp);
-    return ((unsigned long long)tSec << 16) + fractional;
-}
-
 // Returns the number of milliseconds since the epoch
 unsigned long long now(void)
 {
@@ -194,398 +218,7 @@ const char *formattedtime(unsigned long long milliseconds)
 
 
 
-/* Conversion function */
-int verify_process(int id, const char *infile, download_t *download, int globalOptions)
-{
-    char output = 0;
-    OmReaderHandle reader;
-    int batteryStartPercent = 0, batteryEndPercent = 0;
-    int batteryMaxPercent = -1, batteryMinPercent = -1;
-    unsigned long long veryFirstTime = 0;                   // First time in file
-    unsigned long long firstTime = 0, lastTime = 0;         // First & last time in current recording block
-    unsigned long long blockStart = 0;
-    unsigned long long previousBlockEnd = 0;
-    unsigned int minLight = 0xffff;
-    unsigned int previousSequenceId = -1;
-    int block;
-    int day = 0;
-    unsigned int totalSamples = 0;
-    unsigned int errorFile = 0, errorEvent = 0, errorStuck = 0, errorRange = 0, errorBreaks = 0, errorRate = 0;
-    double maxAv = 0.0, peakAv = 0.0;
-    char first = 1;
-    unsigned long long minInterval = 0, maxInterval = 0;
-    unsigned long long lastBlockStart = 0;
-    unsigned long long totalDuration = 0;
-    float breakTime = 0.0f;
-    int firstPacket;
-    int lastSecond;
-    int restarts = 0;
-    OM_READER_HEADER_PACKET *hp;
-    char outOfRange = 0;
-    char label[256];
-    char line[768];
-    int retval;
-    float percentPerHour = 0;
-    // old statics
-    short lx = 0, ly = 0, lz = 0, stuck = 0;
-    char timeString[25];  /* "YYYY-MM-DD hh:mm:ss.000"; */
-    int seconds, packetCount = 0;
-    double av = 0.0;
-    int lastHour = -1;
-    char description[1024] = "";
-
-    if (infile == NULL || infile[0] == '\0')
-    {
-        fprintf(stderr, "ERROR: File not specified\n");
-        return -2;
-    }
-
-    fprintf(stderr, "FILE: %s\n", infile);
-    sprintf(label, infile);
-    if (id >= 0) { sprintf(label, "%d", id); }
-
-    /* Open the binary file reader on the input file */
-    reader = OmReaderOpen(infile);
-    if (reader == NULL)
-    {
-        fprintf(stderr, "ERROR: Problem opening file: %s\n", infile);
-        return -1;
-    }
-
-    /* Iterate over all of the blocks of the file */
-    firstPacket = 1;
-    lastSecond = -1;
-    for (block = 0; ; block++)
-    {
-        OM_READER_DATA_PACKET *dp;
-        unsigned long long interval;
-        int numSamples;
-        short *buffer;
-        int i;
-
-        /* Report progress: minute */
-        if (block != 0 && block %    50 == 0) { fprintf(stderr, "."); }						/* Approx. 1 minute */
-        //if (block != 0 && block %  3000 == 0) { fprintf(stderr, "|\n"); }					/* Approx. 1 hour */
-        //if (block != 0 && block % 72000 == 0) { fprintf(stderr, "===\n"); }				/* Approx. 1 day */
-
-        /* Read the next block */
-        numSamples = OmReaderNextBlock(reader);
-
-        /* Successful end of file */
-        if (numSamples == OM_E_FAIL) { break; }
-
-        /* Problem reading the file */
-        if (numSamples < 0)
-        {
-            fprintf(stderr, "[ERROR: %d - %s]\n", numSamples, OmErrorString(numSamples)); 
-            errorFile++;
-            break;
-        }
-
-        /* Block has no valid data */
-        if (numSamples == 0)
-        {
-            fprintf(stderr, "[WARNING: Missing packet -- probably checksum failed?]\n"); 
-            errorFile++;
-            continue;
-        }
-
-        /* Get the raw packet handle */
-        dp = OmReaderRawDataPacket(reader);
-        if (dp == NULL)
-        {
-            fprintf(stderr, "[ERROR: Cannot get raw data packet]\n"); 
-            errorFile++;
-            continue;
-        }
-
-        /* Check events mask */
-        if (dp->events & 0xf0)
-        {
-            fprintf(stderr, "[EVENT-ERROR: 0x%02x]\n", dp->events); 
-            errorEvent++;
-        }
-
-        // Read the block start time
-        {
-            unsigned int timestamp;
-            unsigned short fractional;
-            timestamp = OmReaderTimestamp(reader, 0, &fractional);
-            blockStart = Ticks(timestamp, fractional);
-        }
-
-        {
-            unsigned int light = OmReaderGetValue(reader, OM_VALUE_LIGHT);
-            if (light < minLight) { minLight = light; }
-        }
-
-        /*
-        fprintf(stderr, "\n[timestampOffset %04d-%02d-%02d %02d:%02d:%02d %+d * %.3f]", 
-            OM_DATETIME_YEAR(timestamp), OM_DATETIME_MONTH(timestamp), OM_DATETIME_DAY(timestamp),
-            OM_DATETIME_HOURS(timestamp), OM_DATETIME_MINUTES(timestamp), OM_DATETIME_SECONDS(timestamp),
-            -timestampOffset, 1.0f / sampleRate);
-            */
-
-        // If we read a block out-of-sequence
-        if (previousSequenceId != (unsigned int)-1 && previousSequenceId + 1 != dp->sequenceId)
-        {
-            if (dp->sequenceId != 0)
-            {
-                fprintf(stderr, "WARNING: Sequence break %u -> %u\n", previousSequenceId, dp->sequenceId);
-            }
-            else
-            {
-                long long recordingLength = (long long)(lastTime - firstTime);
-                long long diff = (long long)(blockStart - previousBlockEnd);
-
-#ifdef IGNORE_RECENT_RESTARTS
-                time_t allowed = time(NULL) - IGNORE_RECENT_RESTARTS;
-                struct tm *tm = localtime(&allowed);
-                OM_DATETIME allowedRestartTime = OM_DATETIME_FROM_YMDHMS(tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
-
-                if (dp->timestamp >= allowedRestartTime)
-                {
-                    // Recalculate allowed restart time
-
-                    fprintf(stderr, "NOTE: Permitted recording sequence restarted @%u, length of %+.2fs (gap of %+.2fs)\n", previousSequenceId, (float)recordingLength / 65536.0f, (float)diff / 65536.0f);
-                }
-                else
-#endif
-                {
-                    fprintf(stderr, "NOTE: Recording sequence restarted @%u, length of %+.2fs (gap of %+.2fs)\n", previousSequenceId, (float)recordingLength / 65536.0f, (float)diff / 65536.0f);
-                    restarts++;
-                    breakTime += (float)diff / 65536.0f;
-                }
-
-                totalDuration += recordingLength;
-                lastBlockStart = 0;
-                firstPacket = 1;
-                lastSecond = -1;
-                firstTime = 0;           // Start of a new block
-            }
-        }
-
-        if (firstTime == 0)
-        {
-            firstTime = blockStart;
-            if (veryFirstTime == 0) { veryFirstTime = firstTime; }
-            lastTime = firstTime;
-            batteryStartPercent = OmReaderGetValue(reader, OM_VALUE_BATTERY_PERCENT);
-            batteryEndPercent = batteryStartPercent;
-            if (batteryMaxPercent < 0) { batteryMaxPercent = batteryStartPercent; }
-            if (batteryMinPercent < 0) { batteryMinPercent = batteryStartPercent; }
-        }
-
-        if (lastBlockStart > 0)
-        {
-            // Interval
-            interval = blockStart - lastBlockStart;
-
-            // If the previous block's "blockEnd" is not close (+- 5%) to this block's "blockStart", we have a time discontinuity
-            if (previousBlockEnd != 0 && blockStart != 0 && abs((int)(previousBlockEnd - blockStart)) >= 8000)
-            {
-                long long diff = (long long)(blockStart - previousBlockEnd);
-                fprintf(stderr, "WARNING: Time break in sequence by %+.2f seconds (last: %f, curr: %f)\n", (float)diff / 65536.0f, lastBlockStart / 65536.0f, blockStart / 65536.0f);
-                fprintf(stderr, "\n");
-                breakTime += (float)diff / 65536.0f;
-            }
-            else
-            {
-                // Min/max interval
-                if (first) { first = 0; minInterval = interval; maxInterval = interval; }
-                if (interval > maxInterval) { maxInterval = interval; }
-                if (interval < minInterval) { minInterval = interval; }
-            }
-        }
-
-        lastBlockStart = blockStart;
-
-        buffer = OmReaderBuffer(reader);
-        for (i = 0; i < numSamples; i++)
-        {
-            OM_DATETIME dateTime;
-            unsigned short fractional;
-            short x, y, z;
-            double v;
-
-            totalSamples++;
-
-            /* Get the date/time value for this sample, and the 1/65536th fractions of a second */
-            dateTime = OmReaderTimestamp(reader, i, &fractional);
-            sprintf(timeString, "%04d-%02d-%02d %02d:%02d:%02d.%03d", 
-                    OM_DATETIME_YEAR(dateTime), OM_DATETIME_MONTH(dateTime), OM_DATETIME_DAY(dateTime), 
-                    OM_DATETIME_HOURS(dateTime), OM_DATETIME_MINUTES(dateTime), OM_DATETIME_SECONDS(dateTime), 
-                    (int)fractional * 1000 / 0xffff);
-
-            /* Get the x/y/z/ values */
-            x = buffer[3 * i + 0];
-            y = buffer[3 * i + 1];
-            z = buffer[3 * i + 2];
-
-            /* Detect stuck values */
-            if (x == lx && y == ly && z == lz)
-            { 
-                stuck++;
-                if (stuck == STUCK_COUNT)
-                {
-                    fprintf(stderr, "\nERROR: Readings could be stuck at (%d, %d, %d); has been for %d consecutive readings. ", lx, ly, lz, stuck);
-                    errorStuck++;
-                }
-            }
-            else
-            {
-                if (stuck >= STUCK_COUNT)
-                {
-                    fprintf(stderr, "\nNOTE: Readings now changed -- were at (%d, %d, %d) for total of %d consecutive readings. ", lx, ly, lz, stuck);
-                }
-                lx = x; ly = y; lz = z;
-                stuck = 0;
-            }
-
-            /* Get the SVM - 1 */
-            v = sqrt((x / 256.0) * (x / 256.0) + (y / 256.0) * (y / 256.0) + (z / 256.0) * (z / 256.0)) - 1.0;
-            av = ((1.0 - AVERAGE_FACTOR) * av) + (AVERAGE_FACTOR * v);
-            if (fabs(av) > peakAv) { peakAv = fabs(av); }
-            if (fabs(av) > maxAv) { maxAv = fabs(av); }
-            if (fabs(av) > AVERAGE_RANGE_MAX)
-            {
-                if (!outOfRange)
-                {
-                    errorRange++;
-                    outOfRange = 1;
-                    peakAv = fabs(av);
-                    fprintf(stderr, "WARNING: Average SVM gone out-of-normal-range abs(avg(svm-1)): %0.3f\n", fabs(av));
-                }
-            } 
-            else if (fabs(av) < AVERAGE_RANGE_OFF && outOfRange) 
-            { 
-                outOfRange = 0; 
-                fprintf(stderr, "WARNING: Average SVM back in normal range, peak was abs(avg(svm-1)): %0.3f\n", peakAv);
-            }
-
-            /* Output the data */
-//            if (output) { fprintf(stdout, "%s,%d,%d,%d\n", timeString, x, y, z); }
-
-            {
-                int hour = OM_DATETIME_HOURS(dateTime);
-                if (hour != lastHour)
-                {
-                    fprintf(stderr, "\n%02d-%02d %02d:%02d:%02d.%02d", /*OM_DATETIME_YEAR(dateTime) % 100, */ OM_DATETIME_MONTH(dateTime), OM_DATETIME_DAY(dateTime), OM_DATETIME_HOURS(dateTime), OM_DATETIME_MINUTES(dateTime), OM_DATETIME_SECONDS(dateTime), (int)fractional * 100 / 0xffff);
-                    lastHour = hour;
-                }
-            }
-
-            seconds = OM_DATETIME_SECONDS(dateTime);
-            if (lastSecond == -1) { lastSecond = seconds; };
-            if (seconds != lastSecond)
-            {
-                if (firstPacket) { /* fprintf(stderr, "!"); */ firstPacket = 0; }
-                else if (packetCount >= 88 && packetCount <= 112) { /* fprintf(stderr, "#"); */ }
-                else
-                { 
-                    if (seconds == lastSecond + 1 || (seconds == 0 && lastSecond == 59))
-                    {
-                        errorRate++;
-                        fprintf(stderr, "WARNING: 'Out of range' %d samples in second :%02d before %s]\n", packetCount, lastSecond, timeString);
-                    }
-                    else
-                    {
-                        errorBreaks++;
-                        fprintf(stderr, "WARNING: Non-sequential second jump (%d samples in second :%02d before %s)]\n", packetCount, lastSecond, timeString);
-                    }
-                }
-                lastSecond = seconds;
-                packetCount = 0;
-            }
-            packetCount++;
-
-        }
-
-        // Store the current sequence id
-        previousSequenceId = dp->sequenceId;
-
-        // Read the block end time
-        {
-            unsigned int timestamp;
-            unsigned short fractional;
-            timestamp = OmReaderTimestamp(reader, numSamples, &fractional);
-            previousBlockEnd = Ticks(timestamp, fractional);
-        }
-
-        lastTime = previousBlockEnd;
-        batteryEndPercent = OmReaderGetValue(reader, OM_VALUE_BATTERY_PERCENT);
-        if (batteryEndPercent > batteryMaxPercent) { batteryMaxPercent = batteryEndPercent; }
-        if (batteryEndPercent < batteryMinPercent) { batteryMinPercent = batteryEndPercent; }
-
-    }
-
-    /* Last session's duration */
-    {
-        long long recordingLength = (long long)(lastTime - firstTime);
-        totalDuration += recordingLength;
-    }
-
-    /* Summary */
-    {
-        int startStopFail = 0;
-
-        hp = OmReaderRawHeaderPacket(reader);
-
-        fprintf(stderr, "\n");
-
-        if (hp == NULL)
-        {
-            fprintf(stderr, "ERROR: Unable to access file header for start/stop times.\n");
-            startStopFail += 4;
-        }
-        else
-        {
-            if (hp->loggingStartTime >= OM_DATETIME_MIN_VALID && hp->loggingStartTime <= OM_DATETIME_MAX_VALID && hp->loggingEndTime > hp->loggingStartTime)
-            {
-                unsigned long fStart = (unsigned long)TimeSerial(hp->loggingStartTime);
-                unsigned long aStart = (unsigned long)(veryFirstTime >> 16);
-                int startDiff = (int)(aStart - fStart);
-                if (abs(startDiff) < 80)
-                { 
-                    fprintf(stderr, "NOTE: Data started near recording start time (%ds).\n", startDiff);
-                }
-                else
-                {
-                    fprintf(stderr, "ERROR: Data did not start near recording start time (%ds).\n", startDiff);
-                    startStopFail += 2;
-                }
-            }
-            else
-            {
-                fprintf(stderr, "NOTE: Recording has no start time (not verifying).\n");
-            }
-            
-            
-            if (hp->loggingEndTime >= OM_DATETIME_MIN_VALID && hp->loggingEndTime <= OM_DATETIME_MAX_VALID && hp->loggingStartTime < hp->loggingEndTime)
-            {
-                unsigned long fEnd = (unsigned long)TimeSerial(hp->loggingEndTime);
-                unsigned long aEnd = (unsigned long)(lastTime >> 16);
-                int stopDiff = (int)(aEnd - fEnd);
-                if (globalOptions & VERIFY_OPTION_NO_CHECK_STOP)
-                {
-                    fprintf(stderr, "NOTE: Ignoring whether data stopped near recording stop time (difference was %ds).\n", stopDiff);
-                }
-                else if (abs(stopDiff) < 80)
-                { 
-                    fprintf(stderr, "NOTE: Data stopped near recording stop time (%ds).\n", stopDiff);
-                }
-                else
-                {
-                    fprintf(stderr, "ERROR: Data did not stop near recording stop time (%ds).\n", stopDiff);
-                    startStopFail += 1;
-                }
-            }
-            else
-            {
-                fprintf(stderr, "NOTE: Recording has no stop time (not verifying).\n");
-            }
-        }
-
+/* Result codes (the same bits as OM_VERIFY_WARNING_* and OM_VERIFY_ERROR_*, plus the NAND checks made by this tool) */
 // Error mask
 #define CODE_ERROR_MASK         0xfffff000
 #define CODE_WARNING_MASK       0x00000fff
@@ -639,32 +272,69 @@ int verify_process(int id, const char *infile, download_t *download, int globalO
 #define CODE_ERROR_NANDID       0x800000
 
 
-retval = 0;
-if (errorFile   > 0)  { retval |= CODE_ERROR_FILE; }     else if (errorFile > 0)   { retval |= CODE_WARNING_FILE; }
-if (errorEvent  > 0)  { retval |= CODE_ERROR_EVENT; }    else if (errorEvent > 0)  { retval |= CODE_WARNING_EVENT; }
-if (errorStuck  > 0)  { retval |= CODE_ERROR_STUCK; }    else if (errorStuck > 0)  { retval |= CODE_WARNING_STUCK; }
-if (errorRange  > 0)  { retval |= CODE_ERROR_RANGE; }    else if (errorRange > 0)  { retval |= CODE_WARNING_RANGE; }
-if (errorRate   > 0)  { retval |= CODE_ERROR_RATE; }     else if (errorRate > 0)   { retval |= CODE_WARNING_RATE; }
-if (errorBreaks > 0)  { retval |= CODE_ERROR_BREAKS; }   else if (errorBreaks > 0) { retval |= CODE_WARNING_BREAKS; }
-if (restarts    > globalAllowedRestarts) { retval |= CODE_ERROR_RESTARTS; } else if (restarts > 0) { retval |= CODE_WARNING_RESTARTS; }
-if (minLight    < 90) { retval |= CODE_ERROR_LIGHT; }    else if (minLight < 140)  { retval |= CODE_WARNING_LIGHT; }
-// Discharge
+
+/* Verifies a single file with the API's checks, writing the diagnostic output to the specified log */
+static int verify_file(int id, const char *infile, download_t *download, int globalOptions, FILE *log, verify_result_t *result)
 {
-    float hours = ((totalDuration >> 16) / 60.0f / 60.0f);
-    float percentLoss = (float)batteryMaxPercent - batteryMinPercent;
-    percentPerHour = 0;
-    if (hours > 0) { percentPerHour = percentLoss / hours; } else { percentPerHour = 0; }
-    if (percentPerHour >= 0.29f) { retval |= CODE_ERROR_BATT; } else if (percentPerHour >= 0.25f)  { retval |= CODE_WARNING_BATT; }
-}
-// Start/stop
-if (startStopFail) { retval |= CODE_ERROR_STARTSTOP; } 
+    OM_VERIFY_RESULT verify;
+    int status;
+    int startStopFail;
+    char label[256];
+    char line[768];
+    int retval;
+    char description[1024] = "";
+
+    if (infile == NULL || infile[0] == '\0')
+    {
+        fprintf(log, "ERROR: File not specified\n");
+        return -2;
+    }
+
+    fprintf(log, "FILE: %s\n", infile);
+    snprintf(label, sizeof(label), "%s", infile);
+    if (id >= 0) { sprintf(label, "%d", id); }
+
+    /* Check every block of the file (large sequential reads ahead of the checks, where supported) */
+    status = OmVerifyFile(infile, globalReadAhead, &verify);
+    if (OM_FAILED(status))
+    {
+        fprintf(log, "ERROR: Problem opening file: %s (%s)\n", infile, OmErrorString(status));
+        return -1;
+    }
 
-        fprintf(stderr, "---\n");
-        fprintf(stderr, "Input file,%d,\"%s\",%d\n", id, infile, retval);
-        fprintf(stderr, "Summary errors: file=%d, event=%d, stuck=%d, range=%d, rate=%d, breaks=%d\n", errorFile, errorEvent, errorStuck, errorRange, errorRate, errorBreaks);
-        fprintf(stderr, "Summary info-1: restart=%d, breakTime=%0.1fs, maxAv=%f\n", restarts, breakTime, maxAv);
-        fprintf(stderr, "Summary info-2: minInterval=%0.3f, maxInterval=%0.3f, duration=%0.4fh\n", minInterval / 65536.0f, maxInterval / 65536.0f, ((totalDuration >> 16) / 60.0f / 60.0f));
-        fprintf(stderr, "Summary info-3: minLight=%d, Bmax=%d%%, Bmin=%d%%, intervalFail=%d\n", minLight, batteryMaxPercent, batteryMinPercent, startStopFail);
+    /* Summary */
+    {
+        retval = verify.code;
+
+        /* Start/stop times */
+        startStopFail = verify.startStopFail;
+        if (startStopFail & 4) { fprintf(log, "ERROR: Unable to access file header for start/stop times.\n"); }
+        if (startStopFail & 2) { fprintf(log, "ERROR: Data did not start near recording start time.\n"); }
+        if (startStopFail & 1)
+        {
+            if (globalOptions & VERIFY_OPTION_NO_CHECK_STOP)
+            {
+                fprintf(log, "NOTE: Ignoring whether data stopped near recording stop time.\n");
+                startStopFail &= ~1;
+            }
+            else
+            {
+                fprintf(log, "ERROR: Data did not stop near recording stop time.\n");
+            }
+        }
+        retval &= ~(CODE_WARNING_STARTSTOP | CODE_ERROR_STARTSTOP);
+        if (startStopFail) { retval |= CODE_ERROR_STARTSTOP; }
+
+        /* Restarts (the number permitted is an option of this tool) */
+        retval &= ~(CODE_WARNING_RESTARTS | CODE_ERROR_RESTARTS);
+        if (verify.restarts > globalAllowedRestarts) { retval |= CODE_ERROR_RESTARTS; } else if (verify.restarts > 0) { retval |= CODE_WARNING_RESTARTS; }
+
+        fprintf(log, "---\n");
+        fprintf(log, "Input file,%d,\"%s\",%d\n", id, infile, retval);
+        fprintf(log, "Summary errors: file=%d, event=%d, stuck=%d, range=%d, rate=%d, breaks=%d\n", verify.errorFile, verify.errorEvent, verify.errorStuck, verify.errorRange, verify.errorRate, verify.errorBreaks);
+        fprintf(log, "Summary info-1: restart=%d, breakTime=%0.1fs, maxAv=%f\n", verify.restarts, verify.breakTime, verify.maxAv);
+        fprintf(log, "Summary info-2: minInterval=%0.3f, maxInterval=%0.3f, duration=%0.4fh\n", verify.minInterval, verify.maxInterval, verify.duration);
+        fprintf(log, "Summary info-3: minLight=%d, Bmax=%d%%, Bmin=%d%%, intervalFail=%d\n", verify.minLight, verify.batteryMaxPercent, verify.batteryMinPercent, startStopFail);
 
 if (download != NULL)
 {
@@ -678,11 +348,11 @@ if (download != NULL)
     else if (download->nandType < 1) { retval |= CODE_ERROR_NANDID; }   // ERROR: Not primary or secondary type
     //else if (download->nandType != 1) { retval |= CODE_WARNING_NANDID; }                            // WARNING: Not primary type
 
-    fprintf(stderr, "NAND #%d (%d spare)\n", download->nandType, download->memoryHealth);
+    fprintf(log, "NAND #%d (%d spare)\n", download->nandType, download->memoryHealth);
 #endif
 }
 
-        fprintf(stderr, "---\n");
+        fprintf(log, "---\n");
 
 #define HEADER        "VERIFY," "id,"  "summary,"  "file,"    "event,"    "stuck,"    "range,"    "rate,"    "breaks,"    "restarts," "breakTime," "maxAv,"    "minInterval,"          "maxInterval,"           "duration,"                             "minLight," "batteryMaxPercent," "batteryMinPercent," "intervalFail," "percentLoss," "description\n"
         {
@@ -695,8 +365,8 @@ if (download != NULL)
             if (retval & CODE_WARNING_RATE      ) { strcat(description, "W:Rate;"); }
             if (retval & CODE_WARNING_BREAKS    ) { strcat(description, "W:Breaks;"); }
             if (retval & CODE_WARNING_RESTARTS  ) { strcat(description, "W:Restarts;"); }
-            if (retval & CODE_WARNING_LIGHT     ) { char temp[32]; sprintf(temp, "W:Light(%d);", minLight); strcat(description, temp); }
-            if (retval & CODE_WARNING_BATT      ) { char temp[32]; sprintf(temp, "W:Batt(%2.2f);", percentPerHour); strcat(description, temp); }
+            if (retval & CODE_WARNING_LIGHT     ) { char temp[32]; sprintf(temp, "W:Light(%d);", verify.minLight); strcat(description, temp); }
+            if (retval & CODE_WARNING_BATT      ) { char temp[32]; sprintf(temp, "W:Batt(%2.2f);", verify.percentPerHour); strcat(description, temp); }
             if (retval & CODE_WARNING_STARTSTOP ) { strcat(description, "W:StartStop;"); }
             if (retval & CODE_WARNING_NANDHEALTH) { strcat(description, "W:NandHealth;"); }
             if (retval & CODE_WARNING_NANDID    ) { strcat(description, "W:NandId;"); }
@@ -707,44 +377,89 @@ if (download != NULL)
             if (retval & CODE_ERROR_RATE        ) { strcat(description, "E:Rate;"); }
             if (retval & CODE_ERROR_BREAKS      ) { strcat(description, "E:Breaks;"); }
             if (retval & CODE_ERROR_RESTARTS    ) { strcat(description, "E:Restarts;"); }
-            if (retval & CODE_ERROR_LIGHT       ) { char temp[32]; sprintf(temp, "E:Light(%d);", minLight); strcat(description, temp); }
-            if (retval & CODE_ERROR_BATT        ) { char temp[32]; sprintf(temp, "E:Batt(%2.2f);", percentPerHour); strcat(description, temp); }
+            if (retval & CODE_ERROR_LIGHT       ) { char temp[32]; sprintf(temp, "E:Light(%d);", verify.minLight); strcat(description, temp); }
+            if (retval & CODE_ERROR_BATT        ) { char temp[32]; sprintf(temp, "E:Batt(%2.2f);", verify.percentPerHour); strcat(description, temp); }
             if (retval & CODE_ERROR_STARTSTOP   ) { strcat(description, "E:StartStop;"); }
             if (retval & CODE_ERROR_NANDHEALTH  ) { strcat(description, "E:NandHealth;"); }
             if (retval & CODE_ERROR_NANDID      ) { strcat(description, "E:NandId;"); }
 
         sprintf(line, "VERIFYX," "%s,"  "%d,"       "%d,"      "%d,"       "%d,"       "%d,"       "%d,"      "%d,"        "%d,"       "%.1f,"      "%.4f,"     "%.3f,"                 "%.3f,"                  "%.4f,"                                 "%d,"       "%d,"                "%d,"                "%d,"           "%f,"          "%s\n",
-                                 label, retval,     errorFile, errorEvent, errorStuck, errorRange, errorRate, errorBreaks, restarts,   breakTime,   maxAv,       minInterval / 65536.0f, maxInterval / 65536.0f, ((totalDuration >> 16) / 60.0f / 60.0f), minLight,   batteryMaxPercent,   batteryMinPercent,   startStopFail, percentPerHour, description);
+                                 label, retval,     verify.errorFile, verify.errorEvent, verify.errorStuck, verify.errorRange, verify.errorRate, verify.errorBreaks, verify.restarts, verify.breakTime, verify.maxAv, verify.minInterval, verify.maxInterval, verify.duration, verify.minLight, verify.batteryMaxPercent, verify.batteryMinPercent, startStopFail, verify.percentPerHour, description);
         }
 
-        fprintf(stdout, line);
-        fprintf(stderr, line);
-        if (outfile != NULL)
-        { 
-			// New output format
-			if (globalOptions & VERIFY_OPTION_OUTPUT_NEW)
-			{
-				int passed = ((retval & CODE_ERROR_MASK) == 0) ? 1 : 0;
-				// "VERIFY,YYYY-MM-DD hh:mm:ss.000,12345,1,260,W:Batt;W:Stuck;"
-				sprintf(line, "VERIFY,%s,%s,%d,%d,%s\n", formattedtime(now()), label, passed, retval, description);
-
-		        fprintf(stderr, line);
-			}
-
-			fprintf(stdout, line);
+        fprintf(log, line);
 
-            fprintf(outfile, line); 
-            fflush(outfile);
+        /* Results */
+        if (result != NULL)
+        {
+            strncpy(result->label, label, sizeof(result->label) - 1);
+            result->label[sizeof(result->label) - 1] = '\0';
+            result->retval = retval;
+            result->errorFile = verify.errorFile;
+            result->errorEvent = verify.errorEvent;
+            result->errorStuck = verify.errorStuck;
+            result->errorRange = verify.errorRange;
+            result->errorRate = verify.errorRate;
+            result->errorBreaks = verify.errorBreaks;
+            result->restarts = verify.restarts;
+            result->breakTime = verify.breakTime;
+            result->maxAv = verify.maxAv;
+            result->minInterval = verify.minInterval;
+            result->maxInterval = verify.maxInterval;
+            result->duration = verify.duration;
+            result->minLight = verify.minLight;
+            result->batteryMaxPercent = verify.batteryMaxPercent;
+            result->batteryMinPercent = verify.batteryMinPercent;
+            result->startStopFail = startStopFail;
+            result->percentPerHour = verify.percentPerHour;
+            strcpy(result->description, description);
+            strcpy(result->line, line);
         }
-        printf(line);
     }
 
-    /* Close the files */
-    OmReaderClose(reader);
     return retval;
 }
 
 
+/* Writes a file's result lines to the standard output and output file */
+static void verify_output(const verify_result_t *result, int globalOptions)
+{
+    char line[768];
+
+    strcpy(line, result->line);
+    fprintf(stdout, line);
+    if (outfile != NULL)
+    { 
+        // New output format
+        if (globalOptions & VERIFY_OPTION_OUTPUT_NEW)
+        {
+            int passed = ((result->retval & CODE_ERROR_MASK) == 0) ? 1 : 0;
+            // "VERIFY,YYYY-MM-DD hh:mm:ss.000,12345,1,260,W:Batt;W:Stuck;"
+            sprintf(line, "VERIFY,%s,%s,%d,%d,%s\n", formattedtime(now()), result->label, passed, result->retval, result->description);
+
+            fprintf(stderr, line);
+        }
+
+        fprintf(stdout, line);
+
+        fprintf(outfile, line); 
+        fflush(outfile);
+    }
+    printf(line);
+}
+
+
+/* Conversion function */
+int verify_process(int id, const char *infile, download_t *download, int globalOptions)
+{
+    verify_result_t result;
+    int retval;
+
+    retval = verify_file(id, infile, download, globalOptions, stderr, &result);
+    if (retval < 0) { return retval; }
+    verify_output(&result, globalOptions);
+    return retval;
+}
 
 
 
@@ -990,10 +705,289 @@ int verify(void)
 }
 
 
+/* Report formats */
+#define VERIFY_REPORT_CSV  0
+#define VERIFY_REPORT_JSON 1
+
+/* Multi-file verification state, shared by the worker threads */
+typedef struct
+{
+    const char **files;             // Input files
+    int numFiles;
+    verify_result_t *results;       // Results, in the same order as the input files
+    int *codes;                     // verify_file() return value for each file
+    int next;                       // Index of the next file to be taken by a worker
+    int options;
+    mutex_t mutex;                  // Guards 'next' and the copying of each file's output to stderr
+} verify_batch_t;
+
+
+/* Worker thread: takes the next file from the batch until there are none left */
+static thread_return_t verify_worker(void *arg)
+{
+    verify_batch_t *batch = (verify_batch_t *)arg;
+
+    for (;;)
+    {
+        FILE *log;
+        int index;
+        int code;
+
+        mutex_lock(&batch->mutex);
+        index = batch->next;
+        if (index < batch->numFiles) { batch->next++; }
+        mutex_unlock(&batch->mutex);
+        if (index >= batch->numFiles) { break; }
+
+        // Buffer the diagnostic output so that it is not interleaved with other files
+        log = tmpfile();
+        code = verify_file(-1, batch->files[index], NULL, batch->options, (log != NULL) ? log : stderr, &batch->results[index]);
+        batch->codes[index] = code;
+
+        // The file's output (including its VERIFYX line) is copied to stderr, the standard output is left for the merged report
+        if (log != NULL)
+        {
+            char buffer[4096];
+            size_t len;
+            rewind(log);
+            mutex_lock(&batch->mutex);
+            while ((len = fread(buffer, 1, sizeof(buffer), log)) > 0) { fwrite(buffer, 1, len, stderr); }
+            mutex_unlock(&batch->mutex);
+            fclose(log);
+        }
+    }
+
+    return thread_return_value(0);
+}
+
+
+/* Writes a string as a quoted JSON or CSV value */
+static void verify_report_string(FILE *fp, const char *value, int format)
+{
+    const char *p;
+
+    fputc('"', fp);
+    for (p = value; *p != '\0'; p++)
+    {
+        if (format == VERIFY_REPORT_JSON)
+        {
+            if (*p == '"' || *p == '\\') { fputc('\\', fp); fputc(*p, fp); }
+            else if ((unsigned char)*p < 0x20) { fprintf(fp, "\\u%04x", (unsigned char)*p); }
+            else { fputc(*p, fp); }
+        }
+        else
+        {
+            if (*p == '"') { fputc('"', fp); }
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+
+/* Writes the merged report of all of the files in a batch */
+static void verify_report(FILE *fp, const verify_batch_t *batch, int format)
+{
+    int passed = 0, warnings = 0, failed = 0, unreadable = 0;
+    int i;
+
+    for (i = 0; i < batch->numFiles; i++)
+    {
+        int code = batch->codes[i];
+        if (code < 0) { unreadable++; }
+        else if (code & CODE_ERROR_MASK) { failed++; }
+        else if (code & CODE_WARNING_MASK) { warnings++; passed++; }
+        else { passed++; }
+    }
+
+    if (format == VERIFY_REPORT_JSON)
+    {
+        fprintf(fp, "{\n  \"files\": %d, \"passed\": %d, \"warnings\": %d, \"failed\": %d, \"unreadable\": %d,\n  \"results\": [", batch->numFiles, passed, warnings, failed, unreadable);
+    }
+    else
+    {
+        fprintf(fp, "path,label,summary,passed,file,event,stuck,range,rate,breaks,restarts,breakTime,maxAv,minInterval,maxInterval,duration,minLight,batteryMaxPercent,batteryMinPercent,intervalFail,percentLoss,description\n");
+    }
+
+    for (i = 0; i < batch->numFiles; i++)
+    {
+        const verify_result_t *r = &batch->results[i];
+        int code = batch->codes[i];
+
+        if (format == VERIFY_REPORT_JSON)
+        {
+            fprintf(fp, "%s\n    { \"path\": ", (i > 0) ? "," : "");
+            verify_report_string(fp, batch->files[i], format);
+            if (code < 0)
+            {
+                fprintf(fp, ", \"summary\": %d, \"passed\": false }", code);
+                continue;
+            }
+            fprintf(fp, ", \"label\": ");
+            verify_report_string(fp, r->label, format);
+            fprintf(fp, ", \"summary\": %d, \"passed\": %s, "
+                        "\"file\": %u, \"event\": %u, \"stuck\": %u, \"range\": %u, \"rate\": %u, \"breaks\": %u, \"restarts\": %d, "
+                        "\"breakTime\": %.1f, \"maxAv\": %.4f, \"minInterval\": %.3f, \"maxInterval\": %.3f, \"duration\": %.4f, "
+                        "\"minLight\": %u, \"batteryMaxPercent\": %d, \"batteryMinPercent\": %d, \"intervalFail\": %d, \"percentLoss\": %f, \"description\": ",
+                        code, (code & CODE_ERROR_MASK) ? "false" : "true",
+                        r->errorFile, r->errorEvent, r->errorStuck, r->errorRange, r->errorRate, r->errorBreaks, r->restarts,
+                        r->breakTime, r->maxAv, r->minInterval, r->maxInterval, r->duration,
+                        r->minLight, r->batteryMaxPercent, r->batteryMinPercent, r->startStopFail, r->percentPerHour);
+            verify_report_string(fp, r->description, format);
+            fprintf(fp, " }");
+        }
+        else
+        {
+            verify_report_string(fp, batch->files[i], format);
+            if (code < 0)
+            {
+                fprintf(fp, ",,%d,0,,,,,,,,,,,,,,,,,,\n", code);
+                continue;
+            }
+            fprintf(fp, ",");
+            verify_report_string(fp, r->label, format);
+            fprintf(fp, ",%d,%d,%u,%u,%u,%u,%u,%u,%d,%.1f,%.4f,%.3f,%.3f,%.4f,%u,%d,%d,%d,%f,",
+                        code, (code & CODE_ERROR_MASK) ? 0 : 1,
+                        r->errorFile, r->errorEvent, r->errorStuck, r->errorRange, r->errorRate, r->errorBreaks, r->restarts,
+                        r->breakTime, r->maxAv, r->minInterval, r->maxInterval, r->duration,
+                        r->minLight, r->batteryMaxPercent, r->batteryMinPercent, r->startStopFail, r->percentPerHour);
+            verify_report_string(fp, r->description, format);
+            fprintf(fp, "\n");
+        }
+    }
+
+    if (format == VERIFY_REPORT_JSON)
+    {
+        fprintf(fp, "\n  ]\n}\n");
+    }
+
+    fprintf(stderr, "VERIFY: %d files, %d passed (%d with warnings), %d failed, %d unreadable.\n", batch->numFiles, passed, warnings, failed, unreadable);
+}
+
+
+/* Verifies many files concurrently on a pool of worker threads, returns the number of files that did not pass */
+static int verify_batch(const char **files, int numFiles, int jobs, const char *reportFilename, int reportFormat)
+{
+    verify_batch_t batch = {0};
+    thread_t *threads;
+    int numThreads;
+    int failed = 0;
+    int i;
+
+    if (jobs <= 0)
+    {
+#ifdef _WIN32
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        jobs = (int)systemInfo.dwNumberOfProcessors;
+#else
+        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (jobs <= 0) { jobs = 1; }
+    }
+    if (jobs > numFiles) { jobs = numFiles; }
+
+    batch.files = files;
+    batch.numFiles = numFiles;
+    batch.options = globalOptions;
+    batch.results = (verify_result_t *)calloc(numFiles, sizeof(verify_result_t));
+    batch.codes = (int *)calloc(numFiles, sizeof(int));
+    threads = (thread_t *)malloc(jobs * sizeof(thread_t));
+    if (batch.results == NULL || batch.codes == NULL || threads == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory for %d files.\n", numFiles);
+        free(batch.results); free(batch.codes); free(threads);
+        return -1;
+    }
+    mutex_init(&batch.mutex, NULL);
+
+    fprintf(stderr, "VERIFY: %d files on %d worker threads.\n", numFiles, jobs);
+
+    // Start the workers (the calling thread continues with the remainder if a worker cannot be started)
+    for (numThreads = 0; numThreads < jobs; numThreads++)
+    {
+        if (thread_create(&threads[numThreads], NULL, verify_worker, &batch)) { break; }
+    }
+    if (numThreads == 0) { verify_worker(&batch); }
+    for (i = 0; i < numThreads; i++)
+    {
+        thread_join(&threads[i], NULL);
+    }
+
+    // Merged report
+    if (reportFilename != NULL)
+    {
+        FILE *fp = fopen(reportFilename, "wt");
+        if (fp == NULL)
+        {
+            fprintf(stderr, "ERROR: Problem opening report file: %s\n", reportFilename);
+        }
+        else
+        {
+            verify_report(fp, &batch, reportFormat);
+            fclose(fp);
+        }
+    }
+    else
+    {
+        verify_report(stdout, &batch, reportFormat);
+    }
+
+    for (i = 0; i < numFiles; i++)
+    {
+        if (batch.codes[i] < 0 || (batch.codes[i] & CODE_ERROR_MASK)) { failed++; }
+    }
+
+    mutex_destroy(&batch.mutex);
+    free(threads);
+    free(batch.codes);
+    free(batch.results);
+    return failed;
+}
+
+
+/* Reads a list of input files (one per line) */
+static int verify_read_list(const char *listFilename, const char ***files, int *numFiles)
+{
+    FILE *fp;
+    char line[1024];
+    int capacity = *numFiles;
+
+    fp = fopen(listFilename, "rt");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "ERROR: Problem opening list file: %s\n", listFilename);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        size_t len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) { line[--len] = '\0'; }
+        if (len == 0) { continue; }
+        if (*numFiles >= capacity)
+        {
+            const char **newFiles;
+            capacity = (capacity < 64) ? 64 : capacity * 2;
+            newFiles = (const char **)realloc((void *)*files, capacity * sizeof(const char *));
+            if (newFiles == NULL) { fclose(fp); return -1; }
+            *files = newFiles;
+        }
+        (*files)[(*numFiles)++] = strdup(line);
+    }
+    fclose(fp);
+    return 0;
+}
+
+
 /* Main function */
 int verify_main(int argc, char *argv[])
 {
     const char *outfilename = NULL;
+    const char **files = NULL;
+    int numFiles = 0;
+    int batch = 0, jobs = 0;
+    const char *reportFilename = NULL;
+    int reportFormat = VERIFY_REPORT_CSV;
     int ret = -1;
     int i;
     fprintf(stderr, "VERIFY: verify a specified binary data file contains sensible data.\n");
@@ -1004,6 +998,9 @@ int verify_main(int argc, char *argv[])
         const char *infile = NULL;
         //char output = 0;
 
+        files = (const char **)malloc(argc * sizeof(const char *));
+        if (files == NULL) { return -1; }
+
         for (i = 1; i < argc; i++)
         {
             if (!strcmp(argv[i], "-headeronly"))
@@ -1016,25 +1013,53 @@ int verify_main(int argc, char *argv[])
             else if (!strcmp(argv[i], "-output:new"))     { fprintf(stderr, "VERIFY: Option -output:new\n");        globalOptions |= VERIFY_OPTION_OUTPUT_NEW; }
             else if (!strcmp(argv[i], "-output:old"))     { fprintf(stderr, "VERIFY: Option -output:old\n");        globalOptions &= ~VERIFY_OPTION_OUTPUT_NEW; }
             else if (!strcmp(argv[i], "-allow-restarts")) { globalAllowedRestarts = atoi(argv[++i]); fprintf(stderr, "VERIFY: Option -allow-restarts %d\n", globalAllowedRestarts); }
+            else if (!strcmp(argv[i], "-readahead") && i + 1 < argc) { globalReadAhead = atoi(argv[++i]); fprintf(stderr, "VERIFY: Option -readahead %d\n", globalReadAhead); }
+            else if (!strcmp(argv[i], "-jobs") && i + 1 < argc)      { batch = 1; jobs = atoi(argv[++i]); }
+            else if (!strcmp(argv[i], "-list") && i + 1 < argc)      { batch = 1; if (verify_read_list(argv[++i], &files, &numFiles)) { return -1; } }
+            else if (!strcmp(argv[i], "-report") && i + 1 < argc)    { batch = 1; reportFilename = argv[++i]; }
+            else if (!strcmp(argv[i], "-report:csv"))                { batch = 1; reportFormat = VERIFY_REPORT_CSV; }
+            else if (!strcmp(argv[i], "-report:json"))               { batch = 1; reportFormat = VERIFY_REPORT_JSON; }
             else if (argv[i][0] == '-')
             {
                 fprintf(stdout, "ERROR: Unrecognized option %s\n", argv[i]);
                 return -3;
             }
-            else if (infile == NULL && !(globalOptions & VERIFY_OPTION_ALL))
+            else
+            {
+                files[numFiles++] = argv[i];
+            }
+        }
+
+        /* Batch mode: every parameter is an input file */
+        if (batch)
+        {
+            if (numFiles <= 0)
+            {
+                fprintf(stdout, "ERROR: No input files\n");
+                return -3;
+            }
+            ret = verify_batch(files, numFiles, jobs, reportFilename, reportFormat);
+            free((void *)files);
+            return ret;
+        }
+
+        for (i = 0; i < numFiles; i++)
+        {
+            if (infile == NULL && !(globalOptions & VERIFY_OPTION_ALL))
             {
-                infile = argv[i];
+                infile = files[i];
             }
             else if (outfilename == NULL)
             {
-                outfilename = argv[i];
+                outfilename = files[i];
             }
             else
             {
-                fprintf(stdout, "ERROR: Unexpected parameter %s\n", argv[i]);
+                fprintf(stdout, "ERROR: Unexpected parameter %s\n", files[i]);
                 return -3;
             }
         }
+        free((void *)files);
 
         /* Open the input and output files */
         if (outfilename != NULL)
@@ -1056,11 +1081,17 @@ int verify_main(int argc, char *argv[])
     }
     else
     {
-        fprintf(stderr, "Usage: verify <<binary-input-file> | <-stop-clear-all> [outfile.csv] | <-headeronly>> [-no-check-stop] [-allow-restarts <n>]\n");
+        fprintf(stderr, "Usage: verify <<binary-input-file> | <-stop-clear-all> [outfile.csv] | <-headeronly>> [-no-check-stop] [-allow-restarts <n>] [-readahead <n>]\n");
+        fprintf(stderr, "       verify [-jobs <n>] [-list <list-file>] [-report <report-file>] [-report:csv | -report:json] [binary-input-file...]\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Where: binary-input-file: the name of the binary file to verify.\n");
+        fprintf(stderr, "       -jobs: the number of files to verify concurrently (default: number of processors).\n");
+        fprintf(stderr, "       -list: a file listing the binary files to verify, one per line.\n");
+        fprintf(stderr, "       -report: the merged report of all files (default: standard output).\n");
+        fprintf(stderr, "       -readahead: the number of 64 kB buffers to read ahead of the checks (0 to disable).\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Example: verify data.cwa\n");
+        fprintf(stderr, "         verify -jobs 8 -report:json -report results.json *.cwa\n");
         fprintf(stderr, "\n");
     }
 
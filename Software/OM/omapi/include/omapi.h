@@ -29,7 +29,7 @@
  *  @ingroup   API
  *  @brief     Open Movement API
  *  @author    Dan Jackson
- *  @version   1.6.0
+ *  @version   1.7.0
  *  @date      2011-2013
  *  @copyright BSD 2-clause license. Copyright (c) 2009-2012, Newcastle University, UK. All rights reserved.
  *  @details
@@ -47,7 +47,7 @@
 
 
 /** @mainpage Open Movement API
- *  @version   1.6.0
+ *  @version   1.7.0
  *  @date      2011-2013
  *  @copyright BSD 2-clause license. Copyright (c) 2009-2013, Newcastle University, UK. All rights reserved.
  *  @details
@@ -225,7 +225,7 @@ extern "C" {
  * @remark This can be used to detect a DLL version incompatibility in OmStartup().
  * @see OmStartup()
  */
-#define OM_VERSION 106
+#define OM_VERSION 107
 
 
 /**
@@ -325,6 +325,36 @@ OM_EXPORT int OmSetDeviceCallback(OmDeviceCallback deviceCallback, void *referen
 OM_EXPORT int OmGetDeviceIds(int *deviceIds, int maxDevices);
 
 
+/**
+ * Adds a simulated device, for testing and benchmarking without hardware.
+ * The simulated device is a pseudo-terminal that answers the device commands, and a directory that stands in for the device's mounted volume.
+ * It is reported through the \a OmDeviceCallback and OmGetDeviceIds() in the same way as a connected device, until it is removed with OmRemoveSimulatedDevice() or OmShutdown().
+ * @remark Simulated devices can also be added at start-up by setting the environment variable \a OMAPI_SIMULATE to "count[,latency[,readRate[,dataBlocks]]]",
+ *         which adds \a count devices, from ID 60001, with their volumes in the temporary directory.
+ * @remark Not currently supported on Windows.
+ * @param deviceId The ID of the device to simulate (must not be the ID of a connected device).
+ * @param volumePath The directory to use as the device's volume (created if it does not exist).
+ * @param dataBlocks The number of blocks of generated data to write to the data file on the volume, or -1 to keep an existing data file.
+ * @param latency The delay before the device responds to each command, in milliseconds.
+ * @param readRate The maximum rate that data can be read from the device's volume by a download, in bytes per second (0 for no limit).
+ * @return \a OM_OK if successful, \a OM_E_NOT_IMPLEMENTED if not supported on this platform, an error code otherwise.
+ * @see OmRemoveSimulatedDevice()
+ * @since 1.7
+ */
+OM_EXPORT int OmAddSimulatedDevice(int deviceId, const char *volumePath, int dataBlocks, unsigned int latency, unsigned int readRate);
+
+
+/**
+ * Removes a simulated device, which is reported as removed (cancelling any download in progress).
+ * The volume directory and its data file are left in place.
+ * @param deviceId The ID of the simulated device.
+ * @return \a OM_OK if successful, \a OM_E_INVALID_DEVICE if the device is not a simulated device, an error code otherwise.
+ * @see OmAddSimulatedDevice()
+ * @since 1.7
+ */
+OM_EXPORT int OmRemoveSimulatedDevice(int deviceId);
+
+
 /**@}*/
 
 
@@ -549,6 +579,41 @@ OM_EXPORT int OmGetEcc(int deviceId);
 OM_EXPORT int OmCommand(int deviceId, const char *command, char *buffer, size_t bufferSize, const char *expected, unsigned int timeoutMs, char **parseParts, int parseMax);
 
 
+/**
+ * A command in a batch for OmCommandBatch().
+ * @since 1.7
+ */
+typedef struct
+{
+    const char *command;            /**< The command string to send (typically followed with CRLF). */
+    const char *expected;           /**< The expected response prefix, or \a NULL if the command's response is not waited for. */
+    char *response;                 /**< A buffer to hold the matching response line, or \a NULL if not required. */
+    size_t responseSize;            /**< The size (in bytes) of the response buffer. */
+    int result;                     /**< [out] \a OM_OK if the expected response was received, otherwise an error code (\a OM_E_UNEXPECTED_RESPONSE if not received before the timeout). */
+} OM_BATCH_COMMAND;
+
+
+/**
+ * Issues a batch of direct commands over the CDC port for a particular device, without waiting for each response before sending the next command.
+ * The commands are written back-to-back, then the responses are matched to the commands in order (by their expected prefix, or an error response), 
+ *   ignoring any other lines, until all have been received or the timeout is hit.  
+ * A response for a later command means that the earlier commands did not respond.
+ * This saves a round-trip per command when configuring a device.
+ * OmSetDelays() and OmSetMetadata() batch their commands in this way; the other setters each send a single command,
+ *   so a caller configuring many devices may batch their commands (e.g. "RATE", "TIME") directly.
+ * OmEraseDataAndCommit() should still be called on its own, after the settings, as it applies them and its time is dominated by the device's flash write.
+ * @note This method is not generally recommended -- incorrect results could lead to unspecified behaviour.
+ * @param deviceId Identifier of the device.
+ * @param[in,out] commands An array of commands, each receiving its response and result code.
+ * @param count The number of commands in the array.
+ * @param timeoutMs The time, in milliseconds, for the whole batch, after which any commands without a response will time-out.
+ * @return \a OM_OK if all of the commands received their expected response, otherwise the result code of the first that did not.
+ * @see OmCommand()
+ * @since 1.7
+ */
+OM_EXPORT int OmCommandBatch(int deviceId, OM_BATCH_COMMAND *commands, int count, unsigned int timeoutMs);
+
+
 /**@}*/
 
 
@@ -866,6 +931,58 @@ OM_EXPORT int OmSetDownloadCallback(OmDownloadCallback downloadCallback, void *r
 OM_EXPORT int OmSetDownloadChunkCallback(OmDownloadChunkCallback downloadChunkCallback, void *reference);
 
 
+/**
+ * Download option flag: read the device's data file without the operating system's cache (O_DIRECT), where supported.
+ * @see OmSetDownloadOptions()
+ * @since 1.7
+ */
+#define OM_DOWNLOAD_FLAG_DIRECT     0x0001
+
+/**
+ * Download option flag: advise the operating system that the device's data file is read sequentially (posix_fadvise), where supported.
+ * @see OmSetDownloadOptions()
+ * @since 1.7
+ */
+#define OM_DOWNLOAD_FLAG_SEQUENTIAL 0x0002
+
+/**
+ * Download option flag: verify the data file as it is downloaded, see OmQueryDownloadVerification().
+ * @remark Only downloads that begin at the start of the data file are verified.
+ * @see OmSetDownloadOptions()
+ * @since 1.7
+ */
+#define OM_DOWNLOAD_FLAG_VERIFY     0x0004
+
+
+/**
+ * Sets the options used by subsequent downloads.
+ * With more than one buffer, the data file is read in to a ring of buffers on a separate thread, overlapping reading from the device with writing to the destination.
+ * The chunk and progress callbacks are still called in file order, from the download thread.
+ * @remark Multiple buffers and the option flags are not currently supported on Windows, where only the block set size is used.
+ * @param blockSetSize The number of 512-byte blocks read at a time, or 0 for the default (256).
+ * @param bufferCount The number of buffers, or 0 for the default (4).  A single buffer alternates reading and writing.
+ * @param flags A combination of the \a OM_DOWNLOAD_FLAG_* options (or 0 for none).
+ * @return \a OM_OK if successful, an error code otherwise.
+ * @see OmBeginDownloading(), OmSetDownloadChunkCallback()
+ * @since 1.7
+ */
+OM_EXPORT int OmSetDownloadOptions(int blockSetSize, int bufferCount, int flags);
+
+
+/**
+ * Sets limits to schedule many simultaneous downloads (e.g. from a rack of docked devices).
+ * Downloads begun while the maximum number are reading wait, in the order they were begun, for an earlier download to finish.
+ * Waiting downloads report \a OM_DOWNLOAD_PROGRESS at 0%, and may be cancelled as usual.
+ * @param maxReaders The maximum number of downloads reading from devices at once, or 0 for no limit.
+ * @param maxWriters The maximum number of simultaneous writes to destination files, or 0 for no limit.
+ * @param maxBytesPerSecond The maximum aggregate rate at which all downloads read from devices, or 0 for no limit.
+ * @return \a OM_OK if successful, an error code otherwise.
+ * @see OmBeginDownloading(), OmQueryDownloadThroughput()
+ * @since 1.7
+ */
+OM_EXPORT int OmSetDownloadLimits(int maxReaders, int maxWriters, int maxBytesPerSecond);
+
+
 /**
  * Return the data file size of the specified device.
  * @param deviceId Identifier of the device.
@@ -932,6 +1049,24 @@ OM_EXPORT int OmBeginDownloading(int deviceId, int dataOffsetBlocks, int dataLen
 OM_EXPORT int OmBeginDownloadingReference(int deviceId, int dataOffsetBlocks, int dataLengthBlocks, const char *destinationFile, void *reference);
 
 
+/**
+ * Begin a resumable download of all of the data from the current device.
+ * A checkpoint file (the destination file name with ".checkpoint" appended) records the device ID, session ID, number of blocks completed, and a rolling checksum of those blocks.
+ * If the checkpoint is for the same device and session, and the destination file still matches the checksum, only the remaining blocks are copied (appended to the destination file), 
+ *   otherwise the whole data file is downloaded.
+ * This resumes an interrupted download, or copies only the blocks written since a previous download.
+ * Once the download has successfully started, the call returns immediately, and the download continues in another thread.
+ * @param deviceId Identifier of the device.
+ * @param destinationFile File to write to.
+ * @param reference An additional reference to pass to the download callbacks -- if NULL, the reference given when registering the callback will be used instead.
+ * @return \a OM_OK if successfully started the download, an error code otherwise.
+ * @remark The chunk callback positions are file positions, so the first chunk of a resumed download is not at position zero.
+ * @see OmBeginDownloadingReference(), OmSetDownloadCallback(), OmWaitForDownload(), OmCancelDownload()
+ * @since 1.7
+ */
+OM_EXPORT int OmBeginDownloadingResume(int deviceId, const char *destinationFile, void *reference);
+
+
 /**
  * This function queries the status of the specified device's asynchronous download.
  * @remark Using the user-specified download callback would be sufficient for most applications.
@@ -947,6 +1082,105 @@ OM_EXPORT int OmBeginDownloadingReference(int deviceId, int dataOffsetBlocks, in
 OM_EXPORT int OmQueryDownload(int deviceId, OM_DOWNLOAD_STATUS *downloadStatus, int *downloadValue);
 
 
+/**
+ * This function queries the throughput of the specified device's download, and of all downloads in progress.
+ * The device's throughput is averaged since the download began reading (or over the whole download, once finished).
+ * @param deviceId Identifier of the device.
+ * @param[out] deviceBytesPerSecond A pointer to a value to receive the device's download throughput, or \a NULL if not required.
+ * @param[out] totalBytesPerSecond A pointer to a value to receive the total throughput of all downloads in progress, or \a NULL if not required.
+ * @return \a OM_OK if successful, an error code otherwise.
+ * @see OmQueryDownload(), OmSetDownloadLimits()
+ * @since 1.7
+ */
+OM_EXPORT int OmQueryDownloadThroughput(int deviceId, int *deviceBytesPerSecond, int *totalBytesPerSecond);
+
+
+/**
+ * @name Verification result codes
+ * Bits of the \a OM_VERIFY_RESULT \a code, where each check sets either its warning or its error bit.
+ * @see OmQueryDownloadVerification()
+ * @since 1.7
+ * @{
+ */
+#define OM_VERIFY_ERROR_MASK         0xfffff000     /**< Mask of the error bits */
+#define OM_VERIFY_WARNING_MASK       0x00000fff     /**< Mask of the warning bits */
+#define OM_VERIFY_WARNING_FILE       0x000001       /**< FILE - Read file issue (sector incorrect or checksum mismatch) */
+#define OM_VERIFY_ERROR_FILE         0x001000       /**< FILE - Read file issue (sector incorrect or checksum mismatch) */
+#define OM_VERIFY_WARNING_EVENT      0x000002       /**< EVENT - System logged event error (e.g. FIFO overflow) */
+#define OM_VERIFY_ERROR_EVENT        0x002000       /**< EVENT - System logged event error (e.g. FIFO overflow) */
+#define OM_VERIFY_WARNING_STUCK      0x000004       /**< STUCK - Where the accelerometer appears to be stuck at the same value */
+#define OM_VERIFY_ERROR_STUCK        0x004000       /**< STUCK - Where the accelerometer appears to be stuck at the same value */
+#define OM_VERIFY_WARNING_RANGE      0x000008       /**< RANGE - Where the accelerometer doesn't seem to average to 1G */
+#define OM_VERIFY_ERROR_RANGE        0x008000       /**< RANGE - Where the accelerometer doesn't seem to average to 1G */
+#define OM_VERIFY_WARNING_RATE       0x000010       /**< RATE - Where the rate is too far off 100Hz */
+#define OM_VERIFY_ERROR_RATE         0x010000       /**< RATE - Where the rate is too far off 100Hz */
+#define OM_VERIFY_WARNING_BREAKS     0x000020       /**< BREAKS - Where there is a gap in the data */
+#define OM_VERIFY_ERROR_BREAKS       0x020000       /**< BREAKS - Where there is a gap in the data */
+#define OM_VERIFY_WARNING_RESTARTS   0x000040       /**< RESTARTS - Where the device has restarted */
+#define OM_VERIFY_ERROR_RESTARTS     0x040000       /**< RESTARTS - Where the device has restarted */
+#define OM_VERIFY_WARNING_LIGHT      0x000080       /**< LIGHT - Where the light level reading is far lower than normal */
+#define OM_VERIFY_ERROR_LIGHT        0x080000       /**< LIGHT - Where the light level reading is far lower than normal */
+#define OM_VERIFY_WARNING_BATT       0x000100       /**< BATT - Where the battery discharge is more rapid than usual */
+#define OM_VERIFY_ERROR_BATT         0x100000       /**< BATT - Where the battery discharge is more rapid than usual */
+#define OM_VERIFY_WARNING_STARTSTOP  0x000200       /**< STARTSTOP - Where the configured start/stop times are not met */
+#define OM_VERIFY_ERROR_STARTSTOP    0x200000       /**< STARTSTOP - Where the configured start/stop times are not met */
+/**@}*/
+
+
+/**
+ * Result of verifying a downloaded data file.
+ * @see OmQueryDownloadVerification()
+ * @since 1.7
+ */
+typedef struct
+{
+    int code;                       /**< Combination of the \a OM_VERIFY_WARNING_* and \a OM_VERIFY_ERROR_* bits (zero if no issues found) */
+    int errorFile;                  /**< Number of blocks that could not be read or were invalid */
+    int errorEvent;                 /**< Number of blocks with an error event logged */
+    int errorStuck;                 /**< Number of times the accelerometer readings were stuck */
+    int errorRange;                 /**< Number of times the average SVM went out of range */
+    int errorRate;                  /**< Number of seconds with an out-of-range number of samples */
+    int errorBreaks;                /**< Number of non-sequential jumps in time */
+    int restarts;                   /**< Number of times the recording sequence restarted */
+    float breakTime;                /**< Total duration of the time breaks (seconds) */
+    float maxAv;                    /**< Maximum absolute average of (SVM - 1) */
+    float minInterval;              /**< Minimum interval between blocks (seconds) */
+    float maxInterval;              /**< Maximum interval between blocks (seconds) */
+    float duration;                 /**< Total duration of the recording sessions (hours) */
+    int minLight;                   /**< Minimum light reading */
+    int batteryMaxPercent;          /**< Maximum battery level (percent) */
+    int batteryMinPercent;          /**< Minimum battery level (percent) */
+    float percentPerHour;           /**< Battery discharge rate (percent per hour) */
+    int startStopFail;              /**< Start/stop check failures: 1 = data did not stop near the stop time, 2 = data did not start near the start time, 4 = header unavailable */
+    unsigned int totalSamples;      /**< Total number of samples checked */
+    int downloadStalls;             /**< Number of times the download waited for the checks to catch up (when verified during a download, otherwise zero) */
+} OM_VERIFY_RESULT;
+
+
+/**
+ * This function queries the result of verifying the specified device's download, where the download was made with the \a OM_DOWNLOAD_FLAG_VERIFY option.
+ * The checks are made on a separate thread as the data is downloaded, and the result is available from the \a OM_DOWNLOAD_COMPLETE callback onwards.
+ * @param deviceId Identifier of the device.
+ * @param[out] result A pointer to a structure to receive the verification result.
+ * @return \a OM_OK if successful, \a OM_E_NOT_VALID_STATE if the last download was not verified, an error code otherwise.
+ * @see OmSetDownloadOptions(), OmSetDownloadCallback()
+ * @since 1.7
+ */
+OM_EXPORT int OmQueryDownloadVerification(int deviceId, OM_VERIFY_RESULT *result);
+
+
+/**
+ * This function verifies the contents of a data file, with the same checks as a download made with the \a OM_DOWNLOAD_FLAG_VERIFY option.
+ * @param filename The data file to verify.
+ * @param readAhead The number of buffers to read ahead of the checks (see OmReaderReadAhead()), or 0 to read each block as it is checked.
+ * @param[out] result A pointer to a structure to receive the verification result.
+ * @return \a OM_OK if the file was checked (the result holds any issues found), \a OM_E_ACCESS_DENIED if the file could not be opened, an error code otherwise.
+ * @see OmQueryDownloadVerification()
+ * @since 1.7
+ */
+OM_EXPORT int OmVerifyFile(const char *filename, int readAhead, OM_VERIFY_RESULT *result);
+
+
 /**
  * This function waits for the specified device's asynchronous download to finish.
  * The call returns immediately if a download is not in progress, or will blocks and return when the download completes, is cancelled, or fails. 
@@ -1087,6 +1321,8 @@ OM_EXPORT char *OmDateTimeToString(OM_DATETIME value, char *buffer);
  * The file is read in blocks by repeatedly calling OmReaderNextBlock(), and the unpacked data is
  *   accessed through OmReaderBuffer(), and the precise sample timestamps are interpolated with OmReaderTimestamp().
  *
+ * Alternatively, runs of consecutive blocks can be unpacked in to a single buffer, with their timestamps, by calling OmReaderNextBlocks().
+ *
  * Advanced uses are supported with direct access to the buffer through OmReaderRawHeaderPacket() and OmReaderRawDataPacket().
  *
  * @see Example code convert.c, for an example of how to use the binary file reader functions of the API.
@@ -1095,7 +1331,7 @@ OM_EXPORT char *OmDateTimeToString(OM_DATETIME value, char *buffer);
 
 /**
  * Handle to a reader object. 
- * Obtained by calling OmReaderOpen(), and disposed of with OmReaderClose().
+ * Obtained by calling OmReaderOpen() or OmReaderOpenBuffer(), and disposed of with OmReaderClose().
  * @see OmReaderOpen(), OmReaderClose()
  */
 typedef void * OmReaderHandle;
@@ -1125,6 +1361,7 @@ typedef void * OmReaderHandle;
 /**
  * Opens a binary data file for reading.
  * Parses the file header and places the stream at the first block of data.
+ * @remark Where supported, the file is memory-mapped and the raw packets are accessed directly from the mapping, otherwise the file is read a block at a time.
  * @param binaryFilename The file name of the binary file to open.
  * @see OmReaderNextBlock(), OmReaderClose()
  * @return If successful, a handle to the reader object, otherwise \a NULL
@@ -1132,6 +1369,34 @@ typedef void * OmReaderHandle;
 OM_EXPORT OmReaderHandle OmReaderOpen(const char *binaryFilename);
 
 
+/**
+ * Opens a binary data file already held in memory for reading.
+ * Behaves as OmReaderOpen(), but reads from the caller's buffer rather than a file (e.g. data downloaded to memory using the OmDownloadChunkCallback).
+ * @remark The buffer is not copied: it must remain valid, and unchanged, until OmReaderClose() is called. It is never written to, and need not be aligned: the raw packets returned by OmReaderRawHeaderPacket() and OmReaderRawDataPacket() are copied from it.
+ * @param buffer A pointer to the contents of the binary file.
+ * @param length The length of the binary file contents, in bytes.
+ * @see OmReaderOpen(), OmReaderClose()
+ * @return If successful, a handle to the reader object, otherwise \a NULL
+ * @since 1.7
+ */
+OM_EXPORT OmReaderHandle OmReaderOpenBuffer(const void *buffer, int length);
+
+
+/**
+ * Starts (or stops) reading the binary file ahead of the consumer on a background thread.
+ * The thread fills a ring of large buffers ahead of the current position, so that OmReaderNextBlock() is not stalled by the latency of each read from slow storage (e.g. network shares or USB mass storage).
+ * Seeking outside the buffered range discards the buffers and restarts reading from the new position.
+ * The thread is stopped when the reader is closed.
+ * @remark Read-ahead replaces any memory-mapping of the file, has no effect for a reader opened with OmReaderOpenBuffer(), and is not currently supported on Windows.
+ * @param reader The handle to the reader.
+ * @param depth The number of 64 kB buffers to read ahead, or 0 to stop reading ahead.
+ * @return \a OM_OK if successful, \a OM_E_NOT_IMPLEMENTED if not supported on this platform, an error code otherwise.
+ * @see OmReaderOpen(), OmReaderClose()
+ * @since 1.7
+ */
+OM_EXPORT int OmReaderReadAhead(OmReaderHandle reader, int depth);
+
+
 /**
  * Read the size, time-range, and internal chunking of the binary file.
  * @param reader The handle to the reader.
@@ -1155,6 +1420,19 @@ OM_EXPORT int OmReaderDataRange(OmReaderHandle reader, int *dataBlockSize, int *
 OM_EXPORT const char *OmReaderMetadata(OmReaderHandle reader, int *deviceId, unsigned int *sessionId);
 
 
+/**
+ * Read the precise times of the first and last samples in the binary file.
+ * These are determined from the first and last readable blocks when the file is opened, so no further data is read.
+ * @param reader The handle to the reader.
+ * @param[out] firstTime A pointer to a value to receive the time of the first sample, in 1/65536ths of a second since the epoch (1970-01-01), or \a NULL if not required.
+ * @param[out] lastTime A pointer to a value to receive the time of the last sample, in 1/65536ths of a second since the epoch (1970-01-01), or \a NULL if not required.
+ * @return \a OM_OK if successful, an error code otherwise.
+ * @see OmReaderDataRange(), OmReaderSeekTime()
+ * @since 1.7
+ */
+OM_EXPORT int OmReaderDataTimeRange(OmReaderHandle reader, unsigned long long *firstTime, unsigned long long *lastTime);
+
+
 /**
  * Return the current block index of the reader.
  * @param reader The handle to the reader.
@@ -1172,6 +1450,19 @@ OM_EXPORT int OmReaderDataBlockPosition(OmReaderHandle reader);
 OM_EXPORT int OmReaderDataBlockSeek(OmReaderHandle reader, int dataBlockNumber);
 
 
+/**
+ * Seeks the file reader to the data block containing the specified time.
+ * The block is found by a binary search of the block timestamps, refined by a local scan in case the timestamps are not strictly monotonic.
+ * The next call to OmReaderNextBlock() reads the first block that ends after the specified time.
+ * @param reader The handle to the reader.
+ * @param time The time to seek to, in 1/65536ths of a second since the epoch (1970-01-01).
+ * @return If non-negative, the data block index sought to (the number of data blocks if the time is after the end of the data), an error code otherwise.
+ * @see OmReaderDataTimeRange(), OmReaderDataBlockSeek()
+ * @since 1.7
+ */
+OM_EXPORT int OmReaderSeekTime(OmReaderHandle reader, unsigned long long time);
+
+
 /**
  * Reads the next block of data from the binary file.
  * @param reader The handle to the reader.
@@ -1211,6 +1502,28 @@ OM_EXPORT short *OmReaderBuffer(OmReaderHandle reader);
 OM_EXPORT OM_DATETIME OmReaderTimestamp(OmReaderHandle reader, int index, unsigned short *fractional);
 
 
+/**
+ * Reads and unpacks a run of consecutive blocks from the binary file in to a single buffer.
+ * The sample values and timestamps are identical to calling OmReaderNextBlock() for each block, then OmReaderBuffer() and OmReaderTimestamp() for each sample.
+ * Unreadable blocks are skipped.  Reading stops after \a maxBlocks blocks, or before a block that might not fit in the remaining space.
+ * @note The per-block accessors (e.g. OmReaderGetValue(), OmReaderRawDataPacket()) refer to the last block read, but OmReaderBuffer() is not updated.
+ * @param reader The handle to the reader.
+ * @param maxBlocks The maximum number of blocks to read.
+ * @param[out] buffer The buffer to receive the samples, which must hold 3 * \a maxSamples values.  
+ *             If interleaved, each sample is three consecutive values (x, y, z); if planar, the x-, y- and z-values are at offsets 0, \a maxSamples and 2 * \a maxSamples.
+ * @param maxSamples The capacity of the buffer in samples (at least OM_MAX_SAMPLES).
+ * @param[out] timestamps A buffer to receive the time of each sample, in 1/65536ths of a second since the epoch (1970-01-01), or \a NULL if not required.
+ * @param planar Non-zero for planar output, zero for interleaved output.
+ * @retval >0 the number of samples read in to the buffer. 
+ * @retval 0 only unreadable blocks were read, but additional blocks remain (call OmReaderNextBlocks() again).
+ * @retval -1, the end-of-file has been reached.
+ * @retval Otherwise, an error code (if samples were already read, the error is instead returned by the next call).
+ * @see OmReaderNextBlock()
+ * @since 1.7
+ */
+OM_EXPORT int OmReaderNextBlocks(OmReaderHandle reader, int maxBlocks, short *buffer, int maxSamples, unsigned long long *timestamps, int planar);
+
+
 /**
  * Reader value indexes for OmReaderGetValue() function.
  * @see OmReaderGetValue
@@ -1264,8 +1577,8 @@ typedef struct
 	unsigned short deviceId;            /**< @ 5 +2 Device identifier */
 	unsigned int sessionId;             /**< @ 7 +4 Unique session identifier */
 	unsigned short reserved2;           /**< @11 +2 (2 bytes reserved) */
-	OM_DATETIME loggingStartTime;       /**< @13 +4 Start time for delayed logging */
-	OM_DATETIME loggingEndTime;         /**< @17 +4 Stop time for delayed logging */
+	unsigned int loggingStartTime;      /**< @13 +4 Start time for delayed logging (an OM_DATETIME, stored as 32 bits) */
+	unsigned int loggingEndTime;        /**< @17 +4 Stop time for delayed logging (an OM_DATETIME, stored as 32 bits) */
 	unsigned int loggingCapacity;       /**< @21 +4 Preset maximum number of samples to collect, 0 = unlimited */
     unsigned char reserved3[11];        /**< @25 +11 (11 bytes reserved) */
 	unsigned char samplingRate;		    /**< @36 +1 Sampling rate */
@@ -1301,7 +1614,7 @@ typedef struct
 	unsigned short deviceFractional;	/**< @ 4 +2  Top bit set: 15-bit fraction of a second for the time stamp, the timestampOffset was already adjusted to minimize this assuming ideal sample rate; Top bit clear: 15-bit device identifier, 0 = unknown; */
     unsigned int sessionId;			    /**< @ 6 +4  Unique session identifier, 0 = unknown */
     unsigned int sequenceId;		    /**< @10 +4  Sequence counter, each packet has a new number (reset if restarted) */
-    OM_DATETIME timestamp;			    /**< @14 +4  Last reported RTC value, 0 = unknown */
+    unsigned int timestamp;			    /**< @14 +4  Last reported RTC value, 0 = unknown (an OM_DATETIME, stored as 32 bits) */
 	unsigned short light;			    /**< @18 +2  Last recorded light sensor value in raw units, 0 = none */
 	unsigned short temperature;		    /**< @20 +2  Last recorded temperature sensor value in raw units, 0 = none */
 	unsigned char  events;			    /**< @22 +1  Event flags since last packet, b0 = resume logging, b1 = single-tap event, b2 = double-tap event, b3-b7 = reserved for diagnostic use) */
@@ -1329,7 +1642,7 @@ OM_EXPORT OM_READER_DATA_PACKET *OmReaderRawDataPacket(OmReaderHandle reader);
 
 /**
  * Closes the specified reader handle.
- * Frees any resources allocated to the reader.
+ * Frees any resources allocated to the reader, and stops any read-ahead thread.
  * @param reader The handle to the reader to close.
  * @see OmReaderOpen()
  */
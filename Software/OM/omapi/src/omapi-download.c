@@ -26,13 +26,35 @@
 // Open Movement API - Download Functions
 // Dan Jackson, 2011-2012
 
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // O_DIRECT
+#endif
+
 #include "omapi-internal.h"
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 
 
-/** Download buffer size */
+/** Default download buffer size (blocks) */
 #define OM_DOWNLOAD_BLOCK_SET (256)
 
+/** Default number of download buffers */
+#define OM_DOWNLOAD_BUFFERS (4)
+
+/** Alignment of download buffers (suitable for unbuffered reads) */
+#define OM_DOWNLOAD_ALIGNMENT (4096)
+
+/** Interval at which a download waiting for a reader or writer slot checks again, where there is no condition variable to wait on (milliseconds) */
+#define OM_DOWNLOAD_WAIT_INTERVAL (10)
+
+/** Minimum interval between saving a resumable download's checkpoint (milliseconds) */
+#define OM_DOWNLOAD_CHECKPOINT_INTERVAL (1000)
+
+/** Suffix added to the destination file name for a resumable download's checkpoint */
+#define OM_DOWNLOAD_CHECKPOINT_SUFFIX ".checkpoint"
+
 
 /** Internal method to update the download progress. */
 static int OmDoDownloadUpdate(unsigned short deviceId, OM_DOWNLOAD_STATUS downloadStatus, int downloadValue)
@@ -41,14 +63,14 @@ static int OmDoDownloadUpdate(unsigned short deviceId, OM_DOWNLOAD_STATUS downlo
  
     // Check system and device state
     if (!om.initialized) return OM_E_NOT_VALID_STATE;
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
-    device = om.devices[deviceId];
+    device = OmDeviceFind(deviceId);
+    if (device == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
 
     // Acquire download mutex here (otherwise there is a small window here in which the state will become unknown if accessed from another thread)
-    mutex_lock(&om.downloadMutex);          // Lock download mutex to update device state structure
+    mutex_lock(&device->downloadMutex);     // Lock the device's download mutex to update device state structure
     device->downloadStatus = downloadStatus;
     device->downloadValue = downloadValue;
-    mutex_unlock(&om.downloadMutex);        // Release download mutex after updating device state structure
+    mutex_unlock(&device->downloadMutex);   // Release the device's download mutex after updating device state structure
 
     // Call user-supplied callback
     if (om.downloadCallback != NULL)
@@ -60,14 +82,702 @@ static int OmDoDownloadUpdate(unsigned short deviceId, OM_DOWNLOAD_STATUS downlo
 }
 
 
+/** Internal method to update a rolling (Adler-32) checksum, initially 1. */
+static unsigned long OmDownloadChecksum(unsigned long checksum, const unsigned char *buffer, size_t length)
+{
+    unsigned long a = checksum & 0xffff, b = (checksum >> 16) & 0xffff;
+    while (length > 0)
+    {
+        size_t n = (length < 5552) ? length : 5552;     // Largest run before the sums could overflow 32 bits
+        length -= n;
+        while (n--) { a += *buffer++; b += a; }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+
+/** Internal method to save a resumable download's checkpoint (after flushing the destination file). */
+static int OmDownloadCheckpointWrite(OmDeviceState *deviceState)
+{
+    FILE *fp;
+
+    if (deviceState->downloadCheckpoint[0] == '\0' || deviceState->downloadDest == NULL) { return OM_E_NOT_VALID_STATE; }
+    if (fflush(deviceState->downloadDest) != 0) { return OM_E_ACCESS_DENIED; }
+
+    fp = fopen(deviceState->downloadCheckpoint, "wt");
+    if (fp == NULL) { return OM_E_ACCESS_DENIED; }
+    fprintf(fp, "OMDOWNLOAD device=%u session=%u blocks=%d checksum=%08lx\n", deviceState->id, deviceState->downloadSessionId, deviceState->downloadBlocksBase + deviceState->downloadBlocksCopied, deviceState->downloadChecksum);
+    fclose(fp);
+
+    return OM_OK;
+}
+
+
+/** Internal method to load a resumable download's checkpoint, returns the number of blocks that can be skipped (zero if the checkpoint is missing, for other data, or the destination no longer matches). */
+static int OmDownloadCheckpointRead(OmDeviceState *deviceState, const char *destinationFile, int fileTotalBlocks)
+{
+    unsigned char header[OM_BLOCK_SIZE];
+    unsigned int checkpointDevice = 0, checkpointSession = 0;
+    unsigned long checkpointChecksum = 0;
+    int checkpointBlocks = 0;
+    char *buffer;
+    FILE *fp;
+    int i;
+
+    // Start from scratch unless the checkpoint is verified
+    deviceState->downloadChecksum = 1;
+
+    // Session ID from the data file header
+    deviceState->downloadSessionId = 0;
+    fseek(deviceState->downloadSource, 0, SEEK_SET);
+    if (fread(header, 1, sizeof(header), deviceState->downloadSource) == sizeof(header) && header[0] == 0x4d && header[1] == 0x44)
+    {
+        deviceState->downloadSessionId = (unsigned int)header[7] | ((unsigned int)header[8] << 8) | ((unsigned int)header[9] << 16) | ((unsigned int)header[10] << 24);
+    }
+
+    // Read the checkpoint, and check it is for the same device and session
+    sprintf(deviceState->downloadCheckpoint, "%s%s", destinationFile, OM_DOWNLOAD_CHECKPOINT_SUFFIX);
+    fp = fopen(deviceState->downloadCheckpoint, "rt");
+    if (fp == NULL) { return 0; }
+    i = fscanf(fp, "OMDOWNLOAD device=%u session=%u blocks=%d checksum=%lx", &checkpointDevice, &checkpointSession, &checkpointBlocks, &checkpointChecksum);
+    fclose(fp);
+    if (i != 4 || checkpointDevice != deviceState->id || checkpointSession != deviceState->downloadSessionId) { return 0; }
+    if (checkpointBlocks <= 0 || checkpointBlocks > fileTotalBlocks) { return 0; }
+
+    // Verify the blocks already in the destination file against the checksum
+    fp = fopen(destinationFile, "rb");
+    if (fp == NULL) { return 0; }
+    buffer = (char *)malloc(OM_DOWNLOAD_BLOCK_SET * OM_BLOCK_SIZE);
+    if (buffer != NULL)
+    {
+        unsigned long checksum = 1;
+        int remaining = checkpointBlocks;
+        while (remaining > 0)
+        {
+            int toRead = (remaining < OM_DOWNLOAD_BLOCK_SET) ? remaining : OM_DOWNLOAD_BLOCK_SET;
+            if ((int)fread(buffer, OM_BLOCK_SIZE, toRead, fp) != toRead) { break; }
+            checksum = OmDownloadChecksum(checksum, (unsigned char *)buffer, (size_t)toRead * OM_BLOCK_SIZE);
+            remaining -= toRead;
+        }
+        if (remaining > 0 || checksum != checkpointChecksum) { checkpointBlocks = 0; }
+        free(buffer);
+    }
+    else
+    {
+        checkpointBlocks = 0;
+    }
+    fclose(fp);
+
+    if (checkpointBlocks > 0) { deviceState->downloadChecksum = checkpointChecksum; }
+    return checkpointBlocks;
+}
+
+
+/** Internal method to remove a download from the reader slot queue (downloadLimitMutex must be held). */
+static void OmDownloadUnqueue(OmDeviceState *deviceState)
+{
+    OmDeviceState **link = &om.downloadQueueHead;
+    OmDeviceState *previous = NULL;
+    while (*link != NULL && *link != deviceState) { previous = *link; link = &(*link)->downloadQueueNext; }
+    if (*link == deviceState)
+    {
+        *link = deviceState->downloadQueueNext;
+        if (om.downloadQueueTail == deviceState) { om.downloadQueueTail = previous; }
+    }
+    deviceState->downloadQueueNext = NULL;
+}
+
+
+/** Internal method to wait for a change in the download scheduling state (downloadLimitMutex must be held, and is held again on return). */
+static void OmDownloadLimitWait(int deviceId)
+{
+#ifndef _WIN32
+    cond_wait(&om.downloadLimitCond, &om.downloadLimitMutex);
+#else
+    mutex_unlock(&om.downloadLimitMutex);
+    usleep(OM_DOWNLOAD_WAIT_INTERVAL * 1000UL);
+    mutex_lock(&om.downloadLimitMutex);
+#endif
+}
+
+
+/** Internal method to wake any downloads waiting for a change in the download scheduling state (downloadLimitMutex must be held). */
+static void OmDownloadLimitSignal(void)
+{
+#ifndef _WIN32
+    cond_broadcast(&om.downloadLimitCond);
+#endif
+}
+
+
+/** Internal method to wait for a reader slot, in the order the downloads were queued, returns zero if cancelled while waiting. */
+static int OmDownloadReaderAcquire(OmDeviceState *deviceState)
+{
+    int deviceId = deviceState->id;     // (for mutex debugging)
+    int admitted = 0;
+
+    mutex_lock(&om.downloadLimitMutex);
+    for (;;)
+    {
+        if (om.downloadQueueHead == deviceState && (om.downloadMaxReaders <= 0 || om.downloadReaders < om.downloadMaxReaders))
+        {
+            admitted = 1;
+            break;
+        }
+        if (deviceState->downloadCancel) { break; }
+        OmDownloadLimitWait(deviceId);
+    }
+
+    // Remove from the queue (the next download may now be at the head)
+    OmDownloadUnqueue(deviceState);
+    if (admitted)
+    {
+        om.downloadReaders++;
+        deviceState->downloadStartTime = OmMilliseconds();
+    }
+    OmDownloadLimitSignal();
+    mutex_unlock(&om.downloadLimitMutex);
+
+    return admitted;
+}
+
+
+/** Internal method to release a reader slot. */
+static void OmDownloadReaderRelease(OmDeviceState *deviceState)
+{
+    int deviceId = deviceState->id;     // (for mutex debugging)
+    mutex_lock(&om.downloadLimitMutex);
+    om.downloadReaders--;
+    deviceState->downloadEndTime = OmMilliseconds();
+    if (deviceState->downloadEndTime == 0) { deviceState->downloadEndTime = 1; }
+    OmDownloadLimitSignal();
+    mutex_unlock(&om.downloadLimitMutex);
+}
+
+
+/** Internal method to count bytes copied (with the download timings, so the throughput is read consistently). */
+static void OmDownloadAddBytes(OmDeviceState *deviceState, unsigned long bytes)
+{
+    int deviceId = deviceState->id;     // (for mutex debugging)
+    mutex_lock(&om.downloadLimitMutex);
+    deviceState->downloadBytes += bytes;
+    mutex_unlock(&om.downloadLimitMutex);
+}
+
+
+void OmDownloadSignalCancel(OmDeviceState *deviceState)
+{
+    int deviceId = deviceState->id;     // (for mutex debugging)
+    mutex_lock(&om.downloadLimitMutex);
+    deviceState->downloadCancel = 1;
+    OmDownloadLimitSignal();
+    mutex_unlock(&om.downloadLimitMutex);
+}
+
+
+int OmDownloadJoin(OmDeviceState *deviceState, char finishedOnly)
+{
+    int deviceId = deviceState->id;     // (for mutex debugging)
+    thread_t thread;
+    char joinable;
+
+    // Take the thread under the mutex, so only one caller joins it (but join without the mutex, which the thread and its callback may still need)
+    mutex_lock(&deviceState->downloadMutex);
+    joinable = deviceState->downloadThreadJoinable && (!finishedOnly || deviceState->downloadStatus != OM_DOWNLOAD_PROGRESS);
+    if (joinable)
+    {
+        thread = deviceState->downloadThread;
+        deviceState->downloadThreadJoinable = 0;
+    }
+    mutex_unlock(&deviceState->downloadMutex);
+    if (!joinable) { return 0; }
+
+    // From the download's own completion callback, the thread cannot join itself
+    if (thread_is_current(&thread)) { thread_detach(&thread); }
+    else { thread_join(&thread, NULL); }
+    return 1;
+}
+
+
+/** Internal method to wait until the aggregate read rate allows a read of the specified size. */
+static void OmDownloadThrottle(int deviceId, int simulated, int bytes)
+{
+    unsigned long long now;
+    unsigned long wait = 0;
+
+    // A simulated device may have its own read rate
+    if (simulated) { OmSimulatorThrottle(deviceId, bytes); }
+
+    if (om.downloadMaxRate <= 0) { return; }
+
+    // Reserve the time for this read after any already reserved
+    mutex_lock(&om.downloadLimitMutex);
+    now = OmMillisecondsEpoch();
+    if (om.downloadRateNext < now) { om.downloadRateNext = now; }
+    wait = (unsigned long)(om.downloadRateNext - now);
+    om.downloadRateNext += (unsigned long long)bytes * 1000 / om.downloadMaxRate;
+    mutex_unlock(&om.downloadLimitMutex);
+
+    if (wait > 0) { usleep(wait * 1000UL); }
+}
+
+
+/** Internal method to wait for a writer slot. */
+static void OmDownloadWriterAcquire(int deviceId)
+{
+    mutex_lock(&om.downloadLimitMutex);
+    while (om.downloadMaxWriters > 0 && om.downloadWriters >= om.downloadMaxWriters)
+    {
+        OmDownloadLimitWait(deviceId);
+    }
+    om.downloadWriters++;
+    mutex_unlock(&om.downloadLimitMutex);
+}
+
+
+/** Internal method to release a writer slot. */
+static void OmDownloadWriterRelease(int deviceId)
+{
+    mutex_lock(&om.downloadLimitMutex);
+    om.downloadWriters--;
+    OmDownloadLimitSignal();
+    mutex_unlock(&om.downloadLimitMutex);
+}
+
+
+#ifndef _WIN32
+/** Ring of download buffers, filled in file order by the reader stage and emptied by the download thread */
+typedef struct
+{
+    unsigned short deviceId;
+    char simulated;             // Simulated device (reads are also limited to its volume read rate)
+    int fd;                     // Source file descriptor (read with pread(), bypassing the stream buffer)
+    long position;              // Next file position to read
+    int blocksRemaining;        // Blocks left to read
+    int blockSet;               // Blocks per buffer
+    int count;                  // Number of buffers
+    char **buffers;
+    long *positions;            // File position of each buffer
+    int *blocks;                // Blocks read in to each buffer, or a (negative) error code
+    int head;                   // Oldest filled buffer
+    int filled;                 // Number of filled buffers
+    char quit;
+    thread_t thread;
+    mutex_t mutex;
+    cond_t cond;
+} OmDownloadRing;
+
+
+/** Internal method to run the reader stage of a download, filling the ring of buffers ahead of the download thread. */
+static thread_return_t OmDownloadReaderThread(void *arg)
+{
+    OmDownloadRing *ring = (OmDownloadRing *)arg;
+
+    for (;;)
+    {
+        int slot, toRead, blocks;
+        ssize_t len;
+
+        // Wait for a free buffer
+        mutex_lock(&ring->mutex);
+        while (ring->filled >= ring->count && !ring->quit) { cond_wait(&ring->cond, &ring->mutex); }
+        if (ring->quit) { mutex_unlock(&ring->mutex); break; }
+        slot = (ring->head + ring->filled) % ring->count;
+        mutex_unlock(&ring->mutex);
+
+        // Read in to the free buffer (the download thread only accesses filled buffers)
+        toRead = ring->blocksRemaining;
+        if (toRead > ring->blockSet) { toRead = ring->blockSet; }
+        if (toRead <= 0) { break; }
+        OmDownloadThrottle(ring->deviceId, ring->simulated, toRead * OM_BLOCK_SIZE);
+        len = pread(ring->fd, ring->buffers[slot], (size_t)toRead * OM_BLOCK_SIZE, ring->position);
+#ifdef O_DIRECT
+        if (len < 0 && errno == EINVAL && (fcntl(ring->fd, F_GETFL) & O_DIRECT))
+        {
+            // Unbuffered reads not possible with this alignment, fall back to buffered reads
+            fcntl(ring->fd, F_SETFL, fcntl(ring->fd, F_GETFL) & ~O_DIRECT);
+            len = pread(ring->fd, ring->buffers[slot], (size_t)toRead * OM_BLOCK_SIZE, ring->position);
+        }
+#endif
+        if (len < 0) { blocks = OM_E_ACCESS_DENIED; }
+        else if (len < OM_BLOCK_SIZE) { blocks = OM_E_UNEXPECTED; }     // Unexpected end of file
+        else { blocks = (int)(len / OM_BLOCK_SIZE); }
+
+        // Publish the buffer
+        mutex_lock(&ring->mutex);
+        ring->positions[slot] = ring->position;
+        ring->blocks[slot] = blocks;
+        ring->filled++;
+        cond_broadcast(&ring->cond);
+        mutex_unlock(&ring->mutex);
+
+        if (blocks <= 0) { break; }
+        ring->position += (long)blocks * OM_BLOCK_SIZE;
+        ring->blocksRemaining -= blocks;
+    }
+
+    return thread_return_value(0);
+}
+
+
+/** Internal method to stop the reader stage and free the ring of download buffers. */
+static void OmDownloadRingDestroy(OmDownloadRing *ring)
+{
+    int i;
+
+    if (ring == NULL) { return; }
+
+    // Stop the reader stage
+    mutex_lock(&ring->mutex);
+    ring->quit = 1;
+    cond_broadcast(&ring->cond);
+    mutex_unlock(&ring->mutex);
+    thread_join(&ring->thread, NULL);
+
+    for (i = 0; i < ring->count; i++) { free(ring->buffers[i]); }
+    free(ring->buffers);
+    free(ring->positions);
+    free(ring->blocks);
+    cond_destroy(&ring->cond);
+    mutex_destroy(&ring->mutex);
+    free(ring);
+}
+
+
+/** Internal method to create a ring of download buffers and start the reader stage from the current source position, returns NULL on failure. */
+static OmDownloadRing *OmDownloadRingCreate(OmDeviceState *deviceState, int blockSet, int count, int flags)
+{
+    OmDownloadRing *ring;
+    int i;
+
+    ring = (OmDownloadRing *)malloc(sizeof(OmDownloadRing));
+    if (ring == NULL) { return NULL; }
+    memset(ring, 0, sizeof(OmDownloadRing));
+    ring->deviceId = deviceState->id;
+    ring->simulated = deviceState->simulated;
+    ring->fd = fileno(deviceState->downloadSource);
+    ring->position = ftell(deviceState->downloadSource);
+    ring->blocksRemaining = deviceState->downloadBlocksTotal - deviceState->downloadBlocksCopied;
+    ring->blockSet = blockSet;
+    ring->count = count;
+
+    // Allocate aligned buffers
+    ring->buffers = (char **)malloc(count * sizeof(char *));
+    ring->positions = (long *)malloc(count * sizeof(long));
+    ring->blocks = (int *)malloc(count * sizeof(int));
+    if (ring->buffers == NULL || ring->positions == NULL || ring->blocks == NULL)
+    {
+        free(ring->buffers); free(ring->positions); free(ring->blocks); free(ring);
+        return NULL;
+    }
+    for (i = 0; i < count; i++)
+    {
+        void *buffer = NULL;
+        if (posix_memalign(&buffer, OM_DOWNLOAD_ALIGNMENT, (size_t)blockSet * OM_BLOCK_SIZE) != 0) { buffer = NULL; }
+        ring->buffers[i] = (char *)buffer;
+        if (buffer == NULL)
+        {
+            while (i-- > 0) { free(ring->buffers[i]); }
+            free(ring->buffers); free(ring->positions); free(ring->blocks); free(ring);
+            return NULL;
+        }
+    }
+
+    // Source access hints
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (flags & OM_DOWNLOAD_FLAG_SEQUENTIAL) { posix_fadvise(ring->fd, 0, 0, POSIX_FADV_SEQUENTIAL); }
+#endif
+#ifdef O_DIRECT
+    if (flags & OM_DOWNLOAD_FLAG_DIRECT) { fcntl(ring->fd, F_SETFL, fcntl(ring->fd, F_GETFL) | O_DIRECT); }
+#endif
+
+    // Start the reader stage
+    mutex_init(&ring->mutex, NULL);
+    cond_init(&ring->cond, NULL);
+    if (thread_create(&ring->thread, NULL, OmDownloadReaderThread, ring) != 0)
+    {
+        for (i = 0; i < count; i++) { free(ring->buffers[i]); }
+        free(ring->buffers); free(ring->positions); free(ring->blocks);
+        cond_destroy(&ring->cond);
+        mutex_destroy(&ring->mutex);
+        free(ring);
+        return NULL;
+    }
+
+    return ring;
+}
+#endif
+
+
+/** Verification of the data as it is downloaded (the checks run on a separate thread) */
+typedef struct
+{
+    unsigned short deviceId;
+    long fileSize;              // Size of the data being verified
+    OmReaderHandle reader;      // Stream reader over the chunk being verified
+    OmVerifyState *verify;
+    long dataOffset;            // File position of the first data block
+    int chunkSize;              // Size of each chunk buffer
+    int count;                  // Number of chunk buffers
+    char **buffers;             // Copies of the chunks waiting to be verified
+    long *positions;            // File position of each chunk
+    int *lengths;               // Length of each chunk
+    int head;                   // Oldest waiting chunk
+    int filled;                 // Number of waiting chunks
+    int stalls;                 // Number of times the download waited for a free chunk buffer
+    char quit;
+    thread_t thread;
+    mutex_t mutex;
+#ifndef _WIN32
+    cond_t cond;
+#endif
+} OmDownloadVerifier;
+
+
+/** Internal method to wait for a change in the verifier's chunk buffers (the verifier mutex must be held, and is held again on return). */
+static void OmDownloadVerifierWait(OmDownloadVerifier *verifier)
+{
+#ifndef _WIN32
+    cond_wait(&verifier->cond, &verifier->mutex);
+#else
+    int deviceId = verifier->deviceId;     // (for mutex debugging)
+    mutex_unlock(&verifier->mutex);
+    usleep(OM_DOWNLOAD_WAIT_INTERVAL * 1000UL);
+    mutex_lock(&verifier->mutex);
+#endif
+}
+
+
+/** Internal method to wake the other side of the verifier after a change in its chunk buffers (the verifier mutex must be held). */
+static void OmDownloadVerifierSignal(OmDownloadVerifier *verifier)
+{
+#ifndef _WIN32
+    cond_broadcast(&verifier->cond);
+#else
+    (void)verifier;
+#endif
+}
+
+
+/** Internal method to verify a chunk of the data file (chunks must be in file order, starting with the header). */
+static void OmDownloadVerifierProcess(OmDownloadVerifier *verifier, const char *buffer, long position, int length)
+{
+    if (verifier->reader == NULL)
+    {
+        int dataBlockSize = 0, dataOffsetBlocks = 0;
+
+        // The first chunk must hold the header
+        if (position != 0) { OmVerifyBlock(verifier->verify, NULL, OM_E_UNEXPECTED); return; }
+        verifier->reader = OmReaderOpenStream(buffer, length, verifier->fileSize);
+        if (verifier->reader == NULL) { OmVerifyBlock(verifier->verify, NULL, OM_E_UNEXPECTED); return; }
+        OmReaderDataRange(verifier->reader, &dataBlockSize, &dataOffsetBlocks, NULL, NULL, NULL);
+        verifier->dataOffset = (long)dataOffsetBlocks * dataBlockSize;
+    }
+    else if (OmReaderStreamBuffer(verifier->reader, buffer, position, length) != OM_OK)
+    {
+        return;
+    }
+
+    // Check each data block held in the chunk
+    while (verifier->dataOffset + (long)(OmReaderDataBlockPosition(verifier->reader) + 1) * OM_BLOCK_SIZE <= position + length)
+    {
+        int numSamples = OmReaderNextBlock(verifier->reader);
+        if (OmVerifyBlock(verifier->verify, verifier->reader, numSamples)) { break; }
+    }
+}
+
+
+/** Internal method to run the verification thread, checking the chunks copied by the download thread. */
+static thread_return_t OmDownloadVerifierThread(void *arg)
+{
+    OmDownloadVerifier *verifier = (OmDownloadVerifier *)arg;
+    int deviceId = verifier->deviceId;     // (for mutex debugging)
+
+    for (;;)
+    {
+        int slot;
+
+        // Wait for a chunk
+        mutex_lock(&verifier->mutex);
+        while (verifier->filled <= 0 && !verifier->quit) { OmDownloadVerifierWait(verifier); }
+        if (verifier->filled <= 0) { mutex_unlock(&verifier->mutex); break; }
+        slot = verifier->head;
+        mutex_unlock(&verifier->mutex);
+
+        OmDownloadVerifierProcess(verifier, verifier->buffers[slot], verifier->positions[slot], verifier->lengths[slot]);
+
+        // Return the buffer to the download thread
+        mutex_lock(&verifier->mutex);
+        verifier->head = (verifier->head + 1) % verifier->count;
+        verifier->filled--;
+        OmDownloadVerifierSignal(verifier);
+        mutex_unlock(&verifier->mutex);
+    }
+
+    return thread_return_value(0);
+}
+
+
+/** Internal method to create a verifier for a download of the specified size in chunks of up to the block set size, returns NULL on failure. */
+static OmDownloadVerifier *OmDownloadVerifierCreate(unsigned short deviceId, long fileSize, int blockSet)
+{
+    OmDownloadVerifier *verifier;
+    int i;
+
+    verifier = (OmDownloadVerifier *)malloc(sizeof(OmDownloadVerifier));
+    if (verifier == NULL) { return NULL; }
+    memset(verifier, 0, sizeof(OmDownloadVerifier));
+    verifier->deviceId = deviceId;
+    verifier->fileSize = fileSize;
+    verifier->verify = OmVerifyCreate();
+    if (verifier->verify == NULL) { free(verifier); return NULL; }
+
+    // Allocate the chunk buffers, and start the verification thread
+    verifier->chunkSize = blockSet * OM_BLOCK_SIZE;
+    verifier->count = OM_DOWNLOAD_BUFFERS;
+    verifier->buffers = (char **)malloc(verifier->count * sizeof(char *));
+    verifier->positions = (long *)malloc(verifier->count * sizeof(long));
+    verifier->lengths = (int *)malloc(verifier->count * sizeof(int));
+    for (i = 0; verifier->buffers != NULL && i < verifier->count; i++)
+    {
+        verifier->buffers[i] = (char *)malloc(verifier->chunkSize);
+        if (verifier->buffers[i] == NULL) { break; }
+    }
+    mutex_init(&verifier->mutex, NULL);
+#ifndef _WIN32
+    cond_init(&verifier->cond, NULL);
+#endif
+    if (verifier->buffers == NULL || i < verifier->count || verifier->positions == NULL || verifier->lengths == NULL || thread_create(&verifier->thread, NULL, OmDownloadVerifierThread, verifier) != 0)
+    {
+        if (verifier->buffers != NULL) { while (i-- > 0) { free(verifier->buffers[i]); } }
+        free(verifier->buffers); free(verifier->positions); free(verifier->lengths);
+#ifndef _WIN32
+        cond_destroy(&verifier->cond);
+#endif
+        mutex_destroy(&verifier->mutex);
+        OmVerifyDestroy(verifier->verify);
+        free(verifier);
+        return NULL;
+    }
+
+    return verifier;
+}
+
+
+/** Internal method to pass a downloaded chunk to the verifier. */
+static void OmDownloadVerifierAdd(OmDownloadVerifier *verifier, const char *buffer, long position, int length)
+{
+    int deviceId = verifier->deviceId;     // (for mutex debugging)
+    int slot;
+
+    // Wait for a free buffer (counting the times the download is held up by the checks), and copy the chunk to it (the download buffer is reused)
+    mutex_lock(&verifier->mutex);
+    if (verifier->filled >= verifier->count) { verifier->stalls++; }
+    while (verifier->filled >= verifier->count) { OmDownloadVerifierWait(verifier); }
+    slot = (verifier->head + verifier->filled) % verifier->count;
+    mutex_unlock(&verifier->mutex);
+
+    if (length > verifier->chunkSize) { length = verifier->chunkSize; }
+    memcpy(verifier->buffers[slot], buffer, length);
+    verifier->positions[slot] = position;
+    verifier->lengths[slot] = length;
+
+    mutex_lock(&verifier->mutex);
+    verifier->filled++;
+    OmDownloadVerifierSignal(verifier);
+    mutex_unlock(&verifier->mutex);
+}
+
+
+/** Internal method to finish verifying the chunks added, and free the verifier, optionally returning the result. */
+static void OmDownloadVerifierDestroy(OmDownloadVerifier *verifier, OM_VERIFY_RESULT *result)
+{
+    int deviceId;     // (for mutex debugging)
+    int i;
+
+    if (verifier == NULL) { return; }
+    deviceId = verifier->deviceId;
+
+    // Wait for the remaining chunks to be verified
+    mutex_lock(&verifier->mutex);
+    verifier->quit = 1;
+    OmDownloadVerifierSignal(verifier);
+    mutex_unlock(&verifier->mutex);
+    thread_join(&verifier->thread, NULL);
+
+    for (i = 0; i < verifier->count; i++) { free(verifier->buffers[i]); }
+    free(verifier->buffers);
+    free(verifier->positions);
+    free(verifier->lengths);
+#ifndef _WIN32
+    cond_destroy(&verifier->cond);
+#endif
+    mutex_destroy(&verifier->mutex);
+
+    if (verifier->stalls > 0) { OmLog(2, "OmDownloadVerifier: download waited %d time(s) for verification.\n", verifier->stalls); }
+    if (result != NULL)
+    {
+        OmVerifyResult(verifier->verify, verifier->reader, result);
+        result->downloadStalls = verifier->stalls;
+    }
+    if (verifier->reader != NULL) { OmReaderClose(verifier->reader); }
+    OmVerifyDestroy(verifier->verify);
+    free(verifier);
+}
+
+
 /** Internal method to run the download thread. */
 static thread_return_t OmDownloadThread(void *arg)
 {
     int downloadValue = OM_E_UNEXPECTED;
     OM_DOWNLOAD_STATUS downloadStatus = OM_DOWNLOAD_ERROR;
     OmDeviceState *deviceState = (OmDeviceState *)arg;
-    char *buffer = (char *)malloc((OM_DOWNLOAD_BLOCK_SET * OM_BLOCK_SIZE));
-    if (buffer == NULL)
+    int blockSet = (om.downloadBlockSet > 0) ? om.downloadBlockSet : OM_DOWNLOAD_BLOCK_SET;
+    char *buffer = NULL;
+    int admitted;
+    unsigned long lastCheckpoint = OmMilliseconds();
+    OmDownloadVerifier *verifier = NULL;
+#ifndef _WIN32
+    int bufferCount = (om.downloadBuffers > 0) ? om.downloadBuffers : OM_DOWNLOAD_BUFFERS;
+    OmDownloadRing *ring = NULL;
+#endif
+
+    // Wait for a reader slot (downloads start reading in the order they were begun)
+    OmDoDownloadUpdate(deviceState->id, OM_DOWNLOAD_PROGRESS, 0);
+    admitted = OmDownloadReaderAcquire(deviceState);
+
+#ifndef _WIN32
+    // Overlap reading and writing with a ring of buffers (falling back to a single buffer)
+    if (admitted && bufferCount > 1 && deviceState->downloadSource != NULL)
+    {
+        ring = OmDownloadRingCreate(deviceState, blockSet, bufferCount, om.downloadFlags);
+    }
+    if (admitted && ring == NULL)
+#else
+    if (admitted)
+#endif
+    {
+        buffer = (char *)malloc((size_t)blockSet * OM_BLOCK_SIZE);
+    }
+
+    // Verify the data as it is downloaded (only when downloading from the start of the file)
+    if (admitted && (om.downloadFlags & OM_DOWNLOAD_FLAG_VERIFY) && deviceState->downloadBlocksBase == 0 && deviceState->downloadSource != NULL)
+    {
+        verifier = OmDownloadVerifierCreate(deviceState->id, (long)deviceState->downloadBlocksTotal * OM_BLOCK_SIZE, blockSet);
+    }
+
+    if (!admitted)
+    {
+        downloadStatus = OM_DOWNLOAD_CANCELLED;
+        downloadValue = 0;
+    }
+    else if (buffer == NULL
+#ifndef _WIN32
+        && ring == NULL
+#endif
+       )
     { 
         downloadStatus = (OM_DOWNLOAD_STATUS)OM_E_OUT_OF_MEMORY; 
     }
@@ -79,10 +789,9 @@ static thread_return_t OmDownloadThread(void *arg)
     {
 		int lastDownloadValue;
 
-        // Initial status update
+        // Initial status (already reported while waiting for a reader slot)
         downloadStatus = OM_DOWNLOAD_PROGRESS;
         downloadValue = 0;
-        OmDoDownloadUpdate(deviceState->id, downloadStatus, downloadValue);
 		lastDownloadValue = downloadValue;
 
         // Copy loop
@@ -94,21 +803,45 @@ static thread_return_t OmDownloadThread(void *arg)
 
             // Calculate how many blocks to read
             toRead = deviceState->downloadBlocksTotal - deviceState->downloadBlocksCopied;
-            if (toRead > OM_DOWNLOAD_BLOCK_SET) { toRead = OM_DOWNLOAD_BLOCK_SET; }
+            if (toRead > blockSet) { toRead = blockSet; }
             if (toRead <= 0) { downloadValue = 100; downloadStatus = OM_DOWNLOAD_COMPLETE; break; }
 
             // Check for cancellation
             if (deviceState->downloadCancel) { downloadStatus = OM_DOWNLOAD_CANCELLED; break; }
 
-            // Check for unexpected end
-            if (feof(deviceState->downloadSource)) { downloadStatus = OM_DOWNLOAD_ERROR; break; }
+#ifndef _WIN32
+            if (ring != NULL)
+            {
+                // Release the previous buffer to the reader stage, and wait for the next one
+                mutex_lock(&ring->mutex);
+                if (buffer != NULL)
+                {
+                    ring->head = (ring->head + 1) % ring->count;
+                    ring->filled--;
+                    cond_broadcast(&ring->cond);
+                }
+                while (ring->filled <= 0) { cond_wait(&ring->cond, &ring->mutex); }
+                buffer = ring->buffers[ring->head];
+                position = (int)ring->positions[ring->head];
+                blocksRead = ring->blocks[ring->head];
+                mutex_unlock(&ring->mutex);
+                if (blocksRead == OM_E_UNEXPECTED) { downloadStatus = OM_DOWNLOAD_ERROR; break; }
+                if (blocksRead <= 0) { downloadStatus = OM_DOWNLOAD_ERROR; downloadValue = OM_E_ACCESS_DENIED; break; }
+            }
+            else
+#endif
+            {
+                // Check for unexpected end
+                if (feof(deviceState->downloadSource)) { downloadStatus = OM_DOWNLOAD_ERROR; break; }
 
-            // Get current position
-            position = ftell(deviceState->downloadSource);
+                // Get current position
+                position = ftell(deviceState->downloadSource);
 
-            // Read a block of data
-            blocksRead = fread(buffer, OM_BLOCK_SIZE, toRead, deviceState->downloadSource);
-            if (blocksRead <= 0) { downloadStatus = OM_DOWNLOAD_ERROR; downloadValue = OM_E_ACCESS_DENIED; break; }
+                // Read a block of data
+                OmDownloadThrottle(deviceState->id, deviceState->simulated, toRead * OM_BLOCK_SIZE);
+                blocksRead = fread(buffer, OM_BLOCK_SIZE, toRead, deviceState->downloadSource);
+                if (blocksRead <= 0) { downloadStatus = OM_DOWNLOAD_ERROR; downloadValue = OM_E_ACCESS_DENIED; break; }
+            }
 
             // Check for cancellation
             if (deviceState->downloadCancel) { downloadStatus = OM_DOWNLOAD_CANCELLED; break; }
@@ -126,12 +859,29 @@ static thread_return_t OmDownloadThread(void *arg)
             }
             else
             {
+                OmDownloadWriterAcquire(deviceState->id);
                 blocksWritten = fwrite(buffer, OM_BLOCK_SIZE, blocksRead, deviceState->downloadDest);
+                OmDownloadWriterRelease(deviceState->id);
                 if (blocksWritten != blocksRead) {  downloadStatus = OM_DOWNLOAD_ERROR; downloadValue = OM_E_ACCESS_DENIED; break; }
             }
 
+            // Pass the block of data to the verifier
+            if (verifier != NULL) { OmDownloadVerifierAdd(verifier, buffer, position, blocksWritten * OM_BLOCK_SIZE); }
+
             // Update progress
             deviceState->downloadBlocksCopied += blocksWritten;
+            OmDownloadAddBytes(deviceState, (unsigned long)blocksWritten * OM_BLOCK_SIZE);
+
+            // Update the checksum of a resumable download, and periodically save its checkpoint
+            if (deviceState->downloadCheckpoint[0] != '\0')
+            {
+                deviceState->downloadChecksum = OmDownloadChecksum(deviceState->downloadChecksum, (unsigned char *)buffer, (size_t)blocksWritten * OM_BLOCK_SIZE);
+                if (OmMilliseconds() - lastCheckpoint >= OM_DOWNLOAD_CHECKPOINT_INTERVAL)
+                {
+                    OmDownloadCheckpointWrite(deviceState);
+                    lastCheckpoint = OmMilliseconds();
+                }
+            }
             if (deviceState->downloadBlocksTotal == 0) { downloadValue = 0; }
             else { downloadValue = (int)(deviceState->downloadBlocksCopied * 100UL / deviceState->downloadBlocksTotal); }
 			if (downloadValue != lastDownloadValue)
@@ -142,11 +892,33 @@ static thread_return_t OmDownloadThread(void *arg)
         }
     }
 
+    // Save the final checkpoint of a resumable download
+    if (admitted && deviceState->downloadCheckpoint[0] != '\0') { OmDownloadCheckpointWrite(deviceState); }
+
     // Close resources
+#ifndef _WIN32
+    if (ring != NULL) { OmDownloadRingDestroy(ring); buffer = NULL; }
+#endif
     if (buffer != NULL) { free(buffer); }
+    if (admitted) { OmDownloadReaderRelease(deviceState); }
     if (deviceState->downloadSource != NULL) { fclose(deviceState->downloadSource); }
     if (deviceState->downloadDest != NULL) { fclose(deviceState->downloadDest); }
 
+    // Finish verifying the download (the result is available from the completion callback)
+    if (verifier != NULL)
+    {
+        int deviceId = deviceState->id;     // (for mutex debugging)
+        OM_VERIFY_RESULT result;
+        OmDownloadVerifierDestroy(verifier, (downloadStatus == OM_DOWNLOAD_COMPLETE) ? &result : NULL);
+        if (downloadStatus == OM_DOWNLOAD_COMPLETE)
+        {
+            mutex_lock(&deviceState->downloadMutex);        // Lock the device's download mutex to store the verification result
+            deviceState->downloadVerify = result;
+            deviceState->downloadVerifyValid = 1;
+            mutex_unlock(&deviceState->downloadMutex);      // Release the device's download mutex
+        }
+    }
+
     // Update progress
     OmDoDownloadUpdate(deviceState->id, downloadStatus, downloadValue);
 
@@ -172,19 +944,21 @@ int OmGetDataFileSize(int deviceId)
 
 int OmGetDataFilename(int deviceId, char *filenameBuffer)
 {
+    OmDeviceState *device;
     if (filenameBuffer == NULL) return OM_E_POINTER;
     filenameBuffer[0] = '\0';
     // Check system and device state
     if (!om.initialized) return OM_E_NOT_VALID_STATE;
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
-    if (om.devices[deviceId]->deviceStatus != OM_DEVICE_CONNECTED) return OM_E_INVALID_DEVICE;   // Device lost
-    if (strlen(om.devices[deviceId]->root) == 0)
+    device = OmDeviceFind(deviceId);
+    if (device == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    if (device->deviceStatus != OM_DEVICE_CONNECTED) return OM_E_INVALID_DEVICE;   // Device lost
+    if (strlen(device->root) == 0)
     {
         // We don't have a path to the root
         // ??? (Could re-mount the volume to a path here?)
         return OM_E_FAIL;
     }
-    strcat(filenameBuffer, om.devices[deviceId]->root);
+    strcat(filenameBuffer, device->root);
 #if !defined(_WIN32)
     strcat(filenameBuffer, "/");
 #endif
@@ -229,6 +1003,9 @@ int OmGetDataRange(int deviceId, int *dataBlockSize, int *dataOffsetBlocks, int
 }
 
 
+static int OmDownloadBegin(int deviceId, int dataOffsetBlocks, int dataLengthBlocks, const char *destinationFile, void *reference, int resume);
+
+
 int OmBeginDownloading(int deviceId, int dataOffsetBlocks, int dataLengthBlocks, const char *destinationFile)
 {
     return OmBeginDownloadingReference(deviceId, dataOffsetBlocks, dataLengthBlocks, destinationFile, NULL);
@@ -236,6 +1013,21 @@ int OmBeginDownloading(int deviceId, int dataOffsetBlocks, int dataLengthBlocks,
 
 
 int OmBeginDownloadingReference(int deviceId, int dataOffsetBlocks, int dataLengthBlocks, const char *destinationFile, void *reference)
+{
+    return OmDownloadBegin(deviceId, dataOffsetBlocks, dataLengthBlocks, destinationFile, reference, 0);
+}
+
+
+int OmBeginDownloadingResume(int deviceId, const char *destinationFile, void *reference)
+{
+    if (destinationFile == NULL) return OM_E_INVALID_ARG;
+    if (strlen(destinationFile) >= OM_MAX_PATH) return OM_E_INVALID_ARG;
+    return OmDownloadBegin(deviceId, 0, -1, destinationFile, reference, 1);
+}
+
+
+/** Internal method to begin a download, optionally resuming from a checkpoint. */
+static int OmDownloadBegin(int deviceId, int dataOffsetBlocks, int dataLengthBlocks, const char *destinationFile, void *reference, int resume)
 {
     int status;
     char filename[OM_MAX_PATH];
@@ -243,17 +1035,20 @@ int OmBeginDownloadingReference(int deviceId, int dataOffsetBlocks, int dataLeng
  
     // Check system and device state
     if (!om.initialized) return OM_E_NOT_VALID_STATE;
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
-    if (om.devices[deviceId]->deviceStatus != OM_DEVICE_CONNECTED) return OM_E_INVALID_DEVICE;   // Device lost
-    device = om.devices[deviceId];
+    device = OmDeviceFind(deviceId);
+    if (device == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    if (device->deviceStatus != OM_DEVICE_CONNECTED) return OM_E_INVALID_DEVICE;   // Device lost
 
     // Check parameters
     if (dataOffsetBlocks < 0) return OM_E_INVALID_ARG;
     if (dataLengthBlocks < -1) return OM_E_INVALID_ARG;
     if (destinationFile != NULL && !strlen(destinationFile)) return OM_E_INVALID_ARG;
 
+    // Join the thread of a previous download that finished without being waited for
+    OmDownloadJoin(device, 1);
+
     // Acquire download mutex here (otherwise there is a small window here in which the state will become unknown if two threads start a download at exactly the same time).
-    mutex_lock(&om.downloadMutex);          // Lock download mutex to begin download thread
+    mutex_lock(&device->downloadMutex);     // Lock the device's download mutex to begin download thread
     do          // This is only a 'do' to allow a single code path to hit the mutex unlock with any exceptional 'break's
     {
         int fileTotalBlocks;
@@ -272,21 +1067,18 @@ int OmBeginDownloadingReference(int deviceId, int dataOffsetBlocks, int dataLeng
         device->downloadSource = fopen(filename, "rb");
         if (device->downloadSource == NULL) { status = OM_E_ACCESS_DENIED; break; }
 
-        // Open the destination file
-        if (destinationFile == NULL)
-        {
-            device->downloadDest = NULL;
-        }
-        else
-        {
-            device->downloadDest = fopen(destinationFile, "wb");
-            if (device->downloadDest == NULL) { fclose(device->downloadSource); device->downloadSource = NULL; status = OM_E_ACCESS_DENIED; break; }
-        }
-
         // Calculate the total number of blocks in the file
         fseek(device->downloadSource, 0, SEEK_END);
         fileTotalBlocks = ftell(device->downloadSource) / OM_BLOCK_SIZE;
 
+        // If resuming, skip the blocks already completed (if the checkpoint is for the same device and session, and the destination still matches it)
+        device->downloadCheckpoint[0] = '\0';
+        if (resume)
+        {
+            dataOffsetBlocks = OmDownloadCheckpointRead(device, destinationFile, fileTotalBlocks);
+            dataLengthBlocks = -1;
+        }
+
         // Seek to the requested block offset
         if (dataOffsetBlocks > fileTotalBlocks) { fclose(device->downloadSource); device->downloadSource = NULL; status = OM_E_INVALID_ARG; break; }
         fseek(device->downloadSource, OM_BLOCK_SIZE * dataOffsetBlocks, SEEK_SET);
@@ -298,22 +1090,75 @@ int OmBeginDownloadingReference(int deviceId, int dataOffsetBlocks, int dataLeng
         }
         else
         {
-            device->downloadBlocksTotal = fileTotalBlocks;
+            device->downloadBlocksTotal = dataLengthBlocks;
         }
 
         // If the requested number of blocks is too many, return
         if (dataOffsetBlocks + device->downloadBlocksTotal > fileTotalBlocks) { fclose(device->downloadSource); device->downloadSource = NULL; status = OM_E_INVALID_ARG; break; }
 
+        // Open the destination file (a resumed download is appended after the blocks already completed)
+        if (destinationFile == NULL)
+        {
+            device->downloadDest = NULL;
+        }
+        else if (resume && dataOffsetBlocks > 0)
+        {
+            device->downloadDest = fopen(destinationFile, "r+b");
+            if (device->downloadDest != NULL)
+            {
+#ifdef _WIN32
+                _chsize(_fileno(device->downloadDest), OM_BLOCK_SIZE * dataOffsetBlocks);
+#else
+                ftruncate(fileno(device->downloadDest), (off_t)OM_BLOCK_SIZE * dataOffsetBlocks);
+#endif
+                fseek(device->downloadDest, OM_BLOCK_SIZE * dataOffsetBlocks, SEEK_SET);
+            }
+        }
+        else
+        {
+            device->downloadDest = fopen(destinationFile, "wb");
+        }
+        if (destinationFile != NULL && device->downloadDest == NULL) { fclose(device->downloadSource); device->downloadSource = NULL; status = OM_E_ACCESS_DENIED; break; }
+
         // Start the download thread
+        device->downloadBlocksBase = dataOffsetBlocks;
         device->downloadBlocksCopied = 0;
         device->downloadCancel = 0;
         device->downloadReference = reference;
+        device->downloadVerifyValid = 0;
+
+        // Queue for a reader slot
+        mutex_lock(&om.downloadLimitMutex);
+        device->downloadStartTime = 0;
+        device->downloadEndTime = 0;
+        device->downloadBytes = 0;
+        device->downloadQueueNext = NULL;
+        if (om.downloadQueueTail != NULL) { om.downloadQueueTail->downloadQueueNext = device; }
+        else { om.downloadQueueHead = device; }
+        om.downloadQueueTail = device;
+        mutex_unlock(&om.downloadLimitMutex);
+
+        device->downloadStatus = OM_DOWNLOAD_PROGRESS;                  // Set before the thread starts, so that an immediate OmWaitForDownload() waits for it
+        device->downloadValue = 0;
         //OmDoDownloadUpdate(device->id, OM_DOWNLOAD_PROGRESS, 0);        // Removed - don't do an initial update here, one is done in OmDownloadThread anyway, and don't want to call out to user code with the download mutex held
-        thread_create(&device->downloadThread, NULL, OmDownloadThread, device);
+        if (thread_create(&device->downloadThread, NULL, OmDownloadThread, device) != 0)
+        {
+            // Leave the queue, so that later downloads are not blocked behind one that will never start
+            mutex_lock(&om.downloadLimitMutex);
+            OmDownloadUnqueue(device);
+            OmDownloadLimitSignal();
+            mutex_unlock(&om.downloadLimitMutex);
+            device->downloadStatus = OM_DOWNLOAD_NONE;
+            fclose(device->downloadSource); device->downloadSource = NULL;
+            if (device->downloadDest != NULL) { fclose(device->downloadDest); device->downloadDest = NULL; }
+            status = OM_E_FAIL;
+            break;
+        }
+        device->downloadThreadJoinable = 1;
 
         status = OM_OK;
     } while(0);
-    mutex_unlock(&om.downloadMutex);        // Release download mutex after updating beginning download thread
+    mutex_unlock(&device->downloadMutex);   // Release the device's download mutex after updating beginning download thread
 
     return status;
 }
@@ -327,17 +1172,17 @@ int OmQueryDownload(int deviceId, OM_DOWNLOAD_STATUS *downloadStatus, int *downl
 
     // Check system and device state
     if (!om.initialized) return OM_E_NOT_VALID_STATE;
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
-    if (om.devices[deviceId]->deviceStatus != OM_DEVICE_CONNECTED) return OM_E_INVALID_DEVICE;   // Device lost
-    device = om.devices[deviceId];
+    device = OmDeviceFind(deviceId);
+    if (device == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    if (device->deviceStatus != OM_DEVICE_CONNECTED) return OM_E_INVALID_DEVICE;   // Device lost
 
     // Acquire download mutex here (otherwise there's a small chance the status and value may be inconsistent and invalidated by a download start/update/stop).
-    mutex_lock(&om.downloadMutex);          // Lock download mutex to query device state structure
+    mutex_lock(&device->downloadMutex);     // Lock the device's download mutex to query device state structure
     {
         dStatus = device->downloadStatus;
         value = device->downloadValue;
     }
-    mutex_unlock(&om.downloadMutex);        // Release download mutex after querying device state structure
+    mutex_unlock(&device->downloadMutex);   // Release the device's download mutex after querying device state structure
 
     // Output values
     if (downloadStatus != NULL) { *downloadStatus = dStatus; }
@@ -347,23 +1192,97 @@ int OmQueryDownload(int deviceId, OM_DOWNLOAD_STATUS *downloadStatus, int *downl
 }
 
 
+int OmQueryDownloadThroughput(int deviceId, int *deviceBytesPerSecond, int *totalBytesPerSecond)
+{
+    unsigned long now;
+    int deviceRate = 0, totalRate = 0;
+    OmDeviceState *device;
+    int i;
+
+    // Check system and device state
+    if (!om.initialized) return OM_E_NOT_VALID_STATE;
+    if (OmDeviceFind(deviceId) == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+
+    mutex_lock(&om.downloadLimitMutex);          // Lock download limit mutex to read consistent download timings
+    mutex_lock(&om.deviceTableMutex);            // Lock device table mutex to walk the table
+    now = OmMilliseconds();
+    for (i = 0; i < OM_DEVICE_TABLE_SIZE; i++)
+    {
+        for (device = om.deviceTable[i]; device != NULL; device = device->hashNext)
+        {
+            unsigned long elapsed;
+            int rate;
+
+            // Average rate since the download began reading (until it finished)
+            if (device->downloadStartTime == 0) { continue; }
+            elapsed = (device->downloadEndTime != 0 ? device->downloadEndTime : now) - device->downloadStartTime;
+            rate = (elapsed > 0) ? (int)((unsigned long long)device->downloadBytes * 1000 / elapsed) : 0;
+
+            if (device->id == deviceId) { deviceRate = rate; }
+            if (device->downloadEndTime == 0) { totalRate += rate; }
+        }
+    }
+    mutex_unlock(&om.deviceTableMutex);          // Release device table mutex
+    mutex_unlock(&om.downloadLimitMutex);        // Release download limit mutex
+
+    // Output values
+    if (deviceBytesPerSecond != NULL) { *deviceBytesPerSecond = deviceRate; }
+    if (totalBytesPerSecond != NULL) { *totalBytesPerSecond = totalRate; }
+
+    return OM_OK;
+}
+
+
+int OmQueryDownloadVerification(int deviceId, OM_VERIFY_RESULT *result)
+{
+    OmDeviceState *device;
+    int status;
+
+    // Check system and device state
+    if (!om.initialized) return OM_E_NOT_VALID_STATE;
+    device = OmDeviceFind(deviceId);
+    if (device == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    if (result == NULL) return OM_E_POINTER;
+
+    mutex_lock(&device->downloadMutex);     // Lock the device's download mutex to read the verification result
+    if (device->downloadVerifyValid)
+    {
+        *result = device->downloadVerify;
+        status = OM_OK;
+    }
+    else
+    {
+        status = OM_E_NOT_VALID_STATE;
+    }
+    mutex_unlock(&device->downloadMutex);   // Release the device's download mutex
+
+    return status;
+}
+
+
 int OmWaitForDownload(int deviceId, OM_DOWNLOAD_STATUS *downloadStatus, int *downloadValue)
 {
     OM_DOWNLOAD_STATUS dStatus = OM_DOWNLOAD_NONE;
     int dValue = -1;
     int status;
+    OmDeviceState *device;
 
     // Check download state
     OmLog(3, "OmWaitForDownload() started.\n");
     status = OmQueryDownload(deviceId, &dStatus, &dValue);
     if (OM_FAILED(status)) { return status; }
+    device = OmDeviceFind(deviceId);
 
-    // If downloading...
-    if (dStatus == OM_DOWNLOAD_PROGRESS && om.devices[deviceId]->downloadThread != NULL)
+    // Wait for download thread to terminate (or, if another caller is joining it, for the download to finish)
+    OmLog(3, "OmWaitForDownload() waiting for download thread to terminate...\n");
+    if (!OmDownloadJoin(device, 0))
     {
-        // Wait for download thread to terminate
-        OmLog(3, "OmWaitForDownload() waiting for download thread to terminate...\n");
-        thread_join(&om.devices[deviceId]->downloadThread, NULL);
+        while (dStatus == OM_DOWNLOAD_PROGRESS)
+        {
+            usleep(OM_DOWNLOAD_WAIT_INTERVAL * 1000UL);
+            status = OmQueryDownload(deviceId, &dStatus, &dValue);
+            if (OM_FAILED(status)) { return status; }
+        }
     }
 
     // Check completed download state
@@ -381,12 +1300,15 @@ int OmWaitForDownload(int deviceId, OM_DOWNLOAD_STATUS *downloadStatus, int *dow
 
 int OmCancelDownload(int deviceId)
 {
+    OmDeviceState *device;
+
     // Check system and device state
     if (!om.initialized) return OM_E_NOT_VALID_STATE;
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    device = OmDeviceFind(deviceId);
+    if (device == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
 
     // Set signal for download to cancel
-    om.devices[deviceId]->downloadCancel = 1;
+    OmDownloadSignalCancel(device);
 
     // Wait for the download to stop (or return immediately if not in progress)
     return OmWaitForDownload(deviceId, NULL, NULL);
@@ -103,6 +103,22 @@ int OmDebugMutexUnlock(mutex_t *mutex, const char *mutexName, const char *source
 #endif
 #endif
 
+/** Internal method to find the state of a device (NULL if never seen). */
+OmDeviceState *OmDeviceFind(int deviceId)
+{
+    OmDeviceState *deviceState;
+
+    if (deviceId < 0 || deviceId > OM_MAX_SERIAL) { return NULL; }
+    mutex_lock(&om.deviceTableMutex);       // Lock device table mutex to walk the bucket
+    for (deviceState = om.deviceTable[OM_DEVICE_HASH(deviceId)]; deviceState != NULL; deviceState = deviceState->hashNext)
+    {
+        if (deviceState->id == deviceId) { break; }
+    }
+    mutex_unlock(&om.deviceTableMutex);     // Release device table mutex
+    return deviceState;
+}
+
+
 /** Internal, method for handling device discovery. */
 void OmDeviceDiscovery(OM_DEVICE_STATUS status, unsigned int inSerialNumber, const char *port, const char *volumePath)
 {
@@ -116,9 +132,14 @@ void OmDeviceDiscovery(OM_DEVICE_STATUS status, unsigned int inSerialNumber, con
         serialNumber = (unsigned short)inSerialNumber;
 
         // Get the current OmDeviceState structure, or make one if it doesn't exist
-        deviceState = om.devices[serialNumber];
+        deviceState = OmDeviceFind(serialNumber);
         if (deviceState == NULL)
         {
+            int deviceId = serialNumber;     // (for mutex debugging)
+#if !defined(_WIN32)
+            pthread_mutexattr_t attr;
+#endif
+
             // Create and initialize the structure
             deviceState = (OmDeviceState *)malloc(sizeof(OmDeviceState));
             if (deviceState == NULL)
@@ -127,7 +148,25 @@ void OmDeviceDiscovery(OM_DEVICE_STATUS status, unsigned int inSerialNumber, con
                 return;
             }
             memset(deviceState, 0, sizeof(OmDeviceState));
+            deviceState->id = serialNumber;
             deviceState->fd = -1;
+
+            // Per-device mutexes (the download mutex is recursive)
+            mutex_init(&deviceState->portMutex, NULL);
+#if !defined(_WIN32)
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE); 
+            mutex_init(&deviceState->downloadMutex, &attr);
+            pthread_mutexattr_destroy(&attr);
+#else
+            mutex_init(&deviceState->downloadMutex, NULL);
+#endif
+
+            // Add to the device table (the entry is never removed until shutdown, so the state remains valid)
+            mutex_lock(&om.deviceTableMutex);       // Lock device table mutex to add the device
+            deviceState->hashNext = om.deviceTable[OM_DEVICE_HASH(serialNumber)];
+            om.deviceTable[OM_DEVICE_HASH(serialNumber)] = deviceState;
+            mutex_unlock(&om.deviceTableMutex);     // Release device table mutex
         }
 
 OmLog(0, "DEBUG: Device added %d  %s  %s\n", serialNumber, port, volumePath);
@@ -141,9 +180,8 @@ OmLog(0, "DEBUG: Device added %d  %s  %s\n", serialNumber, port, volumePath);
         //deviceState->downloadStatus = OM_DOWNLOAD_NONE;
         //deviceState->downloadValue = 0;
 
-        // Finally, set the connected flag and the entry in devices
+        // Finally, set the connected flag
         deviceState->deviceStatus = OM_DEVICE_CONNECTED;
-        om.devices[serialNumber] = deviceState;
 
         // Call user's device callback
         if (om.deviceCallback != NULL)
@@ -162,14 +200,13 @@ OmLog(0, "DEBUG: Device added %d  %s  %s\n", serialNumber, port, volumePath);
 OmLog(0, "DEBUG: Device removed: %d\n", serialNumber);
 
         // Get the current OmDeviceState structure
-        deviceState = om.devices[serialNumber];
+        deviceState = OmDeviceFind(serialNumber);
         if (deviceState == NULL) { return; }        // Removal called for a never-seen device (should not be possible from the DeviceFinder)
 
         // Set the removed status
         deviceState->deviceStatus = OM_DEVICE_REMOVED;
 
         // Port
-        //deviceState->portMutex;
         //deviceState->fd = -1;
 
         // Download
@@ -189,8 +226,15 @@ OmLog(0, "DEBUG: Device removed: %d\n", serialNumber);
 
 #if !defined(_WIN32)
 
+// USB vendor and product ID of the devices
+#define OM_USB_VENDOR_ID  "04d8"
+#define OM_USB_PRODUCT_ID "0057"
+
+// Time to wait for a device's volume to be mounted before reporting it with the conventional mount point (milliseconds)
+#define OM_DISCOVERY_MOUNT_WAIT 5000
+
 /** Internal, extract device id from serial id **/
-int GetDeviceId(char *serial_id) {
+int GetDeviceId(const char *serial_id) {
     int value = 0;
     if(serial_id) {
         while(*serial_id != '\0' && *serial_id != '_') {
@@ -206,217 +250,308 @@ int GetDeviceId(char *serial_id) {
     return value;
 }
 
-/** Internal, method to add a device to the device list **/
-void AddDevice(char *block_device, char *mount_path, char *serial_device, int id) {
-    deviceNode *dev = (deviceNode *)malloc(sizeof(deviceNode));
-    strcpy(dev->block_device, block_device);
-    strcpy(dev->mount_path, mount_path);
-    strcpy(dev->serial_device, serial_device);
-    dev->device_id = id;
-    dev->next = NULL;
-    
-    OmDeviceDiscovery(OM_DEVICE_CONNECTED, dev->device_id, dev->serial_device, dev->mount_path);
-
-    if(deviceList == NULL) {
-        deviceList = dev;
-    } else {
-        dev->next = deviceList;
-        deviceList = dev;
-    }
-}
 
-/** Internal, method to remove a device from the device list **/
-void RemoveDevice(char *block_device) 
+/** Internal, copy a mount table path, decoding the octal escapes (e.g. "\040" for a space) */
+static void OmDiscoveryUnescape(char *dest, size_t size, const char *source)
 {
-    deviceNode *current;
-    deviceNode *previous = NULL;
-
-    for(current = deviceList; current != NULL; previous = current, current = current->next) {
-        
-        //found device
-        if(strcmp(current->block_device, block_device) == 0) {
-            
-            OmDeviceDiscovery(OM_DEVICE_REMOVED, current->device_id, current->serial_device, current->mount_path);
-            if(previous == NULL) {
-                deviceList = current->next;
-            } else {
-                previous->next = current->next;
-            }
-
-            free(current);
-            
-            return;
+    size_t len = 0;
+    while (*source != '\0' && len + 1 < size)
+    {
+        if (source[0] == '\\' && source[1] >= '0' && source[1] <= '3' && source[2] >= '0' && source[2] <= '7' && source[3] >= '0' && source[3] <= '7')
+        {
+            dest[len++] = (char)(((source[1] - '0') << 6) | ((source[2] - '0') << 3) | (source[3] - '0'));
+            source += 4;
+        }
+        else
+        {
+            dest[len++] = *source++;
         }
     }
+    dest[len] = '\0';
 }
 
-/** Internal, method for getting devices already plugged in **/
-void InitDeviceFinder() 
+
+/** Internal, resolve the mount points of discovered block devices from the mount table (matched by device number) */
+static void OmDiscoveryUpdateMounts(void)
 {
-    struct udev *udev;
-    struct udev_enumerate *enumerate;
-    struct udev_list_entry *devices, *dev_list_entry;
-    struct udev_device *dev;
-
-    deviceList = NULL;
-    
-    udev = udev_new();
-    if(!udev) {
-        printf("Can't create udev\n");
-        exit(1);
+    OmDiscoveredDevice *device;
+    char line[1024];
+    FILE *fp;
+
+    // Only read the mount table if a device is waiting for its mount point
+    for (device = om.discovered; device != NULL; device = device->next)
+    {
+        if (!device->announced && device->block[0] != '\0' && device->root[0] == '\0') { break; }
     }
+    if (device == NULL) { return; }
 
-    //find block devices with vendor id and product id.
-    enumerate = udev_enumerate_new(udev);
+    fp = fopen("/proc/self/mountinfo", "r");
+    if (fp == NULL) { return; }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        unsigned int major, minor;
+        char mountPoint[OM_MAX_PATH];
 
-    udev_enumerate_add_match_subsystem(enumerate, "block");
-    udev_enumerate_add_match_property(enumerate, "ID_PRODUCT_ID", "0057");
-    udev_enumerate_add_match_property(enumerate, "ID_VENDOR_ID", "04d8");
-    udev_enumerate_scan_devices(enumerate);
-    devices = udev_enumerate_get_list_entry(enumerate);
-
-    udev_list_entry_foreach(dev_list_entry, devices) {
-        const char *path;
-
-        path = udev_list_entry_get_name(dev_list_entry);
-        dev = udev_device_new_from_syspath(udev, path);
-
-        strcpy(path, udev_device_get_devnode(dev));
-
-        //get mount path first.
-        char mount_path[100];
-        strcpy(mount_path, "/media/");
-        char *name = udev_device_get_property_value(dev, "ID_FS_LABEL");
-        if(name != NULL) {
-            dev = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
-            if(dev) {
-               
-                //get serial device path.
-                char serial_device[100];
-                char *serial_id = udev_device_get_sysattr_value(dev, "serial");
-                GetSerialDevice(serial_id, serial_device);
-                if(strlen(serial_device) > 0) {
-                    strcat(mount_path, name);
-                    //now save device info.
-                    AddDevice(path, mount_path, serial_device, GetDeviceId(serial_id));
-                }
-            }
+        // e.g. "36 25 8:17 / /media/user/CWA17_12345 rw,nosuid,nodev,relatime shared:1 - vfat /dev/sdb1 rw"
+        if (sscanf(line, "%*u %*u %u:%u %*s %255s", &major, &minor, mountPoint) != 3) { continue; }
+        for (device = om.discovered; device != NULL; device = device->next)
+        {
+            if (device->announced || device->block[0] == '\0' || device->blockNumber != makedev(major, minor)) { continue; }
+            OmDiscoveryUnescape(device->root, sizeof(device->root), mountPoint);
         }
     }
-    
-    udev_enumerate_unref(enumerate);
-    udev_unref(udev);
+    fclose(fp);
 }
 
 
-/** Internal, method for getting serial device by id **/
-void GetSerialDevice(char *serial_id, char *serial_device)
+/** Internal, update the discovered devices from a serial port or block device event (action is NULL when enumerating) */
+static void OmDiscoveryUpdate(struct udev_device *dev, const char *action)
 {
-    struct udev *udev;
-    struct udev_enumerate *enumerate;
-    struct udev_list_entry *devices, *dev_list_entry;
-    struct udev_device *dev;
+    const char *subsystem = udev_device_get_subsystem(dev);
+    const char *devnode = udev_device_get_devnode(dev);
+    struct udev_device *usbDevice;
+    const char *vendor, *product, *usbPath, *label = NULL;
+    OmDiscoveredDevice *device, **link;
+    char isBlock;
+
+    if (subsystem == NULL || devnode == NULL) { return; }
+    if (strcmp(subsystem, "block") == 0) { isBlock = 1; }
+    else if (strcmp(subsystem, "tty") == 0) { isBlock = 0; }
+    else { return; }
+
+    // Removed nodes are matched by name (the parent device may already have gone)
+    if (action != NULL && strcmp(action, "remove") == 0)
+    {
+        for (link = &om.discovered; (device = *link) != NULL; link = &device->next)
+        {
+            char *node = isBlock ? device->block : device->port;
+            if (strcmp(node, devnode) != 0) { continue; }
+
+            node[0] = '\0';
+            if (isBlock) { device->root[0] = '\0'; }
+            if (device->announced)
+            {
+                device->announced = 0;
+                OmDeviceDiscovery(OM_DEVICE_REMOVED, device->deviceId, NULL, NULL);
+            }
+            if (device->port[0] == '\0' && device->block[0] == '\0')
+            {
+                *link = device->next;
+                free(device);
+            }
+            break;
+        }
+        return;
+    }
+
+    // The serial port and the block device share the same USB device parent
+    usbDevice = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
+    if (usbDevice == NULL) { return; }
+    vendor = udev_device_get_sysattr_value(usbDevice, "idVendor");
+    product = udev_device_get_sysattr_value(usbDevice, "idProduct");
+    usbPath = udev_device_get_syspath(usbDevice);
+    if (vendor == NULL || product == NULL || usbPath == NULL || strcmp(vendor, OM_USB_VENDOR_ID) != 0 || strcmp(product, OM_USB_PRODUCT_ID) != 0) { return; }
 
-    udev = udev_new();
-    if(!udev) {
-        printf("Can't create udev\n");
-        exit(1);
+    // Only the block device holding the file system is of interest
+    if (isBlock)
+    {
+        label = udev_device_get_property_value(dev, "ID_FS_LABEL");
+        if (label == NULL) { return; }
     }
 
-    //find serial devices with vendor id and product id and serial id.
-    enumerate = udev_enumerate_new(udev);
+    // Find or create the record for the USB device
+    for (device = om.discovered; device != NULL; device = device->next)
+    {
+        if (strcmp(device->usbPath, usbPath) == 0) { break; }
+    }
+    if (device == NULL)
+    {
+        device = (OmDiscoveredDevice *)malloc(sizeof(OmDiscoveredDevice));
+        if (device == NULL) { return; }
+        memset(device, 0, sizeof(OmDiscoveredDevice));
+        snprintf(device->usbPath, sizeof(device->usbPath), "%s", usbPath);
+        device->deviceId = GetDeviceId(udev_device_get_sysattr_value(usbDevice, "serial"));
+        device->next = om.discovered;
+        om.discovered = device;
+    }
+    if (device->announced) { return; }
 
-    udev_enumerate_add_match_subsystem(enumerate, "tty");
-    udev_enumerate_add_match_property(enumerate, "ID_SERIAL_SHORT", serial_id);
-    udev_enumerate_scan_devices(enumerate);
-    devices = udev_enumerate_get_list_entry(enumerate);
-
-    udev_list_entry_foreach(dev_list_entry, devices) {
-        const char *path;
-        path = udev_list_entry_get_name(dev_list_entry);
-        dev = udev_device_new_from_syspath(udev, path);
-        strcpy(serial_device, udev_device_get_devnode(dev));
-        break;
+    if (isBlock)
+    {
+        snprintf(device->block, sizeof(device->block), "%s", devnode);
+        snprintf(device->label, sizeof(device->label), "%s", label);
+        device->blockNumber = udev_device_get_devnum(dev);
+        device->root[0] = '\0';
     }
-    udev_enumerate_unref(enumerate);
-    udev_unref(udev);
+    else
+    {
+        snprintf(device->port, sizeof(device->port), "%s", devnode);
+    }
+    device->completeTime = OmMilliseconds();
 }
 
 
-/** Internal, method for updating a list of seen devices. */
-thread_return_t OmDeviceDiscoveryThread(void *arg)
+/** Internal, report devices that have both their serial port and volume, returns the milliseconds until a device without a mount point should be reported anyway (-1 if none) */
+static int OmDiscoveryAnnounce(void)
 {
-    struct udev *udev;
-    struct udev_enumerate *enumerate;
-    struct udev_device *dev;
-    struct udev_monitor *mon;
+    OmDiscoveredDevice *device;
+    int timeout = -1;
+
+    for (device = om.discovered; device != NULL; device = device->next)
+    {
+        if (device->announced || device->port[0] == '\0' || device->block[0] == '\0') { continue; }
 
-    udev = udev_new();
+        if (device->root[0] == '\0')
+        {
+            unsigned long elapsed = OmMilliseconds() - device->completeTime;
+            if (elapsed < OM_DISCOVERY_MOUNT_WAIT)
+            {
+                int remaining = (int)(OM_DISCOVERY_MOUNT_WAIT - elapsed);
+                if (timeout < 0 || remaining < timeout) { timeout = remaining; }
+                continue;
+            }
+            // Not mounted (e.g. no automounter), assume the conventional mount point
+            snprintf(device->root, sizeof(device->root), "/media/%s", device->label);
+        }
 
-    mon = udev_monitor_new_from_netlink(udev, "udev");
-    udev_monitor_filter_add_match_subsystem_devtype(mon, "block", NULL);
-    udev_monitor_enable_receiving(mon);
+        device->announced = 1;
+        OmDeviceDiscovery(OM_DEVICE_CONNECTED, device->deviceId, device->port, device->root);
+    }
+    return timeout;
+}
 
 
-    // Polled device discovery for non-Windows
+/** Internal, device discovery thread: a single poll loop over udev events, mount table changes and the wake pipe. */
+thread_return_t OmDeviceDiscoveryThread(void *arg)
+{
+    int timeout = OmDiscoveryAnnounce();
+
     while (!om.quitDiscoveryThread)
     {
-        dev = udev_monitor_receive_device(mon);
-        if(dev) {
-
-            //get block device name.
-            struct udev_device *usb_dev = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
-
-            //make sure it's one of our devices.
-            if(strcmp(udev_device_get_sysattr_value(usb_dev, "idVendor"), "04d8") == 0 && strcmp(udev_device_get_sysattr_value(usb_dev, "idProduct"), "0057") == 0) {
-
-                //get block device name.
-                char *block_device = udev_device_get_devnode(dev);
-
-                //check type of action (remove or add)
-                char *action = udev_device_get_action(dev);
-
-                if(strcmp(action, "add") == 0)  {
-                    //get mount path.
-                    char mount_path[100];
-                    strcpy(mount_path, "/media/");
-                    char *name = udev_device_get_property_value(dev, "ID_FS_LABEL");
-                    if(name != NULL) {
-                        char serial_device[100];
-                        char *serial_id = udev_device_get_sysattr_value(usb_dev, "serial");
-                        GetSerialDevice(serial_id, &serial_device[0]);
-                        
-                        if(strlen(serial_device) > 0) {
-                            strcat(mount_path, name);
-                            AddDevice(&block_device[0], &mount_path[0], &serial_device[0], GetDeviceId(serial_id));
-                        }
-                    }
-                } else if(strcmp(action, "remove") == 0) {
-                    RemoveDevice(block_device);
-                }
+        struct pollfd fds[3];
+        struct udev_device *dev;
+
+        fds[0].fd = om.discoveryWakeFd[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = udev_monitor_get_fd(om.udevMonitor);
+        fds[1].events = POLLIN;
+        fds[2].fd = om.mountInfoFd;         // (ignored if -1)
+        fds[2].events = POLLPRI;            // (the mount table signals changes with POLLPRI|POLLERR)
+        fds[0].revents = fds[1].revents = fds[2].revents = 0;
+
+        if (poll(fds, 3, timeout) < 0)
+        {
+            if (errno == EINTR) { continue; }
+            OmLog(0, "ERROR: Device discovery poll failed (%d).\n", errno);
+            break;
+        }
+        if (om.quitDiscoveryThread) { break; }
+
+        // Drain the pending udev events (the monitor socket is non-blocking)
+        if (fds[1].revents & POLLIN)
+        {
+            while ((dev = udev_monitor_receive_device(om.udevMonitor)) != NULL)
+            {
+                OmDiscoveryUpdate(dev, udev_device_get_action(dev));
+                udev_device_unref(dev);
             }
         }
+
+        OmDiscoveryUpdateMounts();
+        timeout = OmDiscoveryAnnounce();
     }
- 
-    udev_unref(udev);
+
     return thread_return_value(0);
 }
 
 /** Internal method to start device discovery. */
 void OmDeviceDiscoveryStart(void)
 {
-    InitDeviceFinder();
-    // Perform an initial device discovery and create device discovery thread
+    struct udev_enumerate *enumerate;
+    struct udev_list_entry *entry;
+
+    // Simulated devices requested by the environment
+    OmSimulatorStartup();
+
     om.quitDiscoveryThread = 0;
-    //OmUpdateDevices();
+    om.discovered = NULL;
+    om.discoveryWakeFd[0] = om.discoveryWakeFd[1] = -1;
+    om.mountInfoFd = -1;
+    om.udevMonitor = NULL;
+
+    om.udev = udev_new();
+    if (om.udev == NULL)
+    {
+        OmLog(0, "ERROR: Cannot create udev context, device discovery disabled.\n");
+        return;
+    }
+
+    // Start monitoring before enumerating so that no events are missed
+    om.udevMonitor = udev_monitor_new_from_netlink(om.udev, "udev");
+    if (om.udevMonitor != NULL)
+    {
+        udev_monitor_filter_add_match_subsystem_devtype(om.udevMonitor, "block", NULL);
+        udev_monitor_filter_add_match_subsystem_devtype(om.udevMonitor, "tty", NULL);
+        udev_monitor_enable_receiving(om.udevMonitor);
+    }
+    om.mountInfoFd = open("/proc/self/mountinfo", O_RDONLY);
+
+    // Perform an initial device discovery: a single pass over the serial ports and block devices of the vendor
+    enumerate = udev_enumerate_new(om.udev);
+    udev_enumerate_add_match_subsystem(enumerate, "block");
+    udev_enumerate_add_match_subsystem(enumerate, "tty");
+    udev_enumerate_add_match_property(enumerate, "ID_VENDOR_ID", OM_USB_VENDOR_ID);
+    udev_enumerate_scan_devices(enumerate);
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate))
+    {
+        struct udev_device *dev = udev_device_new_from_syspath(om.udev, udev_list_entry_get_name(entry));
+        if (dev == NULL) { continue; }
+        OmDiscoveryUpdate(dev, NULL);
+        udev_device_unref(dev);
+    }
+    udev_enumerate_unref(enumerate);
+    OmDiscoveryUpdateMounts();
+    OmDiscoveryAnnounce();
+
+    // Create the device discovery thread
+    if (om.udevMonitor == NULL || pipe(om.discoveryWakeFd) != 0)
+    {
+        om.discoveryWakeFd[0] = om.discoveryWakeFd[1] = -1;
+        OmLog(0, "ERROR: Cannot monitor devices, only initially connected devices will be found.\n");
+        return;
+    }
     thread_create(&om.discoveryThread, NULL, OmDeviceDiscoveryThread, NULL);
 }
 
 /** Internal method to stop device discovery. */
 void OmDeviceDiscoveryStop(void)
 {
+    OmSimulatorShutdown();
+
+    if (om.udev == NULL) { return; }
+
+    // Wake and wait for the discovery thread
     om.quitDiscoveryThread = 1;
-    thread_cancel(&om.discoveryThread);     // thread_join(&om.discoveryThread, NULL);
+    if (om.discoveryWakeFd[1] >= 0)
+    {
+        if (write(om.discoveryWakeFd[1], "", 1) != 1) { thread_cancel(&om.discoveryThread); }
+        thread_join(&om.discoveryThread, NULL);
+        close(om.discoveryWakeFd[0]);
+        close(om.discoveryWakeFd[1]);
+        om.discoveryWakeFd[0] = om.discoveryWakeFd[1] = -1;
+    }
+
+    if (om.mountInfoFd >= 0) { close(om.mountInfoFd); om.mountInfoFd = -1; }
+    if (om.udevMonitor != NULL) { udev_monitor_unref(om.udevMonitor); om.udevMonitor = NULL; }
+    udev_unref(om.udev);
+    om.udev = NULL;
+
+    while (om.discovered != NULL)
+    {
+        OmDiscoveredDevice *device = om.discovered;
+        om.discovered = device->next;
+        free(device);
+    }
 }
 
 #endif
@@ -613,30 +748,117 @@ static int OmPortOpen(const char *infile, char writeable)
 }
 
 
+/** Internal method to wait for data from the serial port and append it to the device's receive buffer, returns the number of bytes received, 0 if none before the timeout (0 = no timeout), or -1 if the port is closed or in error. */
+static int OmPortReceive(OmDeviceState *deviceState, unsigned long timeout)
+{
+    int len;
+
+    // Move any unread data to the start of the buffer
+    if (deviceState->rxOffset > 0)
+    {
+        deviceState->rxLength -= deviceState->rxOffset;
+        memmove(deviceState->rxBuffer, deviceState->rxBuffer + deviceState->rxOffset, deviceState->rxLength);
+        deviceState->rxOffset = 0;
+    }
+
+#ifdef _WIN32
+    // Read whatever arrives within the port's read timeout
+    (void)timeout;
+    len = read(deviceState->fd, deviceState->rxBuffer + deviceState->rxLength, OM_PORT_BUFFER_SIZE - deviceState->rxLength);
+    if (len < 0) { len = 0; }
+#else
+    // Wait for data (or the timeout)
+    {
+        struct pollfd pfd;
+        int ret;
+
+        pfd.fd = deviceState->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        ret = poll(&pfd, 1, (timeout > 0) ? (int)timeout : -1);
+        if (ret < 0) { return (errno == EINTR) ? 0 : -1; }
+        if (ret == 0) { return 0; }
+        if (!(pfd.revents & POLLIN)) { return -1; }        // Hang-up or error without data (e.g. device disconnected)
+    }
+
+    // Read all of the data available
+    len = read(deviceState->fd, deviceState->rxBuffer + deviceState->rxLength, OM_PORT_BUFFER_SIZE - deviceState->rxLength);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) { len = 0; }
+    else if (len <= 0) { return -1; }                       // End of file or error (e.g. device disconnected)
+#endif
+
+    deviceState->rxLength += len;
+    return len;
+}
+
+
 /** Internal method to read a line from the device */
 int OmPortReadLine(unsigned short deviceId, char *inBuffer, int len, unsigned long timeout)
 {
     unsigned long start = OmMilliseconds();
+    OmDeviceState *deviceState;
     int received = 0;
-    unsigned char cc;
-    int c;
-    int fd;
 	unsigned long elapsed = 0;
 
     OmLog(3, "OmPortReadLine(%d, _,%d, %d);", deviceId, len, timeout);
 
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
-    fd = om.devices[deviceId]->fd;
-    if (fd < 0) { return -1; }
+    deviceState = OmDeviceFind(deviceId);
+    if (deviceState == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    if (deviceState->fd < 0) { return -1; }
     if (inBuffer != NULL) { inBuffer[0] = '\0'; }
     for (;;)
     {
-        // Read character
-        c = -1; cc = 0;
-        if (read(fd, &cc, 1) == 1) { c = cc; }
+        int ret;
 
-        // If timeout (or NULL)
-        if (c <= 0)
+        // Take characters from the receive buffer (any after the end of the line remain for the next call)
+        while (deviceState->rxOffset < deviceState->rxLength)
+        {
+            int c = (unsigned char)deviceState->rxBuffer[deviceState->rxOffset++];
+
+            if (c == '\0')
+            {
+                continue;   // (NULL characters are ignored)
+            }
+            else if (c == '\r' || c == '\n')
+            {
+OmLog(5, "[CRLF]", c);    // For extreme logging
+                if (received > 0)
+                {
+OmLog(3, "- Done (CRLF), %d bytes", received);
+                    return received;
+                }
+            }
+            else
+            {
+OmLog(5, "[%c]", c);    // For extreme logging
+                if (received < len - 1)
+                {
+                    if (inBuffer != NULL)
+                    { 
+                        inBuffer[received] = (char)c; 
+                        inBuffer[received + 1] = '\0';
+                    }
+                    received++;
+                }
+            }
+        }
+
+        // Wait for more data, until the timeout (a partial line is discarded on timeout)
+#if defined(_WIN32) && defined(TIMEOUT_CONSTANT)
+        ret = OmPortReceive(deviceState, 0);
+#else
+        elapsed = OmMilliseconds() - start;
+        ret = OmPortReceive(deviceState, (timeout > 0) ? ((elapsed < timeout) ? (timeout - elapsed + 1) : 1) : 0);
+#endif
+        if (ret < 0)
+        {
+OmLog(3, "- Port closed or in error");
+            deviceState->rxOffset = deviceState->rxLength = 0;
+            return -1;
+        }
+
+        // If timeout
+        if (ret == 0)
         {
 #if defined(_WIN32) && defined(TIMEOUT_CONSTANT)
 			elapsed += TIMEOUT_CONSTANT;
@@ -651,30 +873,6 @@ OmLog(3, "-T/O(%d/%d)", elapsed, timeout);
 OmLog(3, "- Overall timeout > %d", timeout);
 				return -1; 
 			}
-
-            continue;   // try to read again until timeout
-        }
-        else if (c == '\r' || c == '\n')
-        {
-OmLog(5, "[CRLF]", c);    // For extreme logging
-            if (received > 0)
-            {
-OmLog(3, "- Done (CRLF), %d bytes", received);
-                return received;
-            }
-        }
-        else
-        {
-OmLog(5, "[%c]", c);    // For extreme logging
-            if (received < len - 1)
-            {
-                if (inBuffer != NULL)
-                { 
-                    inBuffer[received] = (char)c; 
-                    inBuffer[received + 1] = '\0';
-                }
-                received++;
-            }
         }
     }
 }
@@ -683,9 +881,11 @@ OmLog(5, "[%c]", c);    // For extreme logging
 /** Internal method to write to the device */
 int OmPortWrite(unsigned short deviceId, const char *command)
 {
+    OmDeviceState *deviceState;
     int fd;
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
-    fd = om.devices[deviceId]->fd;
+    deviceState = OmDeviceFind(deviceId);
+    if (deviceState == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    fd = deviceState->fd;
     if (fd < 0) { return OM_E_FAIL; }
     if (command == NULL) { return OM_E_POINTER; }
 OmLog(3, "OmPortWrite(%d, \"%s\");\n", deviceId, command);
@@ -697,29 +897,33 @@ OmLog(3, "OmPortWrite(%d, \"%s\");\n", deviceId, command);
 /** Internal method to safely acquire an open serial port for a device. */
 int OmPortAcquire(unsigned short deviceId)
 {
+    OmDeviceState *deviceState;
     int status;
 
     // Check system and device state
     if (!om.initialized) return OM_E_NOT_VALID_STATE;
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
-    if (om.devices[deviceId]->deviceStatus != OM_DEVICE_CONNECTED) return OM_E_INVALID_DEVICE;   // Device lost
+    deviceState = OmDeviceFind(deviceId);
+    if (deviceState == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    if (deviceState->deviceStatus != OM_DEVICE_CONNECTED) return OM_E_INVALID_DEVICE;   // Device lost
 
     // Open port
-    mutex_lock(&om.portMutex);              // Lock port mutex to open the port
+    mutex_lock(&deviceState->portMutex);    // Lock the device's port mutex to open the port
     do          // This is only a 'do' to allow a single code path to hit the mutex unlock with any exceptional 'break's
     {
         // Check if already open
-        if (om.devices[deviceId]->fd >= 0) { status = OM_E_ACCESS_DENIED; break; }
+        if (deviceState->fd >= 0) { status = OM_E_ACCESS_DENIED; break; }
 
         // Open the port
-        om.devices[deviceId]->fd = OmPortOpen(om.devices[deviceId]->port, 1);
+        deviceState->fd = OmPortOpen(deviceState->port, 1);
 
         // Check if opened successfully
-        if (om.devices[deviceId]->fd < 0) { status = OM_E_ACCESS_DENIED; break; }
+        if (deviceState->fd < 0) { status = OM_E_ACCESS_DENIED; break; }
+        deviceState->rxOffset = 0;
+        deviceState->rxLength = 0;
 
         status = OM_OK;
     } while (0);
-    mutex_unlock(&om.portMutex);            // Release port mutex after opening the port
+    mutex_unlock(&deviceState->portMutex);  // Release the device's port mutex after opening the port
 
     return status;
 }
@@ -728,17 +932,22 @@ int OmPortAcquire(unsigned short deviceId)
 /** Internal method to safely release a serial port for a device. */
 int OmPortRelease(unsigned short deviceId)
 {
+    OmDeviceState *deviceState;
+
     // Check device state
-    if (om.devices[deviceId] == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
+    deviceState = OmDeviceFind(deviceId);
+    if (deviceState == NULL) return OM_E_INVALID_DEVICE;   // Device never seen
 
     // Close port
-    mutex_lock(&om.portMutex);              // Lock port mutex to close the port
-    if (om.devices[deviceId]->fd >= 0)
+    mutex_lock(&deviceState->portMutex);    // Lock the device's port mutex to close the port
+    if (deviceState->fd >= 0)
     { 
-        close(om.devices[deviceId]->fd);
-        om.devices[deviceId]->fd = -1;
+        close(deviceState->fd);
+        deviceState->fd = -1;
+        deviceState->rxOffset = 0;
+        deviceState->rxLength = 0;
     }
-    mutex_unlock(&om.portMutex);            // Release port mutex after closing the port
+    mutex_unlock(&deviceState->portMutex);  // Release the device's port mutex after closing the port
     return OM_OK;
 }
 
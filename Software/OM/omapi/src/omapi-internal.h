@@ -48,6 +48,8 @@
     #define thread_create(thread, attr_ignored, start_routine, arg) ((*(thread) = CreateThread(attr_ignored, 0, start_routine, arg, 0, NULL)) == NULL)
     #define thread_join(thread, value_ptr_ignored) ((value_ptr_ignored), WaitForSingleObject((*thread), INFINITE) != WAIT_OBJECT_0)
     #define thread_cancel(thread) (TerminateThread(*(thread), -1) == 0)
+    #define thread_detach(thread) (CloseHandle(*(thread)) == 0)
+    #define thread_is_current(thread) (GetThreadId(*(thread)) == GetCurrentThreadId())
     #define thread_return_t DWORD WINAPI
     #define thread_return_value(value) ((unsigned int)(value))
 
@@ -73,6 +75,7 @@
 
     // Time
     #define gmtime_r(timer, result) gmtime_s(result, timer)
+    #define localtime_r(timer, result) localtime_s(result, timer)
     #define timegm _mkgmtime
 
     // Strings
@@ -84,14 +87,18 @@
     #include <sys/wait.h>
     //#include <sys/types.h>
     #include <termios.h>
+    #include <poll.h>
     #include <pthread.h>
     #include <libudev.h>
+    #include <sys/sysmacros.h>
 
     // Thread
 	#define thread_t      pthread_t
     #define thread_create pthread_create
-    #define thread_join   pthread_join
-    #define thread_cancel pthread_cancel
+    #define thread_join(thread, value_ptr) pthread_join(*(thread), value_ptr)
+    #define thread_cancel(thread) pthread_cancel(*(thread))
+    #define thread_detach(thread) pthread_detach(*(thread))
+    #define thread_is_current(thread) pthread_equal(*(thread), pthread_self())
 	typedef void *        thread_return_t;
     #define thread_return_value(value_ignored) ((value_ignored), NULL)
 
@@ -102,15 +109,13 @@
     #define mutex_unlock  pthread_mutex_unlock
     #define mutex_destroy pthread_mutex_destroy
 
-    typedef struct {
-        char serial_device[100];
-        char block_device[100];
-        char mount_path[100];
-        int device_id;
-        struct deviceNode *next;
-    } deviceNode;
-
-    deviceNode *deviceList;
+    // Condition variable
+    #define cond_t         pthread_cond_t
+    #define cond_init      pthread_cond_init
+    #define cond_wait      pthread_cond_wait
+    #define cond_signal    pthread_cond_signal
+    #define cond_broadcast pthread_cond_broadcast
+    #define cond_destroy   pthread_cond_destroy
 
 #endif
 
@@ -136,11 +141,14 @@ extern "C" {
 
 // Constants
 #define OM_MAX_SERIAL 0xffff    /**< The maximum serial number allowed (16-bit, unsigned) */
+#define OM_DEVICE_TABLE_SIZE 64 /**< The number of buckets in the device table (a power of two) */
+#define OM_DEVICE_HASH(deviceId) ((unsigned int)(deviceId) & (OM_DEVICE_TABLE_SIZE - 1))   /**< The device table bucket for a device identifier */
 #define OM_MAX_CDC_PATH 32      /**< The maximum string length of the CDC port.  e.g. "\\.\COM12345" + '\0' on Windows, or "/dev/tty.usbmodem12345" + '\0' */
 #define OM_MAX_MSD_PATH 64      /**< The maximum string length to the root of the MSD volume.  e.g. "\\?\Volume{abc12345-1234-1234-1234-123456789abc}\" + '\0'. */
 #define OM_DEFAULT_FILENAME "CWA-DATA.CWA"
 
 #define OM_MAX_RESPONSE_SIZE 256
+#define OM_PORT_BUFFER_SIZE 512     /**< Size of the serial port receive buffer */
 #define OM_DEFAULT_TIMEOUT 2000
 
 /** Data block size in bytes */
@@ -155,7 +163,7 @@ extern "C" {
 
 
 /** Device status structure */
-typedef struct
+typedef struct OmDeviceState_t
 {
     // Device properties
     unsigned short id;                  /**< Device serial number */
@@ -164,11 +172,20 @@ typedef struct
     char root[OM_MAX_MSD_PATH];         /**< Mounted root of the file system. */
     char dataFile[OM_MAX_PATH];         /**< Data filename. */
 
-    int fd;                             /**< File descriptor for the serial port while open. The common portMutex is used to allow changes to this -- must hold to acquire or release the CDC port. */
+    struct OmDeviceState_t *hashNext;   /**< Next device in the same device table bucket */
+
+    // Per-device locks
+    mutex_t portMutex;                  /**< portMutex must be held to open or close this device's CDC port. */
+    mutex_t downloadMutex;              /**< downloadMutex must be held to start/update/stop this device's download. */
+
+    int fd;                             /**< File descriptor for the serial port while open. The device's portMutex is used to allow changes to this -- must hold to acquire or release the CDC port. */
+    char rxBuffer[OM_PORT_BUFFER_SIZE]; /**< Data received from the serial port and not yet returned as a line (kept across reads while the port is open). */
+    int rxOffset;                       /**< Offset of the next unread byte in the receive buffer. */
+    int rxLength;                       /**< Number of bytes in the receive buffer (including those already read). */
 
     volatile char downloadCancel;       /**< Download cancellation request flag */
 
-    // The common downloadMutex is used to allow changes to these values, must hold to start/update/stop a download.
+    // The device's downloadMutex is used to allow changes to these values, must hold to start/update/stop a download.
     OM_DOWNLOAD_STATUS downloadStatus;  /**< Status of an asynchronous download */
     int downloadValue;                  /**< Status value of an asynchronous download, percentage complete or diagnostic code if in error. */
     FILE *downloadSource;               /**< Input stream for the file being copied from */
@@ -176,11 +193,44 @@ typedef struct
     int downloadBlocksTotal;            /**< Number of blocks to copy */
     int downloadBlocksCopied;           /**< Number of blocks already copied */
     thread_t downloadThread;            /**< Download thread */
+    char downloadThreadJoinable;        /**< Non-zero if the download thread was started and has not been joined */
 
     void *downloadReference;            /**< Download reference to callbacks (if NULL, the reference given when registering the callbacks will be used instead) */
+    char downloadCheckpoint[OM_MAX_PATH + 16];  /**< Checkpoint file for a resumable download (empty if not resumable) */
+    unsigned int downloadSessionId;     /**< Session ID of the data being downloaded (recorded in the checkpoint) */
+    int downloadBlocksBase;             /**< Block offset the download started from (blocks completed = base + copied) */
+    unsigned long downloadChecksum;     /**< Rolling (Adler-32) checksum of the blocks completed */
+    OM_VERIFY_RESULT downloadVerify;    /**< Result of verifying the download (if downloadVerifyValid) */
+    char downloadVerifyValid;           /**< Flag indicating the download was verified */
+
+    // The common downloadLimitMutex is used to allow changes to these values.
+    struct OmDeviceState_t *downloadQueueNext;  /**< Next download waiting for a reader slot */
+    unsigned long downloadStartTime;    /**< Time the download began reading (milliseconds) */
+    unsigned long downloadEndTime;      /**< Time the download finished (milliseconds), zero while in progress */
+    unsigned long downloadBytes;        /**< Number of bytes copied */
+
+    char simulated;                     /**< Non-zero for a simulated device (set by the simulator, and read without a lock so that real devices never take simulatorMutex) */
 } OmDeviceState;
 
 
+#ifndef _WIN32
+/** Discovery record of a USB device, correlating its serial port and block device by their common USB parent */
+typedef struct OmDiscoveredDevice_t
+{
+    struct OmDiscoveredDevice_t *next;  /**< Next discovered device. */
+    char usbPath[OM_MAX_PATH];          /**< System path of the USB device (the parent of both interfaces). */
+    int deviceId;                       /**< Device ID (from the USB serial number). */
+    char port[OM_MAX_CDC_PATH];         /**< Serial port device node (empty if not present). */
+    char block[OM_MAX_CDC_PATH];        /**< Block device node (empty if not present). */
+    dev_t blockNumber;                  /**< Block device number, matched against the mount table. */
+    char label[OM_MAX_CDC_PATH];        /**< Volume label. */
+    char root[OM_MAX_MSD_PATH];         /**< Mount point (empty if not yet mounted). */
+    unsigned long completeTime;         /**< Time (OmMilliseconds) both the serial port and block device were present. */
+    char announced;                     /**< The device has been reported as connected. */
+} OmDiscoveredDevice;
+#endif
+
+
 
 /**
  * Internal status structure
@@ -204,18 +254,45 @@ typedef struct
     OmDownloadChunkCallback downloadChunkCallback; /**< User-supplied callback for download chunks. */
     void *downloadChunkCallbackReference;   /**< User-supplied reference that will be passed to the download chunk callback. */
 
+    // Download options
+    int downloadBlockSet;               /**< Number of blocks in each download read (0 for the default). */
+    int downloadBuffers;                /**< Number of download buffers, more than one overlaps reading with writing (0 for the default). */
+    int downloadFlags;                  /**< Download option flags (OM_DOWNLOAD_FLAG_*). */
+
+    // Download scheduling, downloadLimitMutex must be held to change these values
+    int downloadMaxReaders;             /**< Maximum number of downloads reading at once (0 for no limit). */
+    int downloadMaxWriters;             /**< Maximum number of simultaneous writes to destination files (0 for no limit). */
+    int downloadMaxRate;                /**< Maximum aggregate read rate, bytes per second (0 for no limit). */
+    int downloadReaders;                /**< Number of downloads currently reading. */
+    int downloadWriters;                /**< Number of destination writes in progress. */
+    unsigned long long downloadRateNext;/**< Time the next read may start at the maximum rate (milliseconds since epoch). */
+    OmDeviceState *downloadQueueHead;   /**< First download waiting for a reader slot. */
+    OmDeviceState *downloadQueueTail;   /**< Last download waiting for a reader slot. */
+
     // Device discovery
 #ifndef _WIN32
     thread_t discoveryThread;           /**< Discovery thread. */
     volatile char quitDiscoveryThread;  /**< Quit flag for discovery thread. */
+    int discoveryWakeFd[2];             /**< Pipe used to wake the discovery thread. */
+    int mountInfoFd;                    /**< Mount table, polled for changes. */
+    struct udev *udev;                  /**< udev context. */
+    struct udev_monitor *udevMonitor;   /**< udev monitor for serial port and block device events. */
+    OmDiscoveredDevice *discovered;     /**< Discovered devices (only used by the discovery thread once started). */
 #endif
 
-    // Port and download mutex
-    mutex_t portMutex;                  /**< portMutex must be held to open or close a CDC port. */
-    mutex_t downloadMutex;              /**< downloadMutex must be held to start/update/stop a download. */
+    // Download scheduling mutex
+    mutex_t downloadLimitMutex;         /**< downloadLimitMutex must be held to change the download scheduling state (acquire after a device's downloadMutex if both are needed). */
+#ifndef _WIN32
+    cond_t downloadLimitCond;           /**< Signalled (with downloadLimitMutex held) when a reader or writer slot is released, the download queue changes, or a download is cancelled. */
+#endif
+
+    // Simulated devices
+    mutex_t simulatorMutex;             /**< simulatorMutex must be held to change the list of simulated devices. */
+    struct OmSimulatedDevice_t *simulatedDevices;   /**< Simulated devices. */
 
     // Device table
-    OmDeviceState *devices[OM_MAX_SERIAL];  /**< Array of pointers to connected device states for each device identifier. */    // (Consider replacing with a hash table or balanced tree, as this implementation requires a fixed 256KB of memory). 
+    mutex_t deviceTableMutex;           /**< deviceTableMutex must be held to add to or walk the device table (acquire last, and do not call out while holding it). */
+    OmDeviceState *deviceTable[OM_DEVICE_TABLE_SIZE];   /**< Hash table of the states of each device ever seen, chained through hashNext. Device states are not freed until OmShutdown(). */
 } OmState;
 
 
@@ -228,6 +305,9 @@ extern OmState om;
 /** Log text to the current log stream. */
 int OmLog(int level, const char *format, ...);
 
+/** Find the state of a device (NULL if never seen), the state remains valid until OmShutdown() */
+OmDeviceState *OmDeviceFind(int deviceId);
+
 /** Device discovery start */
 void OmDeviceDiscoveryStart(void);
 
@@ -256,6 +336,46 @@ int OmPortAcquire(unsigned short deviceId);
 /** Release a port */
 int OmPortRelease(unsigned short deviceId);
 
+/** Signal a device's download to cancel, waking it if it is waiting for a reader or writer slot (does not wait for it to stop) */
+void OmDownloadSignalCancel(OmDeviceState *deviceState);
+
+/** Join a device's download thread if it was started and has not been joined (only if it has finished, when finishedOnly is set), returns non-zero if it was joined here */
+int OmDownloadJoin(OmDeviceState *deviceState, char finishedOnly);
+
+/** Open a reader on a buffer holding the start of a file of the specified size, the remainder is supplied with OmReaderStreamBuffer() */
+OmReaderHandle OmReaderOpenStream(const void *buffer, int length, long fileSize);
+
+/** Replace the buffered part of a stream reader's file with the specified data at the file position */
+int OmReaderStreamBuffer(OmReaderHandle reader, const void *buffer, long position, int length);
+
+
+/** Simulated device */
+typedef struct OmSimulatedDevice_t OmSimulatedDevice;
+
+/** Add any simulated devices requested by the environment (called on device discovery start) */
+void OmSimulatorStartup(void);
+
+/** Remove all simulated devices (called on device discovery stop) */
+void OmSimulatorShutdown(void);
+
+/** Wait until a simulated device's read rate allows a read of the specified size from its volume (only called for devices flagged as simulated) */
+void OmSimulatorThrottle(int deviceId, int bytes);
+
+/** Data file verifier */
+typedef struct OmVerifyState_t OmVerifyState;
+
+/** Create a data file verifier */
+OmVerifyState *OmVerifyCreate(void);
+
+/** Check the reader's current block (numSamples is the return value from OmReaderNextBlock), returns zero if further blocks should be checked */
+int OmVerifyBlock(OmVerifyState *verify, OmReaderHandle reader, int numSamples);
+
+/** Summarize the checks of the reader's file (NULL if the file could not be read) */
+void OmVerifyResult(OmVerifyState *verify, OmReaderHandle reader, OM_VERIFY_RESULT *result);
+
+/** Destroy a data file verifier */
+void OmVerifyDestroy(OmVerifyState *verify);
+
 
 
 #ifdef __cplusplus
@@ -87,21 +87,19 @@ int OmStartup(int version)
     }
 
     // Ensure device state table is clear
-    for (i = 0; i < OM_MAX_SERIAL; i++)
+    for (i = 0; i < OM_DEVICE_TABLE_SIZE; i++)
     {
-        om.devices[i] = NULL;
+        om.deviceTable[i] = NULL;
     }
 
-    // Mutex
-    mutex_init(&om.portMutex, NULL);
-#if !defined(_WIN32)
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE); 
-    mutex_init(&om.downloadMutex, &attr);
-#else
-    mutex_init(&om.downloadMutex, NULL);
+    // Mutex (the port and download mutexes are per-device)
+    mutex_init(&om.deviceTableMutex, NULL);
+    mutex_init(&om.downloadLimitMutex, NULL);
+#ifndef _WIN32
+    cond_init(&om.downloadLimitCond, NULL);
 #endif
+    mutex_init(&om.simulatorMutex, NULL);
+    om.simulatedDevices = NULL;
     
     // Flag the API as initialized (before device discovery)
     om.initialized = 1;
@@ -124,26 +122,43 @@ int OmShutdown(void)
     // Destroy device discovery thread
     OmDeviceDiscoveryStop();
     
+    // Stop every download thread before the device states are freed, as they look up their device in the table (including downloads on removed devices, or still finishing after completing)
+    for (i = 0; i < OM_DEVICE_TABLE_SIZE; i++)
+    {
+        OmDeviceState *deviceState;
+        for (deviceState = om.deviceTable[i]; deviceState != NULL; deviceState = deviceState->hashNext)
+        {
+            OmDownloadSignalCancel(deviceState);
+            OmLog(3, "OmCancelDownload(%d)...\n", deviceState->id);
+            OmDownloadJoin(deviceState, 0);
+        }
+    }
+
     // Clear device state table
-    for (i = 0; i < OM_MAX_SERIAL; i++)
     {
-        if (om.devices[i] != NULL)
+        int deviceId = -1;      // (for mutex debugging)
+        mutex_lock(&om.deviceTableMutex);       // Lock device table mutex to remove the devices
+        for (i = 0; i < OM_DEVICE_TABLE_SIZE; i++)
         {
-            // Cancel any pending downloads
-            if (om.devices[i]->deviceStatus == OM_DEVICE_CONNECTED)
+            while (om.deviceTable[i] != NULL)
             {
-                OmLog(3, "OmCancelDownload(%d)...\n", i);
-                OmCancelDownload(i);
+                OmDeviceState *deviceState = om.deviceTable[i];
+                om.deviceTable[i] = deviceState->hashNext;
+                mutex_destroy(&deviceState->portMutex);
+                mutex_destroy(&deviceState->downloadMutex);
+                free(deviceState);
             }
-
-            free(om.devices[i]);
-            om.devices[i] = NULL;
         }
+        mutex_unlock(&om.deviceTableMutex);     // Release device table mutex
     }
 
     // Delete mutex
-    mutex_destroy(&om.portMutex);
-    mutex_destroy(&om.downloadMutex);
+    mutex_destroy(&om.deviceTableMutex);
+    mutex_destroy(&om.downloadLimitMutex);
+#ifndef _WIN32
+    cond_destroy(&om.downloadLimitCond);
+#endif
+    mutex_destroy(&om.simulatorMutex);
 
     OmLog(3, "OmShutdown() done.\n");
     return OM_OK;
@@ -186,21 +201,34 @@ int OmSetLogCallback(OmLogCallback logCallback, void *reference)
 
 int OmGetDeviceIds(int *deviceIds, int maxDevices)
 {
-    int i, total = 0;
+    int deviceId = -1;      // (for mutex debugging)
+    int i, total = 0, count = 0;
     if (!om.initialized) return OM_E_NOT_VALID_STATE;
-    for (i = 0; i < OM_MAX_SERIAL; i++)
+    if (deviceIds == NULL) { maxDevices = 0; }
+    mutex_lock(&om.deviceTableMutex);       // Lock device table mutex to walk the table
+    for (i = 0; i < OM_DEVICE_TABLE_SIZE; i++)
     {
-        OmDeviceState *deviceState = om.devices[i];
-        if (deviceState != NULL && deviceState->deviceStatus == OM_DEVICE_CONNECTED)
+        OmDeviceState *deviceState;
+        for (deviceState = om.deviceTable[i]; deviceState != NULL; deviceState = deviceState->hashNext)
         {
-            if (maxDevices > 0 && deviceIds != NULL)
+            int j;
+
+            if (deviceState->deviceStatus != OM_DEVICE_CONNECTED) { continue; }
+            total++;
+
+            // Keep the lowest identifiers, in ascending order
+            for (j = count; j > 0 && deviceIds[j - 1] > deviceState->id; j--)
             {
-                *deviceIds++ = i;   //deviceState->id;
-                maxDevices--;
+                if (j < maxDevices) { deviceIds[j] = deviceIds[j - 1]; }
+            }
+            if (j < maxDevices)
+            {
+                deviceIds[j] = deviceState->id;
+                if (count < maxDevices) { count++; }
             }
-            total++;
         }
     }
+    mutex_unlock(&om.deviceTableMutex);     // Release device table mutex
     return total;
 }
 
@@ -229,6 +257,41 @@ int OmSetDownloadChunkCallback(OmDownloadChunkCallback downloadChunkCallback, vo
 }
 
 
+int OmSetDownloadOptions(int blockSetSize, int bufferCount, int flags)
+{
+    if (blockSetSize < 0 || bufferCount < 0) { return OM_E_INVALID_ARG; }
+    om.downloadBlockSet = blockSetSize;
+    om.downloadBuffers = bufferCount;
+    om.downloadFlags = flags;
+    return OM_OK;
+}
+
+
+int OmSetDownloadLimits(int maxReaders, int maxWriters, int maxBytesPerSecond)
+{
+    int deviceId = -1;      // (for mutex debugging)
+    if (maxReaders < 0 || maxWriters < 0 || maxBytesPerSecond < 0) { return OM_E_INVALID_ARG; }
+    if (!om.initialized)
+    {
+        om.downloadMaxReaders = maxReaders;
+        om.downloadMaxWriters = maxWriters;
+        om.downloadMaxRate = maxBytesPerSecond;
+        return OM_OK;
+    }
+
+    // Wake any downloads waiting for a slot, in case the new limits admit them
+    mutex_lock(&om.downloadLimitMutex);
+    om.downloadMaxReaders = maxReaders;
+    om.downloadMaxWriters = maxWriters;
+    om.downloadMaxRate = maxBytesPerSecond;
+#ifndef _WIN32
+    cond_broadcast(&om.downloadLimitCond);
+#endif
+    mutex_unlock(&om.downloadLimitMutex);
+    return OM_OK;
+}
+
+
 OM_DATETIME OmDateTimeFromString(const char *value)
 {
     static const unsigned char maxDaysPerMonth[12+1] = {0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
@@ -46,8 +46,25 @@
 
 
 
-/** Maximum possible packet size */
-#define OM_MAX_PACKET_SIZE 0xffff
+/** Memory-map the file where supported (define OM_READER_NO_MMAP to always use the stdio reader) */
+#if !defined(_WIN32) && !defined(OM_READER_NO_MMAP)
+#define OM_READER_MMAP
+#include <sys/mman.h>
+#endif
+
+/** Optional read-ahead thread (not currently supported on Windows) */
+#if !defined(_WIN32)
+#define OM_READER_READAHEAD
+#define OM_READER_READAHEAD_SIZE (128 * OM_BLOCK_SIZE)     /**< Size of each read-ahead buffer */
+
+/** A read-ahead buffer of file contents */
+typedef struct
+{
+    long position;
+    int length;
+    unsigned char data[OM_READER_READAHEAD_SIZE];
+} OmReaderChunk;
+#endif
 
 
 
@@ -57,17 +74,45 @@ typedef struct
     // File pointer
     FILE *fp;
 
+    // Memory-mapped file contents (NULL if reading through the file pointer), holding the 'mapLength' bytes of the file from 'mapOffset' (the whole file, unless streamed) -- read-only, as it may be the caller's buffer
+    const unsigned char *map;
+    long mapOffset;
+    long mapLength;
+
+    // Current byte position in the file
+    long position;
+
+    // Current header and data packets (point in to the mapped file, or to the buffers below)
+    const unsigned char *header;
+    const unsigned char *data;
+
     // Buffers
-    unsigned char header[OM_MAX_PACKET_SIZE];
-    unsigned char data[OM_BLOCK_SIZE];
+    unsigned char headerBuffer[OM_MAX_HEADER_SIZE];
+    unsigned char dataBuffer[OM_BLOCK_SIZE];
     short samples[OM_MAX_SAMPLES * 3];
 
+#ifdef OM_READER_READAHEAD
+    // Read-ahead thread and its ring of buffers (chunks[head] to chunks[head + count - 1] are filled, in file order)
+    OmReaderChunk *chunks;
+    int depth;
+    int head;
+    int count;
+    long readAheadPosition;         // File position the thread reads next
+    unsigned int generation;        // Changed when the consumer seeks, to discard any read in progress
+    char quitReadAhead;
+    thread_t readAheadThread;
+    mutex_t readAheadMutex;
+    cond_t readAheadCond;
+#endif
+
     // Global information
     long dataOffset;
     long fileSize;
     int numDataBlocks;
     OM_DATETIME firstStartTime;
     OM_DATETIME lastEndTime;
+    unsigned long long firstSampleTime;
+    unsigned long long lastSampleTime;
 
     // Current block information
     unsigned int numSamples;
@@ -75,6 +120,7 @@ typedef struct
     unsigned long long blockEnd;
     unsigned int sequenceId;
     unsigned char events;
+    char bytesPerSample;
 
     // Output values
     unsigned short deviceId;
@@ -84,10 +130,163 @@ typedef struct
 } OmReaderState;
 
 
+/** Number of blocks to search past unreadable blocks, and either side of a time seek's estimate, when the block timestamps are not strictly monotonic */
+#define OM_READER_SEEK_WINDOW 16
+
+
+#ifdef OM_READER_READAHEAD
+/** Internal read-ahead thread, fills the ring of buffers ahead of the consumer */
+static thread_return_t OmReaderReadAheadThread(void *arg)
+{
+    OmReaderState *state = (OmReaderState *)arg;
+
+    mutex_lock(&state->readAheadMutex);
+    while (!state->quitReadAhead)
+    {
+        OmReaderChunk *chunk;
+        unsigned int generation;
+        long position;
+        int len;
+
+        // Wait until there is a free buffer and more of the file to read
+        if (state->count >= state->depth || state->readAheadPosition >= state->fileSize)
+        {
+            cond_wait(&state->readAheadCond, &state->readAheadMutex);
+            continue;
+        }
+
+        // Read in to the next free buffer (only this thread writes to free buffers, so no need to hold the lock)
+        chunk = &state->chunks[(state->head + state->count) % state->depth];
+        position = state->readAheadPosition;
+        generation = state->generation;
+        mutex_unlock(&state->readAheadMutex);
+
+        len = -1;
+        if (fseek(state->fp, position, SEEK_SET) == 0)
+        {
+            len = fread(chunk->data, 1, OM_READER_READAHEAD_SIZE, state->fp);
+        }
+
+        mutex_lock(&state->readAheadMutex);
+
+        // Discard the buffer if the consumer sought elsewhere while reading
+        if (generation != state->generation) { continue; }
+
+        // Publish the buffer (a short read ends the read-ahead at that position)
+        chunk->position = position;
+        chunk->length = (len > 0) ? len : 0;
+        state->count++;
+        state->readAheadPosition = (len == OM_READER_READAHEAD_SIZE) ? (position + len) : state->fileSize;
+        cond_broadcast(&state->readAheadCond);
+    }
+    mutex_unlock(&state->readAheadMutex);
+
+    return thread_return_value(0);
+}
+
+
+/** Internal method to copy the block at the current position from the read-ahead buffers, returns the number of bytes copied */
+static int OmReaderReadAheadFetch(OmReaderState *state, unsigned char *buffer)
+{
+    long position = state->position;
+    int len = 0;
+
+    mutex_lock(&state->readAheadMutex);
+    for (;;)
+    {
+        if (state->count > 0)
+        {
+            OmReaderChunk *chunk = &state->chunks[state->head];
+
+            // Position is in the oldest buffer: copy it out
+            if (position >= chunk->position && position < chunk->position + chunk->length)
+            {
+                len = (int)(chunk->position + chunk->length - position);
+                if (len > OM_BLOCK_SIZE) { len = OM_BLOCK_SIZE; }
+                memcpy(buffer, chunk->data + (position - chunk->position), len);
+                break;
+            }
+
+            // Position is after the oldest buffer: release it to be refilled, unless it was a short read (end of the file)
+            if (position >= chunk->position + chunk->length)
+            {
+                if (chunk->length < OM_READER_READAHEAD_SIZE) { break; }
+                state->head = (state->head + 1) % state->depth;
+                state->count--;
+                cond_broadcast(&state->readAheadCond);
+                continue;
+            }
+        }
+        else if (position == state->readAheadPosition)
+        {
+            // End of the file, or waiting for the thread to read
+            if (position >= state->fileSize) { break; }
+            cond_wait(&state->readAheadCond, &state->readAheadMutex);
+            continue;
+        }
+
+        // Sought outside the buffered range: discard the buffers and restart from the new position
+        state->head = 0;
+        state->count = 0;
+        state->readAheadPosition = position;
+        state->generation++;
+        cond_broadcast(&state->readAheadCond);
+    }
+    mutex_unlock(&state->readAheadMutex);
+
+    return len;
+}
+
+
+/** Internal method to stop any read-ahead thread and release its buffers */
+static void OmReaderReadAheadStop(OmReaderState *state)
+{
+    if (state->chunks == NULL) { return; }
+
+    mutex_lock(&state->readAheadMutex);
+    state->quitReadAhead = 1;
+    cond_broadcast(&state->readAheadCond);
+    mutex_unlock(&state->readAheadMutex);
+    thread_join(&state->readAheadThread, NULL);
+
+    cond_destroy(&state->readAheadCond);
+    mutex_destroy(&state->readAheadMutex);
+    free(state->chunks);
+    state->chunks = NULL;
+    state->depth = 0;
+}
+#endif
+
+
+/** Internal method to release the reader's file resources */
+static void OmReaderFree(OmReaderState *state)
+{
+#ifdef OM_READER_READAHEAD
+    OmReaderReadAheadStop(state);
+#endif
+#ifdef OM_READER_MMAP
+    if (state->map != NULL && state->fp != NULL)     // (a caller-owned buffer has no file pointer and is not unmapped)
+    {
+        munmap((void *)state->map, state->fileSize);
+        state->map = NULL;
+    }
+#endif
+    if (state->fp != NULL)
+    {
+        fclose(state->fp);
+        state->fp = NULL;
+    }
+    free(state);
+}
+
+
+static int OmReaderLoadBlock(OmReaderState *state);
+static OmReaderHandle OmReaderStart(OmReaderState *state);
+
+
 OmReaderHandle OmReaderOpen(const char *binaryFilename)
 { 
     OmReaderState *state;
-    int initialReadSize;
 
     // Check parameters
     if (binaryFilename == NULL) { return NULL; }
@@ -98,23 +297,157 @@ OmReaderHandle OmReaderOpen(const char *binaryFilename)
     if (state == NULL) { return NULL; }    
 
     // Open source file
+    state->map = NULL;
+#ifdef OM_READER_READAHEAD
+    state->chunks = NULL;
+    state->depth = 0;
+#endif
     state->fp = fopen(binaryFilename, "rb");
     if (state->fp == NULL) { free(state); return NULL; }    
 
     // Read file size
     fseek(state->fp, 0, SEEK_END);
     state->fileSize = ftell(state->fp);
+    fseek(state->fp, 0, SEEK_SET);
+    state->position = 0;
+
+#ifdef OM_READER_MMAP
+    // Map the whole file (private copy-on-write, so the raw packets remain writeable without altering the file)
+    if (state->fileSize > 0)
+    {
+        void *map = mmap(NULL, state->fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(state->fp), 0);
+        if (map != MAP_FAILED)
+        {
+            state->map = (unsigned char *)map;
+            state->mapOffset = 0;
+            state->mapLength = state->fileSize;
+            madvise(map, state->fileSize, MADV_SEQUENTIAL);
+        }
+    }
+#endif
+
+    return OmReaderStart(state);
+}
+
+
+OmReaderHandle OmReaderOpenBuffer(const void *buffer, int length)
+{ 
+    OmReaderState *state;
+
+    // Check parameters
+    if (buffer == NULL) { return NULL; }
+    if (length <= 0) { return NULL; }
+
+    // Allocate state tracker
+    state = (OmReaderState *)malloc(sizeof(OmReaderState));
+    if (state == NULL) { return NULL; }    
+
+    // Read directly from the caller's buffer as if it were a mapped file (no file pointer)
+    state->fp = NULL;
+    state->map = (const unsigned char *)buffer;
+    state->mapOffset = 0;
+    state->mapLength = length;
+#ifdef OM_READER_READAHEAD
+    state->chunks = NULL;
+    state->depth = 0;
+#endif
+    state->fileSize = length;
+    state->position = 0;
+
+    return OmReaderStart(state);
+}
+
+
+OmReaderHandle OmReaderOpenStream(const void *buffer, int length, long fileSize)
+{ 
+    OmReaderState *state;
+
+    // Check parameters
+    if (buffer == NULL) { return NULL; }
+    if (length <= 0 || fileSize < length) { return NULL; }
+
+    // Allocate state tracker
+    state = (OmReaderState *)malloc(sizeof(OmReaderState));
+    if (state == NULL) { return NULL; }    
+
+    // Read from the caller's buffer, holding the start of the file (later parts are supplied with OmReaderStreamBuffer())
+    state->fp = NULL;
+    state->map = (const unsigned char *)buffer;
+    state->mapOffset = 0;
+    state->mapLength = length;
+#ifdef OM_READER_READAHEAD
+    state->chunks = NULL;
+    state->depth = 0;
+#endif
+    state->fileSize = fileSize;
+    state->position = 0;
+
+    if (OmReaderStart(state) == NULL) { return NULL; }
+
+    // Keep a copy of the header, as the caller's buffer will be reused
+    if (state->header != state->headerBuffer)
+    {
+        memcpy(state->headerBuffer, state->header, OM_MAX_HEADER_SIZE);
+        state->header = state->headerBuffer;
+    }
+
+    return (OmReaderHandle)state;
+}
+
+
+int OmReaderStreamBuffer(OmReaderHandle reader, const void *buffer, long position, int length)
+{
+    OmReaderState *state = (OmReaderState *)reader;
+
+    // Check parameters
+    if (state == NULL || buffer == NULL) { return OM_E_POINTER; }
+    if (state->fp != NULL || length < 0 || position < 0) { return OM_E_INVALID_ARG; }
+
+    // Replace the window of the file held in memory
+    state->map = (const unsigned char *)buffer;
+    state->mapOffset = position;
+    state->mapLength = length;
+    if (state->data != state->dataBuffer)
+    {
+        memcpy(state->dataBuffer, state->data, OM_BLOCK_SIZE);
+        state->data = state->dataBuffer;
+    }
+
+    return OM_OK;
+}
+
+
+/** Internal method to parse the header of a newly-opened source and find the data time range, the state is freed on failure */
+static OmReaderHandle OmReaderStart(OmReaderState *state)
+{
+    int initialReadSize;
 
     // Read header
-    fseek(state->fp, 0, SEEK_SET);
-    initialReadSize = fread(state->header, 1, OM_MAX_PACKET_SIZE, state->fp);
+    if (state->map != NULL && state->mapLength >= OM_MAX_HEADER_SIZE)
+    {
+        state->header = state->map;
+        initialReadSize = OM_MAX_HEADER_SIZE;
+    }
+    else if (state->map != NULL)
+    {
+        memset(state->headerBuffer, 0, OM_MAX_HEADER_SIZE);
+        memcpy(state->headerBuffer, state->map, state->mapLength);
+        state->header = state->headerBuffer;
+        initialReadSize = (int)state->mapLength;
+    }
+    else
+    {
+        state->header = state->headerBuffer;
+        initialReadSize = fread(state->headerBuffer, 1, OM_MAX_HEADER_SIZE, state->fp);
+    }
+    state->data = state->dataBuffer;
 
     // Check header (at least as big as the header packet, actual length is an integer multiple of the size of each data block)
-    if (initialReadSize < OM_BLOCK_SIZE) { fclose(state->fp); free(state); return NULL; }
+    if (initialReadSize < OM_BLOCK_SIZE) { OmReaderFree(state); return NULL; }
     state->dataOffset = state->header[2] + (state->header[3] << 8) + 4;
     if (state->header[0] != 0x4d || state->header[1] != 0x44 || (state->dataOffset & (sizeof(OM_READER_DATA_PACKET) - 1)) != 0)
     {
-        fclose(state->fp); free(state); return NULL;
+        OmReaderFree(state); return NULL;
     }
 
     // Extract the metadata from the header
@@ -132,6 +465,7 @@ OmReaderHandle OmReaderOpen(const char *binaryFilename)
 
     // Determine the start time from the first readable data block
     state->firstStartTime = OM_DATETIME_ZERO;
+    state->firstSampleTime = 0;
     if (state->numDataBlocks > 0)
     {
         int retry = 0;
@@ -140,10 +474,11 @@ OmReaderHandle OmReaderOpen(const char *binaryFilename)
             int values;
             if (retry > 16) { break; }      // Give up after 16 blocks
             OmReaderDataBlockSeek((OmReaderHandle)state, 0 + retry);
-            values = OmReaderNextBlock((OmReaderHandle)state);
+            values = OmReaderLoadBlock(state);
             if (values > 0)
             {
                 state->firstStartTime = OmReaderTimestamp((OmReaderHandle)state, 0, NULL);
+                state->firstSampleTime = state->blockStart;
                 break;
             }
         }
@@ -151,6 +486,7 @@ OmReaderHandle OmReaderOpen(const char *binaryFilename)
 
     // Determine the end time from the last readable data block
     state->lastEndTime = OM_DATETIME_ZERO;
+    state->lastSampleTime = 0;
     if (state->numDataBlocks > 0)
     {
         int retry = 0;
@@ -158,11 +494,12 @@ OmReaderHandle OmReaderOpen(const char *binaryFilename)
         {
             int values;
             if (retry > 16) { break; }      // Give up after 16 blocks
-            OmReaderDataBlockSeek((OmReaderHandle)state, (state->fileSize / OM_BLOCK_SIZE) - 1 - retry);
-            values = OmReaderNextBlock((OmReaderHandle)state);
+            OmReaderDataBlockSeek((OmReaderHandle)state, state->numDataBlocks - 1 - retry);
+            values = OmReaderLoadBlock(state);
             if (values > 0)
             {
                 state->lastEndTime = OmReaderTimestamp((OmReaderHandle)state, values - 1, NULL);
+                state->lastSampleTime = state->blockStart + ((values - 1) * (state->blockEnd - state->blockStart) / state->numSamples);
                 break;
             }
         }
@@ -193,6 +530,21 @@ int OmReaderDataRange(OmReaderHandle reader, int *dataBlockSize, int *dataOffset
 }
 
 
+int OmReaderDataTimeRange(OmReaderHandle reader, unsigned long long *firstTime, unsigned long long *lastTime)
+{
+    OmReaderState *state = (OmReaderState *)reader;
+
+    // Check parameter
+    if (state == NULL) { return OM_E_POINTER; }
+
+    // Output values (determined when the file was opened)
+    if (firstTime != NULL) { *firstTime = state->firstSampleTime; }
+    if (lastTime != NULL) { *lastTime = state->lastSampleTime; }
+
+    return OM_OK; 
+}
+
+
 const char *OmReaderMetadata(OmReaderHandle reader, int *deviceId, unsigned int *sessionId)
 {
     OmReaderState *state = (OmReaderState *)reader;
@@ -217,7 +569,7 @@ int OmReaderDataBlockPosition(OmReaderHandle reader)
     if (state == NULL) { return OM_E_POINTER; }
 
     // Get the data block position
-    dataBlockNumber = (ftell(state->fp) - state->dataOffset) / OM_BLOCK_SIZE;
+    dataBlockNumber = (state->position - state->dataOffset) / OM_BLOCK_SIZE;
 
     // Return data block position
     return dataBlockNumber;
@@ -236,11 +588,20 @@ int OmReaderDataBlockSeek(OmReaderHandle reader, int dataBlockNumber)
     if (dataBlockNumber < -(state->dataOffset / OM_BLOCK_SIZE)) { return OM_E_FAIL; }
     if (dataBlockNumber > (state->fileSize / OM_BLOCK_SIZE)) { return OM_E_FAIL; }
 
-    // Seek the file
-    fseek(state->fp, state->dataOffset + dataBlockNumber * OM_BLOCK_SIZE, SEEK_SET);
+    // Seek the file (a mapped file, or the read-ahead buffers, are only read at the current position)
+    state->position = state->dataOffset + dataBlockNumber * OM_BLOCK_SIZE;
+#ifdef OM_READER_READAHEAD
+    if (state->map == NULL && state->chunks == NULL)
+#else
+    if (state->map == NULL)
+#endif
+    {
+        fseek(state->fp, state->position, SEEK_SET);
+    }
 
     // Clear the data buffer and samples
-    memset(state->data, 0xff, OM_BLOCK_SIZE);
+    state->data = state->dataBuffer;
+    memset(state->dataBuffer, 0xff, OM_BLOCK_SIZE);
     memset(state->samples, 0x00, OM_MAX_SAMPLES * 3 * sizeof(short));
 
     // Clear the sequence and time-tracking values
@@ -254,7 +615,42 @@ int OmReaderDataBlockSeek(OmReaderHandle reader, int dataBlockNumber)
 }
 
 
-int OmReaderNextBlock(OmReaderHandle reader)
+/** Internal method to unpack the current block's samples, each axis to a destination that advances by 'stride' per sample. */
+static void OmReaderUnpack(const unsigned char *data, char bytesPerSample, int numSamples, short *x, short *y, short *z, int stride)
+{
+    const unsigned char *p = data + 30;     // @30 rawSampleData
+    int i;
+
+    if (bytesPerSample == 4)
+    {
+        for (i = 0; i < numSamples; i++, p += 4)
+        {
+            // Packed accelerometer value - must sign-extend each component value and adjust for exponent
+            //        [byte-3] [byte-2] [byte-1] [byte-0]
+            //        eezzzzzz zzzzyyyy yyyyyyxx xxxxxxxx
+            //        10987654 32109876 54321098 76543210
+            unsigned int value = (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+            int shift = 6 - (unsigned char)(value >> 30);
+            x[i * stride] = (short)( (short)((unsigned short)0xffc0 & (unsigned short)(value <<  6)) >> shift );
+            y[i * stride] = (short)( (short)((unsigned short)0xffc0 & (unsigned short)(value >>  4)) >> shift );
+            z[i * stride] = (short)( (short)((unsigned short)0xffc0 & (unsigned short)(value >> 14)) >> shift );
+        }
+    }
+    else if (bytesPerSample == 6)
+    {
+        // Parse each value's bytes for portability
+        for (i = 0; i < numSamples; i++, p += 6)
+        {
+            x[i * stride] = (short)((unsigned short)(p[0] | (((unsigned short)p[1]) << 8)));
+            y[i * stride] = (short)((unsigned short)(p[2] | (((unsigned short)p[3]) << 8)));
+            z[i * stride] = (short)((unsigned short)(p[4] | (((unsigned short)p[5]) << 8)));
+        }
+    }
+}
+
+
+/** Internal method to read and check the next block, and calculate its timestamps (the samples are not unpacked). */
+static int OmReaderLoadBlock(OmReaderState *state)
 {
     unsigned long long previousBlockStart;
     unsigned long long previousBlockEnd;
@@ -263,10 +659,6 @@ int OmReaderNextBlock(OmReaderHandle reader)
     int sampleRate;
     int len;
 
-    // Check parameter
-    OmReaderState *state = (OmReaderState *)reader;
-    if (state == NULL) { return OM_E_POINTER; }
-
     // Record previous block's 'blockStart' and 'blockEnd'
     previousBlockStart = state->blockStart;
     previousBlockEnd = state->blockEnd;
@@ -278,9 +670,36 @@ int OmReaderNextBlock(OmReaderHandle reader)
 
     // Read a block (if not EOF)
     len = -1;
-    if (!feof(state->fp))
+    if (state->map != NULL)
+    {
+        // Use the block directly from the mapped file (a partial final block is copied so as not to read past the end)
+        if (state->position >= state->mapOffset && state->position < state->mapOffset + state->mapLength)
+        {
+            len = OM_BLOCK_SIZE;
+            state->data = state->map + (state->position - state->mapOffset);
+            if (state->position + len > state->mapOffset + state->mapLength)
+            {
+                len = (int)(state->mapOffset + state->mapLength - state->position);
+                state->data = state->dataBuffer;
+                memcpy(state->dataBuffer, state->map + (state->position - state->mapOffset), len);
+            }
+            state->position += len;
+        }
+    }
+#ifdef OM_READER_READAHEAD
+    else if (state->chunks != NULL)
     {
-        len = fread(state->data, 1, OM_BLOCK_SIZE, state->fp);
+        // Copy the block from the read-ahead buffers
+        state->data = state->dataBuffer;
+        len = OmReaderReadAheadFetch(state, state->dataBuffer);
+        if (len > 0) { state->position += len; }
+    }
+#endif
+    else if (!feof(state->fp))
+    {
+        state->data = state->dataBuffer;
+        len = fread(state->dataBuffer, 1, OM_BLOCK_SIZE, state->fp);
+        if (len > 0) { state->position += len; }
     }
 
     if (len != OM_BLOCK_SIZE)
@@ -288,7 +707,7 @@ int OmReaderNextBlock(OmReaderHandle reader)
         // Check if EOF
         if (len == 0 || len == -1)
         {
-            if (ftell(state->fp) == state->fileSize)
+            if (state->position == state->fileSize)
             {
                 return OM_E_FAIL;       // End-of-file as expected
             }
@@ -302,12 +721,12 @@ int OmReaderNextBlock(OmReaderHandle reader)
     if (state->data[0] != 0x41 || state->data[1] != 0x58) { return 0; }                                     // @0 packetHeader
     if (state->data[2] != ((OM_BLOCK_SIZE - 4) & 0xff) || state->data[3] != ((OM_BLOCK_SIZE - 4) >> 8)) { return 0; }   // @2 packetLength
 
-    // Checksum -- 16-bit word-size addition
+    // Checksum -- 16-bit (little-endian) word-size addition, summed by byte as a caller's buffer may not be aligned
     {
-	    unsigned short *p = (unsigned short *)state->data;
+	    const unsigned char *p = state->data;
         unsigned short checksum = 0x0000;
 	    size_t len;
-        for (len = OM_BLOCK_SIZE / 2; len; --len) { checksum += *p++; }
+        for (len = OM_BLOCK_SIZE / 2; len; --len, p += 2) { checksum += (unsigned short)(p[0] | ((unsigned short)p[1] << 8)); }
         if (checksum != 0x0000) { return 0; }
     }
 
@@ -323,47 +742,10 @@ int OmReaderNextBlock(OmReaderHandle reader)
     sequenceId = ((unsigned int)state->data[10] << 0) | ((unsigned int)state->data[11] << 8) | ((unsigned int)state->data[12] << 16) | ((unsigned int)state->data[13] << 24);
     state->events = state->data[22];
 
-    // Extract data values
-    if (bytesPerSample == 4)
-    {
-        unsigned int i;
-
-        // Check sample count matches expected number
-        state->numSamples = (OM_BLOCK_SIZE - 32) / bytesPerSample;      // 120
-        if (state->data[28] != (unsigned char)state->numSamples || state->data[29] != (unsigned char)(state->numSamples >> 8)) { return 0; }    // @28 sampleCount  
-
-        // Unpack each value
-        for (i = 0; i < state->numSamples; i++)
-        {
-            // Packed accelerometer value - must sign-extend each component value and adjust for exponent
-            //        [byte-3] [byte-2] [byte-1] [byte-0]
-            //        eezzzzzz zzzzyyyy yyyyyyxx xxxxxxxx
-            //        10987654 32109876 54321098 76543210
-            unsigned int value = (unsigned int)state->data[30 + i * 4] | ((unsigned int)state->data[31 + i * 4] << 8) | ((unsigned int)state->data[32 + i * 4] << 16) | ((unsigned int)state->data[33 + i * 4] << 24);
-            state->samples[3 * i + 0] = (short)( (short)((unsigned short)0xffc0 & (unsigned short)(value <<  6)) >> (6 - ((unsigned char)(value >> 30))) );
-            state->samples[3 * i + 1] = (short)( (short)((unsigned short)0xffc0 & (unsigned short)(value >>  4)) >> (6 - ((unsigned char)(value >> 30))) );
-            state->samples[3 * i + 2] = (short)( (short)((unsigned short)0xffc0 & (unsigned short)(value >> 14)) >> (6 - ((unsigned char)(value >> 30))) );
-        }
-    }
-    else if (bytesPerSample == 6)
-    {
-        unsigned int i;
-
-        // Check sample count matches expected number
-        state->numSamples = (OM_BLOCK_SIZE - 32) / bytesPerSample;      // 80
-        if (state->data[28] != (unsigned char)state->numSamples || state->data[29] != (unsigned char)(state->numSamples >> 8)) { return 0; }    // @28 sampleCount  
-
-        // Endian-unsafe version - copy 80 unpacked samples directly
-        //memcpy(state->samples, state->data + 30, state->numSamples * 3 * sizeof(short));
-
-        // Parse each value's bytes for portability
-        for (i = 0; i < state->numSamples; i++)
-        {
-            state->samples[3 * i + 0] = (short)((unsigned short)(state->data[30 + i * 6] | (((unsigned short)state->data[31 + i * 6]) << 8)));
-            state->samples[3 * i + 1] = (short)((unsigned short)(state->data[32 + i * 6] | (((unsigned short)state->data[33 + i * 6]) << 8)));
-            state->samples[3 * i + 2] = (short)((unsigned short)(state->data[34 + i * 6] | (((unsigned short)state->data[35 + i * 6]) << 8)));
-        }
-    }
+    // Check sample count matches expected number
+    state->bytesPerSample = bytesPerSample;
+    state->numSamples = (OM_BLOCK_SIZE - 32) / bytesPerSample;      // 120 packed, or 80 unpacked
+    if (state->data[28] != (unsigned char)state->numSamples || state->data[29] != (unsigned char)(state->numSamples >> 8)) { return 0; }    // @28 sampleCount  
 
     // Frequency
 // TODO: This method only works down to 25 Hz, use float to support 12.5, 6.25 rates
@@ -440,6 +822,134 @@ int OmReaderNextBlock(OmReaderHandle reader)
 }
 
 
+/** Internal method to find the first readable block at or after the specified block, returns the block index (with its times loaded), or -1 if none nearby. */
+static int OmReaderProbeBlock(OmReaderState *state, int dataBlockNumber)
+{
+    int retry;
+    for (retry = 0; retry < OM_READER_SEEK_WINDOW && dataBlockNumber + retry < state->numDataBlocks; retry++)
+    {
+        OmReaderDataBlockSeek((OmReaderHandle)state, dataBlockNumber + retry);
+        if (OmReaderLoadBlock(state) > 0) { return dataBlockNumber + retry; }
+    }
+    return -1;
+}
+
+
+int OmReaderSeekTime(OmReaderHandle reader, unsigned long long time)
+{
+    int lo, hi, start, end, block, result;
+
+    // Check parameter
+    OmReaderState *state = (OmReaderState *)reader;
+    if (state == NULL) { return OM_E_POINTER; }
+
+    // Binary search for the first block that starts after the requested time
+    lo = 0;
+    hi = state->numDataBlocks;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        int found = OmReaderProbeBlock(state, mid);
+        if (found < 0 || found >= hi || state->blockStart > time) { hi = mid; }
+        else { lo = found + 1; }
+    }
+
+    // The estimate is the last block starting at or before the requested time
+    result = (lo > 0) ? lo - 1 : 0;
+
+    // Refine with a local scan, in case the timestamps are not strictly monotonic: the first block in the window that ends after the requested time
+    start = result - OM_READER_SEEK_WINDOW;
+    if (start < 0) { start = 0; }
+    end = result + OM_READER_SEEK_WINDOW;
+    if (end > state->numDataBlocks) { end = state->numDataBlocks; }
+    OmReaderDataBlockSeek(reader, start);
+    for (block = start; block < end; block++)
+    {
+        if (OmReaderLoadBlock(state) > 0 && state->blockEnd > time) { result = block; break; }
+        if (block + 1 == end) { result = end; }     // Requested time is after the window
+    }
+
+    // Position the reader so that the next block read is the one found
+    OmReaderDataBlockSeek(reader, result);
+
+    return result;
+}
+
+
+int OmReaderNextBlock(OmReaderHandle reader)
+{
+    int numSamples;
+
+    // Check parameter
+    OmReaderState *state = (OmReaderState *)reader;
+    if (state == NULL) { return OM_E_POINTER; }
+
+    // Read the block, and unpack the samples to the reader's buffer
+    numSamples = OmReaderLoadBlock(state);
+    if (numSamples > 0)
+    {
+        OmReaderUnpack(state->data, state->bytesPerSample, numSamples, state->samples + 0, state->samples + 1, state->samples + 2, 3);
+    }
+
+    return numSamples;
+}
+
+
+int OmReaderNextBlocks(OmReaderHandle reader, int maxBlocks, short *buffer, int maxSamples, unsigned long long *timestamps, int planar)
+{
+    int totalSamples = 0;
+    int block;
+
+    // Check parameters
+    OmReaderState *state = (OmReaderState *)reader;
+    if (state == NULL || buffer == NULL) { return OM_E_POINTER; }
+    if (maxBlocks <= 0 || maxSamples < OM_MAX_SAMPLES) { return OM_E_INVALID_ARG; }
+
+    // Read blocks while there is room for another full block
+    for (block = 0; block < maxBlocks && maxSamples - totalSamples >= OM_MAX_SAMPLES; block++)
+    {
+        int position = OmReaderDataBlockPosition(reader);
+        int numSamples = OmReaderLoadBlock(state);
+
+        // If there is an error (or end-of-file) after some samples were read, return those samples and leave the error for the next call
+        if (numSamples < 0)
+        {
+            if (totalSamples > 0) { OmReaderDataBlockSeek(reader, position); break; }
+            return numSamples;
+        }
+
+        // Skip unreadable blocks
+        if (numSamples == 0) { continue; }
+
+        // Unpack directly to the output buffer
+        if (planar)
+        {
+            OmReaderUnpack(state->data, state->bytesPerSample, numSamples, buffer + totalSamples, buffer + maxSamples + totalSamples, buffer + 2 * maxSamples + totalSamples, 1);
+        }
+        else
+        {
+            short *p = buffer + 3 * totalSamples;
+            OmReaderUnpack(state->data, state->bytesPerSample, numSamples, p + 0, p + 1, p + 2, 3);
+        }
+
+        // Interpolate the sample times across the block (as OmReaderTimestamp)
+        if (timestamps != NULL)
+        {
+            unsigned long long blockDuration = state->blockEnd - state->blockStart;
+            int i;
+            for (i = 0; i < numSamples; i++)
+            {
+                timestamps[totalSamples + i] = state->blockStart + (i * blockDuration / numSamples);
+            }
+        }
+
+        totalSamples += numSamples;
+    }
+
+    return totalSamples;
+}
+
+
 short *OmReaderBuffer(OmReaderHandle reader)
 { 
     OmReaderState *state = (OmReaderState *)reader;
@@ -522,14 +1032,14 @@ static unsigned int AdcBattToPercent(unsigned int Vbat)
 int OmReaderGetValue(OmReaderHandle reader, OM_READER_VALUE_TYPE valueType)
 { 
     OmReaderState *state = (OmReaderState *)reader;
-    OM_READER_DATA_PACKET *dataPacket;
+    const OM_READER_DATA_PACKET *dataPacket;
 
     // Check parameter
     if (state == NULL) { return -1; }
 
     //if (state->numSamples == 0)
 
-    dataPacket = OmReaderRawDataPacket(reader);
+    dataPacket = (const OM_READER_DATA_PACKET *)state->data;     // (read in place, without the copy made by OmReaderRawDataPacket())
     if (dataPacket == NULL) { return -1; }
 
     switch (valueType)
@@ -558,15 +1068,94 @@ int OmReaderGetValue(OmReaderHandle reader, OM_READER_VALUE_TYPE valueType)
 
 OM_READER_HEADER_PACKET *OmReaderRawHeaderPacket(OmReaderHandle reader) 
 {
-    if (reader == NULL) { return NULL; }
-    return (OM_READER_HEADER_PACKET *)&(((OmReaderState *)reader)->header[0]); 
+    OmReaderState *state = (OmReaderState *)reader;
+    if (state == NULL) { return NULL; }
+    // A caller's (read-only) buffer is not handed out: the packet is copied to the header buffer (a mapped file is a private, writeable copy)
+    if (state->fp == NULL && state->header != state->headerBuffer)
+    {
+        memcpy(state->headerBuffer, state->header, OM_MAX_HEADER_SIZE);
+        state->header = state->headerBuffer;
+    }
+    return (OM_READER_HEADER_PACKET *)state->header; 
 }
 
 
 OM_READER_DATA_PACKET *OmReaderRawDataPacket(OmReaderHandle reader) 
 { 
-    if (reader == NULL) { return NULL; }
-    return (OM_READER_DATA_PACKET *)&(((OmReaderState *)reader)->data[0]); 
+    OmReaderState *state = (OmReaderState *)reader;
+    if (state == NULL) { return NULL; }
+    // A caller's (read-only) buffer is not handed out: the packet is copied to the data buffer
+    if (state->fp == NULL && state->data != state->dataBuffer)
+    {
+        memcpy(state->dataBuffer, state->data, OM_BLOCK_SIZE);
+        state->data = state->dataBuffer;
+    }
+    return (OM_READER_DATA_PACKET *)state->data; 
+}
+
+
+int OmReaderReadAhead(OmReaderHandle reader, int depth)
+{
+    OmReaderState *state = (OmReaderState *)reader;
+
+    // Check parameters
+    if (state == NULL) { return OM_E_POINTER; }
+    if (depth < 0) { return OM_E_INVALID_ARG; }
+
+#ifdef OM_READER_READAHEAD
+    // Nothing to read ahead from a memory buffer
+    if (state->fp == NULL) { return OM_OK; }
+
+    // Stop any existing read-ahead (the file pointer is then used directly from the current position)
+    OmReaderReadAheadStop(state);
+    fseek(state->fp, state->position, SEEK_SET);
+    if (depth == 0) { return OM_OK; }
+
+#ifdef OM_READER_MMAP
+    // Read-ahead replaces the mapping: move the header and current block to the buffers and read through the file pointer
+    if (state->map != NULL)
+    {
+        if (state->header != state->headerBuffer)
+        {
+            memcpy(state->headerBuffer, state->header, OM_MAX_HEADER_SIZE);
+            state->header = state->headerBuffer;
+        }
+        if (state->data != state->dataBuffer)
+        {
+            memcpy(state->dataBuffer, state->data, OM_BLOCK_SIZE);
+            state->data = state->dataBuffer;
+        }
+        munmap((void *)state->map, state->fileSize);
+        state->map = NULL;
+    }
+#endif
+
+    // Allocate the buffers and start the thread reading from the current position
+    state->chunks = (OmReaderChunk *)malloc(depth * sizeof(OmReaderChunk));
+    if (state->chunks == NULL) { return OM_E_OUT_OF_MEMORY; }
+    state->depth = depth;
+    state->head = 0;
+    state->count = 0;
+    state->readAheadPosition = state->position;
+    state->generation = 0;
+    state->quitReadAhead = 0;
+    mutex_init(&state->readAheadMutex, NULL);
+    cond_init(&state->readAheadCond, NULL);
+    if (thread_create(&state->readAheadThread, NULL, OmReaderReadAheadThread, state) != 0)
+    {
+        cond_destroy(&state->readAheadCond);
+        mutex_destroy(&state->readAheadMutex);
+        free(state->chunks);
+        state->chunks = NULL;
+        state->depth = 0;
+        fseek(state->fp, state->position, SEEK_SET);
+        return OM_E_FAIL;
+    }
+
+    return OM_OK;
+#else
+    return (depth == 0) ? OM_OK : OM_E_NOT_IMPLEMENTED;
+#endif
 }
 
 
@@ -575,12 +1164,7 @@ void OmReaderClose(OmReaderHandle reader)
     OmReaderState *state = (OmReaderState *)reader;
 
     if (state == NULL) { return; }
-    if (state->fp != NULL)
-    {
-        fclose(state->fp);
-        state->fp = NULL;
-    }
-    free(state);
+    OmReaderFree(state);
     return; 
 }
 
@@ -28,6 +28,15 @@
 #include "omapi-internal.h"
 
 
+/** Internal method to check a batched command received its response, and the response has a value after its prefix (as the parts[1] check after OM_COMMAND) */
+static int OmBatchCheckValue(const OM_BATCH_COMMAND *command)
+{
+    if (OM_FAILED(command->result)) { return command->result; }
+    if (command->response == NULL || command->response[strlen(command->expected)] == '\0') { return OM_E_UNEXPECTED_RESPONSE; }
+    return OM_OK;
+}
+
+
 int OmGetDelays(int deviceId, OM_DATETIME *startTime, OM_DATETIME *stopTime)
 {
     int status;
@@ -51,28 +60,39 @@ int OmGetDelays(int deviceId, OM_DATETIME *startTime, OM_DATETIME *stopTime)
 
 int OmSetDelays(int deviceId, OM_DATETIME startTime, OM_DATETIME stopTime)
 {
-    char command[64];
-    int status1 = OM_E_UNEXPECTED, status2 = OM_E_UNEXPECTED;
-    char response[OM_MAX_RESPONSE_SIZE], *parts[2] = {0};
+    char command1[64], command2[64];
+    char responses[2][OM_MAX_RESPONSE_SIZE];
+    OM_BATCH_COMMAND batch[2] = {{0}};
+    int status, i;
 
     {
-        if (startTime < OM_DATETIME_MIN_VALID) { sprintf(command, "\r\nHIBERNATE 0\r\n"); }
-        else if (startTime > OM_DATETIME_MAX_VALID) { sprintf(command, "\r\nHIBERNATE -1\r\n"); }
-        else sprintf(command, "\r\nHIBERNATE %04u-%02u-%02u %02u:%02u:%02u\r\n", OM_DATETIME_YEAR(startTime), OM_DATETIME_MONTH(startTime), OM_DATETIME_DAY(startTime), OM_DATETIME_HOURS(startTime), OM_DATETIME_MINUTES(startTime), OM_DATETIME_SECONDS(startTime));
-        status1 = OM_COMMAND(deviceId, command, response, "HIBERNATE=", OM_DEFAULT_TIMEOUT, parts);
-        if (parts[1] == NULL) { status1 = OM_E_UNEXPECTED_RESPONSE; }
+        if (startTime < OM_DATETIME_MIN_VALID) { sprintf(command1, "\r\nHIBERNATE 0\r\n"); }
+        else if (startTime > OM_DATETIME_MAX_VALID) { sprintf(command1, "\r\nHIBERNATE -1\r\n"); }
+        else sprintf(command1, "\r\nHIBERNATE %04u-%02u-%02u %02u:%02u:%02u\r\n", OM_DATETIME_YEAR(startTime), OM_DATETIME_MONTH(startTime), OM_DATETIME_DAY(startTime), OM_DATETIME_HOURS(startTime), OM_DATETIME_MINUTES(startTime), OM_DATETIME_SECONDS(startTime));
+        batch[0].command = command1;
+        batch[0].expected = "HIBERNATE=";
+        batch[0].response = responses[0];
+        batch[0].responseSize = sizeof(responses[0]);
     }
 
     {
-        if (stopTime < OM_DATETIME_MIN_VALID) { sprintf(command, "\r\nSTOP 0\r\n"); }
-        else if (stopTime > OM_DATETIME_MAX_VALID) { sprintf(command, "\r\nSTOP -1\r\n"); }
-        else sprintf(command, "\r\nSTOP %04u-%02u-%02u %02u:%02u:%02u\r\n", OM_DATETIME_YEAR(stopTime), OM_DATETIME_MONTH(stopTime), OM_DATETIME_DAY(stopTime), OM_DATETIME_HOURS(stopTime), OM_DATETIME_MINUTES(stopTime), OM_DATETIME_SECONDS(stopTime));
-        status2 = OM_COMMAND(deviceId, command, response, "STOP=", OM_DEFAULT_TIMEOUT, parts);
-        if (parts[1] == NULL) { status2 = OM_E_UNEXPECTED_RESPONSE; }
+        if (stopTime < OM_DATETIME_MIN_VALID) { sprintf(command2, "\r\nSTOP 0\r\n"); }
+        else if (stopTime > OM_DATETIME_MAX_VALID) { sprintf(command2, "\r\nSTOP -1\r\n"); }
+        else sprintf(command2, "\r\nSTOP %04u-%02u-%02u %02u:%02u:%02u\r\n", OM_DATETIME_YEAR(stopTime), OM_DATETIME_MONTH(stopTime), OM_DATETIME_DAY(stopTime), OM_DATETIME_HOURS(stopTime), OM_DATETIME_MINUTES(stopTime), OM_DATETIME_SECONDS(stopTime));
+        batch[1].command = command2;
+        batch[1].expected = "STOP=";
+        batch[1].response = responses[1];
+        batch[1].responseSize = sizeof(responses[1]);
     }
 
-    if (OM_FAILED(status1)) return status1;
-    if (OM_FAILED(status2)) return status2;
+    // Send both commands without waiting for the first response
+    status = OmCommandBatch(deviceId, batch, 2, 2 * OM_DEFAULT_TIMEOUT);
+    if (OM_FAILED(status)) return status;
+    for (i = 0; i < 2; i++)
+    {
+        status = OmBatchCheckValue(&batch[i]);
+        if (OM_FAILED(status)) return status;
+    }
     return OM_OK;
 }
 
@@ -88,6 +108,7 @@ int OmEraseDataAndCommit(int deviceId, OM_ERASE_LEVEL level)
     if (OM_FAILED(status)) return status;
     if (downloadStatus == OM_DOWNLOAD_PROGRESS) return OM_E_NOT_VALID_STATE;
 
+    // (Not batched: this is a single command, and the device's flash write dominates its response time)
     if (level == OM_ERASE_NONE)
     {
         status = OM_COMMAND(deviceId, "\r\ncommit\r\n", response, "COMMIT", 6000, parts);   // Update file
@@ -185,19 +206,20 @@ int OmGetMetadata(int deviceId, char *metadata)
 
 int OmSetMetadata(int deviceId, const char *metadata, int size)
 {
-    int chunk;
+    char commands[14][64], expected[14][32], responses[14][OM_MAX_RESPONSE_SIZE];
+    OM_BATCH_COMMAND batch[14];
+    int status, chunk;
 
     if (metadata == NULL && size != 0) { return OM_E_POINTER; }
 
-    // Write each chunk
+    // Build each chunk
     for (chunk = 0; chunk < 14; chunk++)
     {
-        char command[64], expected[32];
-        int status, o;
+        char *command = commands[chunk];
+        int o;
         char *p;
-        char response[OM_MAX_RESPONSE_SIZE], *parts[2] = {0};
         sprintf(command, "\r\nANNOTATE%02d=", chunk);
-        sprintf(expected, "ANNOTATE%02d=", chunk);
+        sprintf(expected[chunk], "ANNOTATE%02d=", chunk);
 
         p = command + strlen(command);
         for (o = 0; o < 32; o++)
@@ -210,9 +232,20 @@ int OmSetMetadata(int deviceId, const char *metadata, int size)
         }
         *p++ = '\r'; *p++ = '\n'; *p++ = '\0';
 
-        status = OM_COMMAND(deviceId, command, response, expected, OM_DEFAULT_TIMEOUT, parts);
+        memset(&batch[chunk], 0, sizeof(batch[chunk]));
+        batch[chunk].command = command;
+        batch[chunk].expected = expected[chunk];
+        batch[chunk].response = responses[chunk];
+        batch[chunk].responseSize = sizeof(responses[chunk]);
+    }
+
+    // Write all chunks without waiting for each response
+    status = OmCommandBatch(deviceId, batch, 14, 2 * OM_DEFAULT_TIMEOUT);
+    if (OM_FAILED(status)) return status;
+    for (chunk = 0; chunk < 14; chunk++)
+    {
+        status = OmBatchCheckValue(&batch[chunk]);
         if (OM_FAILED(status)) return status;
-        if (parts[1] == NULL) { return OM_E_UNEXPECTED_RESPONSE; }
     }
     return OM_OK;
 }
@@ -312,6 +345,7 @@ int OmSetAccelConfig(int deviceId, int rate, int range)
         default: return OM_E_INVALID_ARG;
     }
 
+    // (Not batched: this is a single command -- the caller may batch it with other settings through OmCommandBatch())
     sprintf(command, "\r\nRATE %u\r\n", value);
     status = OM_COMMAND(deviceId, command, response, "RATE=", OM_DEFAULT_TIMEOUT, parts);
     if (OM_FAILED(status)) return status;
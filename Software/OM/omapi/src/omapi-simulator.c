@@ -0,0 +1,601 @@
+/*
+ * Copyright (c) 2009-2012, Newcastle University, UK.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Open Movement API - Simulated Devices
+// (A pseudo-terminal answering the device commands, and a directory standing in for the device's volume, for testing without hardware)
+
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     // posix_openpt(), ptsname(), cfmakeraw()
+#endif
+
+#include "omapi-internal.h"
+
+#include <math.h>
+#include <sys/stat.h>
+
+
+#ifdef _WIN32
+
+int OmAddSimulatedDevice(int deviceId, const char *volumePath, int dataBlocks, unsigned int latency, unsigned int readRate)
+{
+    return OM_E_NOT_IMPLEMENTED;
+}
+
+int OmRemoveSimulatedDevice(int deviceId)
+{
+    return OM_E_NOT_IMPLEMENTED;
+}
+
+void OmSimulatorStartup(void) { ; }
+void OmSimulatorShutdown(void) { ; }
+void OmSimulatorThrottle(int deviceId, int bytes) { ; }
+
+#else
+
+
+// Simulated device parameters
+#define OM_SIMULATOR_ENVIRONMENT "OMAPI_SIMULATE"       // "count[,latency[,readRate[,dataBlocks]]]" to add simulated devices at start-up
+#define OM_SIMULATOR_FIRST_ID 60001                     // First device ID used for simulated devices added at start-up
+#define OM_SIMULATOR_FIRMWARE 45
+#define OM_SIMULATOR_HARDWARE 17
+#define OM_SIMULATOR_RATE 0x4a                          // 100 Hz, +/- 8 g
+#define OM_SIMULATOR_SAMPLES 120                        // Samples per block (packed)
+
+
+// Simulated device state
+struct OmSimulatedDevice_t
+{
+    struct OmSimulatedDevice_t *next;
+    int id;
+    int master;                         // Pseudo-terminal master (the device side)
+    int slave;                          // Pseudo-terminal slave, held open so that the master does not see a hang-up between commands
+    int wakeFd[2];                      // Pipe used to wake the device thread
+    thread_t thread;
+    volatile char quit;
+    char dataFile[OM_MAX_PATH];
+    unsigned int latency;               // Delay before each response (milliseconds)
+    unsigned int readRate;              // Maximum volume read rate (bytes per second, 0 = no limit)
+    unsigned long long readNext;        // Time the next read may start at the maximum rate (milliseconds since epoch), simulatorMutex must be held
+
+    // Received command line
+    char line[OM_MAX_RESPONSE_SIZE];
+    int lineLength;
+
+    // Settings (only used by the device thread)
+    unsigned int sessionId;
+    unsigned int rate;
+    unsigned int maxSamples;
+    OM_DATETIME startTime, stopTime, lastChanged;
+    int led, ecc;
+    unsigned short lockCode;
+    char locked;
+    time_t timeOffset;
+    char annotation[OM_METADATA_SIZE];
+};
+
+
+/** Internal, the simulated device's current clock time */
+static OM_DATETIME OmSimulatorNow(OmSimulatedDevice *device)
+{
+    time_t now = time(NULL) + device->timeOffset;
+    struct tm tm;
+    localtime_r(&now, &tm);
+    return OM_DATETIME_FROM_YMDHMS(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+
+/** Internal, format a time as the device does: "2011/11/30,02:50:53", or "0" / "-1" for the special values */
+static char *OmSimulatorTimeString(OM_DATETIME value, char *buffer)
+{
+    if (value < OM_DATETIME_MIN_VALID) { strcpy(buffer, "0"); }
+    else if (value > OM_DATETIME_MAX_VALID) { strcpy(buffer, "-1"); }
+    else { sprintf(buffer, "%04u/%02u/%02u,%02u:%02u:%02u", OM_DATETIME_YEAR(value), OM_DATETIME_MONTH(value), OM_DATETIME_DAY(value), OM_DATETIME_HOURS(value), OM_DATETIME_MINUTES(value), OM_DATETIME_SECONDS(value)); }
+    return buffer;
+}
+
+
+/** Internal, store little-endian values (the byte order of the file format) */
+static void OmSimulatorPut16(unsigned char *p, unsigned int value) { p[0] = (unsigned char)value; p[1] = (unsigned char)(value >> 8); }
+static void OmSimulatorPut32(unsigned char *p, unsigned long value) { OmSimulatorPut16(p, (unsigned int)(value & 0xffff)); OmSimulatorPut16(p + 2, (unsigned int)((value >> 16) & 0xffff)); }
+
+
+/** Internal, write the header blocks for the current settings */
+static void OmSimulatorHeader(OmSimulatedDevice *device, unsigned char *buffer)
+{
+    memset(buffer, 0xff, 2 * OM_BLOCK_SIZE);
+    memset(buffer, 0x00, OM_BLOCK_SIZE);
+    buffer[0] = 'M'; buffer[1] = 'D';                                   // @ 0 packetHeader
+    OmSimulatorPut16(buffer + 2, 2 * OM_BLOCK_SIZE - 4);                // @ 2 packetLength
+    OmSimulatorPut16(buffer + 5, (unsigned int)device->id);             // @ 5 deviceId
+    OmSimulatorPut32(buffer + 7, device->sessionId);                    // @ 7 sessionId
+    OmSimulatorPut32(buffer + 13, device->startTime);                   // @13 loggingStartTime
+    OmSimulatorPut32(buffer + 17, device->stopTime);                    // @17 loggingEndTime
+    OmSimulatorPut32(buffer + 21, device->maxSamples);                  // @21 loggingCapacity
+    buffer[36] = (unsigned char)device->rate;                           // @36 samplingRate
+    OmSimulatorPut32(buffer + 37, device->lastChanged);                 // @37 lastChangeTime
+    buffer[41] = OM_SIMULATOR_FIRMWARE;                                 // @41 firmwareRevision
+    OmSimulatorPut16(buffer + 42, 0xffff);                              // @42 timeZone (unknown)
+    memcpy(buffer + 64, device->annotation, OM_METADATA_SIZE);          // @64 annotation
+}
+
+
+/** Internal, generate a data file: the header, then data blocks of a slowly rotating 1 g vector recorded up to the present */
+static int OmSimulatorGenerate(OmSimulatedDevice *device, int dataBlocks)
+{
+    unsigned char buffer[2 * OM_BLOCK_SIZE];
+    double frequency = 3200.0 / (1 << (15 - (OM_SIMULATOR_RATE & 0x0f)));
+    double start;
+    FILE *fp;
+    int block;
+
+    fp = fopen(device->dataFile, "wb");
+    if (fp == NULL) { return OM_E_ACCESS_DENIED; }
+
+    OmSimulatorHeader(device, buffer);
+    fwrite(buffer, 1, 2 * OM_BLOCK_SIZE, fp);
+
+    // The recording ends now, on a whole second
+    start = (double)(time(NULL) + device->timeOffset) - ceil((double)dataBlocks * OM_SIMULATOR_SAMPLES / frequency);
+    for (block = 0; block < dataBlocks; block++)
+    {
+        double blockStart = start + (double)block * OM_SIMULATOR_SAMPLES / frequency;
+        time_t whole = (time_t)ceil(blockStart);
+        unsigned short checksum;
+        struct tm tm;
+        int i;
+
+        memset(buffer, 0, OM_BLOCK_SIZE);
+        localtime_r(&whole, &tm);
+        buffer[0] = 'A'; buffer[1] = 'X';                                           // @ 0 packetHeader
+        OmSimulatorPut16(buffer + 2, OM_BLOCK_SIZE - 4);                            // @ 2 packetLength
+        OmSimulatorPut16(buffer + 4, (unsigned int)device->id & 0x7fff);            // @ 4 deviceFractional (device identifier)
+        OmSimulatorPut32(buffer + 6, device->sessionId);                            // @ 6 sessionId
+        OmSimulatorPut32(buffer + 10, (unsigned long)block);                        // @10 sequenceId
+        OmSimulatorPut32(buffer + 14, OM_DATETIME_FROM_YMDHMS(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec));    // @14 timestamp
+        OmSimulatorPut16(buffer + 18, 300 + (block % 50));                          // @18 light
+        OmSimulatorPut16(buffer + 20, 400);                                         // @20 temperature
+        buffer[23] = 200;                                                           // @23 battery
+        buffer[24] = OM_SIMULATOR_RATE;                                             // @24 sampleRate
+        buffer[25] = 0x30;                                                          // @25 numAxesBPS (3 axes, packed)
+        OmSimulatorPut16(buffer + 26, (unsigned int)(short)floor((whole - blockStart) * frequency + 0.5));    // @26 timestampOffset
+        OmSimulatorPut16(buffer + 28, OM_SIMULATOR_SAMPLES);                        // @28 sampleCount
+
+        // @30 sampleData
+        for (i = 0; i < OM_SIMULATOR_SAMPLES; i++)
+        {
+            double t = (block * OM_SIMULATOR_SAMPLES + i) / frequency;
+            double a = t * 0.05, b = t * 0.03;
+            int x = (int)(256 * sin(a) * cos(b)) + (i % 3) - 1;
+            int y = (int)(256 * sin(a) * sin(b)) + (i % 5) - 2;
+            int z = (int)(256 * cos(a)) + (i % 7) - 3;
+            OmSimulatorPut32(buffer + 30 + 4 * i, ((unsigned long)x & 0x3ff) | (((unsigned long)y & 0x3ff) << 10) | (((unsigned long)z & 0x3ff) << 20));     // (exponent 0)
+        }
+
+        // @510 checksum: the 16-bit word-wise sum of the whole packet is zero
+        checksum = 0;
+        for (i = 0; i < OM_BLOCK_SIZE - 2; i += 2) { checksum += (unsigned short)(buffer[i] | (buffer[i + 1] << 8)); }
+        OmSimulatorPut16(buffer + OM_BLOCK_SIZE - 2, (unsigned short)(0x10000 - checksum));
+
+        if (fwrite(buffer, 1, OM_BLOCK_SIZE, fp) != OM_BLOCK_SIZE) { fclose(fp); return OM_E_ACCESS_DENIED; }
+    }
+
+    fclose(fp);
+    return OM_OK;
+}
+
+
+/** Internal, rewrite the header of the data file with the current settings (clearing the data if requested) */
+static int OmSimulatorCommit(OmSimulatedDevice *device, int clear)
+{
+    unsigned char buffer[2 * OM_BLOCK_SIZE];
+    FILE *fp;
+
+    if (clear) { return OmSimulatorGenerate(device, 0); }
+    fp = fopen(device->dataFile, "r+b");
+    if (fp == NULL) { return OmSimulatorGenerate(device, 0); }
+    OmSimulatorHeader(device, buffer);
+    fwrite(buffer, 1, 2 * OM_BLOCK_SIZE, fp);
+    fclose(fp);
+    return OM_OK;
+}
+
+
+/** Internal, respond to a command line */
+static void OmSimulatorCommand(OmSimulatedDevice *device, char *line)
+{
+    char response[OM_MAX_RESPONSE_SIZE + 16], timeString[32];
+    char *argument;
+    int hasArgument;
+
+    // Command word (case-insensitive) and any argument
+    argument = strchr(line, ' ');
+    if (argument != NULL) { *argument++ = '\0'; }
+    else { argument = line + strlen(line); }
+    hasArgument = (*argument != '\0');
+    { char *c; for (c = line; *c != '\0' && *c != '='; c++) { if (*c >= 'a' && *c <= 'z') { *c -= 'a' - 'A'; } } }
+
+    // Settings cannot be changed while locked
+    if (device->locked && (hasArgument || strchr(line, '=') != NULL || !strcmp(line, "COMMIT") || !strcmp(line, "CLEAR") || !strcmp(line, "FORMAT")) && strcmp(line, "UNLOCK") && strcmp(line, "LED") && strcmp(line, "SAMPLE") && strcmp(line, "STATUS"))
+    {
+        strcpy(response, "ERROR: Locked.");
+    }
+    else if (!strcmp(line, "ID"))
+    {
+        sprintf(response, "ID=CWA,%d,%d,%d,%u", OM_SIMULATOR_HARDWARE, OM_SIMULATOR_FIRMWARE, device->id, device->sessionId);
+    }
+    else if (!strcmp(line, "SAMPLE") && atoi(argument) == 1)
+    {
+        strcpy(response, "$BATT=708,4180,mV,100,1");
+    }
+    else if (!strcmp(line, "SAMPLE") && atoi(argument) == 5)
+    {
+        strcpy(response, "$ACCEL=0,0,256");
+    }
+    else if (!strcmp(line, "STATUS") && atoi(argument) == 1)
+    {
+        strcpy(response, "TEST=0000");
+    }
+    else if (!strcmp(line, "STATUS") && atoi(argument) == 2)
+    {
+        strcpy(response, "BATTHEALTH=12");
+    }
+    else if (!strcmp(line, "STATUS") && atoi(argument) == 3)
+    {
+        strcpy(response, "FTL=1,0,106,2,8,0");
+    }
+    else if (!strcmp(line, "LED"))
+    {
+        if (hasArgument) { device->led = atoi(argument); }
+        sprintf(response, "LED=%d", device->led);
+    }
+    else if (!strcmp(line, "ECC"))
+    {
+        if (hasArgument) { device->ecc = atoi(argument); }
+        sprintf(response, "ECC=%d", device->ecc);
+    }
+    else if (!strcmp(line, "TIME"))
+    {
+        if (hasArgument)
+        {
+            OM_DATETIME value = OmDateTimeFromString(argument);
+            struct tm tm;
+            memset(&tm, 0, sizeof(tm));
+            tm.tm_year = OM_DATETIME_YEAR(value) - 1900; tm.tm_mon = OM_DATETIME_MONTH(value) - 1; tm.tm_mday = OM_DATETIME_DAY(value);
+            tm.tm_hour = OM_DATETIME_HOURS(value); tm.tm_min = OM_DATETIME_MINUTES(value); tm.tm_sec = OM_DATETIME_SECONDS(value);
+            tm.tm_isdst = -1;
+            device->timeOffset = mktime(&tm) - time(NULL);
+        }
+        sprintf(response, "$TIME=%s", OmSimulatorTimeString(OmSimulatorNow(device), timeString));
+    }
+    else if (!strcmp(line, "LOCK"))
+    {
+        sprintf(response, "LOCK=%d", (device->locked ? 1 : 0) | (device->lockCode ? 2 : 0));
+    }
+    else if (!strcmp(line, "ILOCK"))
+    {
+        device->lockCode = (unsigned short)atoi(argument);
+        device->locked = (device->lockCode != 0);
+        sprintf(response, "ILOCK=%u", device->lockCode);
+    }
+    else if (!strcmp(line, "UNLOCK"))
+    {
+        if (device->lockCode == 0 || (unsigned short)atoi(argument) == device->lockCode) { device->locked = 0; }
+        sprintf(response, "LOCK=%d", device->locked ? 1 : 0);
+    }
+    else if (!strcmp(line, "HIBERNATE") || !strcmp(line, "STOP"))
+    {
+        OM_DATETIME *value = !strcmp(line, "STOP") ? &device->stopTime : &device->startTime;
+        if (hasArgument) { *value = OmDateTimeFromString(argument); device->lastChanged = OmSimulatorNow(device); }
+        sprintf(response, "%s=%s", line, OmSimulatorTimeString(*value, timeString));
+    }
+    else if (!strcmp(line, "SESSION"))
+    {
+        if (hasArgument) { device->sessionId = (unsigned int)strtoul(argument, NULL, 10); device->lastChanged = OmSimulatorNow(device); }
+        sprintf(response, "SESSION=%u", device->sessionId);
+    }
+    else if (!strcmp(line, "RATE"))
+    {
+        if (hasArgument) { device->rate = (unsigned int)atoi(argument); device->lastChanged = OmSimulatorNow(device); }
+        sprintf(response, "RATE=%u,%u", device->rate, 3200 / (1 << (15 - (device->rate & 0x0f))));
+    }
+    else if (!strcmp(line, "MAXSAMPLES"))
+    {
+        if (hasArgument) { device->maxSamples = (unsigned int)strtoul(argument, NULL, 10); device->lastChanged = OmSimulatorNow(device); }
+        sprintf(response, "MAXSAMPLES=%u", device->maxSamples);
+    }
+    else if (!strcmp(line, "LASTCHANGED"))
+    {
+        sprintf(response, "LASTCHANGED=%s", OmSimulatorTimeString(device->lastChanged, timeString));
+    }
+    else if (!strncmp(line, "ANNOTATE", 8) && line[8] >= '0' && line[8] <= '9' && line[9] >= '0' && line[9] <= '9' && atoi(line + 8) < OM_METADATA_SIZE / 32)
+    {
+        int chunk = atoi(line + 8);
+        char *value = strchr(line, '=');
+        if (value != NULL)
+        {
+            // (the annotation may itself contain spaces, so restore the argument)
+            int o;
+            if (hasArgument) { argument[-1] = ' '; }
+            value++;
+            for (o = 0; o < 32; o++) { device->annotation[32 * chunk + o] = (*value != '\0') ? *value++ : ' '; }
+            device->lastChanged = OmSimulatorNow(device);
+        }
+        sprintf(response, "ANNOTATE%02d=%.32s", chunk, device->annotation + 32 * chunk);
+    }
+    else if (!strcmp(line, "COMMIT"))
+    {
+        strcpy(response, OM_FAILED(OmSimulatorCommit(device, 0)) ? "ERROR: Commit failed." : "COMMIT");
+    }
+    else if (!strcmp(line, "CLEAR") || !strcmp(line, "FORMAT"))
+    {
+        strcpy(response, OM_FAILED(OmSimulatorCommit(device, 1)) ? "ERROR: Commit failed." : "COMMIT");
+    }
+    else
+    {
+        sprintf(response, "ERROR: Unknown command: %.64s", line);
+    }
+
+    // Simulated latency
+    if (device->latency > 0) { usleep(device->latency * 1000UL); }
+
+    strcat(response, "\r\n");
+    if (write(device->master, response, strlen(response)) < 0) { OmLog(2, "SIMULATOR: Write failed (%d)\n", device->id); }
+}
+
+
+/** Internal, simulated device thread: reads command lines from the pseudo-terminal and responds. */
+static thread_return_t OmSimulatorThread(void *arg)
+{
+    OmSimulatedDevice *device = (OmSimulatedDevice *)arg;
+
+    while (!device->quit)
+    {
+        struct pollfd fds[2];
+        char buffer[256];
+        int len, i;
+
+        fds[0].fd = device->wakeFd[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = device->master;
+        fds[1].events = POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR) { continue; }
+            break;
+        }
+        if (device->quit) { break; }
+        if (!(fds[1].revents & POLLIN)) { continue; }
+
+        len = read(device->master, buffer, sizeof(buffer));
+        if (len <= 0) { continue; }
+        for (i = 0; i < len; i++)
+        {
+            char c = buffer[i];
+            if (c == '\r' || c == '\n')
+            {
+                device->line[device->lineLength] = '\0';
+                if (device->lineLength > 0) { OmSimulatorCommand(device, device->line); }
+                device->lineLength = 0;
+            }
+            else if (device->lineLength < (int)sizeof(device->line) - 1)
+            {
+                device->line[device->lineLength++] = c;
+            }
+        }
+    }
+
+    return thread_return_value(0);
+}
+
+
+/** Internal, free a simulated device that is not (or no longer) in the list */
+static void OmSimulatorDestroy(OmSimulatedDevice *device)
+{
+    if (device->wakeFd[1] >= 0)
+    {
+        device->quit = 1;
+        if (write(device->wakeFd[1], "", 1) != 1) { thread_cancel(&device->thread); }
+        thread_join(&device->thread, NULL);
+    }
+    if (device->wakeFd[0] >= 0) { close(device->wakeFd[0]); }
+    if (device->wakeFd[1] >= 0) { close(device->wakeFd[1]); }
+    if (device->slave >= 0) { close(device->slave); }
+    if (device->master >= 0) { close(device->master); }
+    free(device);
+}
+
+
+int OmAddSimulatedDevice(int deviceId, const char *volumePath, int dataBlocks, unsigned int latency, unsigned int readRate)
+{
+    OmSimulatedDevice *device;
+    OmDeviceState *deviceState;
+    struct termios options;
+    struct stat s;
+    int status;
+
+    if (!om.initialized) { return OM_E_NOT_VALID_STATE; }
+    if (volumePath == NULL) { return OM_E_POINTER; }
+    if (deviceId <= 0 || deviceId > OM_MAX_SERIAL || strlen(volumePath) >= OM_MAX_MSD_PATH) { return OM_E_INVALID_ARG; }
+    deviceState = OmDeviceFind(deviceId);
+    if (deviceState != NULL && deviceState->deviceStatus == OM_DEVICE_CONNECTED) { return OM_E_INVALID_DEVICE; }
+
+    // The volume directory
+    if (stat(volumePath, &s) != 0 && mkdir(volumePath, 0777) != 0) { return OM_E_ACCESS_DENIED; }
+
+    device = (OmSimulatedDevice *)malloc(sizeof(OmSimulatedDevice));
+    if (device == NULL) { return OM_E_OUT_OF_MEMORY; }
+    memset(device, 0, sizeof(OmSimulatedDevice));
+    device->id = deviceId;
+    device->slave = -1;
+    device->wakeFd[0] = device->wakeFd[1] = -1;
+    device->latency = latency;
+    device->readRate = readRate;
+    device->sessionId = 1;
+    device->rate = OM_SIMULATOR_RATE;
+    device->stopTime = 0xffffffff;
+    memset(device->annotation, ' ', OM_METADATA_SIZE);
+    snprintf(device->dataFile, sizeof(device->dataFile), "%s/%s", volumePath, OM_DEFAULT_FILENAME);
+
+    // The data file
+    status = OM_OK;
+    if (dataBlocks >= 0) { status = OmSimulatorGenerate(device, dataBlocks); }
+    else if (stat(device->dataFile, &s) != 0) { status = OmSimulatorGenerate(device, 0); }
+    if (OM_FAILED(status)) { OmSimulatorDestroy(device); return status; }
+
+    // The pseudo-terminal, in raw mode (the serial port settings are otherwise left to OmPortOpen())
+    device->master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (device->master < 0 || grantpt(device->master) != 0 || unlockpt(device->master) != 0 || (device->slave = open(ptsname(device->master), O_RDWR | O_NOCTTY)) < 0)
+    {
+        OmSimulatorDestroy(device);
+        return OM_E_ACCESS_DENIED;
+    }
+    tcgetattr(device->slave, &options);
+    cfmakeraw(&options);
+    tcsetattr(device->slave, TCSANOW, &options);
+
+    if (pipe(device->wakeFd) != 0)
+    {
+        device->wakeFd[0] = device->wakeFd[1] = -1;
+        OmSimulatorDestroy(device);
+        return OM_E_UNEXPECTED;
+    }
+    if (thread_create(&device->thread, NULL, OmSimulatorThread, device) != 0)
+    {
+        close(device->wakeFd[0]);
+        close(device->wakeFd[1]);
+        device->wakeFd[0] = device->wakeFd[1] = -1;
+        OmSimulatorDestroy(device);
+        return OM_E_UNEXPECTED;
+    }
+
+    mutex_lock(&om.simulatorMutex);
+    device->next = om.simulatedDevices;
+    om.simulatedDevices = device;
+    mutex_unlock(&om.simulatorMutex);
+
+    // Report the device as connected, and flag its state as simulated
+    OmDeviceDiscovery(OM_DEVICE_CONNECTED, (unsigned int)deviceId, ptsname(device->master), volumePath);
+    deviceState = OmDeviceFind(deviceId);
+    if (deviceState != NULL) { deviceState->simulated = 1; }
+
+    return OM_OK;
+}
+
+
+/** Internal, remove a simulated device */
+static int OmSimulatorRemove(int deviceId)
+{
+    OmSimulatedDevice *device, **link;
+    OmDeviceState *deviceState;
+
+    mutex_lock(&om.simulatorMutex);
+    for (link = &om.simulatedDevices; (device = *link) != NULL; link = &device->next)
+    {
+        if (device->id == deviceId) { *link = device->next; break; }
+    }
+    mutex_unlock(&om.simulatorMutex);
+    if (device == NULL) { return OM_E_INVALID_DEVICE; }
+
+    // Report the removal (cancelling any download) before the port disappears
+    OmDeviceDiscovery(OM_DEVICE_REMOVED, (unsigned int)deviceId, NULL, NULL);
+    deviceState = OmDeviceFind(deviceId);
+    if (deviceState != NULL) { deviceState->simulated = 0; }
+    OmSimulatorDestroy(device);
+
+    return OM_OK;
+}
+
+
+int OmRemoveSimulatedDevice(int deviceId)
+{
+    if (!om.initialized) { return OM_E_NOT_VALID_STATE; }
+    return OmSimulatorRemove(deviceId);
+}
+
+
+/** Internal method to add any simulated devices requested by the environment */
+void OmSimulatorStartup(void)
+{
+    const char *value = getenv(OM_SIMULATOR_ENVIRONMENT);
+    const char *tempPath = getenv("TMPDIR");
+    unsigned int latency = 0, readRate = 0;
+    int count = 0, dataBlocks = 10000;
+    char path[OM_MAX_MSD_PATH];
+    int i;
+
+    if (value == NULL || value[0] == '\0') { return; }
+    if (tempPath == NULL || tempPath[0] == '\0') { tempPath = "/tmp"; }
+    if (sscanf(value, "%d,%u,%u,%d", &count, &latency, &readRate, &dataBlocks) < 1 || count <= 0) { return; }
+
+    for (i = 0; i < count; i++)
+    {
+        int status;
+        snprintf(path, sizeof(path), "%s/omapi-simulated-%d", tempPath, OM_SIMULATOR_FIRST_ID + i);
+        status = OmAddSimulatedDevice(OM_SIMULATOR_FIRST_ID + i, path, dataBlocks, latency, readRate);
+        if (OM_FAILED(status)) { OmLog(0, "WARNING: Failed to add simulated device %d (%s)\n", OM_SIMULATOR_FIRST_ID + i, OmErrorString(status)); break; }
+    }
+}
+
+
+/** Internal method to remove all simulated devices */
+void OmSimulatorShutdown(void)
+{
+    for (;;)
+    {
+        int deviceId;
+        mutex_lock(&om.simulatorMutex);
+        deviceId = (om.simulatedDevices != NULL) ? om.simulatedDevices->id : -1;
+        mutex_unlock(&om.simulatorMutex);
+        if (deviceId < 0) { break; }
+        OmSimulatorRemove(deviceId);
+    }
+}
+
+
+/** Internal method to wait until a simulated device's read rate allows a read of the specified size from its volume */
+void OmSimulatorThrottle(int deviceId, int bytes)
+{
+    OmSimulatedDevice *device;
+    unsigned long wait = 0;
+
+    mutex_lock(&om.simulatorMutex);
+    for (device = om.simulatedDevices; device != NULL; device = device->next)
+    {
+        if (device->id == deviceId && device->readRate > 0)
+        {
+            unsigned long long now = OmMillisecondsEpoch();
+            if (device->readNext < now) { device->readNext = now; }
+            wait = (unsigned long)(device->readNext - now);
+            device->readNext += (unsigned long long)bytes * 1000 / device->readRate;
+            break;
+        }
+    }
+    mutex_unlock(&om.simulatorMutex);
+
+    if (wait > 0) { usleep(wait * 1000UL); }
+}
+
+#endif
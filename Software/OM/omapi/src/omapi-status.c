@@ -225,6 +225,7 @@ int OmSetTime(int deviceId, OM_DATETIME time)
     char command[64];
     int status;
     char response[OM_MAX_RESPONSE_SIZE], *parts[2] = {0};
+    // (Not batched: this is a single command -- the caller may batch it with other settings through OmCommandBatch())
     sprintf(command, "\r\nTIME %04u-%02u-%02u %02u:%02u:%02u\r\n", OM_DATETIME_YEAR(time), OM_DATETIME_MONTH(time), OM_DATETIME_DAY(time), OM_DATETIME_HOURS(time), OM_DATETIME_MINUTES(time), OM_DATETIME_SECONDS(time));
     status = OM_COMMAND(deviceId, command, response, "$TIME=", OM_DEFAULT_TIMEOUT, parts);
     if (OM_FAILED(status)) return status;
@@ -307,6 +308,29 @@ int OmGetEcc(int deviceId)
 }
 
 
+/** Internal method to flush any existing incoming data from an acquired port before writing a command (Windows only -- seems to cause some problem on Linux?) */
+static int OmCommandFlush(int deviceId, unsigned long start)
+{
+#ifdef _WIN32
+    OmDeviceState *deviceState = OmDeviceFind(deviceId);
+    char c;
+    int num = 0;
+    if (deviceState == NULL) { return OM_E_INVALID_DEVICE; }
+OmLog(4, "- Flush start");
+    for(;;)
+    {
+        unsigned long ret = -1;
+        ret = read(deviceState->fd, &c, 1);
+        if (ret != 1) { break; }
+        num++;
+        if (OmMilliseconds() - start > 5000) { return OM_E_UNEXPECTED_RESPONSE; }   // e.g. if in streaming mode, will not stop producing data
+    }
+OmLog(4, "- Flush done (%d bytes)", num);
+#endif
+    return OM_OK;
+}
+
+
 int OmCommand(int deviceId, const char *command, char *buffer, size_t bufferSize, const char *expected, unsigned int timeoutMs, char **parseParts, int parseMax)
 {
     int status;
@@ -336,23 +360,8 @@ OmLog(3, "OmCommand(%d, \"%s\", _, _, \"%s\", %d, _, _);\n", deviceId, command,
     // If writing a command
     if (command != NULL && strlen(command) > 0)
     {
-#ifdef _WIN32
-        // Flush any existing incoming data (seems to cause some problem on Linux?)
-        {
-            char c;
-            int num = 0;
-OmLog(4, "- Flush start");
-            for(;;)
-            {
-                unsigned long ret = -1;
-                ret = read(om.devices[deviceId]->fd, &c, 1);
-                if (ret != 1) { break; }
-                num++;
-                if (OmMilliseconds() - start > 5000) { OmPortRelease(deviceId); return OM_E_UNEXPECTED_RESPONSE; }   // e.g. if in streaming mode, will not stop producing data
-            }
-OmLog(4, "- Flush done (%d bytes)", num);
-        }
-#endif
+        // Flush any existing incoming data
+        if (OM_FAILED(OmCommandFlush(deviceId, start))) { OmPortRelease(deviceId); return OM_E_UNEXPECTED_RESPONSE; }
 
 #ifdef DEBUG_COMMANDS
         printf(">>> '%s'\n", command);
@@ -454,3 +463,121 @@ OmLog(2, "- Error found: \"%s\"", p);
 }
 
 
+int OmCommandBatch(int deviceId, OM_BATCH_COMMAND *commands, int count, unsigned int timeoutMs)
+{
+    int status;
+    unsigned long start = OmMilliseconds();
+    int next;
+    int i;
+
+    if (commands == NULL) { return OM_E_POINTER; }
+    if (count <= 0) { return OM_OK; }
+
+    // Results and responses until received
+    for (i = 0; i < count; i++)
+    {
+        commands[i].result = OM_E_UNEXPECTED_RESPONSE;
+        if (commands[i].response != NULL && commands[i].responseSize > 0) { commands[i].response[0] = '\0'; }
+    }
+
+OmLog(3, "OmCommandBatch(%d, _, %d, %d);\n", deviceId, count, timeoutMs);
+
+    // (Checks the system and device state first, then) acquire the lock and open the port
+    status = OmPortAcquire(deviceId);
+    if (OM_FAILED(status)) { return status; }
+
+    // Flush any existing incoming data
+    if (OM_FAILED(OmCommandFlush(deviceId, start))) { OmPortRelease(deviceId); return OM_E_UNEXPECTED_RESPONSE; }
+
+    // Write all of the commands back-to-back
+    for (i = 0; i < count; i++)
+    {
+        if (commands[i].command == NULL || strlen(commands[i].command) == 0) { continue; }
+        if (OM_FAILED(OmPortWrite(deviceId, commands[i].command)))
+        {
+            OmPortRelease(deviceId); 
+            for (; i < count; i++) { commands[i].result = OM_E_ACCESS_DENIED; }
+            return OM_E_ACCESS_DENIED;
+        }
+    }
+
+    // Match the responses in order, within the overall timeout (other lines are ignored)
+    next = 0;
+    for (;;)
+    {
+        char line[OM_MAX_RESPONSE_SIZE];
+        unsigned long elapsed;
+        int len;
+
+        // Commands without an expected response are not waited for
+        while (next < count && commands[next].expected == NULL) { commands[next].result = OM_OK; next++; }
+        if (next >= count) { break; }
+
+        elapsed = OmMilliseconds() - start;
+        if (elapsed >= timeoutMs)
+        {
+OmLog(2, "- Overall batch timeout (%d) with %d of %d responses", timeoutMs, next, count);
+            break;
+        }
+        len = OmPortReadLine(deviceId, line, sizeof(line), timeoutMs - elapsed);
+        if (len < 0)
+        {
+            // Either the overall timeout, or the port has closed or is in error (e.g. hung up), in which case nothing further will arrive
+            if (OmMilliseconds() - start < timeoutMs)
+            {
+OmLog(2, "- Port closed or in error with %d of %d responses", next, count);
+                for (i = next; i < count; i++) { commands[i].result = OM_E_ACCESS_DENIED; }
+            }
+            break;
+        }
+        if (len == 0) { continue; }
+        line[len] = '\0';
+OmLog(2, "- Read line: \"%s\"", line);
+
+        // Find the first remaining command expecting this response (any skipped commands had no response)
+        for (i = next; i < count; i++)
+        {
+            const char *expected = commands[i].expected;
+            if (expected == NULL) { continue; }
+            if (strncmp(expected, line, strlen(expected)) == 0) { break; }
+            if (strcmp(expected, "COMMIT") == 0 && strncmp("no file, creatingCOMMIT", line, 23) == 0) { break; }     // (as OmCommand)
+        }
+
+        if (i < count)
+        {
+            // Expected prefix found
+            while (next < i) { if (commands[next].expected == NULL) { commands[next].result = OM_OK; } next++; }
+            commands[next].result = OM_OK;
+        }
+        else if (strncmp(line, "ERROR:", 6) == 0)
+        {
+            // Error found
+OmLog(2, "- Error found: \"%s\"", line);
+            if (strncmp(line, "ERROR: Locked.", 14) == 0) { commands[next].result = OM_E_LOCKED; }
+            else if (strncmp(line, "ERROR: Unknown command:", 23) == 0) { commands[next].result = OM_E_NOT_IMPLEMENTED; }
+            else { commands[next].result = OM_E_FAIL; }
+        }
+        else
+        {
+            continue;
+        }
+
+        // Store the response, and move on to the next command
+        if (commands[next].response != NULL && commands[next].responseSize > 0)
+        {
+            strncpy(commands[next].response, line, commands[next].responseSize - 1);
+            commands[next].response[commands[next].responseSize - 1] = '\0';
+        }
+        next++;
+    }
+    OmPortRelease(deviceId); 
+
+    // Return the first failure
+    for (i = 0; i < count; i++)
+    {
+        if (OM_FAILED(commands[i].result)) { return commands[i].result; }
+    }
+    return OM_OK;
+}
+
+
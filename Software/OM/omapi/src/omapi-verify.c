@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2009-2012, Newcastle University, UK.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Open Movement API - Data Verification Functions
+// (Made block-by-block so that they can run while the data is downloaded, and also used for files by OmVerifyFile() and the 'verify' example)
+
+#include "omapi-internal.h"
+
+#include <math.h>
+
+
+// Verification parameters
+#define OM_VERIFY_STUCK_COUNT (12 * 120)
+#define OM_VERIFY_AVERAGE_FACTOR 0.00001
+#define OM_VERIFY_AVERAGE_RANGE_MAX 0.400
+#define OM_VERIFY_AVERAGE_RANGE_OFF 0.300
+#define OM_VERIFY_IGNORE_RECENT_RESTARTS (6*60*60)     // Restarts within this time are permitted (the device may have been connected/disconnected recently, causing a break in the data)
+#define OM_VERIFY_ALLOWED_RESTARTS 0
+
+
+// Verifier state
+struct OmVerifyState_t
+{
+    int batteryStartPercent, batteryEndPercent;
+    int batteryMaxPercent, batteryMinPercent;
+    unsigned long long veryFirstTime;                   // First time in file
+    unsigned long long firstTime, lastTime;             // First & last time in current recording block
+    unsigned long long blockStart;
+    unsigned long long previousBlockEnd;
+    unsigned int minLight;
+    unsigned int previousSequenceId;
+    unsigned int totalSamples;
+    unsigned int errorFile, errorEvent, errorStuck, errorRange, errorBreaks, errorRate;
+    double maxAv, peakAv;
+    char first;
+    unsigned long long minInterval, maxInterval;
+    unsigned long long lastBlockStart;
+    unsigned long long totalDuration;
+    float breakTime;
+    int firstPacket;
+    int lastSecond;
+    int restarts;
+    char outOfRange;
+    short lx, ly, lz, stuck;
+    int packetCount;
+    double av;
+    OM_DATETIME allowedRestartTime;
+    char stopped;                                       // A file error prevents checking further blocks
+};
+
+
+// Returns the number of seconds since the epoch for the specified OM_DATETIME
+static time_t OmVerifyTimeSerial(OM_DATETIME timestamp)
+{
+    struct tm tParts = {0};                 // Time elements (YMDHMS)
+    tParts.tm_year = OM_DATETIME_YEAR(timestamp) - 1900;
+    tParts.tm_mon = OM_DATETIME_MONTH(timestamp) - 1;
+    tParts.tm_mday = OM_DATETIME_DAY(timestamp);
+    tParts.tm_hour = OM_DATETIME_HOURS(timestamp);
+    tParts.tm_min = OM_DATETIME_MINUTES(timestamp);
+    tParts.tm_sec = OM_DATETIME_SECONDS(timestamp);
+    return timegm(&tParts);                 // Pack from YMDHMS
+}
+
+
+// Returns the number of 1/65536 s ticks since the epoch for the specified OM_DATETIME and fractional part
+static unsigned long long OmVerifyTicks(OM_DATETIME timestamp, unsigned short fractional)
+{
+    time_t tSec = OmVerifyTimeSerial(timestamp);
+    return ((unsigned long long)tSec << 16) + fractional;
+}
+
+
+OmVerifyState *OmVerifyCreate(void)
+{
+    OmVerifyState *verify;
+    time_t allowed;
+    struct tm tm;
+
+    verify = (OmVerifyState *)malloc(sizeof(OmVerifyState));
+    if (verify == NULL) { return NULL; }
+    memset(verify, 0, sizeof(OmVerifyState));
+    verify->batteryMaxPercent = -1;
+    verify->batteryMinPercent = -1;
+    verify->minLight = 0xffff;
+    verify->previousSequenceId = (unsigned int)-1;
+    verify->first = 1;
+    verify->firstPacket = 1;
+    verify->lastSecond = -1;
+
+    // Restarts at or after this time are permitted
+    allowed = time(NULL) - OM_VERIFY_IGNORE_RECENT_RESTARTS;
+    localtime_r(&allowed, &tm);     // (verifiers may be created concurrently by download threads)
+    verify->allowedRestartTime = OM_DATETIME_FROM_YMDHMS(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+
+    return verify;
+}
+
+
+int OmVerifyBlock(OmVerifyState *verify, OmReaderHandle reader, int numSamples)
+{
+    OM_READER_DATA_PACKET *dp;
+    short *buffer;
+    int i;
+
+    if (verify->stopped) { return 1; }
+
+    // Successful end of file
+    if (numSamples == OM_E_FAIL) { return 1; }
+
+    // Problem reading the file
+    if (numSamples < 0)
+    {
+        OmLog(2, "VERIFY: Error reading block: %d - %s\n", numSamples, OmErrorString(numSamples));
+        verify->errorFile++;
+        verify->stopped = 1;
+        return 1;
+    }
+
+    // Block has no valid data (probably checksum failed)
+    if (numSamples == 0)
+    {
+        verify->errorFile++;
+        return 0;
+    }
+
+    // Get the raw packet handle
+    dp = OmReaderRawDataPacket(reader);
+    if (dp == NULL)
+    {
+        verify->errorFile++;
+        return 0;
+    }
+
+    // Check events mask
+    if (dp->events & 0xf0)
+    {
+        OmLog(2, "VERIFY: Event error 0x%02x\n", dp->events);
+        verify->errorEvent++;
+    }
+
+    // Read the block start time
+    {
+        unsigned int timestamp;
+        unsigned short fractional;
+        timestamp = OmReaderTimestamp(reader, 0, &fractional);
+        verify->blockStart = OmVerifyTicks(timestamp, fractional);
+    }
+
+    {
+        unsigned int light = OmReaderGetValue(reader, OM_VALUE_LIGHT);
+        if (light < verify->minLight) { verify->minLight = light; }
+    }
+
+    // If we read a block out-of-sequence
+    if (verify->previousSequenceId != (unsigned int)-1 && verify->previousSequenceId + 1 != dp->sequenceId)
+    {
+        if (dp->sequenceId != 0)
+        {
+            OmLog(2, "VERIFY: Sequence break %u -> %u\n", verify->previousSequenceId, dp->sequenceId);
+        }
+        else
+        {
+            long long recordingLength = (long long)(verify->lastTime - verify->firstTime);
+            long long diff = (long long)(verify->blockStart - verify->previousBlockEnd);
+
+            if (dp->timestamp < verify->allowedRestartTime)
+            {
+                OmLog(2, "VERIFY: Recording sequence restarted @%u, length of %+.2fs (gap of %+.2fs)\n", verify->previousSequenceId, (float)recordingLength / 65536.0f, (float)diff / 65536.0f);
+                verify->restarts++;
+                verify->breakTime += (float)diff / 65536.0f;
+            }
+
+            verify->totalDuration += recordingLength;
+            verify->lastBlockStart = 0;
+            verify->firstPacket = 1;
+            verify->lastSecond = -1;
+            verify->firstTime = 0;           // Start of a new block
+        }
+    }
+
+    if (verify->firstTime == 0)
+    {
+        verify->firstTime = verify->blockStart;
+        if (verify->veryFirstTime == 0) { verify->veryFirstTime = verify->firstTime; }
+        verify->lastTime = verify->firstTime;
+        verify->batteryStartPercent = OmReaderGetValue(reader, OM_VALUE_BATTERY_PERCENT);
+        verify->batteryEndPercent = verify->batteryStartPercent;
+        if (verify->batteryMaxPercent < 0) { verify->batteryMaxPercent = verify->batteryStartPercent; }
+        if (verify->batteryMinPercent < 0) { verify->batteryMinPercent = verify->batteryStartPercent; }
+    }
+
+    if (verify->lastBlockStart > 0)
+    {
+        unsigned long long interval = verify->blockStart - verify->lastBlockStart;
+
+        // If the previous block's end is not close to this block's start, we have a time discontinuity
+        if (verify->previousBlockEnd != 0 && verify->blockStart != 0 && abs((int)(verify->previousBlockEnd - verify->blockStart)) >= 8000)
+        {
+            long long diff = (long long)(verify->blockStart - verify->previousBlockEnd);
+            OmLog(2, "VERIFY: Time break in sequence by %+.2f seconds\n", (float)diff / 65536.0f);
+            verify->breakTime += (float)diff / 65536.0f;
+        }
+        else
+        {
+            // Min/max interval
+            if (verify->first) { verify->first = 0; verify->minInterval = interval; verify->maxInterval = interval; }
+            if (interval > verify->maxInterval) { verify->maxInterval = interval; }
+            if (interval < verify->minInterval) { verify->minInterval = interval; }
+        }
+    }
+
+    verify->lastBlockStart = verify->blockStart;
+
+    buffer = OmReaderBuffer(reader);
+    for (i = 0; i < numSamples; i++)
+    {
+        OM_DATETIME dateTime;
+        unsigned short fractional;
+        short x, y, z;
+        double v, absAv;
+        int seconds;
+
+        verify->totalSamples++;
+
+        dateTime = OmReaderTimestamp(reader, i, &fractional);
+
+        x = buffer[3 * i + 0];
+        y = buffer[3 * i + 1];
+        z = buffer[3 * i + 2];
+
+        // Detect stuck values
+        if (x == verify->lx && y == verify->ly && z == verify->lz)
+        {
+            verify->stuck++;
+            if (verify->stuck == OM_VERIFY_STUCK_COUNT)
+            {
+                OmLog(2, "VERIFY: Readings could be stuck at (%d, %d, %d)\n", x, y, z);
+                verify->errorStuck++;
+            }
+        }
+        else
+        {
+            verify->lx = x; verify->ly = y; verify->lz = z;
+            verify->stuck = 0;
+        }
+
+        // Moving average of the SVM - 1
+        v = sqrt((x / 256.0) * (x / 256.0) + (y / 256.0) * (y / 256.0) + (z / 256.0) * (z / 256.0)) - 1.0;
+        verify->av = ((1.0 - OM_VERIFY_AVERAGE_FACTOR) * verify->av) + (OM_VERIFY_AVERAGE_FACTOR * v);
+        absAv = fabs(verify->av);
+        if (absAv > verify->peakAv) { verify->peakAv = absAv; }
+        if (absAv > verify->maxAv) { verify->maxAv = absAv; }
+        if (absAv > OM_VERIFY_AVERAGE_RANGE_MAX)
+        {
+            if (!verify->outOfRange)
+            {
+                verify->errorRange++;
+                verify->outOfRange = 1;
+                verify->peakAv = absAv;
+                OmLog(2, "VERIFY: Average SVM gone out-of-normal-range abs(avg(svm-1)): %0.3f\n", absAv);
+            }
+        }
+        else if (absAv < OM_VERIFY_AVERAGE_RANGE_OFF && verify->outOfRange)
+        {
+            verify->outOfRange = 0;
+        }
+
+        // Count the samples in each second
+        seconds = OM_DATETIME_SECONDS(dateTime);
+        if (verify->lastSecond == -1) { verify->lastSecond = seconds; };
+        if (seconds != verify->lastSecond)
+        {
+            if (verify->firstPacket) { verify->firstPacket = 0; }
+            else if (verify->packetCount >= 88 && verify->packetCount <= 112) { ; }
+            else if (seconds == verify->lastSecond + 1 || (seconds == 0 && verify->lastSecond == 59))
+            {
+                verify->errorRate++;
+            }
+            else
+            {
+                verify->errorBreaks++;
+            }
+            verify->lastSecond = seconds;
+            verify->packetCount = 0;
+        }
+        verify->packetCount++;
+    }
+
+    // Store the current sequence id
+    verify->previousSequenceId = dp->sequenceId;
+
+    // Read the block end time
+    {
+        unsigned int timestamp;
+        unsigned short fractional;
+        timestamp = OmReaderTimestamp(reader, numSamples, &fractional);
+        verify->previousBlockEnd = OmVerifyTicks(timestamp, fractional);
+    }
+
+    verify->lastTime = verify->previousBlockEnd;
+    verify->batteryEndPercent = OmReaderGetValue(reader, OM_VALUE_BATTERY_PERCENT);
+    if (verify->batteryEndPercent > verify->batteryMaxPercent) { verify->batteryMaxPercent = verify->batteryEndPercent; }
+    if (verify->batteryEndPercent < verify->batteryMinPercent) { verify->batteryMinPercent = verify->batteryEndPercent; }
+
+    return 0;
+}
+
+
+void OmVerifyResult(OmVerifyState *verify, OmReaderHandle reader, OM_VERIFY_RESULT *result)
+{
+    OM_READER_HEADER_PACKET *hp;
+    unsigned long long totalDuration;
+    int startStopFail = 0;
+    int code = 0;
+    float hours;
+
+    // Last session's duration
+    totalDuration = verify->totalDuration + (long long)(verify->lastTime - verify->firstTime);
+
+    // Start/stop times
+    hp = (reader != NULL) ? OmReaderRawHeaderPacket(reader) : NULL;
+    if (hp == NULL)
+    {
+        startStopFail += 4;
+    }
+    else
+    {
+        if (hp->loggingStartTime >= OM_DATETIME_MIN_VALID && hp->loggingStartTime <= OM_DATETIME_MAX_VALID && hp->loggingEndTime > hp->loggingStartTime)
+        {
+            unsigned long fStart = (unsigned long)OmVerifyTimeSerial(hp->loggingStartTime);
+            unsigned long aStart = (unsigned long)(verify->veryFirstTime >> 16);
+            int startDiff = (int)(aStart - fStart);
+            if (abs(startDiff) >= 80)
+            {
+                OmLog(2, "VERIFY: Data did not start near recording start time (%ds).\n", startDiff);
+                startStopFail += 2;
+            }
+        }
+
+        if (hp->loggingEndTime >= OM_DATETIME_MIN_VALID && hp->loggingEndTime <= OM_DATETIME_MAX_VALID && hp->loggingStartTime < hp->loggingEndTime)
+        {
+            unsigned long fEnd = (unsigned long)OmVerifyTimeSerial(hp->loggingEndTime);
+            unsigned long aEnd = (unsigned long)(verify->lastTime >> 16);
+            int stopDiff = (int)(aEnd - fEnd);
+            if (abs(stopDiff) >= 80)
+            {
+                OmLog(2, "VERIFY: Data did not stop near recording stop time (%ds).\n", stopDiff);
+                startStopFail += 1;
+            }
+        }
+    }
+
+    // Result code
+    if (verify->errorFile   > 0)  { code |= OM_VERIFY_ERROR_FILE; }
+    if (verify->errorEvent  > 0)  { code |= OM_VERIFY_ERROR_EVENT; }
+    if (verify->errorStuck  > 0)  { code |= OM_VERIFY_ERROR_STUCK; }
+    if (verify->errorRange  > 0)  { code |= OM_VERIFY_ERROR_RANGE; }
+    if (verify->errorRate   > 0)  { code |= OM_VERIFY_ERROR_RATE; }
+    if (verify->errorBreaks > 0)  { code |= OM_VERIFY_ERROR_BREAKS; }
+    if (verify->restarts    > OM_VERIFY_ALLOWED_RESTARTS) { code |= OM_VERIFY_ERROR_RESTARTS; } else if (verify->restarts > 0) { code |= OM_VERIFY_WARNING_RESTARTS; }
+    if (verify->minLight    < 90) { code |= OM_VERIFY_ERROR_LIGHT; } else if (verify->minLight < 140) { code |= OM_VERIFY_WARNING_LIGHT; }
+
+    // Discharge
+    hours = ((totalDuration >> 16) / 60.0f / 60.0f);
+    result->percentPerHour = 0;
+    if (hours > 0) { result->percentPerHour = ((float)verify->batteryMaxPercent - verify->batteryMinPercent) / hours; }
+    if (result->percentPerHour >= 0.29f) { code |= OM_VERIFY_ERROR_BATT; } else if (result->percentPerHour >= 0.25f) { code |= OM_VERIFY_WARNING_BATT; }
+
+    // Start/stop
+    if (startStopFail) { code |= OM_VERIFY_ERROR_STARTSTOP; }
+
+    result->code = code;
+    result->errorFile = verify->errorFile;
+    result->errorEvent = verify->errorEvent;
+    result->errorStuck = verify->errorStuck;
+    result->errorRange = verify->errorRange;
+    result->errorRate = verify->errorRate;
+    result->errorBreaks = verify->errorBreaks;
+    result->restarts = verify->restarts;
+    result->breakTime = verify->breakTime;
+    result->maxAv = (float)verify->maxAv;
+    result->minInterval = verify->minInterval / 65536.0f;
+    result->maxInterval = verify->maxInterval / 65536.0f;
+    result->duration = hours;
+    result->minLight = verify->minLight;
+    result->batteryMaxPercent = verify->batteryMaxPercent;
+    result->batteryMinPercent = verify->batteryMinPercent;
+    result->startStopFail = startStopFail;
+    result->totalSamples = verify->totalSamples;
+    result->downloadStalls = 0;
+
+    OmLog(1, "VERIFY: code=0x%06x, file=%d, event=%d, stuck=%d, range=%d, rate=%d, breaks=%d, restarts=%d\n", code, result->errorFile, result->errorEvent, result->errorStuck, result->errorRange, result->errorRate, result->errorBreaks, result->restarts);
+}
+
+
+void OmVerifyDestroy(OmVerifyState *verify)
+{
+    free(verify);
+}
+
+
+int OmVerifyFile(const char *filename, int readAhead, OM_VERIFY_RESULT *result)
+{
+    OmReaderHandle reader;
+    OmVerifyState *verify;
+
+    if (filename == NULL || result == NULL) { return OM_E_POINTER; }
+
+    reader = OmReaderOpen(filename);
+    if (reader == NULL) { return OM_E_ACCESS_DENIED; }
+    if (readAhead > 0) { OmReaderReadAhead(reader, readAhead); }
+
+    verify = OmVerifyCreate();
+    if (verify == NULL) { OmReaderClose(reader); return OM_E_OUT_OF_MEMORY; }
+
+    // Check each block until the end of the file (or a file error)
+    while (!OmVerifyBlock(verify, reader, OmReaderNextBlock(reader))) { ; }
+    OmVerifyResult(verify, reader, result);
+
+    OmVerifyDestroy(verify);
+    OmReaderClose(reader);
+    return OM_OK;
+}
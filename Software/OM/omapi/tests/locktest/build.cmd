@@ -12,11 +12,11 @@ ECHO Setting environment variables for C compiler...
 call "%COMNTOOLS%\..\..\VC\vcvarsall.bat"
 
 ECHO Compiling...
-cl -c /D WIN32 /EHsc /I "..\..\include" /Tc"locktest.c" /Tp"..\..\src\DeviceFinder.cpp" /Tp"..\..\src\omapi-devicefinder.cpp" /Tc"..\..\src\omapi-download.c" /Tc"..\..\src\omapi-internal.c" /Tc"..\..\src\omapi-main.c" /Tc"..\..\src\omapi-reader.c" /Tc"..\..\src\omapi-settings.c" /Tc"..\..\src\omapi-status.c"
+cl -c /D WIN32 /EHsc /I "..\..\include" /Tc"locktest.c" /Tp"..\..\src\DeviceFinder.cpp" /Tp"..\..\src\omapi-devicefinder.cpp" /Tc"..\..\src\omapi-download.c" /Tc"..\..\src\omapi-internal.c" /Tc"..\..\src\omapi-main.c" /Tc"..\..\src\omapi-reader.c" /Tc"..\..\src\omapi-settings.c" /Tc"..\..\src\omapi-status.c" /Tc"..\..\src\omapi-verify.c" /Tc"..\..\src\omapi-simulator.c"
 IF ERRORLEVEL 1 GOTO ERROR
 
 ECHO Linking...
-link locktest /defaultlib:user32.lib DeviceFinder omapi-devicefinder omapi-download omapi-internal omapi-main omapi-reader omapi-settings omapi-status /out:locktest.exe
+link locktest /defaultlib:user32.lib DeviceFinder omapi-devicefinder omapi-download omapi-internal omapi-main omapi-reader omapi-settings omapi-status omapi-verify omapi-simulator /out:locktest.exe
 IF ERRORLEVEL 1 GOTO ERROR
 
 rem GOTO END
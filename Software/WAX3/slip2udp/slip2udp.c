@@ -41,6 +41,10 @@ typedef int socklen_t;
 #pragma warning( disable : 4996 )    /* allow deprecated POSIX name functions */
 #pragma comment(lib, "wsock32")
 #else
+#ifdef __linux__
+#define _GNU_SOURCE
+#define HAVE_SENDMMSG                   /* Batched sends */
+#endif
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
@@ -49,6 +53,8 @@ typedef int socklen_t;
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <termios.h>
+#include <poll.h>
+#include <sys/time.h>
 typedef int SOCKET;
 #define SOCKET_ERROR (-1)
 #define closesocket close
@@ -164,7 +170,6 @@ static size_t transmit(SOCKET s, struct sockaddr_in *serverAddr, const void *sen
     size_t sent = 0;
     if (sendLength > 0)
     {
-        fprintf(stderr, "[%d]\n", (unsigned int)sendLength);
         if (sendto(s, (const char *)sendBuffer, sendLength, 0, (struct sockaddr *)serverAddr, sizeof(*serverAddr)) == SOCKET_ERROR)
         {
             fprintf(stderr, "ERROR: Send failed (%s)\n", strerrorsocket());
@@ -176,50 +181,187 @@ static size_t transmit(SOCKET s, struct sockaddr_in *serverAddr, const void *sen
 }
 
 
-/* Read a SLIP-encoded packet from the device */
-static size_t slipread(int fd, void *inBuffer, size_t len)
+/* SLIP characters */
+#define SLIP_END     0xC0                   /* End of packet indicator */
+#define SLIP_ESC     0xDB                   /* Escape character, next character will be a substitution */
+#define SLIP_ESC_END 0xDC                   /* Escaped substitution for the END data byte */
+#define SLIP_ESC_ESC 0xDD                   /* Escaped substitution for the ESC data byte */
+
+
+/* Buffered input: large reads, scanned for SLIP frames in bulk */
+#define READER_BUFFER_SIZE 16384
+typedef struct
+{
+    int fd;
+    unsigned char buffer[READER_BUFFER_SIZE];   /* Raw data read from the input */
+    size_t offset;                          /* Start of the unconsumed data in the buffer */
+    size_t length;                          /* End of the valid data in the buffer */
+    size_t received;                        /* Length of the partial frame already in the caller's buffer */
+    char escaped;                           /* The partial frame ended with an ESC byte */
+} Reader;
+
+
+/* Read the next chunk of data from the input into the reader's (empty) buffer, returns the number of bytes read, or <= 0 on end-of-file/error */
+static int readerfill(Reader *reader)
+{
+    int done;
+    reader->offset = 0;
+    reader->length = 0;
+    done = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+    if (done > 0) { reader->length = (size_t)done; }
+    return done;
+}
+
+
+/* Scan the buffered data for a SLIP-encoded packet (without waiting for more data), returns the packet length once complete, or 0 if more data is needed. */
+static size_t slipscan(Reader *reader, void *inBuffer, size_t len)
 {
-    #define SLIP_END     0xC0                   /* End of packet indicator */
-    #define SLIP_ESC     0xDB                   /* Escape character, next character will be a substitution */
-    #define SLIP_ESC_END 0xDC                   /* Escaped substitution for the END data byte */
-    #define SLIP_ESC_ESC 0xDD                   /* Escaped substitution for the ESC data byte */
     unsigned char *p = (unsigned char *)inBuffer;
-    size_t received = 0;
-    unsigned char c = '\0';
+    const unsigned char *s = reader->buffer + reader->offset;
+    const unsigned char *end = reader->buffer + reader->length;
 
-    if (fd < 0 || inBuffer == NULL) { return 0; }
-    for (;;)
+    while (s < end)
     {
-        c = '\0';
-        if (read(fd, &c, 1) <= 0) { return received; }
-        switch (c)
+        const unsigned char *frameEnd, *escape;
+        size_t run;
+
+        /* The byte following an escape (may have been split across reads) */
+        if (reader->escaped)
         {
-            case SLIP_END:
-                if (received) { return received; }
-                break;
+            unsigned char c = *s++;
+            reader->escaped = 0;
+            switch (c)
+            {
+                case SLIP_ESC_END: c = SLIP_END; break;
+                case SLIP_ESC_ESC: c = SLIP_ESC; break;
+                default: fprintf(stderr, "<Unexpected escaped value: %02x>", c); break;
+            }
+            if (reader->received < len) { p[reader->received++] = c; }
+            continue;
+        }
 
-            case SLIP_ESC:
-                c = '\0';
-                if (read(fd, &c, 1) <= 0) { return received; }
-                switch (c)
-                {
-                    case SLIP_ESC_END:
-                        c = SLIP_END;
-                        break;
-                    case SLIP_ESC_ESC:
-                        c = SLIP_ESC;
-                        break;
-                    default:
-                        fprintf(stderr, "<Unexpected escaped value: %02x>", c);
-                        break;
-                }
-                /* ... fall through to default case with our replaced character ... */
+        /* Find the end of the frame, and the first escape before it */
+        frameEnd = (const unsigned char *)memchr(s, SLIP_END, end - s);
+        if (frameEnd == NULL) { frameEnd = end; }
+        escape = (const unsigned char *)memchr(s, SLIP_ESC, frameEnd - s);
+        if (escape == NULL) { escape = frameEnd; }
 
-            default:
-                if (received < len) { p[received++] = c; }
+        /* Copy the unescaped run in bulk */
+        run = escape - s;
+        if (run > len - reader->received) { run = len - reader->received; }
+        memcpy(p + reader->received, s, run);
+        reader->received += run;
+        s = escape;
+
+        if (s < frameEnd)
+        {
+            /* Escape byte */
+            reader->escaped = 1;
+            s++;
+        }
+        else if (s < end)
+        {
+            /* End of frame */
+            s++;
+            if (reader->received)
+            {
+                size_t received = reader->received;
+                reader->offset = s - reader->buffer;
+                reader->received = 0;
+                return received;
+            }
+        }
+    }
+    reader->offset = reader->length;
+    return 0;
+}
+
+
+/* Frames waiting to be sent together */
+#define BATCH_COUNT 64                      /* Most frames sent in one go */
+#define BATCH_SIZE (256 * 1024)             /* Space for the queued frames */
+typedef struct
+{
+    SOCKET s;
+    struct sockaddr_in *serverAddr;
+    int count;                              /* Number of queued frames */
+    size_t used;                            /* Space used by the queued frames */
+    size_t offset[BATCH_COUNT];
+    size_t length[BATCH_COUNT];
+    unsigned long frames, sends;            /* Totals */
+    unsigned char buffer[BATCH_SIZE];
+} Batch;
+
+
+/* Send the queued frames, each as its own datagram */
+static void batchflush(Batch *batch)
+{
+    int i = 0;
+    if (batch->count <= 0) { return; }
+#ifdef HAVE_SENDMMSG
+    {
+        struct mmsghdr msgs[BATCH_COUNT];
+        struct iovec iovecs[BATCH_COUNT];
+        for (i = 0; i < batch->count; i++)
+        {
+            iovecs[i].iov_base = batch->buffer + batch->offset[i];
+            iovecs[i].iov_len = batch->length[i];
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = batch->serverAddr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(*batch->serverAddr);
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        for (i = 0; i < batch->count; )
+        {
+            int sent = sendmmsg(batch->s, msgs + i, batch->count - i, 0);
+            batch->sends++;
+            if (sent <= 0)
+            {
+                if (sent < 0 && errno == EINTR) { continue; }
+                fprintf(stderr, "ERROR: Send failed (%s)\n", strerrorsocket());
                 break;
+            }
+            i += sent;
         }
     }
+#else
+    for (i = 0; i < batch->count; i++)
+    {
+        size_t tlen = transmit(batch->s, batch->serverAddr, batch->buffer + batch->offset[i], batch->length[i]);
+        if (tlen != batch->length[i]) { fprintf(stderr, "WARNING: Problem transmitting: %d / %d\n", (unsigned int)tlen, (unsigned int)batch->length[i]); }
+        batch->sends++;
+    }
+#endif
+    batch->count = 0;
+    batch->used = 0;
+}
+
+
+/* Queue a frame */
+static void batchadd(Batch *batch, const void *data, size_t len)
+{
+    if (batch->count >= BATCH_COUNT || batch->used + len > BATCH_SIZE) { batchflush(batch); }
+    if (len > BATCH_SIZE) { transmit(batch->s, batch->serverAddr, data, len); batch->sends++; batch->frames++; return; }
+    memcpy(batch->buffer + batch->used, data, len);
+    batch->offset[batch->count] = batch->used;
+    batch->length[batch->count] = len;
+    batch->count++;
+    batch->used += len;
+    batch->frames++;
+}
+
+
+/* Returns the number of milliseconds since the epoch */
+static unsigned long long ticksnow(void)
+{
+#ifdef _WIN32
+    return (unsigned long long)GetTickCount();
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
 }
 
 
@@ -303,12 +445,13 @@ int openport(const char *infile, char writeable)
 }
 
 
-/* Convert SLIP-encoded packets into UDP packets */
-int sliptoudp(const char *infile, const char *host, char dump)
+/* Convert SLIP-encoded packets into UDP packets (frames decoded from each read are sent together, optionally waiting up to 'interval' msec for more) */
+int sliptoudp(const char *infile, const char *host, char dump, int interval)
 {
     #define BUFFER_SIZE 0xffff
     static char buffer[BUFFER_SIZE];
-    size_t bufferLength = 0;
+    static Reader reader;
+    static Batch batch;
     int fd;
     struct sockaddr_in serverAddr;
     SOCKET s = SOCKET_ERROR;
@@ -329,17 +472,58 @@ int sliptoudp(const char *infile, const char *host, char dump)
     }
 
     /* Read packets and transmit */
+    if (fd >= 0)
     {
-        size_t len;
-        while ((len = slipread(fd, buffer, BUFFER_SIZE)) != 0)
+        unsigned long long deadline = 0;
+
+        reader.fd = fd;
+        batch.s = s;
+        batch.serverAddr = &serverAddr;
+        for (;;)
         {
-            if (dump) { hexdump(buffer, len); }
-            if (s != SOCKET_ERROR)
-            { 
-                size_t tlen = transmit(s, &serverAddr, buffer, len);
-                if (tlen != len) { fprintf(stderr, "WARNING: Problem transmitting: %d / %d\n", (unsigned int)tlen, (unsigned int)len); }
+            size_t len = 0;
+
+            /* All of the input read so far has been decoded: send the queued frames unless still inside the wait interval */
+            if (batch.count > 0)
+            {
+#ifndef _WIN32
+                unsigned long long now = ticksnow();
+                struct pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                if (now >= deadline || poll(&pfd, 1, (int)(deadline - now)) <= 0)
+#endif
+                {
+                    batchflush(&batch);
+                }
+            }
+
+            /* Read the next chunk of input */
+            if (readerfill(&reader) <= 0)
+            {
+                /* End of input: the partial frame, if any */
+                len = reader.received;
+                reader.received = 0;
             }
+
+            /* Queue the frames decoded from the chunk */
+            for (;;)
+            {
+                if (len == 0) { len = slipscan(&reader, buffer, BUFFER_SIZE); }
+                if (len == 0) { break; }
+                if (dump) { fprintf(stderr, "[%d]\n", (unsigned int)len); hexdump(buffer, len); }
+                if (s != SOCKET_ERROR)
+                {
+                    if (batch.count == 0) { deadline = ticksnow() + interval; }
+                    batchadd(&batch, buffer, len);
+                }
+                len = 0;
+            }
+            if (reader.length == 0) { break; }
         }
+        batchflush(&batch);
+        fprintf(stderr, "SLIP2UDP: %lu frames in %lu sends\n", batch.frames, batch.sends);
     }
 
     /* Close socket */
@@ -364,6 +548,7 @@ int main(int argc, char *argv[])
     char dump = 0;
     const char *infile = NULL;
     const char *host = NULL;
+    int interval = 0;
 
     fprintf(stderr, "SLIP2UDP  SLIP-to-UDP Converter\n");
     fprintf(stderr, "V1.20     by Daniel Jackson, 2011\n");
@@ -387,6 +572,10 @@ int main(int argc, char *argv[])
         {
             dump = 1;
         }
+        else if (strcasecmp(argv[i], "-batch") == 0)
+        {
+            interval = atoi(argv[++i]);
+        }
         else if (argv[i][0] != '-' && argPosition == 0)
         {
             argPosition++;
@@ -407,7 +596,9 @@ int main(int argc, char *argv[])
 
     if (showHelp)
     {
-        fprintf(stderr, "Usage:   slip2udp [-in <device>] <hostname>[:<port>] [-dump]\n");
+        fprintf(stderr, "Usage:   slip2udp [-in <device>] <hostname>[:<port>] [-dump] [-batch <msec>]\n");
+        fprintf(stderr, "\n");
+        fprintf(stderr, "         -batch <msec>   Wait up to this long for more frames to send together (default 0: send the frames from each read together)\n");
         fprintf(stderr, "\n");
 #ifdef _WIN32
         fprintf(stderr, "Example: slip2udp -in \\\\.\\COM1 localhost:1234\n");
@@ -420,6 +611,6 @@ int main(int argc, char *argv[])
 
     fprintf(stderr, "SLIP2UDP: %s -> %s%s\n", (infile == NULL) ? "<stdin>" : infile, host, (dump ? " [dump]" : ""));
 
-    return sliptoudp(infile, host, dump);
+    return sliptoudp(infile, host, dump, interval);
 }
 
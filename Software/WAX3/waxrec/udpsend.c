@@ -249,70 +249,111 @@ int write_osc_string(unsigned char *buffer, const char *value)
 }
 
 
+/* Writes an OSC message of integer parameters */
+int write_osc_message(unsigned char *buffer, const char *address, int num, char *values[])
+{
+    char type[64];
+    int o = 0;
+    int i;
+
+    if (num > (int)sizeof(type) - 2) { num = (int)sizeof(type) - 2; }
+
+    /* Address */
+    o += write_osc_string(buffer + o, address);                             /* [OSC string] address, starting with '/' */
+
+    /* Type tag */
+    type[0] = ',';
+    for (i = 0; i < num; i++)
+    {
+        type[i + 1] = 'i';
+    }
+    type[num + 1] = '\0';
+    o += write_osc_string(buffer + o, type);                                /* [OSC string] type tag */
+
+    /* Parameters (all integers) */
+    for (i = 0; i < num; i++)
+    {
+        int value = atoi(values[i]);
+        o += write_osc_int(buffer + o, value);                              /* [OSC int] value <4 bytes> */
+    }
+    return o;
+}
+
+
 /* Parse command-line parameters */
 int main(int argc, char *argv[])
 {
     int ret = 0;
+    char single = 0;
     
     fprintf(stderr, "UDPSEND   Simple UDP/OSC Transmitter\n");
     fprintf(stderr, "V1.00     by Daniel Jackson, 2012\n");
     fprintf(stderr, "\n");
 
+    /* Options */
+    if (argc > 1 && strcasecmp(argv[1], "-single") == 0)
+    {
+        single = 1;
+        argc--;
+        argv++;
+    }
+
     /* Check for invalid arguments */
     if (argc <= 2 || argv[1][0] == '-' || argv[1][0] == '/')
     {
-        fprintf(stderr, "Usage:   udpsend <host:port> /<osc-path> [<int-value>...]\n");
+        fprintf(stderr, "Usage:   udpsend [-single] <host:port> /<osc-path> [<int-value>...] [/<osc-path> [<int-value>...]...]\n");
         fprintf(stderr, "         udpsend <host:port> <raw-message>\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Example: udpsend localhost:3333 /transmit/100 1 2 3\n");
         fprintf(stderr, "         udpsend localhost:3333 TRANSMIT 100 1 2 3\\r\\n\n");
         fprintf(stderr, "\n");
+        fprintf(stderr, "Several OSC messages are sent together as one OSC bundle, or with -single, as one datagram each.\n");
+        fprintf(stderr, "\n");
         ret = -1;
     }
     else
     {
         #define BUFFER_SIZE 0xffff
-        static char buffer[BUFFER_SIZE];
+        static unsigned char buffer[BUFFER_SIZE];
         const char *host = NULL;
         struct sockaddr_in serverAddr;
         SOCKET s = SOCKET_ERROR;
-        int o = 0;
+        #define MAX_MESSAGES 64
+        size_t messageOffset[MAX_MESSAGES], messageLength[MAX_MESSAGES];
+        int numMessages = 0;
+        size_t o = 0;
         int i;
 
         /* Host */
         host = argv[1];
             
-        /* If path sent, then format as an OSC packet */
+        /* If path sent, then format as OSC message(s) */
         if (argv[2][0] == '/')
         {
-            int num;
-            
-            /* Number of parameters */
-            num = argc - 3;
-            if (num < 0) { num = 0; }
-            
-            /* Address */
-            o += write_osc_string(buffer + o, argv[2]);                         /* [OSC string] address, starting with '/' */
-            
-            /* Type tag */
+            int start, end;
+            int count = 0;
+            char bundle = 0;
+
+            /* Several messages are sent as one bundle (unless sent singly) */
+            for (i = 2; i < argc; i++) { if (argv[i][0] == '/') { count++; } }
+            if (count > 1 && !single)
             {
-                char type[64];
-                
-                type[0] = ',';
-                for (i = 0; i < num; i++)
-                {
-                    type[i + 1] = 'i';
-                }
-                type[num + 1] = '\0';
-                
-                o += write_osc_string(buffer + o, type);                        /* [OSC string] type tag */
+                o += write_osc_string(buffer + o, "#bundle");                   /* [OSC string] bundle identifier: "#bundle" <pads to 8 bytes> */
+                o += write_osc_int(buffer + o, 0);                              /* [OSC timetag] "immediately" <8 bytes> */
+                o += write_osc_int(buffer + o, 1);
+                bundle = 1;
             }
-            
-            /* Parameters (all integers) */
-            for (i = 0; i < num; i++)
+
+            /* Each message is an address followed by its parameters */
+            for (start = 2; start < argc && numMessages < MAX_MESSAGES; start = end)
             {
-                int value = atoi(argv[3 + i]);
-                o += write_osc_int(buffer + o, value);                          /* [OSC int] value <4 bytes> */
+                for (end = start + 1; end < argc && argv[end][0] != '/'; end++) { ; }
+                if (bundle) { o += 4; }                                         /* [OSC int] element length (written below) */
+                messageOffset[numMessages] = o;
+                o += write_osc_message(buffer + o, argv[start], end - start - 1, argv + start + 1);
+                messageLength[numMessages] = o - messageOffset[numMessages];
+                if (bundle) { write_osc_int(buffer + messageOffset[numMessages] - 4, (signed int)messageLength[numMessages]); }
+                numMessages++;
             }
         }
         else
@@ -347,13 +388,13 @@ int main(int argc, char *argv[])
 								else { c |= *p - '0'; }
 								p++;
 								
-								buffer[o++] = c;		// Allow NULL writes
+								buffer[o++] = (unsigned char)c;		// Allow NULL writes
 								continue;
 							}
 						}
                     }
                     if (c == '\0') { break; }
-                    buffer[o++] = c;
+                    buffer[o++] = (unsigned char)c;
                 }
                 if (i + 1 < argc) { buffer[o++] = ' '; }
             }
@@ -387,7 +428,21 @@ int main(int argc, char *argv[])
         hexdump(buffer, o);
         
         /* Transmit */
-        if (s != SOCKET_ERROR)
+        if (s != SOCKET_ERROR && single && numMessages > 0)
+        {
+            /* Each message as its own datagram */
+            for (i = 0; i < numMessages; i++)
+            {
+                size_t tlen;
+                tlen = transmit(s, &serverAddr, buffer + messageOffset[i], messageLength[i]);
+                if (tlen != messageLength[i]) 
+                { 
+                    fprintf(stderr, "WARNING: Problem transmitting: %d / %d\n", (unsigned int)tlen, (unsigned int)messageLength[i]); 
+                    ret = 1;
+                }
+            }
+        }
+        else if (s != SOCKET_ERROR)
         {
             size_t tlen;
             tlen = transmit(s, &serverAddr, buffer, o);
@@ -33,10 +33,11 @@
  */
 
 /*
-    Usage:   waxrec <device> [-log [-tee]] [-osc <hostname>[:<port>] [-timetag]] [-init <string>] [-dump]
+    Usage:   waxrec <device> [<device>...] [-log [-tee]] [-osc <hostname>[:<port>] [-timetag]] [-init <string>] [-dump]
 
     Log example: waxrec <device> -log -tee -init "MODE=1\r\n" > log.csv
     OSC example: waxrec <device> -osc localhost:1234 -init "MODE=1\r\n"
+    Multiple inputs: waxrec left=/dev/ttyACM0 right=/dev/ttyACM1 udp://:1234 -log
 
     'device' on Windows "\\.\COM1", Mac "/dev/tty.usbmodem*"
 */
@@ -66,6 +67,7 @@
     /* Files */
     #include <direct.h>
     #define mkdir(path, mode) _mkdir(path)
+    #define fsync _commit
 
     /* Sleep */
     #define sleep(seconds) Sleep(seconds * 1000UL)
@@ -73,6 +75,7 @@
 
     /* Time */
     #define gmtime_r(timer, result) gmtime_s(result, timer)
+    #define localtime_r(timer, result) localtime_s(result, timer)
     #define timegm _mkgmtime
 
     /* Socket */
@@ -97,6 +100,21 @@
     #define mutex_unlock(mutex) (ReleaseMutex(*(mutex)) == 0)
     #define mutex_destroy(mutex) (CloseHandle(*(mutex)) == 0)
 
+    /* Condition (auto-reset event: a signal is kept until the single waiter takes it) */
+	#define cond_t HANDLE
+    #define cond_init(cond, attr_ignored) ((*(cond) = CreateEvent(attr_ignored, FALSE, FALSE, NULL)) == NULL)
+    #define cond_signal(cond) (SetEvent(*(cond)) == 0)
+    #define cond_timedwait_ms(cond, mutex, msec) (mutex_unlock(mutex), WaitForSingleObject(*(cond), (msec)), mutex_lock(mutex))
+    #define cond_destroy(cond) (CloseHandle(*(cond)) == 0)
+
+    /* Atomic (ring indexes shared between threads, full barrier) */
+    #define atomic_get(ptr) ((unsigned int)InterlockedCompareExchange((volatile LONG *)(ptr), 0, 0))
+    #define atomic_set(ptr, value) InterlockedExchange((volatile LONG *)(ptr), (LONG)(value))
+    #define atomic_cas(ptr, expected, value) (InterlockedCompareExchange((volatile LONG *)(ptr), (LONG)(value), (LONG)(expected)) == (LONG)(expected))
+
+    /* Process (commands started without waiting) */
+    #include <process.h>
+
     /* Device discovery */
     #include <setupapi.h>
     #ifdef _MSC_VER
@@ -107,6 +125,13 @@
 
 #else
 
+    /* Batched socket calls */
+    #ifdef __linux__
+        #define _GNU_SOURCE
+        #define HAVE_SENDMMSG
+        #define HAVE_RECVMMSG
+    #endif
+
     /* Sockets */
     #include <unistd.h>
     #include <sys/wait.h>
@@ -117,6 +142,7 @@
     #include <netinet/tcp.h>
     #include <netdb.h>
     #include <termios.h>
+    #include <poll.h>
     typedef int SOCKET;
     #define SOCKET_ERROR (-1)
     #define closesocket close
@@ -133,7 +159,7 @@
     #define thread_join   pthread_join
     #define thread_cancel pthread_cancel
     typedef void *        thread_return_t;
-    #define thread_return_value(value_ignored) ((value_ignored), NULL)
+    #define thread_return_value(value_ignored) ((void)(value_ignored), NULL)
 
     /* Mutex */
 	#define mutex_t       pthread_mutex_t
@@ -142,6 +168,32 @@
     #define mutex_unlock  pthread_mutex_unlock
     #define mutex_destroy pthread_mutex_destroy
 
+    /* Condition */
+    #include <sys/time.h>
+	#define cond_t        pthread_cond_t
+    #define cond_init     pthread_cond_init
+    #define cond_signal   pthread_cond_signal
+    #define cond_destroy  pthread_cond_destroy
+    static int cond_timedwait_ms(pthread_cond_t *cond, pthread_mutex_t *mutex, int msec)
+    {
+        struct timeval now;
+        struct timespec until;
+        gettimeofday(&now, NULL);
+        until.tv_sec = now.tv_sec + msec / 1000;
+        until.tv_nsec = now.tv_usec * 1000L + (msec % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) { until.tv_sec++; until.tv_nsec -= 1000000000L; }
+        return pthread_cond_timedwait(cond, mutex, &until);
+    }
+
+    /* Atomic (ring indexes shared between threads, full barrier) */
+    #define atomic_get(ptr) __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+    #define atomic_set(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST)
+    #define atomic_cas(ptr, expected, value) __sync_bool_compare_and_swap(ptr, expected, value)
+
+    /* Process (commands started without waiting) */
+    #include <spawn.h>
+    extern char **environ;
+
 #endif
 
 
@@ -150,12 +202,18 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdarg.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
 #include <sys/timeb.h>
 #include <sys/stat.h>
 
+/* Sending on a closed connection returns an error rather than raising SIGPIPE (where there is no MSG_NOSIGNAL, SO_NOSIGPIPE is set on the socket) */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 
 /* USB IDs */
 #define DEFAULT_VID 0x04D8           /* USB Vendor ID  */
@@ -226,6 +284,27 @@ static unsigned short BitUnpack_uint10(const void *buffer, unsigned short index)
     }
     return 0;
 }
+
+// Un-pack 'count' consecutive 10-bit values, starting at value 'index', a whole 5-byte group at a time where aligned.
+static void BitUnpack_uint10_n(unsigned short *values, const void *buffer, unsigned short index, unsigned short count)
+{
+    const unsigned char *p;
+
+    // Leading values up to a group boundary
+    while (count > 0 && (index & 0x03) != 0) { *values++ = BitUnpack_uint10(buffer, index++); count--; }
+
+    // Whole groups
+    for (p = (const unsigned char *)buffer + ((index >> 2) * 5); count >= 4; p += 5, index += 4, count -= 4)
+    {
+        *values++ = ((unsigned short)p[0]     ) | (((unsigned short)p[1] & 0x0003) << 8);      // A
+        *values++ = ((unsigned short)p[1] >> 2) | (((unsigned short)p[2] & 0x000f) << 6);      // B
+        *values++ = ((unsigned short)p[2] >> 4) | (((unsigned short)p[3] & 0x003f) << 4);      // C
+        *values++ = ((unsigned short)p[3] >> 6) | (((unsigned short)p[4]         ) << 2);      // D
+    }
+
+    // Trailing values
+    while (count > 0) { *values++ = BitUnpack_uint10(buffer, index++); count--; }
+}
 #define DATA_INTERVAL 1        // (20 = 5 seconds, max 28)
 #define DATA_MAX_INTERVAL 28    
 #define DATA_OFFSET 18
@@ -408,6 +487,17 @@ static SOCKET opentcpsocket(const char *host, int defaultPort)
     }
   }
 
+#ifdef SO_NOSIGPIPE
+  /* No SIGPIPE if the server closes the connection */
+  {
+    int nosigpipeoption = 1;
+    if (setsockopt(clientSocket, SOL_SOCKET, SO_NOSIGPIPE, (char *)&nosigpipeoption, sizeof(nosigpipeoption)) < 0)
+    {
+      fprintf(stderr, "WARNING: Setting no-SIGPIPE socket option failed (%s)\n", strerrorsocket());
+    }
+  }
+#endif
+
   /* Connect */
   if (connect(clientSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0)
   {
@@ -437,12 +527,11 @@ static size_t tcptransmit(SOCKET s, const void *sendBuffer, size_t sendLength)
 	size_t sent = 0;
 	if (sendLength > 0)
 	{
-		fprintf(stderr, "[%d]\n", (int)sendLength);
 		/*fprintf(stderr, "DEBUG: Sending...\n");*/
 		/*hexdump(sendBuffer, sendLength);*/
 		while (sent < sendLength)
 		{
-			int ret = send(s, (const char *)sendBuffer + sent, sendLength - sent, 0);
+			int ret = send(s, (const char *)sendBuffer + sent, sendLength - sent, MSG_NOSIGNAL);
 			if (ret < 0)
 			{
 				fprintf(stderr, "ERROR: Send failed (%s)\n", strerrorsocket());
@@ -501,34 +590,149 @@ static size_t tcpreceive(SOCKET s, char *recvBuffer, size_t recvBufferLength)
 /** STOMP **/
 
 #define STOMP_PORT 61613
-#define STOMP_BUFFER_SIZE 0xffff
-/* reconnect delay -- make time-based instead */
-#define STOMP_DELAY 100
+#define STOMP_QUEUE_DEFAULT 256             /* Queued messages */
+#define STOMP_MESSAGE_SIZE 4096             /* Maximum size of a queued SEND frame */
+#define STOMP_RECONNECT_MIN 100             /* Initial reconnect delay (msec), doubling on each failure... */
+#define STOMP_RECONNECT_MAX 30000           /* ...up to this maximum */
+#define STOMP_FULL_DROP  0                  /* A full queue drops new messages */
+#define STOMP_FULL_BLOCK 1                  /* A full queue blocks the receiver until there is space */
 
+unsigned long long TicksNow(void);
+
+/* Messages are formatted directly in to a fixed queue, and sent by a separate thread so that a slow or unavailable broker does not stall receiving */
 typedef struct TinyStompTransmitter_t
 {
 	int _sock;
-	unsigned char *_buffer;
-	int _bufferPos;
     char *_host;
     int _port;
+    char _connect[512];                     /* CONNECT frame */
+
+    /* Queue (fixed-size slots) */
+    char *_queue;
+    size_t *_length;
+    int _queueLength;
+    int _head, _count;
+    char _full;                             /* STOMP_FULL_DROP / STOMP_FULL_BLOCK */
+    char _quit;
+    mutex_t _mutex;
+    cond_t _notEmpty, _notFull;
+    thread_t _thread;
+
+    /* Reconnection */
     int _delay;
+    unsigned long long _nextConnect;
+    unsigned long long _connected;          /* Time the current connection was made */
+
+    /* Counters */
+    unsigned long _queued, _sent, _dropped, _reconnects;
+    int _maxCount;
 } TinyStompTransmitter;
 
 TinyStompTransmitter *stompTransmitter = NULL;
 
 
-TinyStompTransmitter *TinyStompTransmitter_New(const char *host, int defaultPort)
+/* Wait longer before each further connection attempt (sender thread) */
+static void TinyStompTransmitter_Backoff(TinyStompTransmitter *inst, unsigned long long now)
+{
+    inst->_delay = (inst->_delay <= 0) ? STOMP_RECONNECT_MIN : inst->_delay * 2;
+    if (inst->_delay > STOMP_RECONNECT_MAX) { inst->_delay = STOMP_RECONNECT_MAX; }
+    inst->_nextConnect = now + inst->_delay;
+    inst->_reconnects++;
+}
+
+
+/* Connect to the broker (sender thread), returns non-zero if connected */
+static int TinyStompTransmitter_Connect(TinyStompTransmitter *inst)
+{
+    unsigned long long now = TicksNow();
+    size_t tlen;
+
+    if (inst->_sock != SOCKET_ERROR) { return 1; }
+    if (now < inst->_nextConnect) { return 0; }
+
+    inst->_sock = opentcpsocket(inst->_host, inst->_port);
+    if (inst->_sock != SOCKET_ERROR)
+    {
+        tlen = tcptransmit((SOCKET)inst->_sock, inst->_connect, strlen(inst->_connect) + 1);
+        if (tlen == strlen(inst->_connect) + 1) { inst->_connected = now; return 1; }
+        fprintf(stderr, "WARNING: Problem transmitting CONNECT: %d / %d\n", (int)tlen, (int)strlen(inst->_connect) + 1);
+        closesocket(inst->_sock);
+        inst->_sock = SOCKET_ERROR;
+    }
+
+    /* Back off before the next attempt */
+    TinyStompTransmitter_Backoff(inst, now);
+    return 0;
+}
+
+
+/* Sender thread */
+static thread_return_t TinyStompTransmitter_Thread(void *arg)
+{
+    TinyStompTransmitter *inst = (TinyStompTransmitter *)arg;
+
+    mutex_lock(&inst->_mutex);
+    for (;;)
+    {
+        const char *frame;
+        size_t length;
+        size_t tlen;
+
+        /* Wait for a message */
+        while (inst->_count == 0 && !inst->_quit) { cond_timedwait_ms(&inst->_notEmpty, &inst->_mutex, 1000); }
+        if (inst->_count == 0) { break; }
+        frame = inst->_queue + (size_t)inst->_head * STOMP_MESSAGE_SIZE;
+        length = inst->_length[inst->_head];
+        mutex_unlock(&inst->_mutex);
+
+        /* (Re-)connect */
+        if (!TinyStompTransmitter_Connect(inst))
+        {
+            mutex_lock(&inst->_mutex);
+            if (inst->_quit) { break; }         /* Don't wait for the broker when closing */
+            {
+                unsigned long long now = TicksNow();
+                if (inst->_nextConnect > now) { cond_timedwait_ms(&inst->_notEmpty, &inst->_mutex, (int)(inst->_nextConnect - now)); }
+            }
+            continue;
+        }
+
+        /* Send the message at the head of the queue (the slot is not reused until it is removed) */
+        tlen = tcptransmit((SOCKET)inst->_sock, frame, length);
+        if (tlen != length)
+        {
+            fprintf(stderr, "WARNING: Problem transmitting: %d / %d\n", (int)tlen, (int)length);
+            closesocket(inst->_sock);
+            inst->_sock = SOCKET_ERROR;
+            TinyStompTransmitter_Backoff(inst, TicksNow());   /* Retry this message after reconnecting (a broker that accepts then drops connections is not retried at once) */
+            mutex_lock(&inst->_mutex);
+            continue;
+        }
+        if (TicksNow() - inst->_connected >= (unsigned long long)inst->_delay) { inst->_delay = 0; }   /* The broker is healthy once a message is sent on a connection that has lasted the backoff delay */
+
+        mutex_lock(&inst->_mutex);
+        inst->_head = (inst->_head + 1) % inst->_queueLength;
+        inst->_count--;
+        inst->_sent++;
+        cond_signal(&inst->_notFull);
+    }
+    mutex_unlock(&inst->_mutex);
+
+    return thread_return_value(0);
+}
+
+
+TinyStompTransmitter *TinyStompTransmitter_New(const char *host, int defaultPort, const char *user, const char *password, int queueLength, char full)
 {
 	TinyStompTransmitter *trans;
 
 	trans = (TinyStompTransmitter *)malloc(sizeof(TinyStompTransmitter));
-	trans->_buffer = (unsigned char *)malloc(STOMP_BUFFER_SIZE);
-	trans->_bufferPos = 0;
+    if (trans == NULL) { return NULL; }
+    memset(trans, 0, sizeof(TinyStompTransmitter));
 	trans->_sock = SOCKET_ERROR;
     trans->_host = strdup(host);
     trans->_port = defaultPort;
-    trans->_delay = 0;
+    sprintf(trans->_connect, "CONNECT\r\nlogin:%.128s\r\npasscode:%.128s\r\n\r\n", user, password);
 
     /* Parse and remove port */
     {
@@ -540,70 +744,103 @@ TinyStompTransmitter *TinyStompTransmitter_New(const char *host, int defaultPort
         }
     }
 
+    /* Queue */
+    trans->_queueLength = (queueLength > 0) ? queueLength : STOMP_QUEUE_DEFAULT;
+    trans->_queue = (char *)malloc((size_t)trans->_queueLength * STOMP_MESSAGE_SIZE);
+    trans->_length = (size_t *)malloc((size_t)trans->_queueLength * sizeof(size_t));
+    trans->_full = full;
+    if (trans->_queue == NULL || trans->_length == NULL)
+    {
+        fprintf(stderr, "ERROR: Out of memory for the STOMP queue.\n");
+        free(trans->_queue); free(trans->_length); free(trans->_host); free(trans);
+        return NULL;
+    }
+
+    /* Sender thread */
+    mutex_init(&trans->_mutex, NULL);
+    cond_init(&trans->_notEmpty, NULL);
+    cond_init(&trans->_notFull, NULL);
+    if (thread_create(&trans->_thread, NULL, TinyStompTransmitter_Thread, trans) != 0)
+    {
+        fprintf(stderr, "ERROR: Problem creating STOMP sender thread.\n");
+        cond_destroy(&trans->_notFull);
+        cond_destroy(&trans->_notEmpty);
+        mutex_destroy(&trans->_mutex);
+        free(trans->_queue); free(trans->_length); free(trans->_host); free(trans);
+        return NULL;
+    }
+
 	return trans;
 }
 
 
-void TinyStompTransmitter_Transmit(TinyStompTransmitter *inst, const char *destination, const char *message, const char *user, const char *password)
+/* Start a message for the destination, returns where to write the message body (the largest packet's JSON is ~2 KB), or NULL if it is dropped */
+char *TinyStompTransmitter_Begin(TinyStompTransmitter *inst, const char *destination)
 {
-	/* Start packet */
-	if (inst == NULL) { return; }
-	inst->_bufferPos = 0;
+    char *p;
+    size_t len;
 
-	inst->_bufferPos += sprintf((char *)inst->_buffer + inst->_bufferPos, "SEND\r\ndestination:%s\r\n\r\n%s\r\n", destination, message);
-	inst->_buffer[inst->_bufferPos++] = '\0';
+	if (inst == NULL) { return NULL; }
 
-	/* Open TCP socket */
-	if (inst->_sock == SOCKET_ERROR && inst->_host != NULL)
-	{
-        if (inst->_delay == 0)
-        {
-		    inst->_sock = opentcpsocket(inst->_host, inst->_port);
-		    if (inst->_sock != SOCKET_ERROR)
-		    {
-			    char msg[256];
-			    size_t tlen;
-                sprintf(msg, "CONNECT\r\nlogin:%s\r\npasscode:%s\r\n\r\n", user, password);
-			    tlen = tcptransmit((SOCKET)inst->_sock, msg, strlen(msg) + 1);
-			    if (tlen != strlen(msg) + 1)
-                {
-                    fprintf(stderr, "WARNING: Problem transmitting CONNECT: %d / %d\n", (int)tlen, (int)strlen(msg) + 1);
-                    inst->_sock = SOCKET_ERROR;
-                    inst->_delay = STOMP_DELAY;
-                }
-		    }
-        }
-        else
+    mutex_lock(&inst->_mutex);
+    while (inst->_count >= inst->_queueLength)
+    {
+        if (inst->_full != STOMP_FULL_BLOCK)
         {
-            /* Wait until reconnect attempt */
-            inst->_delay--;
+            if (inst->_dropped == 0) { fprintf(stderr, "WARNING: STOMP queue full, dropping messages.\n"); }
+            inst->_dropped++;
+            mutex_unlock(&inst->_mutex);
+            return NULL;
         }
-	}
+        cond_timedwait_ms(&inst->_notFull, &inst->_mutex, 1000);
+    }
+    p = inst->_queue + (size_t)((inst->_head + inst->_count) % inst->_queueLength) * STOMP_MESSAGE_SIZE;
+    mutex_unlock(&inst->_mutex);
+
+    /* Only this thread writes to the free slot */
+    len = strlen(destination);
+    if (len > STOMP_MESSAGE_SIZE / 4) { len = STOMP_MESSAGE_SIZE / 4; }
+    memcpy(p, "SEND\r\ndestination:", 18);
+    memcpy(p + 18, destination, len);
+    memcpy(p + 18 + len, "\r\n\r\n", 4);
+    return p + 18 + len + 4;
+}
 
-	if (inst->_sock != SOCKET_ERROR)
-	{ 
-		size_t tlen = tcptransmit((SOCKET)inst->_sock, inst->_buffer, inst->_bufferPos);
-		if (tlen != inst->_bufferPos)
-        {
-            fprintf(stderr, "WARNING: Problem transmitting: %d / %d\n", (int)tlen, inst->_bufferPos); 
-		    closesocket(inst->_sock);
-            inst->_sock = SOCKET_ERROR;
-            inst->_delay = STOMP_DELAY;
-        }
-	}
-	inst->_bufferPos = 0;
+
+/* Queue the message started with TinyStompTransmitter_Begin(), the body ends at 'end' */
+void TinyStompTransmitter_Commit(TinyStompTransmitter *inst, char *end)
+{
+    int tail;
+	if (inst == NULL) { return; }
+
+    mutex_lock(&inst->_mutex);
+    tail = (inst->_head + inst->_count) % inst->_queueLength;
+    *end++ = '\r'; *end++ = '\n'; *end++ = '\0';
+    inst->_length[tail] = end - (inst->_queue + (size_t)tail * STOMP_MESSAGE_SIZE);
+    inst->_count++;
+    inst->_queued++;
+    if (inst->_count > inst->_maxCount) { inst->_maxCount = inst->_count; }
+    cond_signal(&inst->_notEmpty);
+    mutex_unlock(&inst->_mutex);
 }
 
 
 void TinyStompTransmitter_Delete(TinyStompTransmitter *inst)
 {
 	if (inst == NULL) { return; }
-	if (inst->_buffer != NULL)
-	{
-		free(inst->_buffer);
-		inst->_buffer = NULL;
-	}
-	inst->_bufferPos = 0;
+
+    /* Stop the sender thread (after it sends what it can) */
+    mutex_lock(&inst->_mutex);
+    inst->_quit = 1;
+    cond_signal(&inst->_notEmpty);
+    mutex_unlock(&inst->_mutex);
+    thread_join(inst->_thread, NULL);
+    cond_destroy(&inst->_notFull);
+    cond_destroy(&inst->_notEmpty);
+    mutex_destroy(&inst->_mutex);
+
+    fprintf(stderr, "STOMP: %lu queued, %lu sent, %lu dropped, %d unsent, %d queue high-water, %lu failed connections\n", inst->_queued, inst->_sent, inst->_dropped, inst->_count, inst->_maxCount, inst->_reconnects);
+
 	if (inst->_sock != SOCKET_ERROR)
 	{
 		const char *msg = "DISCONNECT\r\n\r\n";
@@ -613,11 +850,62 @@ void TinyStompTransmitter_Delete(TinyStompTransmitter *inst)
 		closesocket(inst->_sock);
 		inst->_sock = SOCKET_ERROR;
 	}
+    free(inst->_queue);
+    free(inst->_length);
 	if (inst->_host != NULL)
     {
         free(inst->_host);
         inst->_host = NULL;
     }
+    free(inst);
+}
+
+
+/* Fast formatting of JSON fields (no locale or format-string parsing) */
+static char *json_text(char *p, const char *text)
+{
+    while (*text != '\0') { *p++ = *text++; }
+    return p;
+}
+
+static char *json_uint(char *p, unsigned long long value)
+{
+    char digits[20];
+    int n = 0;
+    do { digits[n++] = (char)('0' + (value % 10)); value /= 10; } while (value != 0);
+    while (n > 0) { *p++ = digits[--n]; }
+    return p;
+}
+
+static char *json_int(char *p, long long value)
+{
+    if (value < 0) { *p++ = '-'; return json_uint(p, (unsigned long long)(-(value + 1)) + 1); }
+    return json_uint(p, (unsigned long long)value);
+}
+
+/* "name":"value", */
+static char *json_field_uint(char *p, const char *name, unsigned long long value)
+{
+    *p++ = '"'; p = json_text(p, name); *p++ = '"'; *p++ = ':'; *p++ = '"';
+    p = json_uint(p, value);
+    *p++ = '"'; *p++ = ',';
+    return p;
+}
+
+static char *json_field_int(char *p, const char *name, long long value)
+{
+    *p++ = '"'; p = json_text(p, name); *p++ = '"'; *p++ = ':'; *p++ = '"';
+    p = json_int(p, value);
+    *p++ = '"'; *p++ = ',';
+    return p;
+}
+
+static char *json_field_text(char *p, const char *name, const char *value)
+{
+    *p++ = '"'; p = json_text(p, name); *p++ = '"'; *p++ = ':'; *p++ = '"';
+    p = json_text(p, value);
+    *p++ = '"'; *p++ = ',';
+    return p;
 }
 
 /** **/
@@ -690,108 +978,157 @@ static size_t transmit(SOCKET s, struct sockaddr_in *serverAddr, const void *sen
 }
 
 
-/* Read a line from the device */
-static size_t lineread(int fd, void *inBuffer, size_t len)
+/* SLIP framing bytes */
+#define SLIP_END     0xC0                   /* End of packet indicator */
+#define SLIP_ESC     0xDB                   /* Escape character, next character will be a substitution */
+#define SLIP_ESC_END 0xDC                   /* Escaped substitution for the END data byte */
+#define SLIP_ESC_ESC 0xDD                   /* Escaped substitution for the ESC data byte */
+
+/* Buffered reader state for one input (serial port or stdin) */
+#define READER_BUFFER_SIZE 4096
+typedef struct
+{
+    int fd;                                 /* Input descriptor (or HANDLE with WIN_HANDLE) */
+    unsigned char buffer[READER_BUFFER_SIZE];   /* Raw data read from the input */
+    size_t offset;                          /* Start of the unconsumed data in the buffer */
+    size_t length;                          /* End of the valid data in the buffer */
+    size_t received;                        /* Length of the partial frame already in the caller's buffer */
+    char escaped;                           /* The partial SLIP frame ended with an ESC byte */
+} Reader;
+
+
+/* Initialize a reader for the specified input */
+static void readerinit(Reader *reader, int fd)
+{
+    reader->fd = fd;
+    reader->offset = 0;
+    reader->length = 0;
+    reader->received = 0;
+    reader->escaped = 0;
+}
+
+
+/* Read the next chunk of data from the input into the reader's (empty) buffer, returns the number of bytes read, or <= 0 on timeout/end-of-file/error */
+static int readerfill(Reader *reader)
+{
+    int done;
+    reader->offset = 0;
+    reader->length = 0;
+#if defined(_WIN32) && defined(WIN_HANDLE)
+    if (!ReadFile((HANDLE)reader->fd, reader->buffer, sizeof(reader->buffer), (DWORD *)&done, 0)) { done = -1; }
+#else
+    done = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+#endif
+    if (done > 0) { reader->length = (size_t)done; }
+    return done;
+}
+
+
+/* Scan the buffered data for a line of text (without waiting for more data).
+   Returns the line length once complete, 0 if more data is needed, or (size_t)-1 if a SLIP_END was found. */
+static size_t linescan(Reader *reader, void *inBuffer, size_t len)
 {
     unsigned char *p = (unsigned char *)inBuffer;
-    size_t received = 0;
-    unsigned char c;
+    const unsigned char *s = reader->buffer + reader->offset;
+    const unsigned char *end = reader->buffer + reader->length;
 
-    if (fd < 0 || inBuffer == NULL) { return 0; }
-    *p = '\0';
-    for (;;)
+    while (s < end)
     {
-        c = '\0';
-#if defined(_WIN32) && defined(WIN_HANDLE)
+        unsigned char c = *s++;
+        if (c == SLIP_END)                      /* A SLIP_END means the reader should switch to slip reading. */
         {
-            int done;
-            ReadFile((HANDLE)fd, &c, 1, (DWORD *)&done, 0);
-            if (done <= 0) { return received; }
+            reader->offset = s - reader->buffer;
+            reader->received = 0;
+            return (size_t)-1;
         }
-#else
-        if (read(fd, &c, 1) <= 0) { return received; }
-#endif
-        if (c == 0xC0) { return (size_t)-1; }    /* A SLIP_END means the reader should switch to slip reading. */
         if (c == '\r' || c == '\n')
         {
-            if (received) { return received; }
+            if (reader->received)
+            {
+                size_t received = reader->received;
+                reader->offset = s - reader->buffer;
+                reader->received = 0;
+                return received;
+            }
         }
         else
         {
-            if (received < len - 1) { p[received++] = (char)c; p[received] = 0; }
+            if (reader->received < len - 1) { p[reader->received++] = c; p[reader->received] = 0; }
         }
     }
+    reader->offset = reader->length;
+    return 0;
 }
 
 
-/* Read a SLIP-encoded packet from the device */
-static size_t slipread(int fd, void *inBuffer, size_t len)
+/* Scan the buffered data for a SLIP-encoded packet (without waiting for more data), returns the packet length once complete, or 0 if more data is needed. */
+static size_t slipscan(Reader *reader, void *inBuffer, size_t len)
 {
-    #define SLIP_END     0xC0                   /* End of packet indicator */
-    #define SLIP_ESC     0xDB                   /* Escape character, next character will be a substitution */
-    #define SLIP_ESC_END 0xDC                   /* Escaped substitution for the END data byte */
-    #define SLIP_ESC_ESC 0xDD                   /* Escaped substitution for the ESC data byte */
     unsigned char *p = (unsigned char *)inBuffer;
-    size_t received = 0;
-    unsigned char c = '\0';
+    const unsigned char *s = reader->buffer + reader->offset;
+    const unsigned char *end = reader->buffer + reader->length;
 
-    if (fd < 0 || inBuffer == NULL) { return 0; }
-    for (;;)
+    while (s < end)
     {
-        c = '\0';
-#if defined(_WIN32) && defined(WIN_HANDLE)
+        const unsigned char *frameEnd, *escape;
+        size_t run;
+
+        /* The byte following an escape (may have been split across reads) */
+        if (reader->escaped)
         {
-            int done;
-            ReadFile((HANDLE)fd, &c, 1, (DWORD *)&done, 0);
-            if (done <= 0) { return received; }
+            unsigned char c = *s++;
+            reader->escaped = 0;
+            switch (c)
+            {
+                case SLIP_ESC_END: c = SLIP_END; break;
+                case SLIP_ESC_ESC: c = SLIP_ESC; break;
+                default: fprintf(stderr, "<Unexpected escaped value: %02x>", c); break;
+            }
+            if (reader->received < len) { p[reader->received++] = c; }
+            continue;
         }
-#else
-        if (read(fd, &c, 1) <= 0) { return received; }
-#endif
-        switch (c)
-        {
-            case SLIP_END:
-                if (received) { return received; }
-                break;
 
-            case SLIP_ESC:
-                c = '\0';
- #if defined(_WIN32) && defined(WIN_HANDLE)
-                {
-                    int done;
-                    ReadFile((HANDLE)fd, &c, 1, (DWORD *)&done, 0);
-                    if (done <= 0) { return received; }
-                }
-#else
-                if (read(fd, &c, 1) <= 0) { return received; }
-#endif
-               switch (c)
-                {
-                    case SLIP_ESC_END:
-                        c = SLIP_END;
-                        break;
-                    case SLIP_ESC_ESC:
-                        c = SLIP_ESC;
-                        break;
-                    default:
-                        fprintf(stderr, "<Unexpected escaped value: %02x>", c);
-                        break;
-                }
-                /* ... fall through to default case with our replaced character ... */
+        /* Find the end of the frame, and the first escape before it */
+        frameEnd = (const unsigned char *)memchr(s, SLIP_END, end - s);
+        if (frameEnd == NULL) { frameEnd = end; }
+        escape = (const unsigned char *)memchr(s, SLIP_ESC, frameEnd - s);
+        if (escape == NULL) { escape = frameEnd; }
+
+        /* Copy the unescaped run in bulk */
+        run = escape - s;
+        if (run > len - reader->received) { run = len - reader->received; }
+        memcpy(p + reader->received, s, run);
+        reader->received += run;
+        s = escape;
 
-            default:
-                if (received < len) { p[received++] = c; }
-                break;
+        if (s < frameEnd)
+        {
+            /* Escape byte */
+            reader->escaped = 1;
+            s++;
+        }
+        else if (s < end)
+        {
+            /* End of frame */
+            s++;
+            if (reader->received)
+            {
+                size_t received = reader->received;
+                reader->offset = s - reader->buffer;
+                reader->received = 0;
+                return received;
+            }
         }
     }
+    reader->offset = reader->length;
+    return 0;
 }
 
 
-/* Parse a binary WAX packet */
-WaxPacket *parseWaxPacket(const void *inputBuffer, size_t len, unsigned long long now)
+/* Parse a binary WAX packet in to the caller's structure (returns the structure, or NULL if not valid) */
+WaxPacket *parseWaxPacket(WaxPacket *waxPacket, const void *inputBuffer, size_t len, unsigned long long now)
 {
     const unsigned char *buffer = (const unsigned char *)inputBuffer;
-    static WaxPacket waxPacket;
 
     if (buffer == NULL || len <= 0) { return 0; }
 
@@ -835,10 +1172,10 @@ WaxPacket *parseWaxPacket(const void *inputBuffer, size_t len, unsigned long lon
             int i;
             if (len > expectedLength) { fprintf(stderr, "WARNING: Data packet was larger than expected, ignoring additional samples"); }
 
-            waxPacket.timestamp = now;
-            waxPacket.deviceId = deviceId;
-            waxPacket.sequenceId = sequenceId;
-            waxPacket.sampleCount = sampleCount;
+            waxPacket->timestamp = now;
+            waxPacket->deviceId = deviceId;
+            waxPacket->sequenceId = sequenceId;
+            waxPacket->sampleCount = sampleCount;
 
             for (i = 0; i < sampleCount; i++)
             {
@@ -869,13 +1206,13 @@ WaxPacket *parseWaxPacket(const void *inputBuffer, size_t len, unsigned long lon
                 frequency = 3200 / ((unsigned short)1 << (15 - (format & 0x0f)));
                 millisecondsAgo = !frequency ? 0 : (short)((sampleCount + outstanding - 1 - i) * 1000L / frequency);
 
-                waxPacket.samples[i].timestamp = now - millisecondsAgo;
-                waxPacket.samples[i].sampleIndex = sequenceId + i;
-                waxPacket.samples[i].x = x;
-                waxPacket.samples[i].y = y;
-                waxPacket.samples[i].z = z;
+                waxPacket->samples[i].timestamp = now - millisecondsAgo;
+                waxPacket->samples[i].sampleIndex = sequenceId + i;
+                waxPacket->samples[i].x = x;
+                waxPacket->samples[i].y = y;
+                waxPacket->samples[i].z = z;
             }
-            return &waxPacket;
+            return waxPacket;
         }
     }
     else if (len >= 12 && buffer[0] == 0x12 && buffer[1] == 0x58)
@@ -890,11 +1227,10 @@ WaxPacket *parseWaxPacket(const void *inputBuffer, size_t len, unsigned long lon
 }
 
 
-/* Parse a binary WAX9 packet */
-Wax9Packet *parseWax9Packet(const void *inputBuffer, size_t len, unsigned long long now)
+/* Parse a binary WAX9 packet in to the caller's structure (returns the structure, or NULL if not valid) */
+Wax9Packet *parseWax9Packet(Wax9Packet *wax9Packet, const void *inputBuffer, size_t len, unsigned long long now)
 {
     const unsigned char *buffer = (const unsigned char *)inputBuffer;
-    static Wax9Packet wax9Packet;
 
     if (buffer == NULL || len <= 0) { return 0; }
 
@@ -904,71 +1240,71 @@ Wax9Packet *parseWax9Packet(const void *inputBuffer, size_t len, unsigned long l
     }
     else if (len >= 20)
     {
-        wax9Packet.packetType = buffer[0];
-        wax9Packet.packetVersion = buffer[1];
-        wax9Packet.sampleNumber = buffer[2] | ((unsigned short)buffer[3] << 8);
-        wax9Packet.timestamp = buffer[4] | ((unsigned int)buffer[5] << 8) | ((unsigned int)buffer[6] << 16) | ((unsigned int)buffer[7] << 24);
+        wax9Packet->packetType = buffer[0];
+        wax9Packet->packetVersion = buffer[1];
+        wax9Packet->sampleNumber = buffer[2] | ((unsigned short)buffer[3] << 8);
+        wax9Packet->timestamp = buffer[4] | ((unsigned int)buffer[5] << 8) | ((unsigned int)buffer[6] << 16) | ((unsigned int)buffer[7] << 24);
 
-        wax9Packet.accel.x = (short)((unsigned short)(buffer[ 8] | (((unsigned short)buffer[ 9]) << 8)));
-        wax9Packet.accel.y = (short)((unsigned short)(buffer[10] | (((unsigned short)buffer[11]) << 8)));
-        wax9Packet.accel.z = (short)((unsigned short)(buffer[12] | (((unsigned short)buffer[13]) << 8)));
+        wax9Packet->accel.x = (short)((unsigned short)(buffer[ 8] | (((unsigned short)buffer[ 9]) << 8)));
+        wax9Packet->accel.y = (short)((unsigned short)(buffer[10] | (((unsigned short)buffer[11]) << 8)));
+        wax9Packet->accel.z = (short)((unsigned short)(buffer[12] | (((unsigned short)buffer[13]) << 8)));
 
         if (len >= 20)
         {
-            wax9Packet.gyro.x  = (short)((unsigned short)(buffer[14] | (((unsigned short)buffer[15]) << 8)));
-            wax9Packet.gyro.y  = (short)((unsigned short)(buffer[16] | (((unsigned short)buffer[17]) << 8)));
-            wax9Packet.gyro.z  = (short)((unsigned short)(buffer[18] | (((unsigned short)buffer[19]) << 8)));
+            wax9Packet->gyro.x  = (short)((unsigned short)(buffer[14] | (((unsigned short)buffer[15]) << 8)));
+            wax9Packet->gyro.y  = (short)((unsigned short)(buffer[16] | (((unsigned short)buffer[17]) << 8)));
+            wax9Packet->gyro.z  = (short)((unsigned short)(buffer[18] | (((unsigned short)buffer[19]) << 8)));
         }
         else
         {
-            wax9Packet.gyro.x   = 0;
-            wax9Packet.gyro.y   = 0;
-            wax9Packet.gyro.z   = 0;
+            wax9Packet->gyro.x   = 0;
+            wax9Packet->gyro.y   = 0;
+            wax9Packet->gyro.z   = 0;
         }
 
         if (len >= 26)
         {
-            wax9Packet.mag.x   = (short)((unsigned short)(buffer[20] | (((unsigned short)buffer[21]) << 8)));
-            wax9Packet.mag.y   = (short)((unsigned short)(buffer[22] | (((unsigned short)buffer[23]) << 8)));
-            wax9Packet.mag.z   = (short)((unsigned short)(buffer[24] | (((unsigned short)buffer[25]) << 8)));
+            wax9Packet->mag.x   = (short)((unsigned short)(buffer[20] | (((unsigned short)buffer[21]) << 8)));
+            wax9Packet->mag.y   = (short)((unsigned short)(buffer[22] | (((unsigned short)buffer[23]) << 8)));
+            wax9Packet->mag.z   = (short)((unsigned short)(buffer[24] | (((unsigned short)buffer[25]) << 8)));
         }
         else
         {
-            wax9Packet.mag.x   = 0;
-            wax9Packet.mag.y   = 0;
-            wax9Packet.mag.z   = 0;
+            wax9Packet->mag.x   = 0;
+            wax9Packet->mag.y   = 0;
+            wax9Packet->mag.z   = 0;
         }
 
         if (len >= 28)
         {
-            wax9Packet.battery = (unsigned short)(buffer[26] | (((unsigned short)buffer[27]) << 8));
+            wax9Packet->battery = (unsigned short)(buffer[26] | (((unsigned short)buffer[27]) << 8));
         }
         else
         {
-            wax9Packet.battery = 0xffff;
+            wax9Packet->battery = 0xffff;
         }
 
         if (len >= 30)
         {
-            wax9Packet.temperature = (short)((unsigned short)(buffer[28] | (((unsigned short)buffer[29]) << 8)));
+            wax9Packet->temperature = (short)((unsigned short)(buffer[28] | (((unsigned short)buffer[29]) << 8)));
         }
         else
         {
-            wax9Packet.temperature = 0xffff;
+            wax9Packet->temperature = 0xffff;
         }
 
         if (len >= 34)
         {
-            wax9Packet.pressure = buffer[30] | ((unsigned int)buffer[31] << 8) | ((unsigned int)buffer[32] << 16) | ((unsigned int)buffer[33] << 24);
-			wax9Packet.hasExtended = 1;
+            wax9Packet->pressure = buffer[30] | ((unsigned int)buffer[31] << 8) | ((unsigned int)buffer[32] << 16) | ((unsigned int)buffer[33] << 24);
+			wax9Packet->hasExtended = 1;
         }
         else
         {
-            wax9Packet.pressure = 0xfffffffful;
-			wax9Packet.hasExtended = 0;
+            wax9Packet->pressure = 0xfffffffful;
+			wax9Packet->hasExtended = 0;
 		}
 
-        return &wax9Packet;
+        return wax9Packet;
     }
     else
     {
@@ -978,22 +1314,20 @@ Wax9Packet *parseWax9Packet(const void *inputBuffer, size_t len, unsigned long l
 }
 
 
-/* Parse a binary TEDDI packet */
-TeddiPacket *parseTeddiPacket(const void *inputBuffer, size_t len, unsigned long long now)
+/* Parse a binary TEDDI packet in to the caller's structure (returns the structure, or NULL if not valid) */
+TeddiPacket *parseTeddiPacket(TeddiPacket *teddiPacket, const void *inputBuffer, size_t len, unsigned long long now)
 {
     const unsigned char *buffer = (const unsigned char *)inputBuffer;
-    static TeddiPacket teddiPacket;
-    int i;
 
-    teddiPacket.valid = 0;
+    teddiPacket->valid = 0;
     if (buffer == NULL || len <= 0) { return 0; }
 
     if (len >= 5 && buffer[0] == 0x12 && buffer[1] == 0x54)
     {
-        teddiPacket.deviceId = (unsigned short)(buffer[2] | (((unsigned short)buffer[3]) << 8));
-        teddiPacket.version = buffer[4];
+        teddiPacket->deviceId = (unsigned short)(buffer[2] | (((unsigned short)buffer[3]) << 8));
+        teddiPacket->version = buffer[4];
 
-        if (((teddiPacket.version & 0x0f) == 0x03 || (teddiPacket.version & 0x0f) >= 0x04) && len >= 18)
+        if (((teddiPacket->version & 0x0f) == 0x03 || (teddiPacket->version & 0x0f) >= 0x04) && len >= 18)
         {
             /*
             #define DATA_OFFSET 18
@@ -1015,58 +1349,55 @@ TeddiPacket *parseTeddiPacket(const void *inputBuffer, size_t len, unsigned long
             unsigned short parentAltAddress;	// @ADDITIONAL_OFFSET+2  [2] (optional) Parent alt. address
             */
             unsigned char config = (unsigned char)(buffer[4] >> 4);
-            int msPerSample = 1000 / teddiFrequency[(teddiPacket.version >> 4)];
-            teddiPacket.sampleCount = (unsigned char)(buffer[5]);         // Sample count (default config is at 250 msec interval with an equal number of PIR and audio samples; 20 = 5 seconds)
-            teddiPacket.sequence = (unsigned short)(buffer[ 6] | (((unsigned short)buffer[ 7]) << 8));
-            teddiPacket.unsent =   (unsigned short)(buffer[ 8] | (((unsigned short)buffer[ 9]) << 8));
-            teddiPacket.temp =     (unsigned short)(buffer[10] | (((unsigned short)buffer[11]) << 8));
-            teddiPacket.light =    (unsigned short)(buffer[12] | (((unsigned short)buffer[13]) << 8));
-            teddiPacket.battery =  (unsigned short)(buffer[14] | (((unsigned short)buffer[15]) << 8));
+            int msPerSample = 1000 / teddiFrequency[(teddiPacket->version >> 4)];
+            teddiPacket->sampleCount = (unsigned char)(buffer[5]);         // Sample count (default config is at 250 msec interval with an equal number of PIR and audio samples; 20 = 5 seconds)
+            if (teddiPacket->sampleCount > DATA_MAX_INTERVAL)
+            {
+                fprintf(stderr, "WARNING: TEDDI packet has too many samples (%d, maximum %d) -- ignoring.\n", teddiPacket->sampleCount, DATA_MAX_INTERVAL);
+                return NULL;
+            }
+            teddiPacket->sequence = (unsigned short)(buffer[ 6] | (((unsigned short)buffer[ 7]) << 8));
+            teddiPacket->unsent =   (unsigned short)(buffer[ 8] | (((unsigned short)buffer[ 9]) << 8));
+            teddiPacket->temp =     (unsigned short)(buffer[10] | (((unsigned short)buffer[11]) << 8));
+            teddiPacket->light =    (unsigned short)(buffer[12] | (((unsigned short)buffer[13]) << 8));
+            teddiPacket->battery =  (unsigned short)(buffer[14] | (((unsigned short)buffer[15]) << 8));
 
             // Parent address is optional
-            teddiPacket.parentAddress = 0;
-            teddiPacket.parentAltAddress = 0;
+            teddiPacket->parentAddress = 0;
+            teddiPacket->parentAltAddress = 0;
 
-            teddiPacket.valid = 1;
+            teddiPacket->valid = 1;
 
-            if ((teddiPacket.version & 0x0f) >= 0x04)
+            if ((teddiPacket->version & 0x0f) >= 0x04)
             {
-                int additionalOffset = ADDITIONAL_OFFSET(teddiPacket.sampleCount);
-                teddiPacket.humidity = (unsigned short)(buffer[16] | (((unsigned short)buffer[17]) << 8));
+                int additionalOffset = ADDITIONAL_OFFSET(teddiPacket->sampleCount);
+                teddiPacket->humidity = (unsigned short)(buffer[16] | (((unsigned short)buffer[17]) << 8));
 
                 if (additionalOffset != (int)len && additionalOffset + 4 != (int)len)
                 {
                     fprintf(stderr, "WARNING: TEDDI packet incorrect length (%d, expected %d or 4 less) - probably corrupt?\n", len, additionalOffset + 4);
-                    teddiPacket.valid = 0;
+                    teddiPacket->valid = 0;
                 }
 
-                if (additionalOffset + 2 <= (int)len) { teddiPacket.parentAddress = (unsigned short)(buffer[additionalOffset + 0] | (((unsigned short)buffer[additionalOffset + 1]) << 8)); }
-                if (additionalOffset + 4 <= (int)len) { teddiPacket.parentAltAddress = (unsigned short)(buffer[additionalOffset + 2] | (((unsigned short)buffer[additionalOffset + 3]) << 8)); }
+                if (additionalOffset + 2 <= (int)len) { teddiPacket->parentAddress = (unsigned short)(buffer[additionalOffset + 0] | (((unsigned short)buffer[additionalOffset + 1]) << 8)); }
+                if (additionalOffset + 4 <= (int)len) { teddiPacket->parentAltAddress = (unsigned short)(buffer[additionalOffset + 2] | (((unsigned short)buffer[additionalOffset + 3]) << 8)); }
             }
             else
             {
-                teddiPacket.humidity = 0x00;
-            }
-
-            // Unpack PIR
-            for (i = 0; i < teddiPacket.sampleCount; i++)
-            {
-                teddiPacket.pirData[i] = BitUnpack_uint10(buffer + 18, i);
+                teddiPacket->humidity = 0x00;
             }
 
-            // Unpack Audio
-            for (i = 0; i < teddiPacket.sampleCount; i++)
-            {
-                teddiPacket.audioData[i] = BitUnpack_uint10(buffer + 18, teddiPacket.sampleCount + i);
-            }
+            // Unpack PIR, then audio
+            BitUnpack_uint10_n(teddiPacket->pirData, buffer + DATA_OFFSET, 0, teddiPacket->sampleCount);
+            BitUnpack_uint10_n(teddiPacket->audioData, buffer + DATA_OFFSET, teddiPacket->sampleCount, teddiPacket->sampleCount);
 
             // Divide temp/light/battery measurement down
-            if ((teddiPacket.version & 0x0f) <= 0x03 && teddiPacket.sampleCount > 0)
+            if ((teddiPacket->version & 0x0f) <= 0x03 && teddiPacket->sampleCount > 0)
             {
-                teddiPacket.temp     /= teddiPacket.sampleCount;
-                teddiPacket.light    /= teddiPacket.sampleCount;
-                teddiPacket.battery  /= teddiPacket.sampleCount;
-                teddiPacket.humidity /= teddiPacket.sampleCount;
+                teddiPacket->temp     /= teddiPacket->sampleCount;
+                teddiPacket->light    /= teddiPacket->sampleCount;
+                teddiPacket->battery  /= teddiPacket->sampleCount;
+                teddiPacket->humidity /= teddiPacket->sampleCount;
             }
 
 // [Each PIR/sound sample]
@@ -1074,10 +1405,10 @@ TeddiPacket *parseTeddiPacket(const void *inputBuffer, size_t len, unsigned long
 //   seq = (unsigned short)(sequence * sampleCount) + i
 // [Overall packet]
 //   time = timestamp - TimeSpan.FromMilliseconds((unsent + sampleCount - 1) * sampleInterval
-teddiPacket.timestampReceived = now;
-teddiPacket.timestampEstimated = teddiPacket.timestampReceived - (teddiPacket.unsent + teddiPacket.sampleCount - 1) * msPerSample;
+teddiPacket->timestampReceived = now;
+teddiPacket->timestampEstimated = teddiPacket->timestampReceived - (teddiPacket->unsent + teddiPacket->sampleCount - 1) * msPerSample;
 
-            return &teddiPacket;
+            return teddiPacket;
         }
         else
         {
@@ -1087,21 +1418,20 @@ teddiPacket.timestampEstimated = teddiPacket.timestampReceived - (teddiPacket.un
     return NULL;
 }
 
-/* Parse a binary TEDDI status packet */
-TeddiStatusPacket *parseTeddiStatusPacket(const void *inputBuffer, size_t len, unsigned long long now)
+/* Parse a binary TEDDI status packet in to the caller's structure (returns the structure, or NULL if not valid) */
+TeddiStatusPacket *parseTeddiStatusPacket(TeddiStatusPacket *teddiStatusPacket, const void *inputBuffer, size_t len, unsigned long long now)
 {
     const unsigned char *buffer = (const unsigned char *)inputBuffer;
-    static TeddiStatusPacket teddiStatusPacket;
     int i;
 
     if (buffer == NULL || len <= 0) { return 0; }
 
     if (len >= 5 && buffer[0] == 0x12 && buffer[1] == 0x53)
     {
-        teddiStatusPacket.reportType = buffer[0];
-        teddiStatusPacket.reportId = buffer[1];
-        teddiStatusPacket.deviceId = (unsigned short)(buffer[2] | (((unsigned short)buffer[3]) << 8));
-        teddiStatusPacket.version = buffer[4];
+        teddiStatusPacket->reportType = buffer[0];
+        teddiStatusPacket->reportId = buffer[1];
+        teddiStatusPacket->deviceId = (unsigned short)(buffer[2] | (((unsigned short)buffer[3]) << 8));
+        teddiStatusPacket->version = buffer[4];
 
         if (len >= 24)
         {
@@ -1122,23 +1452,23 @@ TeddiStatusPacket *parseTeddiStatusPacket(const void *inputBuffer, size_t len, u
                 unsigned char  neighbours[NUM_COORDINATOR/8];	// @ 16 [8] Neighbouring routers bitmap
             } TeddiStatusPacket;
             */
-            teddiStatusPacket.power =             (unsigned char)(buffer[5]);         // Sample count (default config is at 250 msec interval with an equal number of PIR and audio samples; 20 = 5 seconds)
-            teddiStatusPacket.sequence =          (unsigned short)(buffer[ 6] | (((unsigned short)buffer[ 7]) << 8));
-            teddiStatusPacket.shortAddress =      (unsigned short)(buffer[ 8] | (((unsigned short)buffer[ 9]) << 8));
-            teddiStatusPacket.lastLQI =           buffer[10];
-            teddiStatusPacket.lastRSSI =          buffer[11];
-            teddiStatusPacket.parentAddress =     (unsigned short)(buffer[12] | (((unsigned short)buffer[13]) << 8));
-            teddiStatusPacket.parentAltAddress =  (unsigned short)(buffer[14] | (((unsigned short)buffer[15]) << 8));
+            teddiStatusPacket->power =             (unsigned char)(buffer[5]);         // Sample count (default config is at 250 msec interval with an equal number of PIR and audio samples; 20 = 5 seconds)
+            teddiStatusPacket->sequence =          (unsigned short)(buffer[ 6] | (((unsigned short)buffer[ 7]) << 8));
+            teddiStatusPacket->shortAddress =      (unsigned short)(buffer[ 8] | (((unsigned short)buffer[ 9]) << 8));
+            teddiStatusPacket->lastLQI =           buffer[10];
+            teddiStatusPacket->lastRSSI =          buffer[11];
+            teddiStatusPacket->parentAddress =     (unsigned short)(buffer[12] | (((unsigned short)buffer[13]) << 8));
+            teddiStatusPacket->parentAltAddress =  (unsigned short)(buffer[14] | (((unsigned short)buffer[15]) << 8));
 
             // Neighbour table
             for (i = 0; i < NUM_COORDINATOR/8; i++)
             {
-                teddiStatusPacket.neighbours[i] = buffer[16 + i];
+                teddiStatusPacket->neighbours[i] = buffer[16 + i];
             }
 
-            teddiStatusPacket.timestampReceived = now;
+            teddiStatusPacket->timestampReceived = now;
 
-            return &teddiStatusPacket;
+            return teddiStatusPacket;
         }
         else
         {
@@ -1158,6 +1488,21 @@ unsigned long long TicksNow(void)
 }
 
 
+/* Returns the number of microseconds since the epoch */
+unsigned long long TicksNowMicro(void)
+{
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return ((((unsigned long long)ft.dwHighDateTime << 32) | ft.dwLowDateTime) / 10) - 11644473600000000ull;   /* 100 nsec since 1601 */
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+
 /* Returns a date/time string for the specific number of milliseconds since the epoch */
 const char *timestamp(unsigned long long ticks, int timeformat)
 {
@@ -1183,94 +1528,428 @@ const char *timestamp(unsigned long long ticks, int timeformat)
     return output;
 }
 
-/* Dumps a WAX packet */
-void waxDump(WaxPacket *waxPacket, FILE *ofp, char tee, int timeformat)
+/* Log writer -- log lines are appended to large buffers, and written (with file rotation, syncing and compression) by a separate thread */
+#define LOG_BUFFER_COUNT 4
+#define LOG_BUFFER_SIZE (1024 * 1024)
+#define LOG_FLUSH_INTERVAL 200              /* Longest time (msec) a partly-filled buffer is held */
+#define LOG_SYNC_NONE   0                   /* Never fsync() */
+#define LOG_SYNC_ROTATE -1                  /* fsync() each file as it is closed, or every N seconds (N > 0) */
+#define LOG_COMPRESS_MAX 8                  /* Compression commands running at once before the writer waits for them */
+typedef struct
 {
-    int i;
-    for (i = 0; i < waxPacket->sampleCount; i++)
+    const char *logfile;                    /* File name template (empty for stdout) */
+    unsigned long interval;                 /* Rotation interval (msec), 0 = none */
+    int sync;                               /* LOG_SYNC_NONE / LOG_SYNC_ROTATE / N seconds */
+    const char *compress;                   /* Command to compress closed files with (NULL = none) */
+    unsigned long long now;                 /* Time of the data being written */
+
+    /* Buffers: 'count' full buffers from 'head' waiting to be written, followed by the one being filled */
+    char *buffer[LOG_BUFFER_COUNT];
+    size_t length[LOG_BUFFER_COUNT];
+    unsigned long long time[LOG_BUFFER_COUNT];
+    int head, count;
+    char quit;
+    mutex_t mutex;
+    cond_t notEmpty, notFull;
+    thread_t thread;
+
+    /* Writer thread's file */
+    FILE *fp;
+    char filename[260];
+    unsigned long long opened;
+    unsigned long long synced;
+
+    /* Compression commands still running */
+    intptr_t compressProcess[LOG_COMPRESS_MAX];
+    char compressFile[LOG_COMPRESS_MAX][260];
+    int numCompress;
+
+    /* Counters */
+    unsigned long long written, discarded;
+    unsigned long rotations, stalls;
+} LogWriter;
+
+FILE *openlogfile(const char *logfile, unsigned long long ticks, unsigned long *loginterval, char *filename);
+
+/* The rotation interval of a log file name template */
+static unsigned long logfileinterval(const char *logfile)
+{
+    if (strstr(logfile, "@s") != NULL) { return 1 * 1000ul; }                  /* Every second(!) */
+    if (strstr(logfile, "@m") != NULL) { return 60 * 1000ul; }                 /* Every minute */
+    if (strstr(logfile, "@h") != NULL) { return 60 * 60 * 1000ul; }            /* Every hour */
+    if (strstr(logfile, "@D") != NULL || strstr(logfile, "@M") != NULL || strstr(logfile, "@Y") != NULL) { return 24 * 60 * 60 * 1000ul; }  /* Every day */
+    return 0;
+}
+
+/* Collects finished compression commands, or waits for all of them (writer thread, or once it has stopped) */
+static void logreap(LogWriter *log, char wait)
+{
+    int i = 0;
+    while (i < log->numCompress)
     {
-        const char *timeString = timestamp(waxPacket->samples[i].timestamp, timeformat);
-        fprintf(ofp, "ACCEL,%s,%u,%u,%f,%f,%f\n", timeString, waxPacket->deviceId, waxPacket->samples[i].sampleIndex, waxPacket->samples[i].x / 256.0f, waxPacket->samples[i].y / 256.0f, waxPacket->samples[i].z / 256.0f);
-        if (tee & 1) fprintf(stderr, "ACCEL,%s,%u,%u,%f,%f,%f\n", timeString, waxPacket->deviceId, waxPacket->samples[i].sampleIndex, waxPacket->samples[i].x / 256.0f, waxPacket->samples[i].y / 256.0f, waxPacket->samples[i].z / 256.0f);
-		if (tee & 2) fprintf(stderr, ".");
+        int failed;
+#ifdef _WIN32
+        HANDLE process = (HANDLE)log->compressProcess[i];
+        DWORD code = 1;
+        if (WaitForSingleObject(process, wait ? INFINITE : 0) == WAIT_TIMEOUT) { i++; continue; }
+        GetExitCodeProcess(process, &code);
+        CloseHandle(process);
+        failed = (code != 0);
+#else
+        int status = 0;
+        pid_t pid = waitpid((pid_t)log->compressProcess[i], &status, wait ? 0 : WNOHANG);
+        if (pid == 0) { i++; continue; }
+        failed = (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0);
+#endif
+        if (failed) { fprintf(stderr, "WARNING: Problem compressing log file: %s\n", log->compressFile[i]); }
+        log->numCompress--;
+        log->compressProcess[i] = log->compressProcess[log->numCompress];
+        strcpy(log->compressFile[i], log->compressFile[log->numCompress]);
     }
-    return;
 }
 
-
-/* Dumps a WAX9 packet */
-void wax9Dump(Wax9Packet *wax9Packet, FILE *ofp, char tee, int timeformat, unsigned long long receivedTime, int format)
+/* Starts the compression command on a closed log file, without waiting for it to finish (writer thread) */
+static void logcompress(LogWriter *log, const char *filename)
 {
-	static char extended[128] = "0,0,0";
-    int i;
-    const char *timeString = timestamp(receivedTime, timeformat);
-    for (i = 0; i <= (tee & 1); i++)
-    {
-		if (format == 1) // short format, never any extended data
-		{
-			extended[0] = '\0';
-		}
-		else if (wax9Packet->hasExtended)		// not-short format, and packet has extended data, update
-		{
-			sprintf(extended, ",%.3f,%.1f,%u", wax9Packet->battery * 0.001f, wax9Packet->temperature * 0.1f, wax9Packet->pressure);	// battery (V), temperature (deg. C), pressure (Pascal)
-		}
-		else if (format == 0)	// default format, with no extended data
-		{
-			extended[0] = '\0';
-		}
-		else
-		{
-			;			// bit of a hack, but leaving the extended data allows an always 'long format' for mixed normal/extended packets (by duplicating the last extended info seen)
-		}
+    char command[600];
+    intptr_t process;
+    int len;
 
-		// TODO: This scaling is for the default sensor set-up (can't recover setup from the packet data)
-        fprintf((i == 0) ? ofp : stderr, "$WAX9,%s,%u,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f%s\n", timeString, wax9Packet->sampleNumber, wax9Packet->timestamp / 65536.0, 
-			wax9Packet->accel.x / 4096.0f, wax9Packet->accel.y / 4096.0f, wax9Packet->accel.z / 4096.0f,	// 'G' (9.81 m/s/s)
-            wax9Packet->gyro.x * 0.07f,    wax9Packet->gyro.y * 0.07f,    wax9Packet->gyro.z * 0.07f,		// degrees/sec
-			wax9Packet->mag.x * 0.10f, wax9Packet->mag.y * 0.10f, wax9Packet->mag.z * 0.10f * -1,			// uT (magnetic field ranges between 25-65 uT), invert Z axis to match accel/gyro
-            extended);
-    }
+    /* The file name is passed to the shell as an argument, so is never parsed as part of the command */
+#ifdef _WIN32
+    if (strpbrk(filename, "\"%") != NULL) { fprintf(stderr, "WARNING: Not compressing log file (name cannot be quoted): %s\n", filename); return; }
+    len = snprintf(command, sizeof(command), "%s \"%s\"", log->compress, filename);
+#else
+    len = snprintf(command, sizeof(command), "%s \"$1\"", log->compress);
+#endif
+    if (len < 0 || len >= (int)sizeof(command)) { fprintf(stderr, "WARNING: Log compression command too long, not compressing: %s\n", filename); return; }
 
-	if (tee & 2) fprintf(stderr, ".");
+    /* Collect finished commands, and only wait when too many are still running */
+    logreap(log, 0);
+    if (log->numCompress >= LOG_COMPRESS_MAX) { logreap(log, 1); }
 
-    return;
+#ifdef _WIN32
+    process = _spawnlp(_P_NOWAIT, "cmd.exe", "cmd.exe", "/c", command, NULL);
+    if (process == -1) { fprintf(stderr, "WARNING: Problem starting log compression: %s\n", command); return; }
+#else
+    {
+        char *argv[] = { "sh", "-c", command, "sh", (char *)filename, NULL };
+        pid_t pid;
+        if (posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ) != 0) { fprintf(stderr, "WARNING: Problem starting log compression: %s\n", command); return; }
+        process = (intptr_t)pid;
+    }
+#endif
+    log->compressProcess[log->numCompress] = process;
+    strcpy(log->compressFile[log->numCompress], filename);
+    log->numCompress++;
 }
 
+/* Closes the current log file (writer thread) */
+static void logclose(LogWriter *log, char rotated)
+{
+    if (log->fp == NULL) { return; }
+    fflush(log->fp);
+    if (log->fp == stdout) { log->fp = NULL; return; }
+    if (log->sync != LOG_SYNC_NONE) { fsync(fileno(log->fp)); }
+    fclose(log->fp);
+    log->fp = NULL;
+
+    /* Compress closed files (not the final file, which may be appended to if restarted) */
+    if (rotated && log->compress != NULL && log->compress[0] != '\0' && log->filename[0] != '\0')
+    {
+        logcompress(log, log->filename);
+    }
+}
 
-/* Dumps a TEDDI packet */
-void teddiDump(TeddiPacket *teddiPacket, FILE *ofp, char tee, int format, char ignoreInvalid)
+/* Writes a full buffer (writer thread) */
+static void logwritebuffer(LogWriter *log, int index)
 {
-    static char line[2048];
-    static char number[32];
-    char *labelAppend = "";
-    int i;
+    unsigned long long time = log->time[index];
+    unsigned long long now;
 
-    if (!teddiPacket->valid)
+    /* Rotate */
+    if (log->fp != NULL && log->interval && (time / log->interval) != (log->opened / log->interval))
     {
-        if (ignoreInvalid == 1) { return; }
-        else if (ignoreInvalid == 2) { labelAppend = "!"; }
+        logclose(log, 1);
+        log->rotations++;
     }
 
-    if (format == 1)
+    /* Open */
+    if (log->fp == NULL)
     {
-        unsigned short imin = 0, imax = 0, iav = 0;
-        int itot = 0;
+        unsigned long interval = 0;
+        log->filename[0] = '\0';
+        log->fp = openlogfile(log->logfile, time, &interval, log->filename);
+        log->opened = time;
+        log->synced = TicksNow();
+    }
+    if (log->fp == NULL)
+    {
+        log->discarded += log->length[index];
+        return;
+    }
 
-        sprintf(line, "TEDDI_SHORT%s,%s,%u,%u,%u,%u,%u,%u,%u,%u,%u", labelAppend, timestamp(teddiPacket->timestampEstimated, 3), teddiPacket->deviceId, teddiPacket->version,
-                                            teddiPacket->sampleCount, teddiPacket->sequence, teddiPacket->unsent,
-                                            teddiPacket->temp, teddiPacket->light, teddiPacket->battery, teddiPacket->humidity);
+    fwrite(log->buffer[index], 1, log->length[index], log->fp);
+    fflush(log->fp);
+    log->written += log->length[index];
 
-        for (i = 0; i < teddiPacket->sampleCount; i++)
-        {
-            if (teddiPacket->pirData[i] < imin) { imin = teddiPacket->pirData[i]; }
-            if (teddiPacket->pirData[i] > imax) { imax = teddiPacket->pirData[i]; }
-            itot = itot + teddiPacket->pirData[i];
-        }
-        iav = itot / 24;
+    /* Periodic sync */
+    now = TicksNow();
+    if (log->sync > 0 && log->fp != stdout && now - log->synced >= (unsigned long long)log->sync * 1000)
+    {
+        fsync(fileno(log->fp));
+        log->synced = now;
+    }
+}
 
-        //fprintf(stderr, "PIR   min max avg: %u,%u,%u\n",imin,imax,iav);
-        sprintf(number, ",%u,%u,%d", imin,imax,iav);
-        strcat(line, number);
+/* Queues the buffer being filled for writing (mutex held) */
+static void logsubmit(LogWriter *log)
+{
+    int fill = (log->head + log->count) % LOG_BUFFER_COUNT;
+    if (log->length[fill] == 0) { return; }
+    if (log->count >= LOG_BUFFER_COUNT - 1) { log->stalls++; }
+    while (log->count >= LOG_BUFFER_COUNT - 1) { cond_timedwait_ms(&log->notFull, &log->mutex, 1000); }
+    log->count++;
+    log->length[(log->head + log->count) % LOG_BUFFER_COUNT] = 0;
+    cond_signal(&log->notEmpty);
+}
+
+/* Writer thread */
+static thread_return_t logthread(void *arg)
+{
+    LogWriter *log = (LogWriter *)arg;
+
+    mutex_lock(&log->mutex);
+    for (;;)
+    {
+        int index;
+
+        if (log->count == 0)
+        {
+            int fill = log->head;
+            if (log->length[fill] > 0 && (log->quit || TicksNow() - log->time[fill] >= LOG_FLUSH_INTERVAL)) { logsubmit(log); }
+            else if (log->quit) { break; }
+            else { cond_timedwait_ms(&log->notEmpty, &log->mutex, LOG_FLUSH_INTERVAL); continue; }
+        }
+
+        /* The head buffer is not touched by the receiver until it is released */
+        index = log->head;
+        mutex_unlock(&log->mutex);
+        logwritebuffer(log, index);
+        mutex_lock(&log->mutex);
+        log->head = (log->head + 1) % LOG_BUFFER_COUNT;
+        log->count--;
+        cond_signal(&log->notFull);
+    }
+    mutex_unlock(&log->mutex);
+
+    logclose(log, 0);
+    return thread_return_value(0);
+}
+
+/* Starts a log writer for the file name template ("" for stdout) */
+LogWriter *logopen(const char *logfile, int sync, const char *compress)
+{
+    LogWriter *log;
+    int i;
+
+    tzset();
+    log = (LogWriter *)malloc(sizeof(LogWriter));
+    if (log == NULL) { return NULL; }
+    memset(log, 0, sizeof(LogWriter));
+    log->logfile = logfile;
+    log->interval = logfileinterval(logfile);
+    log->sync = sync;
+    log->compress = compress;
+    for (i = 0; i < LOG_BUFFER_COUNT; i++)
+    {
+        log->buffer[i] = (char *)malloc(LOG_BUFFER_SIZE);
+        if (log->buffer[i] == NULL)
+        {
+            fprintf(stderr, "ERROR: Out of memory for the log buffers.\n");
+            while (i-- > 0) { free(log->buffer[i]); }
+            free(log);
+            return NULL;
+        }
+    }
+    mutex_init(&log->mutex, NULL);
+    cond_init(&log->notEmpty, NULL);
+    cond_init(&log->notFull, NULL);
+    if (thread_create(&log->thread, NULL, logthread, log) != 0)
+    {
+        fprintf(stderr, "ERROR: Problem creating log writer thread.\n");
+        cond_destroy(&log->notFull);
+        cond_destroy(&log->notEmpty);
+        mutex_destroy(&log->mutex);
+        for (i = 0; i < LOG_BUFFER_COUNT; i++) { free(log->buffer[i]); }
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+/* Sets the time of the following log data (which selects its file) */
+void logtime(LogWriter *log, unsigned long long now)
+{
+    if (log != NULL) { log->now = now; }
+}
+
+/* Appends data to the log */
+void logwrite(LogWriter *log, const char *data, size_t len)
+{
+    int fill;
+    if (log == NULL || len == 0) { return; }
+    if (len > LOG_BUFFER_SIZE) { len = LOG_BUFFER_SIZE; }
+
+    mutex_lock(&log->mutex);
+    fill = (log->head + log->count) % LOG_BUFFER_COUNT;
+
+    /* A buffer only holds data for one file */
+    if (log->length[fill] > 0 && log->interval && (log->now / log->interval) != (log->time[fill] / log->interval))
+    {
+        logsubmit(log);
+        fill = (log->head + log->count) % LOG_BUFFER_COUNT;
+    }
+    if (log->length[fill] + len > LOG_BUFFER_SIZE)
+    {
+        logsubmit(log);
+        fill = (log->head + log->count) % LOG_BUFFER_COUNT;
+    }
+
+    if (log->length[fill] == 0) { log->time[fill] = log->now; }
+    memcpy(log->buffer[fill] + log->length[fill], data, len);
+    log->length[fill] += len;
+    mutex_unlock(&log->mutex);
+}
+
+/* Appends formatted text to the log */
+void logprintf(LogWriter *log, const char *format, ...)
+{
+    char line[2048];
+    va_list args;
+    int len;
+
+    if (log == NULL) { return; }
+    va_start(args, format);
+    len = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (len < 0) { return; }
+    if (len >= (int)sizeof(line)) { len = sizeof(line) - 1; }
+    logwrite(log, line, (size_t)len);
+}
+
+/* Writes the remaining data, stops the writer and closes the log */
+void logend(LogWriter *log)
+{
+    int i;
+    if (log == NULL) { return; }
+    mutex_lock(&log->mutex);
+    log->quit = 1;
+    cond_signal(&log->notEmpty);
+    mutex_unlock(&log->mutex);
+    thread_join(log->thread, NULL);
+    logreap(log, 1);                        /* Leave no file part-compressed */
+    cond_destroy(&log->notFull);
+    cond_destroy(&log->notEmpty);
+    mutex_destroy(&log->mutex);
+    if (log->discarded > 0 || log->stalls > 0)
+    {
+        fprintf(stderr, "LOG: %llu bytes written, %llu bytes discarded (file could not be opened), %lu rotations, %lu waits for the writer\n", log->written, log->discarded, log->rotations, log->stalls);
+    }
+    for (i = 0; i < LOG_BUFFER_COUNT; i++) { free(log->buffer[i]); }
+    free(log);
+}
+
+
+/* Dumps a WAX packet */
+void waxDump(WaxPacket *waxPacket, LogWriter *log, char tee, int timeformat, const char *prefix)
+{
+    int i;
+    for (i = 0; i < waxPacket->sampleCount; i++)
+    {
+        const char *timeString = timestamp(waxPacket->samples[i].timestamp, timeformat);
+        logprintf(log, "%sACCEL,%s,%u,%u,%f,%f,%f\n", prefix, timeString, waxPacket->deviceId, waxPacket->samples[i].sampleIndex, waxPacket->samples[i].x / 256.0f, waxPacket->samples[i].y / 256.0f, waxPacket->samples[i].z / 256.0f);
+        if (tee & 1) fprintf(stderr, "%sACCEL,%s,%u,%u,%f,%f,%f\n", prefix, timeString, waxPacket->deviceId, waxPacket->samples[i].sampleIndex, waxPacket->samples[i].x / 256.0f, waxPacket->samples[i].y / 256.0f, waxPacket->samples[i].z / 256.0f);
+		if (tee & 2) fprintf(stderr, ".");
+    }
+    return;
+}
+
+
+/* Dumps a WAX9 packet */
+void wax9Dump(Wax9Packet *wax9Packet, LogWriter *log, char tee, int timeformat, unsigned long long receivedTime, int format, const char *prefix)
+{
+	static char extended[128] = "0,0,0";
+    char line[512];
+    const char *timeString = timestamp(receivedTime, timeformat);
+    {
+		if (format == 1) // short format, never any extended data
+		{
+			extended[0] = '\0';
+		}
+		else if (wax9Packet->hasExtended)		// not-short format, and packet has extended data, update
+		{
+			sprintf(extended, ",%.3f,%.1f,%u", wax9Packet->battery * 0.001f, wax9Packet->temperature * 0.1f, wax9Packet->pressure);	// battery (V), temperature (deg. C), pressure (Pascal)
+		}
+		else if (format == 0)	// default format, with no extended data
+		{
+			extended[0] = '\0';
+		}
+		else
+		{
+			;			// bit of a hack, but leaving the extended data allows an always 'long format' for mixed normal/extended packets (by duplicating the last extended info seen)
+		}
+
+		// TODO: This scaling is for the default sensor set-up (can't recover setup from the packet data)
+        sprintf(line, "%s$WAX9,%s,%u,%f,%f,%f,%f,%f,%f,%f,%f,%f,%f%s\n", prefix, timeString, wax9Packet->sampleNumber, wax9Packet->timestamp / 65536.0, 
+			wax9Packet->accel.x / 4096.0f, wax9Packet->accel.y / 4096.0f, wax9Packet->accel.z / 4096.0f,	// 'G' (9.81 m/s/s)
+            wax9Packet->gyro.x * 0.07f,    wax9Packet->gyro.y * 0.07f,    wax9Packet->gyro.z * 0.07f,		// degrees/sec
+			wax9Packet->mag.x * 0.10f, wax9Packet->mag.y * 0.10f, wax9Packet->mag.z * 0.10f * -1,			// uT (magnetic field ranges between 25-65 uT), invert Z axis to match accel/gyro
+            extended);
+        logwrite(log, line, strlen(line));
+        if (tee & 1) fprintf(stderr, "%s", line);
+    }
+
+	if (tee & 2) fprintf(stderr, ".");
+
+    return;
+}
+
+
+/* Dumps a TEDDI packet */
+void teddiDump(TeddiPacket *teddiPacket, LogWriter *log, char tee, int format, char ignoreInvalid, const char *prefix)
+{
+    static char line[2048];
+    static char number[32];
+    char *labelAppend = "";
+    int i;
+
+    if (!teddiPacket->valid)
+    {
+        if (ignoreInvalid == 1) { return; }
+        else if (ignoreInvalid == 2) { labelAppend = "!"; }
+    }
+
+    if (format == 1)
+    {
+        unsigned short imin = 0, imax = 0, iav = 0;
+        int itot = 0;
+
+        sprintf(line, "%sTEDDI_SHORT%s,%s,%u,%u,%u,%u,%u,%u,%u,%u,%u", prefix, labelAppend, timestamp(teddiPacket->timestampEstimated, 3), teddiPacket->deviceId, teddiPacket->version,
+                                            teddiPacket->sampleCount, teddiPacket->sequence, teddiPacket->unsent,
+                                            teddiPacket->temp, teddiPacket->light, teddiPacket->battery, teddiPacket->humidity);
+
+        for (i = 0; i < teddiPacket->sampleCount; i++)
+        {
+            if (teddiPacket->pirData[i] < imin) { imin = teddiPacket->pirData[i]; }
+            if (teddiPacket->pirData[i] > imax) { imax = teddiPacket->pirData[i]; }
+            itot = itot + teddiPacket->pirData[i];
+        }
+        iav = itot / 24;
+
+        //fprintf(stderr, "PIR   min max avg: %u,%u,%u\n",imin,imax,iav);
+        sprintf(number, ",%u,%u,%d", imin,imax,iav);
+        strcat(line, number);
 
         imin=0, imax=0, iav=0, itot=0;
         for (i = 0; i < teddiPacket->sampleCount; i++)
@@ -1289,7 +1968,7 @@ void teddiDump(TeddiPacket *teddiPacket, FILE *ofp, char tee, int format, char i
     }
     else
     {
-        sprintf(line, "TEDDI%s,%s,%u,%u,%u,%u,%u,%u,%u,%u,%u", labelAppend, timestamp(teddiPacket->timestampReceived, 3), teddiPacket->deviceId, teddiPacket->version, 
+        sprintf(line, "%sTEDDI%s,%s,%u,%u,%u,%u,%u,%u,%u,%u,%u", prefix, labelAppend, timestamp(teddiPacket->timestampReceived, 3), teddiPacket->deviceId, teddiPacket->version, 
                                             teddiPacket->sampleCount, teddiPacket->sequence, teddiPacket->unsent, 
                                             teddiPacket->temp, teddiPacket->light, teddiPacket->battery, teddiPacket->humidity);
         for (i = 0; i < teddiPacket->sampleCount; i++)
@@ -1306,7 +1985,7 @@ void teddiDump(TeddiPacket *teddiPacket, FILE *ofp, char tee, int format, char i
 	    strcat(line, "\n");
     }
 
-    fprintf(ofp, "%s", line);
+    logwrite(log, line, strlen(line));
 	if (tee & 1) fprintf(stderr, "%s", line);
 	if (tee & 2) fprintf(stderr, ".");
 	return;
@@ -1465,6 +2144,135 @@ size_t teddiToOsc(TeddiPacket *teddiPacket, void *outputBuffer, char timetag)
 }
 
 
+/* Batched UDP transmission -- datagrams are queued and sent together, at most 'interval' milliseconds after the first was queued */
+#define UDP_BATCH_COUNT 64                  /* Maximum number of queued datagrams */
+#define UDP_MTU_DEFAULT 1472                /* Ethernet MTU less the IP and UDP headers */
+#define UDP_MTU_MAX 9000                    /* Jumbo frames */
+#define UDP_BATCH_DATAGRAM 0                /* Each item is sent as its own datagram */
+#define UDP_BATCH_BUNDLE   1                /* OSC bundles are packed together in to an enclosing bundle, up to the MTU */
+#define UDP_BATCH_SINGLE   2                /* OSC bundles are split and each message sent as its own datagram */
+typedef struct
+{
+    SOCKET s;
+    struct sockaddr_in *serverAddr;
+    char mode;                              /* UDP_BATCH_DATAGRAM / UDP_BATCH_BUNDLE / UDP_BATCH_SINGLE */
+    int interval;                           /* Maximum time (msec) a datagram is held for, 0 = send immediately */
+    size_t mtu;                             /* Maximum datagram size for packing */
+    unsigned long long deadline;            /* Time the queued datagrams must be sent by (0 = none queued) */
+    int count;                              /* Number of queued datagrams (the last may be a bundle that is still filling) */
+    char filling;                           /* The last queued datagram is an enclosing bundle with space */
+    size_t length[UDP_BATCH_COUNT];
+    unsigned char buffer[UDP_BATCH_COUNT][UDP_MTU_MAX];
+} UdpBatch;
+
+/* Send all queued datagrams */
+static void udpbatch_flush(UdpBatch *batch)
+{
+    int i = 0;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[UDP_BATCH_COUNT];
+    struct iovec iovecs[UDP_BATCH_COUNT];
+    for (i = 0; i < batch->count; i++)
+    {
+        iovecs[i].iov_base = batch->buffer[i];
+        iovecs[i].iov_len = batch->length[i];
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = batch->serverAddr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(*batch->serverAddr);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (i = 0; i < batch->count; )
+    {
+        int sent = sendmmsg(batch->s, msgs + i, batch->count - i, 0);
+        if (sent <= 0)
+        {
+            if (sent < 0 && errno == EINTR) { continue; }
+            fprintf(stderr, "ERROR: Send failed (%s)\n", strerrorsocket());
+            break;
+        }
+        i += sent;
+    }
+#else
+    for (i = 0; i < batch->count; i++)
+    {
+        if (sendto(batch->s, (const char *)batch->buffer[i], batch->length[i], 0, (struct sockaddr *)batch->serverAddr, sizeof(*batch->serverAddr)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "ERROR: Send failed (%s)\n", strerrorsocket());
+        }
+    }
+#endif
+    batch->count = 0;
+    batch->filling = 0;
+    batch->deadline = 0;
+}
+
+/* Queue one datagram (or start an enclosing bundle) */
+static unsigned char *udpbatch_next(UdpBatch *batch, unsigned long long now)
+{
+    if (batch->count >= UDP_BATCH_COUNT) { udpbatch_flush(batch); }
+    if (batch->count == 0) { batch->deadline = now + batch->interval; }
+    batch->length[batch->count] = 0;
+    batch->filling = 0;
+    return batch->buffer[batch->count++];
+}
+
+/* Queue an item for transmission */
+static void udpbatch_add(UdpBatch *batch, const void *data, size_t len, unsigned long long now)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    char isBundle = (len >= 16 && memcmp(p, "#bundle", 8) == 0);
+
+    /* Send what is already due first (a busy output may never be idle to do so) */
+    if (batch->deadline != 0 && now >= batch->deadline) { udpbatch_flush(batch); }
+
+    if (batch->mode == UDP_BATCH_SINGLE && isBundle)
+    {
+        /* Each bundle element (messages are length-prefixed) as its own datagram */
+        size_t o = 16;
+        while (o + 4 <= len)
+        {
+            size_t elementLength = ((size_t)p[o] << 24) | ((size_t)p[o + 1] << 16) | ((size_t)p[o + 2] << 8) | p[o + 3];
+            o += 4;
+            if (elementLength > len - o) { break; }
+            udpbatch_add(batch, p + o, elementLength, now);
+            o += elementLength;
+        }
+        return;
+    }
+
+    if (batch->mode == UDP_BATCH_BUNDLE && isBundle && 16 + 4 + len <= batch->mtu)
+    {
+        unsigned char *buffer;
+        if (!batch->filling || batch->length[batch->count - 1] + 4 + len > batch->mtu)
+        {
+            buffer = udpbatch_next(batch, now);
+            batch->length[batch->count - 1] += write_osc_string(buffer, "#bundle");     /* [OSC string] bundle identifier: "#bundle" <pads to 8 bytes> */
+            batch->length[batch->count - 1] += write_osc_int(buffer + 8, 0);            /* [OSC timetag] "immediately" <8 bytes> (each element has its own timetag) */
+            batch->length[batch->count - 1] += write_osc_int(buffer + 12, 1);
+            batch->filling = 1;
+        }
+        buffer = batch->buffer[batch->count - 1] + batch->length[batch->count - 1];
+        write_osc_int(buffer, (signed int)len);                                         /* [OSC int] element length */
+        memcpy(buffer + 4, data, len);                                                  /* [OSC bundle] element */
+        batch->length[batch->count - 1] += 4 + len;
+    }
+    else if (len <= UDP_MTU_MAX)
+    {
+        memcpy(udpbatch_next(batch, now), data, len);
+        batch->length[batch->count - 1] = len;
+    }
+    else
+    {
+        /* Too large to queue */
+        udpbatch_flush(batch);
+        transmit(batch->s, batch->serverAddr, data, len);
+    }
+
+    if (batch->interval <= 0) { udpbatch_flush(batch); }
+}
+
+
 /* Open a serial port */
 int openport(const char *infile, char writeable, int timeout)
 {
@@ -1540,9 +2348,10 @@ int openport(const char *infile, char writeable, int timeout)
                     };
                 }
 
-                timeouts.ReadIntervalTimeout = 0;
-                timeouts.ReadTotalTimeoutConstant = timeout;
-                timeouts.ReadTotalTimeoutMultiplier = 0;
+                /* Reads are buffered in chunks: return as soon as any data is available, otherwise wait up to the timeout (if any) */
+                timeouts.ReadIntervalTimeout = MAXDWORD;
+                timeouts.ReadTotalTimeoutConstant = (timeout > 0) ? timeout : (MAXDWORD - 1);
+                timeouts.ReadTotalTimeoutMultiplier = MAXDWORD;
                 timeouts.WriteTotalTimeoutConstant = 0;
                 timeouts.WriteTotalTimeoutMultiplier = 0;
                 if (!SetCommTimeouts(hSerial, &timeouts))
@@ -1559,6 +2368,8 @@ int openport(const char *infile, char writeable, int timeout)
             tcgetattr(fd, &options);
             options.c_cflag = (options.c_cflag | CLOCAL | CREAD | CS8) & ~(PARENB | CSTOPB | CSIZE | CRTSCTS);
             options.c_lflag &= ~(ICANON | ECHO | ISIG); /* Enable data to be processed as raw input */
+            options.c_cc[VMIN] = 1;                     /* Reads are buffered in chunks: return as soon as any data is available */
+            options.c_cc[VTIME] = 0;
             tcsetattr(fd, TCSANOW, &options);
         }
 #endif
@@ -1880,12 +2691,12 @@ void ReceiveUdpStop(void)
 #endif
 
 
-FILE *openlogfile(const char *logfile, unsigned long long ticks, unsigned long *loginterval)
+FILE *openlogfile(const char *logfile, unsigned long long ticks, unsigned long *loginterval, char *filename)
 {
     char temp[260];
     const char *sp;
     int o;
-    struct tm *today;
+    struct tm local, *today = &local;
     struct timeb tp = {0};
     int year, month, day, hours, mins, secs;
     int fields = 0;
@@ -1893,8 +2704,7 @@ FILE *openlogfile(const char *logfile, unsigned long long ticks, unsigned long *
     
     tp.time = (time_t)(ticks / 1000);
     tp.millitm = (unsigned short)(ticks % 1000);
-    tzset();
-    today = localtime(&(tp.time));
+    localtime_r(&(tp.time), &local);        /* (called from the log writer thread, tzset() is called by logopen()) */
     year = 1900 + today->tm_year;
     month = today->tm_mon + 1;
     day = today->tm_mday;
@@ -1948,6 +2758,7 @@ fprintf(stderr, "DEBUG: Creating log directory: %s\n", temp);
             temp[o] = '\0';
 fprintf(stderr, "DEBUG: Opening log file: %s\n", temp);
             outfp = fopen(temp, "a");
+            if (filename != NULL) { strcpy(filename, temp); }
             break;
         }
         else if (c == '@' && *sp == 'Y') { sp++; temp[o++] = '0' + (( year / 1000) % 10); temp[o++] = '0' + ((year / 100) % 10); temp[o++] = '0' + ((year / 10) % 10); temp[o++] = '0' + (year % 10); fields |= 1; }
@@ -2008,138 +2819,1405 @@ int CreateTestData(char *buffer, const char *fakeType)
 }
 
 
-/* Parse SLIP-encoded packets, log or convert to UDP packets */
-// TODO: Turn this silly argument list into an configuration structure
-int waxrec(const char *infile, const char *host, const char *initString, const char *logfile, char tee, char dump, char timetag, char sendOnly, const char *stompHost, const char *stompAddress, const char *stompUser, const char *stompPassword, int writeFromUdp, int timeformat, char convertToOsc, int format, char ignoreInvalid, const char *waitPrefix, int waitTimeout)
+/* Parser microbenchmark: decode a representative packet of each type repeatedly, report packets per second */
+#define BENCHMARK_DURATION 1000             /* Time (msec) spent on each packet type */
+int benchmark(void)
 {
-    #define BUFFER_SIZE 0xffff
-    static char buffer[BUFFER_SIZE];
-    size_t bufferLength = 0;
-    int fd = -1;
-    struct sockaddr_in serverAddr;
-    SOCKET s = SOCKET_ERROR;
-    static char ports[1024];
-    SOCKET receiveUdpSocket = SOCKET_ERROR;
-    const char *fakeType = NULL;
-	char waiting = 0;
-	char matched = -1;
+    static const char *names[] = { "WAX", "WAX9", "TEDDI" };
+    union { WaxPacket wax; Wax9Packet wax9; TeddiPacket teddi; } packet;
+    unsigned char buffer[128];
+    unsigned long checksum = 0;
+    int type, i;
 
-#ifdef _WIN32
+    for (type = 0; type < 3; type++)
     {
-        WSADATA wsaData;
-        WSAStartup(MAKEWORD(1, 1), &wsaData);
-    }
-#endif
+        unsigned long long start, elapsed;
+        unsigned long count = 0;
+        size_t len = 0;
 
-    /* fake input for testing */
-    if (infile[0] == '*')
-    {
-        fakeType = infile + 1;
+        for (i = 0; i < (int)sizeof(buffer); i++) { buffer[i] = (unsigned char)(i * 37 + 11); }
+        if (type == 0)
+        {
+            /* WAX, 12 samples of 3x 16-bit at 100 Hz */
+            buffer[0] = 0x12; buffer[1] = 0x78;
+            buffer[7] = 0xEA;       /* format */
+            buffer[10] = 0;         /* outstanding */
+            buffer[11] = 12;        /* sampleCount */
+            len = 12 + 12 * 6;
+        }
+        else if (type == 1)
+        {
+            /* WAX9, extended */
+            buffer[0] = '9'; buffer[1] = 0x02;
+            len = 34;
+        }
+        else if (type == 2)
+        {
+            /* TEDDI V4, 20 samples, with parent addresses */
+            CreateTestData((char *)buffer, "t");
+            buffer[5] = 20;         /* sampleCount */
+            len = ADDITIONAL_OFFSET(buffer[5]) + ADDITIONAL_LENGTH;
+        }
+
+        start = TicksNowMicro();
+        do
+        {
+            for (i = 0; i < 4096; i++)
+            {
+                if (type == 0 && parseWaxPacket(&packet.wax, buffer, len, start) != NULL) { checksum += packet.wax.samples[i % packet.wax.sampleCount].x; }
+                else if (type == 1 && parseWax9Packet(&packet.wax9, buffer, len, start) != NULL) { checksum += packet.wax9.accel.x; }
+                else if (type == 2 && parseTeddiPacket(&packet.teddi, buffer, len, start) != NULL) { checksum += packet.teddi.audioData[i % packet.teddi.sampleCount]; }
+                buffer[2]++;        /* (vary the input a little) */
+            }
+            count += i;
+            elapsed = TicksNowMicro() - start;
+        } while (elapsed < BENCHMARK_DURATION * 1000ULL);
+
+        printf("BENCHMARK: %-5s %10.0f packets/sec (%lu in %.3f s)\n", names[type], count * 1000000.0 / elapsed, count, elapsed / 1000000.0);
     }
-    else if (infile[0] == 'u' && infile[1] == 'd' && infile[2] == 'p' && infile[3] == ':')
-    {
-        char *name = (char *)infile + 4;
-        int receiveUdpPort = 1234;
-        char serverName[64] = "localhost";
-        struct sockaddr_in serverAddr;
-        //const int recvMaxLength = 65535;
-        //unsigned char *recvBuffer;
-        //int recvLength = 0;
-        struct hostent *hp;
+    fprintf(stderr, "(checksum %lu)\n", checksum);
+    return 0;
+}
 
-        // Ignore preceding slashes
-        while (*name == '/') { name++; }
 
-        gethostname(serverName, 64);
+#ifndef _WIN32
+/* UDP input: a thread receives datagrams in batches in to a single-producer/single-consumer ring, read by the main loop */
+#define UDP_RING_SLOTS 1024                 /* Datagrams held between the receive thread and the parser (a power of two) */
+#define UDP_SLOT_SIZE 2048                  /* Largest datagram accepted (larger ones are dropped) */
+#define UDP_RECV_BATCH 32                   /* Most datagrams taken per receive call */
+#define UDP_RCVBUF (4 * 1024 * 1024)        /* Requested socket receive buffer (limited by the system, e.g. net.core.rmem_max) */
+typedef struct
+{
+    unsigned long long time;                /* Receive time (msec) of the datagram's batch */
+    size_t length;                          /* Datagram length (0 = empty or dropped) */
+    char data[UDP_SLOT_SIZE];
+} UdpSlot;
+typedef struct
+{
+    SOCKET socket;
+    thread_t thread;
+    volatile char quit;
+    volatile char failed;                   /* Receive failed, the input has ended once the ring is empty */
+    int wake[2];                            /* Pipe (non-blocking), written when the ring goes from empty to non-empty */
+    unsigned int head;                      /* Next slot to fill (written only by the receive thread) */
+    unsigned int tail;                      /* Next slot to read (written only by the main loop) */
+    unsigned long received, batches, dropped;
+    UdpSlot slots[UDP_RING_SLOTS];
+} UdpRing;
+
+
+/* Receive thread: fill the free slots of the ring, a batch at a time */
+static thread_return_t udpringthread(void *arg)
+{
+    UdpRing *ring = (UdpRing *)arg;
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[UDP_RECV_BATCH];
+#endif
+    struct iovec iov[UDP_RECV_BATCH];
 
-        // Check if interface name is specified
-        if (*name != '\0' && *name != ':' && !(*name >= '0' && *name <= '9' && strstr(name, ".") == NULL))
-        {
-            strcpy(serverName, name);
-            // Find and remove port separator
-            name = strstr(serverName, ":");
-            if (name != NULL) { *name++ = '\0'; }
-        }
+    while (!ring->quit)
+    {
+        unsigned int head = ring->head;
+        unsigned int space = UDP_RING_SLOTS - (head - atomic_get(&ring->tail));
+        unsigned long long now;
+        int count, i;
 
-        // Check if port specified
-        if (name != NULL && *name != '\0')
+        /* Ring full: leave further datagrams in the socket buffer until the parser catches up */
+        if (space == 0) { usleep(1000); continue; }
+        if (space > UDP_RECV_BATCH) { space = UDP_RECV_BATCH; }
+
+        for (i = 0; i < (int)space; i++)
         {
-            receiveUdpPort = atoi(name);
+            iov[i].iov_base = ring->slots[(head + i) & (UDP_RING_SLOTS - 1)].data;
+            iov[i].iov_len = UDP_SLOT_SIZE;
         }
 
-        /* Get server host information, name and inet address */
-        hp = gethostbyname(serverName);
-        if (hp == NULL) { fprintf(stderr, "UDPRECV: Can't resolve host: %s\n", serverName); return 8; }
-        memcpy(&(serverAddr.sin_addr), hp->h_addr, hp->h_length);
-        serverAddr.sin_family = AF_INET; 
-        serverAddr.sin_port = htons(receiveUdpPort);
-        fprintf(stderr, "UDPRECV: Address: [%s] = %s : %d\n", hp->h_name, inet_ntoa(serverAddr.sin_addr), receiveUdpPort);
-        serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    
-        /* Create the socket */
-        receiveUdpSocket = socket(AF_INET, SOCK_DGRAM, 0); 
-        if (receiveUdpSocket < 0)
+#ifdef HAVE_RECVMMSG
+        /* Wait for a datagram, then take any others already queued */
+        memset(msgs, 0, sizeof(msgs[0]) * space);
+        for (i = 0; i < (int)space; i++) { msgs[i].msg_hdr.msg_iov = &iov[i]; msgs[i].msg_hdr.msg_iovlen = 1; }
+        count = recvmmsg(ring->socket, msgs, space, MSG_WAITFORONE, NULL);
+        for (i = 0; i < count; i++)
         {
-            fprintf(stderr, "UDPRECV: ERROR: Socket creation failed (%s)\n", strerrorsocket());
-            return 5;
+            ring->slots[(head + i) & (UDP_RING_SLOTS - 1)].length = msgs[i].msg_len;
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) { ring->slots[(head + i) & (UDP_RING_SLOTS - 1)].length = 0; ring->dropped++; }
         }
-    
-        /* Allow rapid reuse of this socket */
+#else
+        /* Wait for a datagram, then take any others already queued */
+        for (count = 0; count < (int)space; count++)
         {
-            int option = 1;
-            setsockopt(receiveUdpSocket, SOL_SOCKET, SO_REUSEADDR, (char *)&option, sizeof(option));
+            ssize_t received = recv(ring->socket, iov[count].iov_base, iov[count].iov_len, (count == 0) ? 0 : MSG_DONTWAIT);
+            if (received < 0) { if (count == 0) { count = -1; } break; }
+            ring->slots[(head + count) & (UDP_RING_SLOTS - 1)].length = (size_t)received;
         }
-    
-        /* Bind the socket */
-        if (bind(receiveUdpSocket, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) == SOCKET_ERROR)
+#endif
+        if (ring->quit) { break; }
+        if (count < 0)
         {
-            fprintf(stderr, "UDPRECV: ERROR: Socket bind failed (%s)\n", strerrorsocket());
-            return 6;
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) { continue; }    /* (receive timeout, to check for quit) */
+            if (!ring->quit) { fprintf(stderr, "UDPRECV: ERROR: Receive failed (%s)\n", strerrorsocket()); }
+            ring->failed = 1;
+            write(ring->wake[1], "", 1);
+            break;
         }
+        if (count == 0) { continue; }
 
+        /* One timestamp for the batch */
+        now = TicksNow();
+        for (i = 0; i < count; i++) { ring->slots[(head + i) & (UDP_RING_SLOTS - 1)].time = now; }
+        ring->received += count;
+        ring->batches++;
+
+        /* Publish, waking the main loop if it had emptied the ring */
+        atomic_set(&ring->head, head + count);
+        if (atomic_get(&ring->tail) == head) { write(ring->wake[1], "", 1); }
     }
-    else
+
+    return thread_return_value(0);
+}
+
+
+/* Start receiving from a bound UDP socket */
+static UdpRing *udpringopen(SOCKET socket)
+{
+    UdpRing *ring;
+    int size = UDP_RCVBUF;
+    socklen_t sizeLength = sizeof(size);
+    struct timeval timeout;
+
+    ring = (UdpRing *)malloc(sizeof(UdpRing));
+    if (ring == NULL) { fprintf(stderr, "ERROR: Out of memory.\n"); return NULL; }
+    memset(ring, 0, sizeof(UdpRing) - sizeof(ring->slots));
+    ring->socket = socket;
+
+    /* Large receive buffer, to ride out bursts while the parser is busy */
+    setsockopt(socket, SOL_SOCKET, SO_RCVBUF, (char *)&size, sizeof(size));
+    if (getsockopt(socket, SOL_SOCKET, SO_RCVBUF, (char *)&size, &sizeLength) == 0 && size < UDP_RCVBUF)
+    {
+        fprintf(stderr, "NOTE: UDP receive buffer limited to %d bytes (requested %d).\n", size, UDP_RCVBUF);
+    }
+
+    /* Receive timeout, so the thread can notice it is to quit */
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 250000;
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+
+    if (pipe(ring->wake) != 0)
+    {
+        fprintf(stderr, "ERROR: pipe() failed (%s)\n", strerror(errno));
+        free(ring);
+        return NULL;
+    }
+    fcntl(ring->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(ring->wake[1], F_SETFL, O_NONBLOCK);
+
+    if (thread_create(&ring->thread, NULL, udpringthread, ring) != 0)
+    {
+        fprintf(stderr, "ERROR: Problem creating UDP receive thread.\n");
+        close(ring->wake[0]); close(ring->wake[1]);
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+
+/* Take the next datagram from the ring, returns its length, or 0 if the ring is empty (-1 if the receiver has failed) */
+static int udpringread(UdpRing *ring, char *buffer, size_t bufferSize, unsigned long long *time)
+{
+    for (;;)
+    {
+        unsigned int tail = ring->tail;
+        UdpSlot *slot;
+        size_t len;
+
+        if (tail == atomic_get(&ring->head))
+        {
+            char drain[64];
+            while (read(ring->wake[0], drain, sizeof(drain)) > 0) { ; }
+            if (tail != atomic_get(&ring->head)) { continue; }   /* (arrived while draining) */
+            return ring->failed ? -1 : 0;
+        }
+
+        slot = &ring->slots[tail & (UDP_RING_SLOTS - 1)];
+        len = slot->length;
+        if (len > bufferSize) { len = bufferSize; }
+        memcpy(buffer, slot->data, len);
+        *time = slot->time;
+        atomic_set(&ring->tail, tail + 1);
+        if (len > 0) { return (int)len; }
+    }
+}
+
+
+/* Stop the receive thread, report the counters and free the ring (the socket is left open) */
+static void udpringclose(UdpRing *ring)
+{
+    ring->quit = 1;
+    shutdown(ring->socket, SHUT_RDWR);      /* (wakes the receive thread at once on some systems, otherwise on the receive timeout) */
+    thread_join(ring->thread, NULL);
+    close(ring->wake[0]);
+    close(ring->wake[1]);
+    fprintf(stderr, "UDPRECV: %lu datagrams in %lu batches (%.1f per batch), %lu dropped as too large\n", ring->received, ring->batches, ring->batches ? (double)ring->received / ring->batches : 0.0, ring->dropped);
+    free(ring);
+}
+#endif
+
+
+/* Input sources */
+#define MAX_SOURCES 16
+#define BUFFER_SIZE 0xffff
+#define SOURCE_SERIAL 0                     /* Serial port or stdin (line and SLIP-encoded packets) */
+#define SOURCE_UDP    1                     /* UDP datagrams */
+#define SOURCE_FAKE   2                     /* Generated test data */
+#define SOURCE_REPLAY 3                     /* Replayed capture file */
+typedef struct
+{
+    char tag[32];                           /* Source tag for the outputs (when there are several inputs) */
+    char prefix[34];                        /* Source tag as a leading log field ("tag,") */
+    char type;                              /* SOURCE_SERIAL / SOURCE_UDP / SOURCE_FAKE / SOURCE_REPLAY */
+    char tagged;                            /* Always tag the output (replay of a capture from several inputs) */
+    int index;                              /* Input number */
+    char text;                              /* Serial input is still in line mode (until the first SLIP_END) */
+    char ended;                             /* Input has ended */
+    int fd;                                 /* Serial port/stdin (or HANDLE with WIN_HANDLE) */
+    SOCKET socket;                          /* UDP socket */
+#ifndef _WIN32
+    UdpRing *ring;                          /* UDP receive thread's ring */
+#endif
+    const char *fakeType;                   /* Type of test data */
+    unsigned long long due;                 /* Time the next test/replayed frame is due */
+    Reader reader;                          /* Buffered serial reader state */
+    FILE *file;                             /* Capture file being replayed... */
+    double speed;                           /* ...at this multiple of real-time (0 = maximum) */
+    unsigned long long replayTime;          /* Capture time (usec) of the next frame */
+    unsigned long long replayFirst;         /* Capture time (usec) of the first frame */
+    unsigned long long replayStart;         /* Time (msec) the replay started */
+    int replayIndex, replayFlags;           /* Source index and flags of the next frame */
+    size_t replayLength;                    /* Length of the next frame */
+    int replayTagCount;
+    char replayTags[MAX_SOURCES][32];       /* Source tags of the captured inputs */
+    unsigned long long frameTime;           /* Receive time (msec) of the current frame (UDP and replays) */
+    char buffer[BUFFER_SIZE];               /* Current frame (partial serial frames are kept here between reads) */
+} Source;
+
+
+/* Capture files -- header: "WAXCAP" 0x01 0x00, start time (usec since epoch, 64-bit), number of input tags (8-bit), each tag (8-bit length, text);
+   then each frame: time since the previous frame (usec, 32-bit; 0xffffffff is followed by the 64-bit time), input index (8-bit), flags (8-bit), length (16-bit), frame data.
+   All values are little-endian. */
+#define CAPTURE_MAGIC "WAXCAP\x01"          /* (with the terminating 0x00) */
+#define CAPTURE_FLAG_TEXT 0x01              /* Frame is a text line */
+typedef struct
+{
+    FILE *fp;
+    unsigned long long last;                /* Time of the last frame (usec) */
+    unsigned long long flushed;             /* Time of the last flush (usec) */
+    unsigned long frames;
+} Capture;
+
+static void capture_put(unsigned char *buffer, unsigned long long value, int bytes)
+{
+    int i;
+    for (i = 0; i < bytes; i++) { buffer[i] = (unsigned char)(value >> (8 * i)); }
+}
+
+static unsigned long long capture_get(const unsigned char *buffer, int bytes)
+{
+    unsigned long long value = 0;
+    int i;
+    for (i = bytes - 1; i >= 0; i--) { value = (value << 8) | buffer[i]; }
+    return value;
+}
+
+/* Create a capture file of the frames from the inputs */
+static Capture *captureopen(const char *filename, Source **sources, int numSources)
+{
+    Capture *capture;
+    unsigned char header[17];
+    int i;
+
+    capture = (Capture *)malloc(sizeof(Capture));
+    if (capture == NULL) { return NULL; }
+    capture->fp = fopen(filename, "wb");
+    if (capture->fp == NULL)
+    {
+        fprintf(stderr, "ERROR: Cannot create capture file: %s\n", filename);
+        free(capture);
+        return NULL;
+    }
+    setvbuf(capture->fp, NULL, _IOFBF, 1024 * 1024);
+    capture->last = TicksNowMicro();
+    capture->flushed = capture->last;
+    capture->frames = 0;
+
+    memcpy(header, CAPTURE_MAGIC, 8);
+    capture_put(header + 8, capture->last, 8);
+    header[16] = (unsigned char)numSources;
+    fwrite(header, 1, sizeof(header), capture->fp);
+    for (i = 0; i < numSources; i++)
+    {
+        unsigned char len = (unsigned char)strlen(sources[i]->tag);
+        fwrite(&len, 1, 1, capture->fp);
+        fwrite(sources[i]->tag, 1, len, capture->fp);
+    }
+    return capture;
+}
+
+/* Append a received frame to the capture file */
+static void capturewrite(Capture *capture, Source *source, const char *buffer, size_t len, char text, unsigned long long time)
+{
+    unsigned char header[16];
+    int o = 0;
+
+    if (capture == NULL) { return; }
+    if (time >= capture->last && time - capture->last < 0xffffffffull)
+    {
+        capture_put(header + o, time - capture->last, 4); o += 4;
+    }
+    else
+    {
+        capture_put(header + o, 0xffffffffull, 4); o += 4;
+        capture_put(header + o, time, 8); o += 8;
+    }
+    capture->last = time;
+    header[o++] = (unsigned char)source->index;
+    header[o++] = text ? CAPTURE_FLAG_TEXT : 0;
+    capture_put(header + o, len, 2); o += 2;
+    fwrite(header, 1, o, capture->fp);
+    fwrite(buffer, 1, len, capture->fp);
+    capture->frames++;
+
+    /* Don't lose more than a second of capture if interrupted */
+    if (time - capture->flushed >= 1000000ull) { fflush(capture->fp); capture->flushed = time; }
+}
+
+static void captureclose(Capture *capture)
+{
+    if (capture == NULL) { return; }
+    fprintf(stderr, "CAPTURE: %lu frames\n", capture->frames);
+    fclose(capture->fp);
+    free(capture);
+}
+
+/* Read the header of the next frame in a replayed capture, returns 0 at the end */
+static int replayhead(Source *source)
+{
+    unsigned char header[8];
+    unsigned long long delta;
+
+    if (fread(header, 1, 8, source->file) != 8) { return 0; }
+    delta = capture_get(header, 4);
+    if (delta == 0xffffffffull)
+    {
+        unsigned char extra[8];
+        if (fread(extra, 1, 8, source->file) != 8) { return 0; }
+        source->replayTime = capture_get(header + 4, 4) | (capture_get(extra, 4) << 32);
+        memcpy(header, extra + 4, 4);
+    }
+    else
+    {
+        source->replayTime += delta;
+        memmove(header, header + 4, 4);
+    }
+    source->replayIndex = header[0];
+    source->replayFlags = header[1];
+    source->replayLength = (size_t)capture_get(header + 2, 2);
+
+    /* Schedule the frame */
+    if (source->replayFirst == 0) { source->replayFirst = source->replayTime; }
+    if (source->speed > 0 && source->replayTime > source->replayFirst)
+    {
+        source->due = source->replayStart + (unsigned long long)((source->replayTime - source->replayFirst) / 1000 / source->speed);
+    }
+    else
+    {
+        source->due = source->replayStart;
+    }
+    return 1;
+}
+
+/* Open a capture file for replay */
+static int replayopen(Source *source, const char *filename)
+{
+    unsigned char header[17];
+    int i;
+
+    source->file = fopen(filename, "rb");
+    if (source->file == NULL) { fprintf(stderr, "ERROR: Cannot open capture file: %s\n", filename); return 0; }
+    setvbuf(source->file, NULL, _IOFBF, 1024 * 1024);
+    if (fread(header, 1, sizeof(header), source->file) != sizeof(header) || memcmp(header, CAPTURE_MAGIC, 8) != 0)
+    {
+        fprintf(stderr, "ERROR: Not a capture file: %s\n", filename);
+        return 0;
+    }
+    source->replayTime = capture_get(header + 8, 8);
+    source->replayTagCount = header[16];
+    for (i = 0; i < source->replayTagCount; i++)
+    {
+        unsigned char len = 0;
+        char tag[256];
+        if (fread(&len, 1, 1, source->file) != 1 || fread(tag, 1, len, source->file) != len) { fprintf(stderr, "ERROR: Truncated capture file: %s\n", filename); return 0; }
+        if (i < MAX_SOURCES)
+        {
+            /* Longer tags are cut short, and always terminated */
+            if (len >= sizeof(source->replayTags[i])) { len = sizeof(source->replayTags[i]) - 1; }
+            memcpy(source->replayTags[i], tag, len);
+            source->replayTags[i][len] = '\0';
+        }
+    }
+    if (source->replayTagCount > MAX_SOURCES) { source->replayTagCount = MAX_SOURCES; }
+    source->tagged = (source->replayTagCount > 1);
+    source->replayStart = TicksNow();
+    if (!replayhead(source)) { source->ended = 1; }
+    return 1;
+}
+
+
+/* Open an input: "udp://[interface][:port]", "*<fakeType>", "replay:<capture-file>", "!" or "![VID+PID]", "@[MAC-address]", or a serial port; optionally prefixed with "<tag>=" */
+static int sourceopen(Source *source, const char *infile, int index, int waitTimeout, double speed)
+{
+    static char ports[1024];
+    const char *separator;
+
+    memset(source, 0, sizeof(*source));
+    source->type = SOURCE_SERIAL;
+    source->text = 1;
+    source->fd = -1;
+    source->socket = SOCKET_ERROR;
+    source->index = index;
+
+    /* Source tag */
+    sprintf(source->tag, "%d", index + 1);
+    separator = strchr(infile, '=');
+    if (separator != NULL && separator > infile && separator - infile < (int)sizeof(source->tag) && strcspn(infile, "/\\:") > (size_t)(separator - infile))
+    {
+        memcpy(source->tag, infile, separator - infile);
+        source->tag[separator - infile] = '\0';
+        infile = separator + 1;
+    }
+    sprintf(source->prefix, "%s,", source->tag);
+
+    /* fake input for testing */
+    if (infile[0] == '*')
+    {
+        source->type = SOURCE_FAKE;
+        source->text = 0;
+        source->fakeType = infile + 1;
+    }
+    else if (strncmp(infile, "replay:", 7) == 0)
+    {
+        source->type = SOURCE_REPLAY;
+        source->text = 0;
+        source->speed = speed;
+        if (!replayopen(source, infile + 7)) { return 3; }
+    }
+    else if (infile[0] == 'u' && infile[1] == 'd' && infile[2] == 'p' && infile[3] == ':')
+    {
+        char *name;
+        int receiveUdpPort = 1234;
+        char serverName[64] = "localhost";
+        char interfaceName[64];
+        struct sockaddr_in serverAddr;
+        struct hostent *hp;
+
+        source->type = SOURCE_UDP;
+        source->text = 0;
+
+        strncpy(interfaceName, infile + 4, sizeof(interfaceName) - 1);
+        interfaceName[sizeof(interfaceName) - 1] = '\0';
+        name = interfaceName;
+
+        // Ignore preceding slashes
+        while (*name == '/') { name++; }
+
+        gethostname(serverName, 64);
+
+        // Check if interface name is specified
+        if (*name != '\0' && *name != ':' && !(*name >= '0' && *name <= '9' && strstr(name, ".") == NULL))
+        {
+            strcpy(serverName, name);
+            // Find and remove port separator
+            name = strstr(serverName, ":");
+            if (name != NULL) { *name++ = '\0'; }
+        }
+        else if (*name == ':')
+        {
+            name++;
+        }
+
+        // Check if port specified
+        if (name != NULL && *name != '\0')
+        {
+            receiveUdpPort = atoi(name);
+        }
+
+        /* Get server host information, name and inet address */
+        hp = gethostbyname(serverName);
+        if (hp == NULL) { fprintf(stderr, "UDPRECV: Can't resolve host: %s\n", serverName); return 8; }
+        memcpy(&(serverAddr.sin_addr), hp->h_addr, hp->h_length);
+        serverAddr.sin_family = AF_INET; 
+        serverAddr.sin_port = htons(receiveUdpPort);
+        fprintf(stderr, "UDPRECV: Address: [%s] = %s : %d\n", hp->h_name, inet_ntoa(serverAddr.sin_addr), receiveUdpPort);
+        serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    
+        /* Create the socket */
+        source->socket = socket(AF_INET, SOCK_DGRAM, 0); 
+        if (source->socket < 0)
+        {
+            fprintf(stderr, "UDPRECV: ERROR: Socket creation failed (%s)\n", strerrorsocket());
+            source->socket = SOCKET_ERROR;
+            return 5;
+        }
+    
+        /* Allow rapid reuse of this socket */
+        {
+            int option = 1;
+            setsockopt(source->socket, SOL_SOCKET, SO_REUSEADDR, (char *)&option, sizeof(option));
+        }
+    
+        /* Bind the socket */
+        if (bind(source->socket, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) == SOCKET_ERROR)
+        {
+            fprintf(stderr, "UDPRECV: ERROR: Socket bind failed (%s)\n", strerrorsocket());
+            return 6;
+        }
+
+#ifndef _WIN32
+        /* Receive on a separate thread */
+        source->ring = udpringopen(source->socket);
+        if (source->ring == NULL) { return 7; }
+#endif
+    }
+    else
+    {
+
+        /* Search for port */
+        if (infile[0] == '!')
+        {
+            unsigned int vidpid = (DEFAULT_VID << 16) | DEFAULT_PID;
+            sscanf(infile + 1, "%08x", &vidpid);
+            fprintf(stderr, "Searching for VID=%04X&PID=%04X...\n", (unsigned short)(vidpid >> 16), (unsigned short)vidpid);
+            if (FindPorts((unsigned short)(vidpid >> 16), (unsigned short)vidpid, ports, 1024) <= 0)
+            {
+                fprintf(stderr, "ERROR: No ports found.\n");
+                return 3;
+            }
+            /* Choose the first port found */
+            infile = ports;
+        }
+        else if (infile[0] == '@')
+        {
+            fprintf(stderr, "Searching for Bluetooth port %s...\n", infile + 1);
+            if (FindBluetoothPorts(infile + 1, ports, 1024) <= 0)
+            {
+                fprintf(stderr, "ERROR: No matching Bluetooth ports found.\n");
+                return 3;
+            }
+            /* Choose the first port found */
+            infile = ports;
+        }
+    
+        /* Open the serial port */
+        fprintf(stderr, "NOTE: Using port: %s\n", infile);
+        source->fd = openport(infile, 1, (waitTimeout > 0) ? waitTimeout : 0);   // (initString != NULL)
+        if (source->fd < 0)
+        {
+            fprintf(stderr, "ERROR: Port not open.\n");
+            return 2;
+        }
+        readerinit(&source->reader, source->fd);
+
+    }
+
+    return 0;
+}
+
+
+/* Close an input */
+static void sourceclose(Source *source)
+{
+#ifndef _WIN32
+    if (source->ring != NULL)
+    {
+        udpringclose(source->ring);
+        source->ring = NULL;
+    }
+#endif
+    if (source->socket != SOCKET_ERROR)
+    {
+        closesocket(source->socket);
+        source->socket = SOCKET_ERROR;
+    }
+    if (source->file != NULL)
+    {
+        fclose(source->file);
+        source->file = NULL;
+    }
+#if defined(_WIN32) && defined(WIN_HANDLE)
+    if (source->fd != -1 && (HANDLE)source->fd != INVALID_HANDLE_VALUE) { CloseHandle((HANDLE)source->fd); }
+#else
+    if (source->fd != -1 && source->fd != fileno(stdin)) { close(source->fd); }
+#endif
+    source->fd = -1;
+}
+
+
+/* Write a string to the input (serial ports only) */
+static void sourcewrite(Source *source, const void *data, size_t len)
+{
+    if (source->type != SOURCE_SERIAL || source->fd == -1) { return; }
+#if defined(_WIN32) && defined(WIN_HANDLE)
+    {
+        DWORD written;
+        WriteFile((HANDLE)source->fd, data, (DWORD)len, &written, 0);
+    }
+#else
+    write(source->fd, data, len);
+#endif
+}
+
+
+/* Scan a serial input's buffered data for a complete frame (line or SLIP packet), returns the frame length, or 0 if more data is needed */
+static size_t sourcescan(Source *source)
+{
+    size_t len;
+    if (source->text)
+    { 
+        len = linescan(&source->reader, source->buffer, BUFFER_SIZE); 
+        if (len != (size_t)-1) { return len; }
+        source->text = 0;
+    }
+    return slipscan(&source->reader, source->buffer, BUFFER_SIZE);
+}
+
+
+/* Read the next frame from an input (the input has data or is a test source), returns the frame length, or 0 if there is not yet a complete frame. */
+static size_t sourceread(Source *source)
+{
+    size_t len = 0;
+
+    if (source->type == SOURCE_UDP)
+    {
+#ifdef _WIN32
+        struct sockaddr_in from;
+        socklen_t fromlen = sizeof(from);
+        int received;
+
+        received = recvfrom(source->socket, (char *)source->buffer, BUFFER_SIZE, 0, (struct sockaddr *)&from, &fromlen);
+        if (received == 0 || received == SOCKET_ERROR) { fprintf(stderr, "UDPRECV: ERROR: Receive failed (%s)\n", strerrorsocket()); source->ended = 1; return 0; }
+        len = (size_t)received;
+        source->frameTime = TicksNow();
+#else
+        int received = udpringread(source->ring, source->buffer, BUFFER_SIZE - 1, &source->frameTime);
+        if (received < 0) { source->ended = 1; return 0; }
+        len = (size_t)received;
+        if (len == 0) { return 0; }
+#endif
+
+        //fprintf(stderr, "UDPRECV: Received from %s:%d\n", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+
+        /* Check if it appears to be an OSC bundle or OSC packet... */
+        if (len >= 1 && source->buffer[0] == '/') { fprintf(stderr, "WARNING: OSC packet receive not yet implemented.\n"); }
+        else if (len >= 1 && source->buffer[0] == '#') { fprintf(stderr, "WARNING: OSC bundle receive not yet implemented.\n"); }
+    }
+    else if (source->type == SOURCE_FAKE)
+    {
+        /* Fake input for testing */
+        len = CreateTestData(source->buffer, source->fakeType);
+        source->due += 1000;
+    }
+    else if (source->type == SOURCE_REPLAY)
+    {
+        /* Next frame from the capture */
+        len = source->replayLength;
+        if (len > BUFFER_SIZE - 1) { len = BUFFER_SIZE - 1; }
+        len = fread(source->buffer, 1, len, source->file);
+        if (source->replayLength > len) { fseek(source->file, (long)(source->replayLength - len), SEEK_CUR); }
+        source->buffer[len] = '\0';
+        source->text = (source->replayFlags & CAPTURE_FLAG_TEXT) ? 1 : 0;
+        source->frameTime = source->replayTime / 1000;
+        if (source->replayIndex < source->replayTagCount && strcmp(source->tag, source->replayTags[source->replayIndex]) != 0)
+        {
+            strcpy(source->tag, source->replayTags[source->replayIndex]);
+            sprintf(source->prefix, "%s,", source->tag);
+        }
+        if (!replayhead(source)) { source->ended = 1; }
+    }
+    else
+    {
+        /* Read data */
+        if (readerfill(&source->reader) <= 0)
+        {
+            /* Timeout or end of input: return whatever was received */
+            len = source->reader.received;
+            source->reader.received = 0;
+            source->reader.escaped = 0;
+            source->ended = 1;
+            if (len == (size_t)-1) { len = 0; }
+        }
+        else
+        {
+            len = sourcescan(source);
+        }
+    }
+
+    return len;
+}
+
+
+/* Wait for the next frame from any of the inputs, returns 1 with the frame's input, or -1 once all of the inputs have ended */
+static int nextframe(Source **sources, int numSources, Source **frameSource, size_t *len)
+{
+    static int next = 0;
+    int i;
+
+    for (;;)
+    {
+#ifndef _WIN32
+        struct pollfd fds[MAX_SOURCES];
+        int pollSource[MAX_SOURCES];
+        int numFds = 0;
+        int timeout = -1;
+#endif
+        unsigned long long now;
+        int active = 0;
+
+        /* Complete frames already buffered (inputs are taken in turn) */
+        for (i = 0; i < numSources; i++)
+        {
+            Source *source = sources[(next + i) % numSources];
+            if (source->type == SOURCE_SERIAL && !source->ended && source->reader.offset < source->reader.length)
+            {
+                *len = sourcescan(source);
+                if (*len != 0) { next = (next + i + 1) % numSources; *frameSource = source; return 1; }
+            }
+#ifndef _WIN32
+            if (source->type == SOURCE_UDP && !source->ended && source->ring->tail != atomic_get(&source->ring->head))
+            {
+                *len = sourceread(source);
+                if (*len != 0 || source->ended) { next = (next + i + 1) % numSources; *frameSource = source; return 1; }
+            }
+#endif
+        }
+
+        /* Test sources that are due */
+        now = TicksNow();
+        for (i = 0; i < numSources; i++)
+        {
+            Source *source = sources[i];
+            if (source->ended) { continue; }
+            active++;
+            if (source->type == SOURCE_FAKE || source->type == SOURCE_REPLAY)
+            {
+                if (source->type == SOURCE_FAKE && source->due == 0) { source->due = now + 1000; }
+                if (now >= source->due)
+                {
+                    *len = sourceread(source);
+                    *frameSource = source;
+                    return 1;
+                }
+#ifndef _WIN32
+                if (timeout < 0 || source->due - now < (unsigned long long)timeout) { timeout = (int)(source->due - now); }
+#endif
+            }
+        }
+        if (active == 0) { return -1; }
+
+#ifdef _WIN32
+        /* Windows: a single input, read with blocking calls */
+        {
+            Source *source = sources[0];
+            if (source->type == SOURCE_FAKE || source->type == SOURCE_REPLAY) { Sleep((DWORD)(source->due - now)); continue; }
+            *len = sourceread(source);
+            if (*len != 0 || source->ended) { *frameSource = source; return 1; }
+        }
+#else
+        /* Wait for any input to have data */
+        for (i = 0; i < numSources; i++)
+        {
+            Source *source = sources[i];
+            if (source->ended || source->type == SOURCE_FAKE || source->type == SOURCE_REPLAY) { continue; }
+            fds[numFds].fd = (source->type == SOURCE_UDP) ? source->ring->wake[0] : source->fd;
+            fds[numFds].events = POLLIN;
+            fds[numFds].revents = 0;
+            pollSource[numFds] = i;
+            numFds++;
+        }
+        if (poll(fds, numFds, timeout) < 0)
+        {
+            if (errno == EINTR) { continue; }
+            fprintf(stderr, "ERROR: poll() failed (%s)\n", strerror(errno));
+            return -1;
+        }
+        for (i = 0; i < numFds; i++)
+        {
+            Source *source = sources[pollSource[i]];
+            if (fds[i].revents == 0) { continue; }
+            *len = sourceread(source);
+            if (*len != 0 || source->ended) { *frameSource = source; return 1; }
+        }
+#endif
+    }
+}
+
+
+/* Outputs: the main loop parses each frame in to a ring, read by one thread per output (single-producer/multi-consumer, lock-free unless the receiver has to wait for an output) */
+#define RING_DEFAULT 256                    /* Default number of frames in the ring (rounded up to a power of two) */
+#define FRAME_DATA_SIZE 4096                /* Largest raw frame kept for the outputs (longer frames are parsed in full, but truncated for raw output) */
+#define OUTPUT_FULL_DROP  0                 /* When the output falls a full ring behind, its oldest frames are dropped */
+#define OUTPUT_FULL_BLOCK 1                 /* When the output falls a full ring behind, the receiver waits for it */
+#define OUTPUT_IDLE_WAIT 1000               /* Longest time (msec) an idle output waits before checking again */
+#define PACKET_NONE         0
+#define PACKET_WAX          1
+#define PACKET_WAX9         2
+#define PACKET_TEDDI        3
+#define PACKET_TEDDI_STATUS 4
+typedef struct
+{
+    unsigned long long received;            /* Receive time (msec) */
+    char tag[32];                           /* Input tag */
+    char prefix[34];                        /* Input tag as a leading log field ("tag,"), or empty if not tagging the output */
+    char text;                              /* Text line (rather than a binary packet) */
+    char kind;                              /* Packet type from the header (PACKET_*) */
+    char parsed;                            /* The packet was decoded in to 'packet' */
+    union { WaxPacket wax; Wax9Packet wax9; TeddiPacket teddi; TeddiStatusPacket teddiStatus; } packet;
+    size_t len;                             /* Length of the raw frame (at most FRAME_DATA_SIZE) */
+    char data[FRAME_DATA_SIZE + 1];         /* Raw frame (text lines are terminated) */
+} Frame;
+
+/* Settings and shared state for the outputs */
+typedef struct
+{
+    const char *logfile;                    /* Log file name pattern (empty for stdout) */
+    int logSync;
+    const char *logCompress;
+    LogWriter *log;                         /* (opened on the first frame) */
+    char textToLog;                         /* Text lines go to the log (on stdout) rather than to the console */
+    char tee, dump, timetag, convertToOsc, ignoreInvalid;
+    int timeformat, format;
+    const char *stompAddress;
+    char stompSource;                       /* Add the input tag to STOMP messages */
+    UdpBatch *udpBatch;
+} OutputConfig;
+
+typedef struct Output_t Output;
+typedef struct FrameRing_t FrameRing;
+struct Output_t
+{
+    const char *name;
+    char policy;                            /* OUTPUT_FULL_DROP / OUTPUT_FULL_BLOCK */
+    void (*process)(Output *output, Frame *frame);
+    int (*idle)(Output *output, unsigned long long now);    /* Called when there are no frames, returns the time (msec) until it is next needed, or -1 */
+    OutputConfig *config;
+    FrameRing *ring;
+    thread_t thread;
+    mutex_t mutex;
+    cond_t cond;
+    unsigned int waiting;                   /* The thread is (about to be) waiting for a frame */
+    unsigned int tail;                      /* Next frame for this output (advanced by the thread, or by the receiver when dropping) */
+    unsigned int copying;                   /* Slot being copied by a dropping output (plus one, 0 = none), which the receiver does not re-use until done */
+    unsigned long processed;                /* Counted by the output's thread */
+    unsigned long dropped;                  /* Counted by the receiver */
+    Frame copy;                             /* Copy of the current frame (dropping outputs: the receiver may re-use the slot) */
+};
+
+#define MAX_OUTPUTS 4
+struct FrameRing_t
+{
+    unsigned int size;                      /* Number of frames (a power of two) */
+    unsigned int head;                      /* Next frame to fill (written only by the receiver) */
+    unsigned int quit;                      /* No more frames: the outputs finish the ring and stop */
+    unsigned long truncated;
+    int numOutputs;
+    Output *outputs[MAX_OUTPUTS];
+    Frame *frames;
+    mutex_t mutex;
+    cond_t space;                           /* Signalled by an output that the receiver is waiting for */
+    unsigned int waiting;                   /* The receiver is (about to be) waiting for space */
+};
+
+
+/* Copy a frame (only the valid part of the data) */
+static void framecopy(Frame *dest, const Frame *frame)
+{
+    size_t len = frame->len;
+    if (len > FRAME_DATA_SIZE) { len = FRAME_DATA_SIZE; }
+    memcpy(dest, frame, (size_t)((const char *)&frame->data - (const char *)frame) + len + 1);
+    dest->len = len;
+    dest->data[len] = '\0';
+}
+
+
+/* Create the ring */
+static FrameRing *ringopen(int size)
+{
+    FrameRing *ring;
+    unsigned int slots = 1;
+
+    while (slots < (unsigned int)size && slots < 0x10000) { slots <<= 1; }
+    ring = (FrameRing *)malloc(sizeof(FrameRing));
+    if (ring == NULL) { return NULL; }
+    memset(ring, 0, sizeof(FrameRing));
+    ring->size = slots;
+    ring->frames = (Frame *)malloc(sizeof(Frame) * slots);
+    if (ring->frames == NULL) { free(ring); return NULL; }
+    mutex_init(&ring->mutex, NULL);
+    cond_init(&ring->space, NULL);
+    return ring;
+}
+
+
+/* Wake the receiver if it is waiting for an output (output thread) */
+static void ringwake(FrameRing *ring)
+{
+    if (atomic_get(&ring->waiting))
     {
+        mutex_lock(&ring->mutex);
+        cond_signal(&ring->space);
+        mutex_unlock(&ring->mutex);
+    }
+}
 
-        /* Search for port */
-        if (infile[0] == '!')
+
+/* Output thread: process the frames in order as they arrive */
+static thread_return_t outputthread(void *arg)
+{
+    Output *output = (Output *)arg;
+    FrameRing *ring = output->ring;
+
+    for (;;)
+    {
+        unsigned int tail = atomic_get(&output->tail);
+        Frame *frame;
+
+        if (tail == atomic_get(&ring->head))
         {
-            unsigned int vidpid = (DEFAULT_VID << 16) | DEFAULT_PID;
-            sscanf(infile + 1, "%08x", &vidpid);
-            fprintf(stderr, "Searching for VID=%04X&PID=%04X...\n", (unsigned short)(vidpid >> 16), (unsigned short)vidpid);
-            if (FindPorts((unsigned short)(vidpid >> 16), (unsigned short)vidpid, ports, 1024) <= 0)
+            /* No frames: finish if the receiver has stopped, otherwise wait (no longer than the output needs) */
+            int timeout = OUTPUT_IDLE_WAIT;
+            if (atomic_get(&ring->quit)) { break; }
+            if (output->idle != NULL)
             {
-                fprintf(stderr, "ERROR: No ports found.\n");
-                return 3;
+                int due = output->idle(output, TicksNow());
+                if (due >= 0 && due < timeout) { timeout = due; }
             }
-            /* Choose the first port found */
-            infile = ports;
+            mutex_lock(&output->mutex);
+            atomic_set(&output->waiting, 1);
+            if (atomic_get(&ring->head) == tail && !atomic_get(&ring->quit)) { cond_timedwait_ms(&output->cond, &output->mutex, timeout); }
+            atomic_set(&output->waiting, 0);
+            mutex_unlock(&output->mutex);
+            continue;
         }
-        else if (infile[0] == '@')
+
+        frame = &ring->frames[tail & (ring->size - 1)];
+        if (output->policy == OUTPUT_FULL_DROP)
         {
-            fprintf(stderr, "Searching for Bluetooth port %s...\n", infile + 1);
-            if (FindBluetoothPorts(infile + 1, ports, 1024) <= 0)
+            /* The receiver can drop the frame when it is a full ring ahead: mark the slot as being copied, then claim the frame (if it was dropped first, it is skipped) */
+            char claimed;
+            atomic_set(&output->copying, (tail & (ring->size - 1)) + 1);
+            claimed = atomic_cas(&output->tail, tail, tail + 1);
+            if (claimed) { framecopy(&output->copy, frame); }
+            atomic_set(&output->copying, 0);
+            ringwake(ring);
+            if (!claimed) { continue; }
+            output->process(output, &output->copy);
+        }
+        else
+        {
+            output->process(output, frame);
+            atomic_set(&output->tail, tail + 1);
+            if (atomic_get(&ring->head) - (tail + 1) <= ring->size / 2) { ringwake(ring); }    /* Once half the ring is free, so the receiver fills it in one go */
+        }
+        output->processed++;
+    }
+
+    return thread_return_value(0);
+}
+
+
+/* Add an output, with its own thread */
+static void ringoutput(FrameRing *ring, const char *name, char policy, void (*process)(Output *, Frame *), int (*idle)(Output *, unsigned long long), OutputConfig *config)
+{
+    Output *output;
+
+    if (ring == NULL || ring->numOutputs >= MAX_OUTPUTS) { return; }
+    output = (Output *)malloc(sizeof(Output));
+    if (output == NULL) { fprintf(stderr, "ERROR: Out of memory.\n"); return; }
+    memset(output, 0, sizeof(Output) - sizeof(output->copy));
+    output->name = name;
+    output->policy = policy;
+    output->process = process;
+    output->idle = idle;
+    output->config = config;
+    output->ring = ring;
+    output->tail = ring->head;
+    mutex_init(&output->mutex, NULL);
+    cond_init(&output->cond, NULL);
+    if (thread_create(&output->thread, NULL, outputthread, output) != 0)
+    {
+        fprintf(stderr, "ERROR: Problem creating %s output thread.\n", name);
+        cond_destroy(&output->cond);
+        mutex_destroy(&output->mutex);
+        free(output);
+        return;
+    }
+    ring->outputs[ring->numOutputs++] = output;
+}
+
+
+/* Whether the output still needs the slot for the next frame (a full ring behind, or copying the slot) */
+static int ringbusy(FrameRing *ring, Output *output, unsigned int head)
+{
+    return (head - atomic_get(&output->tail) >= ring->size) || (atomic_get(&output->copying) == (head & (ring->size - 1)) + 1);
+}
+
+
+/* Take the next frame to fill: an output a full ring behind either has its oldest frame dropped, or is waited for */
+static Frame *ringnext(FrameRing *ring)
+{
+    unsigned int head = ring->head;
+    int i;
+
+    for (i = 0; i < ring->numOutputs; i++)
+    {
+        Output *output = ring->outputs[i];
+        for (;;)
+        {
+            unsigned int tail = atomic_get(&output->tail);
+            if (head - tail >= ring->size && output->policy == OUTPUT_FULL_DROP)
             {
-                fprintf(stderr, "ERROR: No matching Bluetooth ports found.\n");
-                return 3;
+                if (atomic_cas(&output->tail, tail, tail + 1)) { output->dropped++; }
+                continue;
             }
-            /* Choose the first port found */
-            infile = ports;
+            if (!ringbusy(ring, output, head)) { break; }
+
+            /* Wait for the output to finish with the slot (it signals when it sees the receiver waiting) */
+            mutex_lock(&ring->mutex);
+            atomic_set(&ring->waiting, 1);
+            if (ringbusy(ring, output, head)) { cond_timedwait_ms(&ring->space, &ring->mutex, OUTPUT_IDLE_WAIT); }
+            atomic_set(&ring->waiting, 0);
+            mutex_unlock(&ring->mutex);
         }
-    
-        /* Open the serial port */
-        fprintf(stderr, "NOTE: Using port: %s\n", infile);
-        fd = openport(infile, 1, (waitTimeout > 0) ? waitTimeout : 0);   // (initString != NULL)
-        if (fd < 0)
+    }
+    return &ring->frames[head & (ring->size - 1)];
+}
+
+
+/* Publish the filled frame to the outputs */
+static void ringpublish(FrameRing *ring)
+{
+    int i;
+    atomic_set(&ring->head, ring->head + 1);
+    for (i = 0; i < ring->numOutputs; i++)
+    {
+        Output *output = ring->outputs[i];
+        if (atomic_get(&output->waiting))
         {
-            fprintf(stderr, "ERROR: Port not open.\n");
-            return 2;
+            mutex_lock(&output->mutex);
+            cond_signal(&output->cond);
+            mutex_unlock(&output->mutex);
         }
+    }
+}
+
+
+/* Stop the outputs (after they finish the frames in the ring), report their counters, and free the ring */
+static void ringclose(FrameRing *ring)
+{
+    int i;
+    if (ring == NULL) { return; }
+    atomic_set(&ring->quit, 1);
+    for (i = 0; i < ring->numOutputs; i++)
+    {
+        Output *output = ring->outputs[i];
+        mutex_lock(&output->mutex);
+        cond_signal(&output->cond);
+        mutex_unlock(&output->mutex);
+        thread_join(output->thread, NULL);
+        cond_destroy(&output->cond);
+        mutex_destroy(&output->mutex);
+        fprintf(stderr, "OUTPUT: %s: %lu frames, %lu dropped (%s when full)\n", output->name, output->processed, output->dropped, (output->policy == OUTPUT_FULL_DROP) ? "drop" : "block");
+        free(output);
+    }
+    if (ring->truncated) { fprintf(stderr, "OUTPUT: %lu frames truncated to %d bytes for output\n", ring->truncated, FRAME_DATA_SIZE); }
+    cond_destroy(&ring->space);
+    mutex_destroy(&ring->mutex);
+    free(ring->frames);
+    free(ring);
+}
+
+
+/* The datagram to send for a frame (the raw frame, or an OSC bundle), returns its length (0 = none) */
+static size_t framedatagram(Frame *frame, OutputConfig *config, char *buffer, const char **data)
+{
+    *data = frame->data;
+    if (!config->convertToOsc) { return frame->len; }
+    *data = buffer;
+    if (frame->parsed && frame->kind == PACKET_WAX) { return waxToOsc(&frame->packet.wax, buffer, config->timetag); }
+    if (frame->parsed && frame->kind == PACKET_WAX9) { return wax9ToOsc(&frame->packet.wax9, buffer, config->timetag, frame->received); }
+    if (frame->parsed && frame->kind == PACKET_TEDDI) { return teddiToOsc(&frame->packet.teddi, buffer, config->timetag); }
+    *data = frame->data;
+    if (frame->len >= 1 && (frame->data[0] == '#' || frame->data[0] == '/')) { return frame->len; }    /* Already OSC */
+    return 0;
+}
+
+
+/* Console output: text lines (unless they go to the log on stdout), and hex-dumps */
+static void outputconsole(Output *output, Frame *frame)
+{
+    static char buffer[BUFFER_SIZE];
+    OutputConfig *config = output->config;
 
+    if (frame->text && !config->textToLog)
+    {
+        printf("%s%s\n", frame->prefix, frame->data);
+        if (config->tee & 1) fprintf(stderr, "%s%s\n", frame->prefix, frame->data);
+        if (config->tee & 2) fprintf(stderr, ".");
     }
-  
-    /* Send initialization string */
-    if (initString != NULL && fd != -1)
+
+    if (config->dump)
+    {
+        const char *data;
+        size_t len;
+        if (frame->kind != PACKET_NONE) { hexdump(frame->data, frame->len); }
+        len = framedatagram(frame, config, buffer, &data);
+        if (len > 0) { hexdump(data, len); }
+    }
+}
+
+
+/* Log output */
+static void outputlog(Output *output, Frame *frame)
+{
+    OutputConfig *config = output->config;
+
+    /* Start the log writer (its thread opens and rotates the files) */
+    if (config->log == NULL)
+    {
+        config->log = logopen(config->logfile, config->logSync, config->logCompress);
+    }
+    logtime(config->log, frame->received);
+
+    if (frame->text && config->textToLog)       /* Text lines (kept in order with the log on stdout) */
+    {
+        logprintf(config->log, "%s%s\n", frame->prefix, frame->data);
+        if (config->tee & 1) fprintf(stderr, "%s%s\n", frame->prefix, frame->data);
+        if (config->tee & 2) fprintf(stderr, ".");
+    }
+
+    if (!frame->parsed) { return; }
+    if (frame->kind == PACKET_WAX) { waxDump(&frame->packet.wax, config->log, config->tee, config->timeformat, frame->prefix); }
+    else if (frame->kind == PACKET_WAX9) { wax9Dump(&frame->packet.wax9, config->log, config->tee, config->timeformat, frame->received, config->format, frame->prefix); }
+    else if (frame->kind == PACKET_TEDDI) { teddiDump(&frame->packet.teddi, config->log, config->tee, config->format, config->ignoreInvalid, frame->prefix); }
+    //else if (frame->kind == PACKET_TEDDI_STATUS) { teddiStatusDump(&frame->packet.teddiStatus, config->log, config->tee); }
+}
+
+
+/* STOMP output (a JSON message per packet) */
+static void outputstomp(Output *output, Frame *frame)
+{
+    OutputConfig *config = output->config;
+    char *p;
+
+    if (!frame->parsed || frame->kind == PACKET_NONE) { return; }
+    if ((p = TinyStompTransmitter_Begin(stompTransmitter, config->stompAddress)) == NULL) { return; }
+
+    if (frame->kind == PACKET_WAX)
+    {
+        WaxPacket *waxPacket = &frame->packet.wax;
+        int z;
+
+        *p++ = '{';
+        p = json_field_text(p, "Type", "WAX");
+        if (config->stompSource) { p = json_field_text(p, "Source", frame->tag); }
+        p = json_field_uint(p, "Timestamp", waxPacket->timestamp);
+        p = json_field_uint(p, "DeviceId", waxPacket->deviceId);
+        p = json_field_uint(p, "SequenceId", waxPacket->sequenceId);
+        p = json_field_uint(p, "SampleCount", waxPacket->sampleCount);
+
+        p = json_text(p, "\"Samples\":[");
+        for (z = 0; z < waxPacket->sampleCount; z++)
+        {
+            if (z > 0) { *p++ = ','; }
+            *p++ = '[';
+            p = json_uint(p, waxPacket->samples[z].timestamp); *p++ = ',';
+            p = json_uint(p, waxPacket->samples[z].sampleIndex); *p++ = ',';
+            p = json_int(p, waxPacket->samples[z].x); *p++ = ',';
+            p = json_int(p, waxPacket->samples[z].y); *p++ = ',';
+            p = json_int(p, waxPacket->samples[z].z);
+            *p++ = ']';
+        }
+        *p++ = ']';
+
+        *p++ = '}';
+    }
+    else if (frame->kind == PACKET_WAX9)
+    {
+        Wax9Packet *wax9Packet = &frame->packet.wax9;
+
+        *p++ = '{';
+        p = json_field_text(p, "Type", "WAX9");
+        if (config->stompSource) { p = json_field_text(p, "Source", frame->tag); }
+        p = json_field_uint(p, "ReceivedTimestamp", frame->received);
+        if ((wax9Packet->packetVersion & 1) == 0)
+        {
+            p = json_field_uint(p, "Battery", wax9Packet->battery);
+            p = json_field_int(p, "Temperature", wax9Packet->temperature);
+            p = json_field_uint(p, "Pressure", wax9Packet->pressure);
+        }
+        p = json_text(p, "\"Samples\":[[");
+        p = json_uint(p, wax9Packet->timestamp); *p++ = ',';
+        p = json_uint(p, wax9Packet->sampleNumber); *p++ = ',';
+        p = json_int(p, wax9Packet->accel.x); *p++ = ','; p = json_int(p, wax9Packet->accel.y); *p++ = ','; p = json_int(p, wax9Packet->accel.z); *p++ = ',';
+        p = json_int(p, wax9Packet->gyro.x);  *p++ = ','; p = json_int(p, wax9Packet->gyro.y);  *p++ = ','; p = json_int(p, wax9Packet->gyro.z);  *p++ = ',';
+        p = json_int(p, wax9Packet->mag.x);   *p++ = ','; p = json_int(p, wax9Packet->mag.y);   *p++ = ','; p = json_int(p, wax9Packet->mag.z);
+        p = json_text(p, "]]");
+        *p++ = '}';
+    }
+    else if (frame->kind == PACKET_TEDDI)
+    {
+        TeddiPacket *teddiPacket = &frame->packet.teddi;
+        int i;
+        int msPerSample = 1000 / teddiFrequency[(teddiPacket->version >> 4)];
+
+        *p++ = '{';
+        p = json_field_text(p, "Type", "TEDDI");
+        if (config->stompSource) { p = json_field_text(p, "Source", frame->tag); }
+        p = json_field_uint(p, "TimestampReceived", teddiPacket->timestampReceived);
+        p = json_field_uint(p, "TimestampEstimated", teddiPacket->timestampEstimated);
+        p = json_field_uint(p, "DeviceId", teddiPacket->deviceId);
+        p = json_field_uint(p, "Version", teddiPacket->version);
+        p = json_field_uint(p, "SampleCount", teddiPacket->sampleCount);
+        p = json_field_uint(p, "Sequence", teddiPacket->sequence);
+        p = json_field_uint(p, "Unsent", teddiPacket->unsent);
+        p = json_field_uint(p, "Temp", teddiPacket->temp);
+        p = json_field_uint(p, "Light", teddiPacket->light);
+        p = json_field_uint(p, "Battery", teddiPacket->battery);
+        p = json_field_uint(p, "Humidity", teddiPacket->humidity);
+
+        p = json_text(p, "\"Samples\":[");
+        for (i = 0; i < teddiPacket->sampleCount; i++)
+        {
+            if (i > 0) { *p++ = ','; }
+            *p++ = '[';
+            p = json_uint(p, teddiPacket->timestampEstimated + i * msPerSample); *p++ = ',';
+            p = json_uint(p, teddiPacket->pirData[i]); *p++ = ',';
+            p = json_uint(p, teddiPacket->audioData[i]);
+            *p++ = ']';
+        }
+        p = json_text(p, "],");
+
+        p = json_field_uint(p, "ParentAddress", teddiPacket->parentAddress);
+        p = json_field_uint(p, "ParentAltAddress", teddiPacket->parentAltAddress);
+
+        *p++ = '}';
+    }
+    else if (frame->kind == PACKET_TEDDI_STATUS)
+    {
+        TeddiStatusPacket *teddiStatusPacket = &frame->packet.teddiStatus;
+        int i;
+        int numNeighbours = 0;
+
+        *p++ = '{';
+        p = json_field_text(p, "Type", "TEDDI_Status");
+        if (config->stompSource) { p = json_field_text(p, "Source", frame->tag); }
+        p = json_field_uint(p, "TimestampReceived", teddiStatusPacket->timestampReceived);
+        p = json_field_uint(p, "DeviceId", teddiStatusPacket->deviceId);
+        p = json_field_uint(p, "Version", teddiStatusPacket->version);
+        p = json_field_uint(p, "Power", teddiStatusPacket->power);
+        p = json_field_uint(p, "Sequence", teddiStatusPacket->sequence);
+        p = json_field_uint(p, "ShortAddress", teddiStatusPacket->shortAddress);
+        p = json_field_uint(p, "LastLQI", teddiStatusPacket->lastLQI);
+        p = json_field_uint(p, "LastRSSI", teddiStatusPacket->lastRSSI);
+        p = json_field_uint(p, "ParentAddress", teddiStatusPacket->parentAddress);
+        p = json_field_uint(p, "ParentAltAddress", teddiStatusPacket->parentAltAddress);
+
+        if (teddiStatusPacket->version > 0)     // V0 had a broken neighbour table
+        {
+            p = json_text(p, "\"Neighbours\":[");
+            for (i = 0; i < NUM_COORDINATOR; i++)
+            {
+                if (teddiStatusPacket->neighbours[i / 8] & (1 << (i & 7)))
+                {
+                    if (numNeighbours) { *p++ = ','; }
+                    p = json_uint(p, i);
+                    numNeighbours++;
+                }
+            }
+            *p++ = ']';
+        }
+
+        *p++ = '}';
+    }
+
+    TinyStompTransmitter_Commit(stompTransmitter, p);
+}
+
+
+/* UDP output (raw frames, or OSC) */
+static void outputudp(Output *output, Frame *frame)
+{
+    static char buffer[BUFFER_SIZE];
+    const char *data;
+    size_t len = framedatagram(frame, output->config, buffer, &data);
+    if (len > 0) { udpbatch_add(output->config->udpBatch, data, len, TicksNow()); }
+}
+
+/* UDP output when idle: send the queued datagrams when they are due */
+static int outputudpidle(Output *output, unsigned long long now)
+{
+    UdpBatch *udpBatch = output->config->udpBatch;
+    if (udpBatch->deadline == 0) { return -1; }
+    if (now >= udpBatch->deadline) { udpbatch_flush(udpBatch); return -1; }
+    return (int)(udpBatch->deadline - now);
+}
+
+
+/* Parse SLIP-encoded packets, log or convert to UDP packets */
+// TODO: Turn this silly argument list into an configuration structure
+int waxrec(const char **infiles, int numInfiles, const char *host, const char *initString, const char *logfile, char tee, char dump, char timetag, char sendOnly, const char *stompHost, const char *stompAddress, const char *stompUser, const char *stompPassword, int writeFromUdp, int timeformat, char convertToOsc, int format, char ignoreInvalid, const char *waitPrefix, int waitTimeout, char batchMode, int batchInterval, int mtu, int stompQueue, char stompFull, int logSync, const char *logCompress, const char *captureFile, double replaySpeed, int ringSize, char consoleFull, char logFull, char udpFull)
+{
+    static UdpBatch udpBatch;
+    Source *sources[MAX_SOURCES] = {0};
+    int numSources = 0;
+    struct sockaddr_in serverAddr;
+    SOCKET s = SOCKET_ERROR;
+	char waiting = 0;
+	char matched = -1;
+    int ret = 0;
+    int i;
+
+#ifdef _WIN32
+    {
+        WSADATA wsaData;
+        WSAStartup(MAKEWORD(1, 1), &wsaData);
+    }
+    if (numInfiles > 1)
+    {
+        fprintf(stderr, "ERROR: Multiple inputs are not supported on this platform.\n");
+        return 4;
+    }
+#endif
+
+    /* Open the inputs */
+    for (i = 0; i < numInfiles && i < MAX_SOURCES; i++)
+    {
+        sources[i] = (Source *)malloc(sizeof(Source));
+        if (sources[i] == NULL) { fprintf(stderr, "ERROR: Out of memory.\n"); ret = 7; break; }
+        numSources++;
+        ret = sourceopen(sources[i], infiles[i], i, waitTimeout, replaySpeed);
+        if (ret != 0) { break; }
+    }
+    if (ret != 0)
+    {
+        for (i = 0; i < numSources; i++) { sourceclose(sources[i]); free(sources[i]); }
+#ifdef _WIN32
+        WSACleanup();
+#endif
+        return ret;
+    }
+
+    /* Send initialization string (to each serial input) */
+    for (i = 0; i < numSources && initString != NULL; i++)
     {
         const char *p = initString;
         for (;;)
@@ -2168,27 +4246,13 @@ int waxrec(const char *infile, const char *host, const char *initString, const c
 						else { c |= *p - '0'; }
 						p++;
 								
-#if defined(_WIN32) && defined(WIN_HANDLE)
-                        {
-                            DWORD written;
-                            WriteFile((HANDLE)fd, &c, 1, &written, 0);
-                        }
-#else
-                        write(fd, &c, 1);
-#endif
+                        sourcewrite(sources[i], &c, 1);
 						continue;
 					}
 				}
             }
             if (c == '\0') { break; }
-#if defined(_WIN32) && defined(WIN_HANDLE)
-            {
-                DWORD written;
-                WriteFile((HANDLE)fd, &c, 1, &written, 0);
-            }
-#else
-            write(fd, &c, 1);
-#endif
+            sourcewrite(sources[i], &c, 1);
         }
     }
 
@@ -2209,7 +4273,7 @@ int waxrec(const char *infile, const char *host, const char *initString, const c
         /* Open the STOMP port */
         if (stompHost[0] != '\0')
         {
-            stompTransmitter = TinyStompTransmitter_New(stompHost, STOMP_PORT);
+            stompTransmitter = TinyStompTransmitter_New(stompHost, STOMP_PORT, stompUser, stompPassword, stompQueue, stompFull);
         }
 
         /* Open UDP socket */
@@ -2221,16 +4285,24 @@ int waxrec(const char *infile, const char *host, const char *initString, const c
                 fprintf(stderr, "DEBUG: Socket open: %s\n", host);
             }
         }
+        udpBatch.s = s;
+        udpBatch.serverAddr = &serverAddr;
+        udpBatch.mode = convertToOsc ? batchMode : UDP_BATCH_DATAGRAM;
+        udpBatch.interval = batchInterval;
+        udpBatch.mtu = (mtu > 0 && mtu <= UDP_MTU_MAX) ? mtu : UDP_MTU_DEFAULT;
+        udpBatch.count = 0;
+        udpBatch.filling = 0;
+        udpBatch.deadline = 0;
 
         /* Start receiver threads */
 #ifdef THREAD_RECEIVE_KEYS
-        receiveKeysFD = fd;
+        receiveKeysFD = sources[0]->fd;
         ReceiveKeysStart();
 #endif
         if (writeFromUdp != 0)
         {
 #ifdef THREAD_WRITE_FROM_UDP
-            receiveUdpFD = fd;
+            receiveUdpFD = sources[0]->fd;
             ReceiveUdpStart(writeFromUdp);
 #else
             fprintf(stderr, "WARNING: UDP Receive not compiled in.\n");
@@ -2239,61 +4311,63 @@ int waxrec(const char *infile, const char *host, const char *initString, const c
 
         /* Read packets and transmit */
         {
-            FILE *outfp = NULL;
-            unsigned long logInterval = 0;
-            unsigned long long logOpen = 0;
+            Capture *capture = NULL;
+            FrameRing *ring;
+            OutputConfig config;
             unsigned long long start = TicksNow();
-            char text = 1;
 
-            for (;;)
+            /* Start the outputs, each on its own thread */
+            memset(&config, 0, sizeof(config));
+            config.logfile = logfile;
+            config.logSync = logSync;
+            config.logCompress = logCompress;
+            config.textToLog = (logfile != NULL && logfile[0] == '\0');
+            config.tee = tee;
+            config.dump = dump;
+            config.timetag = timetag;
+            config.convertToOsc = convertToOsc;
+            config.ignoreInvalid = ignoreInvalid;
+            config.timeformat = timeformat;
+            config.format = format;
+            config.stompAddress = stompAddress;
+            config.stompSource = (numSources > 1);
+            config.udpBatch = &udpBatch;
+            ring = ringopen(ringSize);
+            if (ring == NULL) { fprintf(stderr, "ERROR: Out of memory.\n"); ret = 7; }
+            if (!config.textToLog || dump) { ringoutput(ring, "console", consoleFull, outputconsole, NULL, &config); }
+            if (logfile != NULL) { ringoutput(ring, "log", logFull, outputlog, NULL, &config); }
+            if (stompTransmitter != NULL) { ringoutput(ring, "stomp", (stompFull == STOMP_FULL_BLOCK) ? OUTPUT_FULL_BLOCK : OUTPUT_FULL_DROP, outputstomp, NULL, &config); }
+            if (s != SOCKET_ERROR) { ringoutput(ring, "udp", udpFull, outputudp, outputudpidle, &config); }
+
+            /* Start capturing */
+            if (captureFile != NULL)
+            {
+                capture = captureopen(captureFile, sources, numSources);
+            }
+
+            while (ring != NULL)
             {
                 size_t len = 0;
                 unsigned long long now;
-
-                if (receiveUdpSocket != SOCKET_ERROR)
-                {
-                    struct sockaddr_in from;
-                    int fromlen = sizeof(from);
-        
-                    len = recvfrom(receiveUdpSocket, (char *)buffer, BUFFER_SIZE, 0, (struct sockaddr *)&from, &fromlen);
-        
-                    if (len == 0 || len == SOCKET_ERROR) { fprintf(stderr, "UDPRECV: ERROR: Receive failed (%s)\n", strerrorsocket()); break; }
-        
-                    //fprintf(stderr, "UDPRECV: Received from %s:%d\n", inet_ntoa(from.sin_addr), ntohs(from.sin_port));
-
-                    /* Check if it appears to be an OSC bundle or OSC packet... */
-                    if (len >= 1 && buffer[0] == '/') { fprintf(stderr, "WARNING: OSC packet receive not yet implemented.\n"); }
-                    else if (len >= 1 && buffer[0] == '#') { fprintf(stderr, "WARNING: OSC bundle receive not yet implemented.\n"); }
-
-                }
-                else if (fd == -1)
-                {
-                    /* Fake input for testing */
-                    sleep(1);
-                    len = CreateTestData(buffer, fakeType);
-                    text = 0;
-                }
-                else
-                {
-                    /* Read data */
-                    if (text)
-                    { 
-                        len = lineread(fd, buffer, BUFFER_SIZE); 
-                        if (len == (size_t)-1)
-                        { 
-                            text = 0;
-                        } 
-                        if (len == 0) { break; } 
-                    }
-                    if (!text)
-                    { 
-                        len = slipread(fd, buffer, BUFFER_SIZE);
-                        if (len == 0) { break; } 
-                    }
-                }
+                Source *source;
+                char *buffer;
+                char text;
+                Frame *frame;
+                unsigned long long received;                /* Receive time of the frame */
+
+                /* Next frame from any input */
+                ret = nextframe(sources, numSources, &source, &len);
+                if (ret < 0) { break; }
+                if (len == 0) { continue; }                 /* Input ended */
+                buffer = source->buffer;
+                text = source->text;
+
+                /* Capture the frame */
+                if (capture != NULL) { capturewrite(capture, source, buffer, len, text, (source->type == SOURCE_REPLAY) ? source->replayTime : TicksNowMicro()); }
 
                 /* Get time now */
                 now = TicksNow();
+                received = (source->type == SOURCE_REPLAY || source->type == SOURCE_UDP) ? source->frameTime : now;
 
 
 				/* Waiting for a specific prefix */
@@ -2340,233 +4414,49 @@ int waxrec(const char *infile, const char *host, const char *initString, const c
 				// When allowing receive timeouts...
 				if (len < 0) { continue; }
 
-                /* Close existing log file if interval recording */
-                if (logInterval && outfp != NULL && (now / (unsigned long long)logInterval) != (logOpen / (unsigned long long)logInterval))
+                /* Fill the next frame of the ring */
+                frame = ringnext(ring);
+                frame->received = received;
+                strcpy(frame->tag, source->tag);
+                strcpy(frame->prefix, (numSources > 1 || source->tagged) ? source->prefix : "");    /* Only tag the output when there are several inputs */
+                frame->text = text;
+                frame->len = len;
+                if (frame->len > FRAME_DATA_SIZE) { frame->len = FRAME_DATA_SIZE; ring->truncated++; }
+                memcpy(frame->data, buffer, frame->len);
+                frame->data[frame->len] = '\0';
+
+                /* Parse the packet */
+                frame->kind = PACKET_NONE;
+                frame->parsed = 0;
+                if (len > 1 && buffer[0] == 0x12 && (buffer[1] == 0x78 || buffer[1] == 0x58))       /* WAX */
                 {
-                    fclose(outfp);
-                    outfp = NULL;
+                    frame->kind = PACKET_WAX;
+                    frame->parsed = (parseWaxPacket(&frame->packet.wax, buffer, len, received) != NULL);
                 }
-                
-                /* Open a log file if needed */
-                if (outfp == NULL && logfile != NULL)
+                else if (len > 1 && buffer[0] == '9')                                               /* WAX9 */
                 {
-                    outfp = openlogfile(logfile, now, &logInterval);
-                    logOpen = now;
+                    frame->kind = PACKET_WAX9;
+                    frame->parsed = (parseWax9Packet(&frame->packet.wax9, buffer, len, received) != NULL);
                 }
-                
-                if (receiveUdpSocket == SOCKET_ERROR && fd != -1 && text)
+                else if (len > 1 && buffer[0] == 0x12 && buffer[1] == 0x54)                         /* TEDDI (USER_REPORT_TYPE, 'T') */
                 {
-                    printf("%s\n", buffer);
-					if (tee & 1) fprintf(stderr, "%s\n", buffer);
-					if (tee & 2) fprintf(stderr, ".");
-				}
-
-                /* If it appears to be a binary WAX packet... */
-                if (len > 1 && buffer[0] == 0x12 && (buffer[1] == 0x78 || buffer[1] == 0x58))
-                {
-                    WaxPacket *waxPacket;
-                    if (dump) { hexdump(buffer, len); }
-                    waxPacket = parseWaxPacket(buffer, len, TicksNow());
-                    if (waxPacket != NULL)
-                    {
-                        /* Output text version */
-                        if (outfp != NULL) { waxDump(waxPacket, outfp, tee, timeformat); }
-
-                        /* Create a STOMP packet */
-	                    if (stompTransmitter != NULL)
-	                    {
-	                        static char msg[2048];
-                            char *p = msg;
-                            int z;
-
-                            p += sprintf(p, "{");
-                            p += sprintf(p, "\"Type\":\"WAX\",");
-                            p += sprintf(p, "\"Timestamp\":\"%llu\",", waxPacket->timestamp);
-                            p += sprintf(p, "\"DeviceId\":\"%u\",", waxPacket->deviceId);
-                            p += sprintf(p, "\"SequenceId\":\"%u\",", waxPacket->sequenceId);
-                            p += sprintf(p, "\"SampleCount\":\"%u\",", waxPacket->sampleCount);
-
-                            p += sprintf(p, "\"Samples\":[");
-                            for (z = 0; z < waxPacket->sampleCount; z++)
-                            {
-                                p += sprintf(p, "[%llu,%u,%d,%d,%d]%s", waxPacket->samples[z].timestamp, waxPacket->samples[z].sampleIndex, waxPacket->samples[z].x, waxPacket->samples[z].y, waxPacket->samples[z].z, z + 1 < waxPacket->sampleCount ? "," : "");
-                            }
-                            p += sprintf(p, "]");
-
-                            p += sprintf(p, "}");
-	                        TinyStompTransmitter_Transmit(stompTransmitter, stompAddress, msg, stompUser, stompPassword);
-                        }
-
-                        /* Create an OSC bundle from the WAX packet */
-                        if (convertToOsc) { len = waxToOsc(waxPacket, buffer, timetag); }
-                    }
+                    frame->kind = PACKET_TEDDI;
+                    frame->parsed = (parseTeddiPacket(&frame->packet.teddi, buffer, len, received) != NULL);
                 }
-
-                /* If it appears to be a binary WAX9 packet... */
-                if (len > 1 && buffer[0] == '9')
+                else if (len > 1 && buffer[0] == 0x12 && buffer[1] == 0x53)                         /* TEDDI status (USER_REPORT_TYPE, 'S') */
                 {
-                    unsigned long long now = TicksNow();
-                    Wax9Packet *wax9Packet;
-                    if (dump) { hexdump(buffer, len); }
-                    wax9Packet = parseWax9Packet(buffer, len, now);
-                    if (wax9Packet != NULL)
-                    {
-                        /* Output text version */
-						if (outfp != NULL) { wax9Dump(wax9Packet, outfp, tee, timeformat, now, format); }
-
-                        /* Create a STOMP packet */
-	                    if (stompTransmitter != NULL)
-	                    {
-	                        static char msg[2048];
-                            char *p = msg;
-
-                            p += sprintf(p, "{");
-                            p += sprintf(p, "\"Type\":\"WAX9\",");
-                            p += sprintf(p, "\"ReceivedTimestamp\":\"%llu\",", now);
-                            if ((wax9Packet->packetVersion & 1) == 0)
-                            {
-                                p += sprintf(p, "\"Battery\":\"%u\",", wax9Packet->battery);
-                                p += sprintf(p, "\"Temperature\":\"%d\",", wax9Packet->temperature);
-                                p += sprintf(p, "\"Pressure\":\"%u\",", wax9Packet->pressure);
-                            }
-                            p += sprintf(p, "\"Samples\":[");
-                            p += sprintf(p, "[%llu,%u,%d,%d,%d,%d,%d,%d,%d,%d,%d]", wax9Packet->timestamp, wax9Packet->sampleNumber, 
-                                wax9Packet->accel.x, wax9Packet->accel.y, wax9Packet->accel.z, 
-                                wax9Packet->gyro.x,  wax9Packet->gyro.y,  wax9Packet->gyro.z, 
-                                wax9Packet->mag.x,   wax9Packet->mag.y,   wax9Packet->mag.z 
-                                );
-                            p += sprintf(p, "]");
-                            p += sprintf(p, "}");
-	                        TinyStompTransmitter_Transmit(stompTransmitter, stompAddress, msg, stompUser, stompPassword);
-                        }
-
-                        /* Create an OSC bundle from the WAX packet */
-                        if (convertToOsc) { len = wax9ToOsc(wax9Packet, buffer, timetag, now); }
-                    }
+                    frame->kind = PACKET_TEDDI_STATUS;
+                    frame->parsed = (parseTeddiStatusPacket(&frame->packet.teddiStatus, buffer, len, received) != NULL);
                 }
 
-                /* If it appears to be a binary TEDDI packet (USER_REPORT_TYPE, 'T') */
-                if (len > 1 && buffer[0] == 0x12 && buffer[1] == 0x54)
-                {
-                    TeddiPacket *teddiPacket;
-                    if (dump) { hexdump(buffer, len); }
-                    teddiPacket = parseTeddiPacket(buffer, len, TicksNow());
-                    if (teddiPacket != NULL)
-                    {
-                        /* Output text version */
-                        if (outfp != NULL) { teddiDump(teddiPacket, outfp, tee, format, ignoreInvalid); }
-
-                        /* Create a STOMP packet */
-	                    if (stompTransmitter != NULL)
-	                    {
-	                        static char msg[2048];
-                            char *p = msg;
-                            int i;
-                            int msPerSample = 1000 / teddiFrequency[(teddiPacket->version >> 4)];
-                            
-                            p += sprintf(p, "{");
-                            p += sprintf(p, "\"Type\":\"TEDDI\",");
-                            p += sprintf(p, "\"TimestampReceived\":\"%llu\",", teddiPacket->timestampReceived);
-                            p += sprintf(p, "\"TimestampEstimated\":\"%llu\",", teddiPacket->timestampEstimated);
-                            p += sprintf(p, "\"DeviceId\":\"%u\",", teddiPacket->deviceId);
-                            p += sprintf(p, "\"Version\":\"%u\",", teddiPacket->version);
-                            p += sprintf(p, "\"SampleCount\":\"%u\",", teddiPacket->sampleCount);
-                            p += sprintf(p, "\"Sequence\":\"%u\",", teddiPacket->sequence);
-                            p += sprintf(p, "\"Unsent\":\"%u\",", teddiPacket->unsent);
-                            p += sprintf(p, "\"Temp\":\"%u\",", teddiPacket->temp);
-                            p += sprintf(p, "\"Light\":\"%u\",", teddiPacket->light);
-                            p += sprintf(p, "\"Battery\":\"%u\",", teddiPacket->battery);
-                            p += sprintf(p, "\"Humidity\":\"%u\",", teddiPacket->humidity);
-
-                            p += sprintf(p, "\"Samples\":[");
-                            for (i = 0; i < teddiPacket->sampleCount; i++)
-                            {
-                                p += sprintf(p, "[%llu,%u,%u]%s", teddiPacket->timestampEstimated + i * msPerSample, teddiPacket->pirData[i], teddiPacket->audioData[i], i + 1 < teddiPacket->sampleCount ? "," : "");
-                            }
-                            p += sprintf(p, "],");
-
-                            p += sprintf(p, "\"ParentAddress\":\"%u\",", teddiPacket->parentAddress);
-                            p += sprintf(p, "\"ParentAltAddress\":\"%u\",", teddiPacket->parentAltAddress);
-
-                            p += sprintf(p, "}");
-	                        TinyStompTransmitter_Transmit(stompTransmitter, stompAddress, msg, stompUser, stompPassword);
-                        }
-
-                        /* Create an OSC bundle from the TEDDI packet */
-                        if (convertToOsc) { len = teddiToOsc(teddiPacket, buffer, timetag); }
-                    }
-                }
-                
-                /* If it appears to be a binary TEDDI packet (USER_REPORT_TYPE, 'S') */
-                if (len > 1 && buffer[0] == 0x12 && buffer[1] == 0x53)
-                {
-                    TeddiStatusPacket *teddiStatusPacket;
-                    if (dump) { hexdump(buffer, len); }
-                    teddiStatusPacket = parseTeddiStatusPacket(buffer, len, TicksNow());
-                    if (teddiStatusPacket != NULL)
-                    {
-                        /* Output text version */
-//                        if (outfp != NULL) { teddiStatusDump(teddiStatusPacket, outfp, tee); }
-
-                        /* Create a STOMP packet */
-	                    if (stompTransmitter != NULL)
-	                    {
-	                        static char msg[2048];
-                            char *p = msg;
-                            int i;
-                            int numNeighbours = 0;
-
-                            p += sprintf(p, "{");
-                            p += sprintf(p, "\"Type\":\"TEDDI_Status\",");
-                            p += sprintf(p, "\"TimestampReceived\":\"%llu\",", teddiStatusPacket->timestampReceived);
-                            p += sprintf(p, "\"DeviceId\":\"%u\",", teddiStatusPacket->deviceId);
-                            p += sprintf(p, "\"Version\":\"%u\",", teddiStatusPacket->version);
-                            p += sprintf(p, "\"Power\":\"%u\",", teddiStatusPacket->power);
-                            p += sprintf(p, "\"Sequence\":\"%u\",", teddiStatusPacket->sequence);
-                            p += sprintf(p, "\"ShortAddress\":\"%u\",", teddiStatusPacket->shortAddress);
-                            p += sprintf(p, "\"LastLQI\":\"%u\",", teddiStatusPacket->lastLQI);
-                            p += sprintf(p, "\"LastRSSI\":\"%u\",", teddiStatusPacket->lastRSSI);
-                            p += sprintf(p, "\"ParentAddress\":\"%u\",", teddiStatusPacket->parentAddress);
-                            p += sprintf(p, "\"ParentAltAddress\":\"%u\",", teddiStatusPacket->parentAltAddress);
-
-                            if (teddiStatusPacket->version > 0)     // V0 had a broken neighbour table
-                            {
-                                p += sprintf(p, "\"Neighbours\":[");
-                                for (i = 0; i < NUM_COORDINATOR; i++)
-                                {
-                                    if (teddiStatusPacket->neighbours[i / 8] & (1 << (i & 7)))
-                                    {
-                                        p += sprintf(p, "%s%u", (numNeighbours ? "," : ""), i);
-                                        numNeighbours++;
-                                    }
-                                }
-                                p += sprintf(p, "]");
-                            }
-
-                            p += sprintf(p, "}");
-	                        TinyStompTransmitter_Transmit(stompTransmitter, stompAddress, msg, stompUser, stompPassword);
-                        }
-
-                        /* Create an OSC bundle from the TEDDI status packet */
-//                        if (convertToOsc) { len = teddiStatusToOsc(teddiStatusPacket, buffer, timetag); }
-                    }
-                }
-                
-                /* If we're keeping packets raw, or if it appears to (now) be an OSC bundle or OSC packet... */
-                if (!convertToOsc || (len >= 1 && (buffer[0] == '#' || buffer[0] == '/')))
-                {
-                    if (dump) { hexdump(buffer, len); }
-                    if (s != SOCKET_ERROR)
-                    {
-                        size_t tlen;
-                        tlen = transmit(s, &serverAddr, buffer, len);
-                        if (tlen != len) 
-                        { 
-                            fprintf(stderr, "WARNING: Problem transmitting: %d / %d\n", (unsigned int)tlen, (unsigned int)len); 
-                        }
-                    }
-                }
+                /* Pass it to the outputs */
+                ringpublish(ring);
             }
+
+            /* Let the outputs finish, then write the rest of the log and close it */
+            ringclose(ring);
+            logend(config.log);
+            captureclose(capture);
         }
 
         /* Stop receiver threads */
@@ -2577,14 +4467,8 @@ int waxrec(const char *infile, const char *host, const char *initString, const c
         ReceiveUdpStop();
 #endif
 
-        /* Close incoming UDP */
-        if (receiveUdpSocket != SOCKET_ERROR)
-        {
-            closesocket(receiveUdpSocket);
-        }
-
         /* Close socket */
-        if (s != SOCKET_ERROR) { closesocket(s); }
+        if (s != SOCKET_ERROR) { udpbatch_flush(&udpBatch); closesocket(s); }
 
         /* Close the STOMP port */
 	    if (stompTransmitter != NULL)
@@ -2595,12 +4479,12 @@ int waxrec(const char *infile, const char *host, const char *initString, const c
 
     }
 
-    /* Close file */
-#if defined(_WIN32) && defined(WIN_HANDLE)
-    if (fd != -1 && (HANDLE)fd != INVALID_HANDLE_VALUE) { CloseHandle((HANDLE)fd); }
-#else
-    if (fd != -1 && fd != fileno(stdin)) { close(fd); }
-#endif
+    /* Close the inputs */
+    for (i = 0; i < numSources; i++)
+    {
+        sourceclose(sources[i]);
+        free(sources[i]);
+    }
 
 #ifdef _WIN32
     WSACleanup();
@@ -2618,7 +4502,8 @@ int main(int argc, char *argv[])
     char showHelp = 0;
     int i, argPosition = 0, ret;
     char tee = 0, dump = 0, timetag = 0, sendOnly = 0;
-    const char *infile = NULL;
+    const char *infiles[MAX_SOURCES];
+    int numInfiles = 0;
     const char *host = NULL;
     const char *initString = NULL;
     char stompHost[128] = ""; /* "localhost"; */
@@ -2626,13 +4511,27 @@ int main(int argc, char *argv[])
     char stompUser[128] = "";
     char stompPassword[128] = "";
     const char *logfile = NULL;
+    int logSync = LOG_SYNC_NONE;
+    const char *captureFile = NULL;
+    double replaySpeed = 1.0;
+    const char *logCompress = NULL;
     int writeFromUdp = 0;
     int timeformat = 2;
     char convertToOsc = 0;
+    char batchMode = UDP_BATCH_BUNDLE;
+    int batchInterval = 10;
+    int mtu = UDP_MTU_DEFAULT;
+    int stompQueue = STOMP_QUEUE_DEFAULT;
+    char stompFull = STOMP_FULL_DROP;
+    int ringSize = RING_DEFAULT;
+    char consoleFull = OUTPUT_FULL_BLOCK;
+    char logFull = OUTPUT_FULL_BLOCK;
+    char udpFull = OUTPUT_FULL_DROP;
     int format = 0;
     char ignoreInvalid = 0;
 	char *waitPrefix = NULL;
 	int waitTimeout = -1;
+    char runBenchmark = 0;
 
     fprintf(stderr, "WAXREC    WAX Receiver\n");
     fprintf(stderr, "V1.96     by Daniel Jackson, 2011-2015\n");
@@ -2697,6 +4596,17 @@ int main(int argc, char *argv[])
             host = argv[++i];
             convertToOsc = 1;
         }
+        else if (strcasecmp(argv[i], "-osc:bundle") == 0) { batchMode = UDP_BATCH_BUNDLE; }
+        else if (strcasecmp(argv[i], "-osc:packet") == 0) { batchMode = UDP_BATCH_DATAGRAM; }
+        else if (strcasecmp(argv[i], "-osc:single") == 0) { batchMode = UDP_BATCH_SINGLE; }
+        else if (strcasecmp(argv[i], "-flush") == 0)
+        {
+            batchInterval = atoi(argv[++i]);
+        }
+        else if (strcasecmp(argv[i], "-mtu") == 0)
+        {
+            mtu = atoi(argv[++i]);
+        }
         else if (strcasecmp(argv[i], "-raw") == 0 || strcasecmp(argv[i], "-udp") == 0)
         {
             host = argv[++i];
@@ -2721,6 +4631,45 @@ int main(int argc, char *argv[])
         {
             strcpy(stompPassword, argv[++i]);
         }
+        else if (strcasecmp(argv[i], "-stompqueue") == 0)
+        {
+            stompQueue = atoi(argv[++i]);
+        }
+        else if (strcasecmp(argv[i], "-stompfull:drop") == 0) { stompFull = STOMP_FULL_DROP; }
+        else if (strcasecmp(argv[i], "-stompfull:block") == 0) { stompFull = STOMP_FULL_BLOCK; }
+        else if (strcasecmp(argv[i], "-ring") == 0)
+        {
+            ringSize = atoi(argv[++i]);
+        }
+        else if (strcasecmp(argv[i], "-consolefull:drop") == 0) { consoleFull = OUTPUT_FULL_DROP; }
+        else if (strcasecmp(argv[i], "-consolefull:block") == 0) { consoleFull = OUTPUT_FULL_BLOCK; }
+        else if (strcasecmp(argv[i], "-logfull:drop") == 0) { logFull = OUTPUT_FULL_DROP; }
+        else if (strcasecmp(argv[i], "-logfull:block") == 0) { logFull = OUTPUT_FULL_BLOCK; }
+        else if (strcasecmp(argv[i], "-udpfull:drop") == 0) { udpFull = OUTPUT_FULL_DROP; }
+        else if (strcasecmp(argv[i], "-udpfull:block") == 0) { udpFull = OUTPUT_FULL_BLOCK; }
+        else if (strcasecmp(argv[i], "-logsync") == 0)
+        {
+            i++;
+            if (strcasecmp(argv[i], "none") == 0) { logSync = LOG_SYNC_NONE; }
+            else if (strcasecmp(argv[i], "rotate") == 0) { logSync = LOG_SYNC_ROTATE; }
+            else { logSync = atoi(argv[i]); }
+        }
+        else if (strcasecmp(argv[i], "-logcompress") == 0)
+        {
+            logCompress = argv[++i];
+        }
+        else if (strcasecmp(argv[i], "-capture") == 0)
+        {
+            captureFile = argv[++i];
+        }
+        else if (strcasecmp(argv[i], "-speed") == 0)
+        {
+            replaySpeed = atof(argv[++i]);
+        }
+        else if (strcasecmp(argv[i], "-benchmark") == 0)
+        {
+            runBenchmark = 1;
+        }
         else if (strcasecmp(argv[i], "-invalid:ignore") == 0)
         {
             ignoreInvalid = 1;
@@ -2733,10 +4682,10 @@ int main(int argc, char *argv[])
         else if (strcasecmp(argv[i], "-t:secs") == 0) { timeformat = 1; }
         else if (strcasecmp(argv[i], "-t:full") == 0) { timeformat = 2; }
         else if (strcasecmp(argv[i], "-t:both") == 0) { timeformat = 3; }
-        else if ((argv[i][0] != '-' || argv[i][0] == '\0') && argPosition == 0)
+        else if ((argv[i][0] != '-' || argv[i][0] == '\0') && argPosition < MAX_SOURCES)
         {
             argPosition++;
-            infile = argv[i];
+            infiles[numInfiles++] = argv[i];
         }
         else
         {
@@ -2745,7 +4694,12 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (infile == NULL)
+    if (runBenchmark && !showHelp)
+    {
+        return benchmark();
+    }
+
+    if (numInfiles <= 0)
     { 
         fprintf(stderr, "ERROR: Port not specified.\n");
         showHelp = 1; 
@@ -2753,11 +4707,16 @@ int main(int argc, char *argv[])
 
     if (showHelp)
     {    
-        fprintf(stderr, "Usage:  waxrec <device>\n");
+        fprintf(stderr, "Usage:  waxrec <device> [<device>...]\n");
         fprintf(stderr, "        [-log [-tee]]                          Output log to stdout, optionally tee to stderr.\n");
         fprintf(stderr, "        [-osc <hostname>[:<port>] [-timetag]]  Send OSC to the specified host/port, time-tag.\n");
+        fprintf(stderr, "        [-osc:bundle|-osc:packet|-osc:single]  OSC datagrams: packet bundles packed to the MTU (default), one bundle per packet, or one message per datagram\n");
         fprintf(stderr, "        [-udp <hostname>[:<port>]]             Send raw packets over UDP to the specified host/port (cannot be used with -osc)\n");
+        fprintf(stderr, "        [-flush <msec>] [-mtu <bytes>]         Longest time UDP output is held for batching (default 10, 0 = immediately); OSC packing size (default %d)\n", UDP_MTU_DEFAULT);
         fprintf(stderr, "        [-stomphost <hostname>[:<port>] [-stomptopic /topic/Topic] [-stompuser <username>] [-stomppassword <password>]]  Send STOMP to the specified server.\n");
+        fprintf(stderr, "        [-stompqueue <n>] [-stompfull:{drop|block}]  STOMP messages queued while the broker is slow or reconnecting (default %d); when full, drop new messages (default) or wait.\n", STOMP_QUEUE_DEFAULT);
+        fprintf(stderr, "        [-ring <n>]                            Parsed frames held for the outputs, which each run on their own thread (default %d)\n", RING_DEFAULT);
+        fprintf(stderr, "        [-consolefull:{drop|block}] [-logfull:{drop|block}] [-udpfull:{drop|block}]  When an output falls that far behind, drop its oldest frames or wait (default: console and log wait, UDP drops; STOMP follows -stompfull)\n");
         fprintf(stderr, "        [-init <string> [-exit]]               Send initialzing string; exit (immediately if not waiting for a response).\n");
         fprintf(stderr, "        [-wait <prefix> [-timeout <msec>]]     Wait for a response line with the specified prefix; timeout waiting.\n");
 #ifdef THREAD_WRITE_FROM_UDP
@@ -2766,15 +4725,21 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "        [-invalid:ignore|-invalid:label]       Ingore or label invalid packets\n");
 		fprintf(stderr, "        [-t:{none|secs|full|both}]             Timestamp format\n");
 		fprintf(stderr, "        [-out <file.csv>]                      Output to a specific log file\n");
+		fprintf(stderr, "        [-logsync {none|rotate|<secs>}]        Sync the log file to disk: never (default), when closed, or every <secs> seconds\n");
+		fprintf(stderr, "        [-logcompress <command>]               Compress each rotated log file with a command (e.g. gzip)\n");
         fprintf(stderr, "        [-format:short]                        Format as short output (TEDDI/WAX9 packets only)\n");
         fprintf(stderr, "        [-dump]                                Hex-dump raw packets.\n");
+        fprintf(stderr, "        [-capture <file>]                      Record the received frames to a binary capture file (replay with 'replay:<file>')\n");
+        fprintf(stderr, "        [-speed <factor>]                      Replay captures at a multiple of real-time (default 1, 0 = maximum speed)\n");
+        fprintf(stderr, "        [-benchmark]                           Measure the packet decoding rate for each packet type, then exit\n");
         fprintf(stderr, "\n");
         fprintf(stderr, "Log example: waxrec %s -log -tee -init \"MODE=1\\r\\n\" > log.csv\n", EXAMPLE_DEVICE);
         fprintf(stderr, "OSC example: waxrec %s -osc localhost:1234 -init \"MODE=1\\r\\n\"\n", EXAMPLE_DEVICE);
         fprintf(stderr, "STOMP example: waxrec %s -stomphost localhost:61613 -stomptopic /topic/Kitchen.Sensor.Wax -init \"MODE=1\\r\\n\"\n", EXAMPLE_DEVICE);
         fprintf(stderr, "Hourly log example: waxrec %s -out /log/@Y-@M-@D/@Y-@M-@D-@h-00-00.csv\n", EXAMPLE_DEVICE);
         fprintf(stderr, "\n");
-        fprintf(stderr, "NOTE: 'device' can be 'udp://localhost:1234' to receive over UDP\n");
+        fprintf(stderr, "NOTE: 'device' can be 'udp://localhost:1234' to receive over UDP, or 'replay:<file>' to replay a capture\n");
+        fprintf(stderr, "NOTE: more than one 'device' can be given (up to %d, not on Windows), each optionally prefixed 'tag=' to label its output (default: 1, 2, ...)\n", MAX_SOURCES);
 #ifdef _MSC_VER
         // See 'findPorts()'
         fprintf(stderr, "NOTE: 'device' can be '!' or '![VID+PID]' to automatically find the first matching serial port (default: !%04X%04X, example: !04D80057)\n", DEFAULT_VID, DEFAULT_PID);
@@ -2784,11 +4749,14 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    fprintf(stderr, "WAXREC: %s -> %s%s%s%s %s:%s@%s%s\n", (infile == NULL) ? "<stdin>" : infile, host, (tee ? " [tee]" : ""), (dump ? " [dump]" : ""), (timetag ? " [timetag]" : ""), stompUser, strlen(stompPassword) > 0 ? "*" : "", stompHost, stompAddress);
+    for (i = 0; i < numInfiles; i++)
+    {
+        fprintf(stderr, "WAXREC: %s -> %s%s%s%s %s:%s@%s%s\n", infiles[i], host, (tee ? " [tee]" : ""), (dump ? " [dump]" : ""), (timetag ? " [timetag]" : ""), stompUser, strlen(stompPassword) > 0 ? "*" : "", stompHost, stompAddress);
+    }
     fprintf(stderr, "INIT: %s\n", initString);
 
     // The function with the most arguments in the world... (I think a configuration structure might help here!)
-    ret = waxrec(infile, host, initString, logfile, tee, dump, timetag, sendOnly, stompHost, stompAddress, stompUser, stompPassword, writeFromUdp, timeformat, convertToOsc, format, ignoreInvalid, waitPrefix, waitTimeout);
+    ret = waxrec(infiles, numInfiles, host, initString, logfile, tee, dump, timetag, sendOnly, stompHost, stompAddress, stompUser, stompPassword, writeFromUdp, timeformat, convertToOsc, format, ignoreInvalid, waitPrefix, waitTimeout, batchMode, batchInterval, mtu, stompQueue, stompFull, logSync, logCompress, captureFile, replaySpeed, ringSize, consoleFull, logFull, udpFull);
 
 #if defined(_WIN32) && defined(_DEBUG)
     if (IsDebuggerPresent()) { fprintf(stderr, "Press [enter] to exit..."); getc(stdin); }